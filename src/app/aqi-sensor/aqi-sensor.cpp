@@ -39,6 +39,7 @@
 // "https://secure.megabozo.com/scripts";
 static constexpr const char *BASE_URL = "https://airquality.circlemud.org";
 static constexpr const size_t CACHE_SIZE = 200;
+static constexpr const size_t FLASH_CACHE_BYTES = 512 * 1024;
 static constexpr const int HTTPS_TIMEOUT_MS = 5000;
 static constexpr const int WATCHDOG_TIME_SEC = 3 * 60;  // 3 minutes
 
@@ -48,14 +49,33 @@ HttpsClient hc(HTTPS_TIMEOUT_MS, cert_x3_ca);
 SensorName sensor_name(&hc, BASE_URL);
 NtpClient ntp;
 
-//////// pms5003 variant ////////////
-
 #if defined(AQI_PMS5003)
 #include "periph/pms5003/pms5003.h"
 #include "pms5003-cache.h"
+typedef PMS5003Cache SensorCache;
+#endif
+
+#if defined(AQI_DHT22)
+#include "dht22-cache.h"
+#include "periph/dht22/dht22.h"
+typedef DHT22Cache SensorCache;
+#endif
+
+// With AQI_FLASH_CACHE, cached data is kept in the "spiffs" partition of the
+// default partition table so that it survives a reboot.
+#if defined(AQI_FLASH_CACHE)
+#include "flash-record-store.h"
+FlashRecordStore cache_store("spiffs", FLASH_CACHE_BYTES,
+                             SensorCache::RECORD_SIZE);
+#else
+RamRecordStore cache_store(SensorCache::RECORD_SIZE, CACHE_SIZE);
+#endif
+SensorCache sensor_cache(&cache_store, &ntp);
+
+//////// pms5003 variant ////////////
 
+#if defined(AQI_PMS5003)
 pms5003_t pms;
-PMS5003Cache sensor_cache(CACHE_SIZE, &ntp);
 
 static void data_received(pms5003_data_t *data, void *user_data) {
   sensor_cache.add(data);
@@ -68,23 +88,24 @@ static void start_sensor() {
 //////// dht22 variant ////////////
 
 #if defined(AQI_DHT22)
-
-#include "dht22-cache.h"
-#include "periph/dht22/dht22.h"
 #define DHT22_IO_PIN  GPIO_5
 #define POLL_FREQ_SEC 15
+static dht22_t dht;
 
-DHT22Cache sensor_cache(CACHE_SIZE, &ntp);
+static void data_received(dht22_data_t *data, void *user_data) {
+  if (data != NULL) {
+    sensor_cache.add(data);
+  }
+}
 
 static void poll_sensor(void *arg) {
   schedule_us(POLL_FREQ_SEC * 1000000, poll_sensor, arg);
-  dht22_data_t data;
-  if (dht22_read(DHT22_IO_PIN, &data)) {
-    sensor_cache.add(&data);
-  }
+  dht22_start_read(&dht);
 }
 
 static void start_sensor() {
+  dht22_init(&dht, DHT22_IO_PIN, data_received, NULL);
+
   // give sensor 2 sec to warm up. (datasheet says 1 sec)
   schedule_us(2000000, poll_sensor, NULL);
 }
@@ -156,8 +177,16 @@ void on_upload_success(void) {
   watchdog_keepalive(&watchdog);
 }
 
+// With AQI_COMPACT_UPLOAD, data is uploaded in the compact binary format
+// described in compact-encoder.h instead of json.
+#if defined(AQI_COMPACT_UPLOAD)
+static constexpr const bool COMPACT_UPLOAD = true;
+#else
+static constexpr const bool COMPACT_UPLOAD = false;
+#endif
+
 DataUploader data_uploader(&hc, BASE_URL, &sensor_name, &sensor_cache,
-                           on_upload_success);
+                           on_upload_success, COMPACT_UPLOAD);
 
 int main() {
   rulos_hal_init();
@@ -169,6 +198,10 @@ int main() {
 
   watchdog_init(&watchdog, WATCHDOG_TIME_SEC);
 
+#if defined(AQI_FLASH_CACHE)
+  cache_store.init();
+#endif
+
   // status LED
   gpio_make_output(LED_PIN);
   schedule_now(show_status, NULL);
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/rulos.h"
+#include "sensor-data-cache.h"
+
+// Compact, columnar encoding of a batch of cached sensor data, as an
+// alternative to the JSON upload format. All integers are LEB128 varints;
+// signed values are zigzag-encoded first. A string is a varint length followed
+// by that many bytes.
+//
+//   "AQC1"
+//   string   password
+//   string   sensor name
+//   varint   number of points
+//   varint   number of fields (not counting time)
+//   for each field:
+//     string name
+//     varint scale: the value sent is the real value times scale
+//   time column: first time in usec since the epoch, then zigzag deltas
+//   for each field, a column: zigzag first value, then zigzag deltas
+//
+// Samples arrive at a steady rate and change slowly, so most deltas fit in
+// one or two bytes. decode-compact.py decodes this format back to JSON.
+class CompactEncoder {
+ private:
+  static const size_t MAX_VARINT_LEN = 10;
+
+  SensorDataCacheIfc *_cache;
+  const char *_password;
+  const char *_sensor_name;
+  size_t _num_points;
+
+  // position in the output: the header, then one column at a time
+  bool _header_done;
+  size_t _column;  // 0 is time; field n is column n + 1
+  size_t _row;
+
+  static size_t _put_varint(uint8_t *dest, uint64_t v) {
+    size_t len = 0;
+    do {
+      uint8_t b = v & 0x7f;
+      v >>= 7;
+      dest[len++] = b | (v ? 0x80 : 0);
+    } while (v);
+    return len;
+  }
+
+  static uint64_t _zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  }
+
+  static size_t _put_string(uint8_t *dest, const char *s, size_t max_len) {
+    size_t len = r_min(strlen(s), max_len - MAX_VARINT_LEN);
+    size_t hdr_len = _put_varint(dest, len);
+    memcpy(dest + hdr_len, s, len);
+    return hdr_len + len;
+  }
+
+  int64_t _value(size_t column, size_t row) {
+    if (column == 0) {
+      return _cache->get_time_usec(row);
+    } else {
+      return _cache->get_field(row, column - 1);
+    }
+  }
+
+  size_t _render_header(uint8_t *dest, size_t max_len) {
+    size_t len = 0;
+    memcpy(dest, "AQC1", 4);
+    len += 4;
+    len += _put_string(dest + len, _password, (max_len - len) / 2);
+    len += _put_string(dest + len, _sensor_name, (max_len - len) / 2);
+    len += _put_varint(dest + len, _num_points);
+    len += _put_varint(dest + len, _cache->num_fields());
+    for (size_t f = 0; f < _cache->num_fields(); f++) {
+      len += _put_string(dest + len, _cache->field_name(f),
+                         r_min(max_len - len, (size_t)32));
+      len += _put_varint(dest + len, _cache->field_scale(f));
+      assert(len + MAX_VARINT_LEN <= max_len);
+    }
+    return len;
+  }
+
+ public:
+  CompactEncoder() : _cache(NULL), _num_points(0) {
+  }
+
+  void init(SensorDataCacheIfc *cache, size_t num_points, const char *password,
+            const char *sensor_name) {
+    _cache = cache;
+    _num_points = num_points;
+    _password = password;
+    _sensor_name = sensor_name;
+    rewind();
+  }
+
+  void rewind() {
+    _header_done = false;
+    _column = 0;
+    _row = 0;
+  }
+
+  // Writes the next piece of the encoding into dest. Returns the number of
+  // bytes written, or 0 when the encoding is complete. max_len should be at
+  // least a couple hundred bytes so that the header fits.
+  size_t render_next(uint8_t *dest, size_t max_len) {
+    if (!_header_done) {
+      _header_done = true;
+      return _render_header(dest, max_len);
+    }
+
+    // with no points, every column is empty
+    size_t len = 0;
+    while (_num_points > 0 && _column <= _cache->num_fields() &&
+           len + MAX_VARINT_LEN <= max_len) {
+      int64_t v = _value(_column, _row);
+      if (_row == 0) {
+        len += _put_varint(dest + len, _column == 0 ? v : _zigzag(v));
+      } else {
+        len += _put_varint(dest + len, _zigzag(v - _value(_column, _row - 1)));
+      }
+
+      if (++_row == _num_points) {
+        _row = 0;
+        _column++;
+      }
+    }
+    return len;
+  }
+};
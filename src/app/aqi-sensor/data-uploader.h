@@ -26,6 +26,7 @@
 #include "periph/inet/inet.h"
 
 // app includes
+#include "compact-encoder.h"
 #include "data-uploader.h"
 #include "sensor-data-cache.h"
 #include "sensor-name.h"
@@ -35,44 +36,83 @@
 
 typedef void (*on_success_t)(void);
 
-class DataUploader : public HttpsHandlerIfc {
+class DataUploader : public HttpsHandlerIfc, public HttpsBodySourceIfc {
  private:
   HttpsClient *_hc;
   const char *_base_url;
   SensorName *_sn;
   SensorDataCacheIfc *_cache;
   on_success_t _on_success;
+  const bool _compact;
 
   static constexpr const char *DATA_UPLOAD_URL = "data";
+  static constexpr const char *COMPACT_UPLOAD_URL = "data-compact";
   static const uint32_t UPLOAD_FREQ_SEC = 15;
   static const size_t MAX_POINTS_PER_UPLOAD = 100;
+
+  // the compact encoding is about 10x smaller, so more points fit in an upload
+  static const size_t MAX_COMPACT_POINTS_PER_UPLOAD = 1000;
+  CompactEncoder _encoder;
   size_t _num_outstanding;
-  size_t _json_max_size;
-  char *_jsonbuf;
   char _respbuf[10000];
 
-  void _serialize() {
-    char *p = _jsonbuf;
-    int cap = _json_max_size;
-
-    size_t len = snprintf(p, cap,
-                          "{\n"
-                          "   \"clowny-cleartext-password\": \"%s\",\n"
-                          "   \"sensorname\": \"%s\",\n"
-                          "   \"sensordata\": [\n",
-                          lectrobox_aqi_password,  // from wifi-credentials.h
-                          _sn->get_sensor_name());
-    p += len;
-    cap -= len;
-
-    for (size_t i = 0; i < _num_outstanding; i++) {
-      len = _cache->serialize(i, p, cap);
-      p += len;
-      cap -= len;
-      assert(cap > 0);
+  // State of the json body as it's streamed out by the https worker task.
+  // Each piece is the header, one data point, or the trailer.
+  size_t _next_piece;
+  char _piece[256];
+  size_t _piece_len;
+  size_t _piece_offset;
+
+  bool _render_next_piece() {
+    if (_compact) {
+      _piece_len = _encoder.render_next((uint8_t *)_piece, sizeof(_piece));
+      _piece_offset = 0;
+      return _piece_len > 0;
+    }
+
+    int len;
+    if (_next_piece == 0) {
+      len = snprintf(_piece, sizeof(_piece),
+                     "{\n"
+                     "   \"clowny-cleartext-password\": \"%s\",\n"
+                     "   \"sensorname\": \"%s\",\n"
+                     "   \"sensordata\": [\n",
+                     lectrobox_aqi_password,  // from wifi-credentials.h
+                     _sn->get_sensor_name());
+    } else if (_next_piece <= _num_outstanding) {
+      len = _cache->serialize(_next_piece - 1, _piece, sizeof(_piece));
+    } else if (_next_piece == _num_outstanding + 1) {
+      len = snprintf(_piece, sizeof(_piece), "]}");
+    } else {
+      return false;
     }
 
-    snprintf(p, cap, "]}");
+    _next_piece++;
+    _piece_len = r_min((size_t)len, sizeof(_piece) - 1);
+    _piece_offset = 0;
+    return true;
+  }
+
+  // HttpsBodySourceIfc: runs on the https worker task
+  void rewind() {
+    _encoder.rewind();
+    _next_piece = 0;
+    _piece_len = 0;
+    _piece_offset = 0;
+  }
+
+  size_t read(char *buf, size_t max_len) {
+    size_t total = 0;
+    while (total < max_len) {
+      if (_piece_offset == _piece_len && !_render_next_piece()) {
+        break;
+      }
+      size_t n = r_min(max_len - total, _piece_len - _piece_offset);
+      memcpy(buf + total, _piece + _piece_offset, n);
+      _piece_offset += n;
+      total += n;
+    }
+    return total;
   }
 
   void _upload() {
@@ -88,26 +128,39 @@ class DataUploader : public HttpsHandlerIfc {
       return;
     }
 
+    if (_hc->is_in_use()) {
+      LOG("not uploading: https client busy");
+      return;
+    }
+
     // how many points should we upload?
-    _num_outstanding = std::min(MAX_POINTS_PER_UPLOAD, _cache->len());
+    _num_outstanding =
+        std::min(_compact ? MAX_COMPACT_POINTS_PER_UPLOAD : MAX_POINTS_PER_UPLOAD,
+                 _cache->len());
     if (_num_outstanding == 0) {
       LOG("not uploading: no data");
       return;
     }
 
-    // serialize them to json
+    // the https worker serializes these points straight out of the cache, so
+    // keep them from being dropped until the upload is done
     LOG("preparing %d records for upload", _num_outstanding);
-    _serialize();
+    _cache->set_pinned(_num_outstanding);
+    if (_compact) {
+      _encoder.init(_cache, _num_outstanding,
+                    lectrobox_aqi_password,  // from wifi-credentials.h
+                    _sn->get_sensor_name());
+    }
 
     // post
-    _hc->set_header("Content-Type", "application/json");
+    _hc->set_header("Content-Type", _compact ? "application/x-aqi-compact"
+                                             : "application/json");
     _hc->set_response_buffer(_respbuf, sizeof(_respbuf));
     char url[100];
-    snprintf(url, sizeof(url), "%s/%s", _base_url, DATA_UPLOAD_URL);
+    snprintf(url, sizeof(url), "%s/%s", _base_url,
+             _compact ? COMPACT_UPLOAD_URL : DATA_UPLOAD_URL);
     LOG("posting to %s", url);
-    log_write(_jsonbuf, strlen(_jsonbuf));
-    log_write("\n", 1);
-    _hc->post(url, _jsonbuf, strlen(_jsonbuf), this);
+    _hc->post(url, this, this);
   }
 
   static void _upload_trampoline(void *data) {
@@ -118,6 +171,7 @@ class DataUploader : public HttpsHandlerIfc {
 
   void on_done(HttpsClient *hc, int response_code, size_t response_len) {
     log_write(_respbuf, response_len);
+    _cache->set_pinned(0);
     if (response_code == 200) {
       LOG("Data upload: success!");
       _cache->pop_n(_num_outstanding);
@@ -129,17 +183,18 @@ class DataUploader : public HttpsHandlerIfc {
   }
 
  public:
+  // If compact is set, data is uploaded using CompactEncoder's format rather
+  // than json. The server must support it.
   DataUploader(HttpsClient *hc, const char *base_url, SensorName *sn,
-               SensorDataCacheIfc *cache, on_success_t on_success)
+               SensorDataCacheIfc *cache, on_success_t on_success,
+               bool compact = false)
       : _hc(hc),
         _base_url(base_url),
         _sn(sn),
         _cache(cache),
         _on_success(on_success),
+        _compact(compact),
         _num_outstanding(0) {
-    _json_max_size = MAX_POINTS_PER_UPLOAD * 100;
-    _jsonbuf = new char[_json_max_size];
-    assert(_jsonbuf != NULL);
   }
 
   void start() {
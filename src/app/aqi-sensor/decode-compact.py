@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+
+# Decodes an upload body in the compact format written by compact-encoder.h
+# and prints the equivalent json upload, for testing the encoder and as a
+# reference for the server side.
+#
+# usage: decode-compact.py [file]   (reads stdin if no file is given)
+
+import json
+import sys
+
+MAGIC = b"AQC1"
+
+class Reader:
+    def __init__(self, buf):
+        self.buf = buf
+        self.pos = 0
+
+    def varint(self):
+        v = 0
+        shift = 0
+        while True:
+            if self.pos >= len(self.buf):
+                raise ValueError("truncated varint")
+            b = self.buf[self.pos]
+            self.pos += 1
+            v |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def zigzag(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def string(self):
+        n = self.varint()
+        s = self.buf[self.pos:self.pos + n]
+        if len(s) != n:
+            raise ValueError("truncated string")
+        self.pos += n
+        return s.decode()
+
+    # first value is read with 'first', the rest are zigzag deltas
+    def column(self, npoints, first):
+        if npoints == 0:
+            return []
+        col = [first()]
+        for i in range(1, npoints):
+            col.append(col[-1] + self.zigzag())
+        return col
+
+def decode(buf):
+    if buf[0:4] != MAGIC:
+        raise ValueError("bad magic")
+    r = Reader(buf)
+    r.pos = len(MAGIC)
+
+    password = r.string()
+    sensorname = r.string()
+    npoints = r.varint()
+    nfields = r.varint()
+    fields = []
+    for i in range(nfields):
+        name = r.string()
+        scale = r.varint()
+        fields.append((name, scale))
+
+    times = r.column(npoints, r.varint)
+    columns = [r.column(npoints, r.zigzag) for f in fields]
+    if r.pos != len(buf):
+        raise ValueError(f"{len(buf) - r.pos} trailing bytes")
+
+    sensordata = []
+    for i in range(npoints):
+        point = {'time': times[i] / 1e6}
+        for (name, scale), col in zip(fields, columns):
+            point[name] = col[i] / scale if scale != 1 else col[i]
+        sensordata.append(point)
+
+    return {
+        'clowny-cleartext-password': password,
+        'sensorname': sensorname,
+        'sensordata': sensordata,
+    }
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            buf = f.read()
+    else:
+        buf = sys.stdin.buffer.read()
+    print(json.dumps(decode(buf), indent=3))
+
+if __name__ == "__main__":
+    main()
@@ -22,19 +22,34 @@
 #include "sensor-data-cache.h"
 
 class DHT22Cache : public SensorDataCacheTemplate<dht22_data_t> {
- private:
-  char _buf[100];
-
  public:
-  DHT22Cache(size_t capacity, NtpClient *ntp)
-      : SensorDataCacheTemplate<dht22_data_t>(capacity, ntp) {
+  DHT22Cache(RecordStoreIfc *store, NtpClient *ntp)
+      : SensorDataCacheTemplate<dht22_data_t>(store, ntp) {
+  }
+
+  virtual int serialize_one(const dht22_data_t *data, char *dest,
+                            size_t max_len) {
+    return snprintf(dest, max_len,
+                    "\"temperature_C\": %.1f,"
+                    "\"humidity_perc\": %.1f",
+                    data->temp_c_tenths / 10.0,
+                    data->humidity_pct_tenths / 10.0);
+  }
+
+  virtual const sensor_field_t *fields(size_t *num_fields) {
+    static const sensor_field_t FIELDS[] = {
+        {"temperature_C", 10},
+        {"humidity_perc", 10},
+    };
+    *num_fields = sizeof(FIELDS) / sizeof(FIELDS[0]);
+    return FIELDS;
   }
 
-  virtual char *serialize_one(dht22_data_t *data) {
-    snprintf(_buf, sizeof(_buf),
-             "\"temperature_C\": %.1f,"
-             "\"humidity_perc\": %.1f",
-             data->temp_c_tenths / 10.0, data->humidity_pct_tenths / 10.0);
-    return _buf;
+  virtual int32_t get_field_one(const dht22_data_t *data, size_t field) {
+    if (field == 0) {
+      return data->temp_c_tenths;
+    } else {
+      return data->humidity_pct_tenths;
+    }
   }
 };
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/rulos.h"
+#include "record-store.h"
+
+extern "C" {
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+}
+
+// A record store kept in a raw flash data partition, so cached sensor data
+// survives a reboot or a watchdog reset during a long network outage.
+//
+// The partition is divided into fixed-size slots, each holding a header and
+// one record. The record with sequence number 'seq' always lives in slot
+// (seq % num_slots). Slots are written sequentially; a flash sector is erased
+// just before its first slot is reused. Records are read back with
+// esp_partition_read rather than through a memory mapping, since the flash
+// cache can hold stale contents of a sector after it's been rewritten. Popping is
+// recorded by clearing the 'popped' field of the newest popped record, which
+// NOR flash allows without an erase, so pop_n is a single small write.
+//
+// On init(), the partition is scanned to find the range of live records.
+class FlashRecordStore : public RecordStoreIfc {
+ private:
+  typedef struct {
+    uint32_t seq;  // 0xffffffff if slot is erased
+    uint16_t check;
+    uint16_t popped;  // 0xffff until this and all older records are popped
+  } slot_header_t;
+
+  static const uint32_t EMPTY_SEQ = 0xffffffff;
+  static const uint16_t NOT_POPPED = 0xffff;
+
+  const char *_label;
+  const size_t _max_bytes;
+  const size_t _record_size;
+
+  const esp_partition_t *_part;
+  size_t _slot_size;
+  size_t _slots_per_sector;
+  size_t _num_slots;
+  uint8_t *_scratch;
+
+  uint32_t _head;  // seq of next record to be written
+  uint32_t _tail;  // seq of oldest live record
+
+  size_t _offset(uint32_t seq) {
+    size_t slot = seq % _num_slots;
+    return (slot / _slots_per_sector) * SPI_FLASH_SEC_SIZE +
+           (slot % _slots_per_sector) * _slot_size;
+  }
+
+  // reads the slot that holds 'seq' into _scratch
+  const slot_header_t *_read_slot(uint32_t seq) {
+    ESP_ERROR_CHECK(
+        esp_partition_read(_part, _offset(seq), _scratch, _slot_size));
+    return reinterpret_cast<const slot_header_t *>(_scratch);
+  }
+
+  uint16_t _checksum(uint32_t seq, const uint8_t *record) {
+    // include the record size, so that records written by firmware with a
+    // different layout are not mistaken for valid ones
+    uint32_t sum = seq + _record_size;
+    for (size_t i = 0; i < _record_size; i++) {
+      sum = (sum << 1 | sum >> 31) ^ record[i];
+    }
+    return (sum ^ (sum >> 16)) & 0xffff;
+  }
+
+  // checks the slot that was just read by _read_slot
+  bool _is_valid(const slot_header_t *hdr, uint32_t seq) {
+    return hdr->seq == seq &&
+           hdr->check == _checksum(seq, reinterpret_cast<const uint8_t *>(
+                                            hdr + 1));
+  }
+
+ public:
+  FlashRecordStore(const char *partition_label, size_t max_bytes,
+                   size_t record_size)
+      : _label(partition_label),
+        _max_bytes(max_bytes),
+        _record_size(record_size),
+        _part(NULL),
+        _num_slots(0),
+        _head(0),
+        _tail(0) {
+  }
+
+  // Finds the partition and recovers the records that were in it. Must be
+  // called before the store is used.
+  void init() {
+    _part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                     ESP_PARTITION_SUBTYPE_ANY, _label);
+    assert(_part != NULL);
+
+    size_t size = r_min(_max_bytes, _part->size);
+    size -= size % SPI_FLASH_SEC_SIZE;
+
+    _slot_size = (sizeof(slot_header_t) + _record_size + 3) & ~3;
+    _slots_per_sector = SPI_FLASH_SEC_SIZE / _slot_size;
+    _num_slots = _slots_per_sector * (size / SPI_FLASH_SEC_SIZE);
+    assert(_num_slots > 2 * _slots_per_sector);
+    _scratch = new uint8_t[_slot_size];
+    assert(_scratch != NULL);
+
+    // find the newest record, and the newest record marked as popped
+    bool found = false;
+    uint32_t newest = 0;
+    bool popped_found = false;
+    uint32_t newest_popped = 0;
+    for (size_t slot = 0; slot < _num_slots; slot++) {
+      const slot_header_t *hdr = _read_slot(slot);
+      if (hdr->seq == EMPTY_SEQ || hdr->seq % _num_slots != slot ||
+          !_is_valid(hdr, hdr->seq)) {
+        continue;
+      }
+      if (!found || hdr->seq > newest) {
+        newest = hdr->seq;
+        found = true;
+      }
+      if (hdr->popped != NOT_POPPED &&
+          (!popped_found || hdr->seq > newest_popped)) {
+        newest_popped = hdr->seq;
+        popped_found = true;
+      }
+    }
+
+    if (!found) {
+      LOG("flash store: no records found in partition %s", _label);
+      return;
+    }
+
+    // live records are the unbroken run of valid records ending at the newest
+    // one, stopping at the newest popped record
+    _head = newest + 1;
+    _tail = _head;
+    while (_tail > 0 && _head - _tail < capacity() &&
+           !(popped_found && _tail - 1 <= newest_popped) &&
+           _is_valid(_read_slot(_tail - 1), _tail - 1)) {
+      _tail--;
+    }
+
+    LOG("flash store: recovered %d records (seq %u-%u) from partition %s",
+        len(), _tail, _head, _label);
+  }
+
+  // one sector of slots is always kept free, since it's erased in one go
+  size_t capacity() {
+    return _num_slots - _slots_per_sector;
+  }
+
+  size_t len() {
+    return _head - _tail;
+  }
+
+  // Reads straight into 'dest', not through _scratch, so it's safe to call
+  // from the uploader's task while records are being pushed.
+  void get(size_t index, void *dest) {
+    assert(index < len());
+    ESP_ERROR_CHECK(esp_partition_read(
+        _part, _offset(_tail + index) + sizeof(slot_header_t), dest,
+        _record_size));
+  }
+
+  void push(const void *record) {
+    assert(len() < capacity());
+
+    size_t offset = _offset(_head);
+    if (offset % SPI_FLASH_SEC_SIZE == 0) {
+      ESP_ERROR_CHECK(
+          esp_partition_erase_range(_part, offset, SPI_FLASH_SEC_SIZE));
+    }
+
+    slot_header_t *hdr = reinterpret_cast<slot_header_t *>(_scratch);
+    memset(_scratch, 0xff, _slot_size);
+    memcpy(hdr + 1, record, _record_size);
+    hdr->seq = _head;
+    hdr->check = _checksum(_head, static_cast<const uint8_t *>(record));
+    ESP_ERROR_CHECK(esp_partition_write(_part, offset, _scratch, _slot_size));
+    _head++;
+  }
+
+  void pop_n(size_t n) {
+    assert(n <= len());
+    if (n == 0) {
+      return;
+    }
+    _tail += n;
+
+    uint16_t popped = 0;
+    ESP_ERROR_CHECK(esp_partition_write(
+        _part, _offset(_tail - 1) + offsetof(slot_header_t, popped), &popped,
+        sizeof(popped)));
+  }
+};
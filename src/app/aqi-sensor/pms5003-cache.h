@@ -21,20 +21,39 @@
 #include "sensor-data-cache.h"
 
 class PMS5003Cache : public SensorDataCacheTemplate<pms5003_data_t> {
- private:
-  char _buf[100];
-
  public:
-  PMS5003Cache(size_t capacity, NtpClient *ntp)
-      : SensorDataCacheTemplate<pms5003_data_t>(capacity, ntp) {
+  PMS5003Cache(RecordStoreIfc *store, NtpClient *ntp)
+      : SensorDataCacheTemplate<pms5003_data_t>(store, ntp) {
+  }
+
+  virtual int serialize_one(const pms5003_data_t *data, char *dest,
+                            size_t max_len) {
+    return snprintf(dest, max_len,
+                    "\"pm1.0\": %d,"
+                    "\"pm2.5\": %d,"
+                    "\"pm10.0\": %d",
+                    data->pm10_standard, data->pm25_standard,
+                    data->pm100_standard);
+  }
+
+  virtual const sensor_field_t *fields(size_t *num_fields) {
+    static const sensor_field_t FIELDS[] = {
+        {"pm1.0", 1},
+        {"pm2.5", 1},
+        {"pm10.0", 1},
+    };
+    *num_fields = sizeof(FIELDS) / sizeof(FIELDS[0]);
+    return FIELDS;
   }
 
-  virtual char *serialize_one(pms5003_data_t *data) {
-    snprintf(_buf, sizeof(_buf),
-             "\"pm1.0\": %d,"
-             "\"pm2.5\": %d,"
-             "\"pm10.0\": %d",
-             data->pm10_standard, data->pm25_standard, data->pm100_standard);
-    return _buf;
+  virtual int32_t get_field_one(const pms5003_data_t *data, size_t field) {
+    switch (field) {
+      case 0:
+        return data->pm10_standard;
+      case 1:
+        return data->pm25_standard;
+      default:
+        return data->pm100_standard;
+    }
   }
 };
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core/rulos.h"
+
+// A fixed-capacity FIFO of fixed-size records. Index 0 is the oldest record.
+// Implementations must make pop_n O(1), and must not move records that are
+// already stored, so the uploader can read them while new data arrives.
+// Records are copied out by get() rather than read in place, so a store
+// needn't keep them in memory.
+class RecordStoreIfc {
+ public:
+  virtual size_t capacity() = 0;
+  virtual size_t len() = 0;
+  virtual void get(size_t index, void *dest) = 0;
+  virtual void push(const void *record) = 0;
+  virtual void pop_n(size_t n) = 0;
+};
+
+// Circular record store in RAM.
+class RamRecordStore : public RecordStoreIfc {
+ private:
+  uint8_t *_buf;
+  const size_t _record_size;
+  const size_t _capacity;
+  size_t _head;  // index of the oldest record
+  size_t _len;
+
+ public:
+  RamRecordStore(size_t record_size, size_t capacity)
+      : _record_size(record_size), _capacity(capacity), _head(0), _len(0) {
+    _buf = new uint8_t[_record_size * _capacity];
+    assert(_buf != NULL);
+  }
+
+  size_t capacity() {
+    return _capacity;
+  }
+
+  size_t len() {
+    return _len;
+  }
+
+  void get(size_t index, void *dest) {
+    assert(index < _len);
+    memcpy(dest, &_buf[((_head + index) % _capacity) * _record_size],
+           _record_size);
+  }
+
+  void push(const void *record) {
+    assert(_len < _capacity);
+    memcpy(&_buf[((_head + _len) % _capacity) * _record_size], record,
+           _record_size);
+    _len++;
+  }
+
+  void pop_n(size_t n) {
+    assert(n <= _len);
+    _head = (_head + n) % _capacity;
+    _len -= n;
+  }
+};
@@ -22,6 +22,7 @@
 #include <stdint.h>
 
 #include "periph/ntp/ntp.h"
+#include "record-store.h"
 
 // Public interface used by the data uploader, which does not have to be
 // specialized for any particular type of data.
@@ -30,66 +31,137 @@ class SensorDataCacheIfc {
   virtual size_t len() = 0;
   virtual void pop_n(size_t n) = 0;
   virtual size_t serialize(size_t index, char *dest, size_t max_len) = 0;
+
+  // Promise that the first n items will not be dropped until they are popped
+  // or unpinned. Used while an upload is reading them from another task.
+  virtual void set_pinned(size_t n) = 0;
+
+  // Column-wise access to the data, for compact encodings. Each data type
+  // describes its fields as integers; the real value is the integer divided
+  // by the field's scale.
+  virtual size_t num_fields() = 0;
+  virtual const char *field_name(size_t field) = 0;
+  virtual uint32_t field_scale(size_t field) = 0;
+  virtual uint64_t get_time_usec(size_t index) = 0;
+  virtual int32_t get_field(size_t index, size_t field) = 0;
 };
 
+// Description of one field of a sensor data type
+typedef struct {
+  const char *name;
+  uint32_t scale;
+} sensor_field_t;
+
 // Template for a cache, including a container for sensor data annotated with a
 // timestamp.
 template <typename SensorDataType>
 class SensorDataCacheTemplate : public SensorDataCacheIfc {
- private:
+ public:
   // create a container for the templated data type annotated with a timestamp
   typedef struct {
     uint64_t epoch_time_usec;
     SensorDataType data;
   } timestamped_data_t;
 
-  timestamped_data_t *_cache;
-  const size_t _capacity;
-  size_t _len;
+  static constexpr size_t RECORD_SIZE = sizeof(timestamped_data_t);
+
+ private:
+  RecordStoreIfc *_store;
   NtpClient *_ntp;
+  size_t _pinned;
+
+  timestamped_data_t _get(size_t index) {
+    timestamped_data_t td;
+    _store->get(index, &td);
+    return td;
+  }
 
  public:
-  // constructor: allocate the requested space for the cache
-  SensorDataCacheTemplate(size_t capacity, NtpClient *ntp)
-      : _capacity(capacity), _len(0), _ntp(ntp) {
-    _cache = new timestamped_data_t[_capacity];
-    assert(_cache != NULL);
+  // constructor: keep the cache in the given record store, which must have
+  // been created with a record size of RECORD_SIZE
+  SensorDataCacheTemplate(RecordStoreIfc *store, NtpClient *ntp)
+      : _store(store), _ntp(ntp), _pinned(0) {
   }
 
   // virtual function that must be overridden: how to serialize the sensor data
-  // type
-  virtual char *serialize_one(SensorDataType *data) = 0;
+  // type. Returns the number of characters written, as snprintf does.
+  virtual int serialize_one(const SensorDataType *data, char *dest,
+                            size_t max_len) = 0;
+
+  // virtual functions that must be overridden: the data type's fields, and
+  // how to extract one of them as an integer
+  virtual const sensor_field_t *fields(size_t *num_fields /* OUT */) = 0;
+  virtual int32_t get_field_one(const SensorDataType *data, size_t field) = 0;
+
+  size_t num_fields() {
+    size_t n;
+    fields(&n);
+    return n;
+  }
+
+  const char *field_name(size_t field) {
+    size_t n;
+    const sensor_field_t *f = fields(&n);
+    assert(field < n);
+    return f[field].name;
+  }
+
+  uint32_t field_scale(size_t field) {
+    size_t n;
+    const sensor_field_t *f = fields(&n);
+    assert(field < n);
+    return f[field].scale;
+  }
+
+  uint64_t get_time_usec(size_t index) {
+    return _get(index).epoch_time_usec;
+  }
+
+  int32_t get_field(size_t index, size_t field) {
+    timestamped_data_t td = _get(index);
+    return get_field_one(&td.data, field);
+  }
 
   // generic serialize serializes the timestamp, depends on the virtual func to
-  // serialize the data
+  // serialize the data. Safe to call from another task.
   size_t serialize(size_t index, char *dest, size_t max_len) {
-    assert(index < _len);
-    timestamped_data_t *pt = &_cache[index];
-
-    return snprintf(dest, max_len,
-                    "%s\n"
-                    "{\n"
-                    "   \"time\": %llu.%06llu,\n"
-                    "   %s\n"
-                    "}",
-                    index > 0 ? ",\n" : "", pt->epoch_time_usec / 1000000,
-                    pt->epoch_time_usec % 1000000, serialize_one(&pt->data));
+    assert(index < _store->len());
+    const timestamped_data_t td = _get(index);
+    const timestamped_data_t *pt = &td;
+
+    size_t len = snprintf(dest, max_len,
+                          "%s\n"
+                          "{\n"
+                          "   \"time\": %llu.%06llu,\n"
+                          "   ",
+                          index > 0 ? ",\n" : "", pt->epoch_time_usec / 1000000,
+                          pt->epoch_time_usec % 1000000);
+    len = r_min(len, max_len - 1);
+    len += serialize_one(&pt->data, dest + len, max_len - len);
+    len = r_min(len, max_len - 1);
+    len += snprintf(dest + len, max_len - len, "\n}");
+    return r_min(len, max_len - 1);
+  }
+
+  void set_pinned(size_t n) {
+    assert(n <= _store->len());
+    _pinned = n;
   }
 
   // remove the first n data items from the cache
   void pop_n(size_t n) {
-    assert(n <= _len);
-    memmove(&_cache[0], &_cache[n], sizeof(_cache[0]) * (_len - n));
-    _len -= n;
+    _store->pop_n(n);
+    _pinned -= r_min(_pinned, n);
+    size_t len = _store->len();
 
     char log_msg[100];
     int log_len =
         snprintf(log_msg, sizeof(log_msg),
-                 "data cache: popping %d items; %d remaining", n, _len);
-    if (_len > 0) {
+                 "data cache: popping %d items; %d remaining", n, len);
+    if (len > 0) {
       log_len += snprintf(log_msg + log_len, sizeof(log_msg) - log_len,
-                          " (%llu-%llu)", _cache[0].epoch_time_usec / 1000000,
-                          _cache[_len - 1].epoch_time_usec / 1000000);
+                          " (%llu-%llu)", _get(0).epoch_time_usec / 1000000,
+                          _get(len - 1).epoch_time_usec / 1000000);
     }
     log_msg[log_len++] = '\n';
     log_write(log_msg, log_len);
@@ -103,8 +175,9 @@ class SensorDataCacheTemplate : public SensorDataCacheIfc {
     uint64_t t = _ntp->get_epoch_time_usec();
 
     // print debug
-    LOG("got data:time_usec=%llu.%06llu,%s", t / 1000000, t % 1000000,
-        serialize_one(data));
+    char buf[100];
+    serialize_one(data, buf, sizeof(buf));
+    LOG("got data:time_usec=%llu.%06llu,%s", t / 1000000, t % 1000000, buf);
 
     if (t == 0) {
       LOG("....dropping sample because NTP is not locked");
@@ -114,19 +187,24 @@ class SensorDataCacheTemplate : public SensorDataCacheIfc {
     // Drop a quarter of the data if the cache has overflowed. In theory we
     // could just drop one, but that causes a lot of CPU overhead in the case
     // the network is down and the data is just getting dropped persistently.
-    if (_len == _capacity) {
-      pop_n(_capacity / 4);
+    // If the oldest data is being uploaded right now, drop the new sample
+    // instead.
+    if (_store->len() == _store->capacity()) {
+      if (_pinned > 0) {
+        LOG("....dropping sample because cache is full during upload");
+        return;
+      }
+      pop_n(_store->capacity() / 4);
     }
 
     // Add the new data item to the end
-    _cache[_len].data = *data;
-    _cache[_len].epoch_time_usec = t;
-    _len++;
-
-    assert(_len <= _capacity);
+    timestamped_data_t td;
+    td.data = *data;
+    td.epoch_time_usec = t;
+    _store->push(&td);
   }
 
   size_t len() {
-    return _len;
+    return _store->len();
   }
 };
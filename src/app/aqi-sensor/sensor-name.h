@@ -30,6 +30,7 @@ class SensorName : public HttpsHandlerIfc {
   const char *_base_url;
   char _sensor_name[100];
   bool _valid;
+  bool _outstanding;
 
   static constexpr const char *SENSOR_NAME_URL = "mac_lookup";
   static constexpr const int RETRY_TIME_SEC = 5;
@@ -49,11 +50,16 @@ class SensorName : public HttpsHandlerIfc {
                 this);
 
     // if last request is outstanding, do nothing
-    if (_hc->is_in_use()) {
+    if (_outstanding) {
       LOG("get sensor name: previous req still outstanding");
       return;
     }
 
+    if (_hc->is_in_use()) {
+      LOG("get sensor name: https client busy");
+      return;
+    }
+
     // set aside one byte for NULL -- we'll null terminate data
     // in-place after we get it
     _hc->set_response_buffer(_sensor_name, sizeof(_sensor_name) - 1);
@@ -62,9 +68,11 @@ class SensorName : public HttpsHandlerIfc {
              inet_wifi_macaddr());
     LOG("Getting sensor name at: %s", url);
     _hc->get(url, this);
+    _outstanding = true;
   }
 
   void on_done(HttpsClient *hc, int response_code, size_t response_len) {
+    _outstanding = false;
     if (response_code == 200 && response_len >= 1) {
       LOG("Sensor name retrieval: success, code %d, len %d", response_code,
           response_len);
@@ -81,6 +89,7 @@ class SensorName : public HttpsHandlerIfc {
     _hc = hc;
     _base_url = base_url;
     _valid = false;
+    _outstanding = false;
   }
 
   const char *get_sensor_name() {
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "adc_capture.h"
+
+#include <string.h>
+
+#include "core/rulos.h"
+
+static void block_ready(void *data, const adc_stream_block_t *block) {
+  adc_capture_t *ac = (adc_capture_t *)data;
+
+  // the timer triggers the first scan one period after it starts
+  const adc_block_header_t hdr = {
+      .start_usec = ac->start_usec + (uint64_t)(block->first_scan + 1) *
+                                         1000000 / ac->rate_hz,
+      .channel_mask = ac->channel_mask,
+      .rate_hz = ac->rate_hz,
+      .first_scan = block->first_scan,
+      .overruns = block->overruns,
+      .num_scans = block->num_scans,
+      .num_channels = block->num_channels,
+  };
+  flash_dumper_write_block(ac->flash_dumper, &hdr, sizeof(hdr), block->samples,
+                           (uint32_t)block->num_scans * block->num_channels *
+                               sizeof(uint16_t),
+                           "adc,");
+  ac->num_blocks++;
+
+  if (block->overruns != ac->last_overruns) {
+    LOG("adc capture: %ld blocks lost", block->overruns);
+    ac->last_overruns = block->overruns;
+  }
+}
+
+void adc_capture_start(adc_capture_t *ac, uint32_t channel_mask,
+                       uint32_t rate_hz, flash_dumper_t *flash_dumper) {
+  memset(ac, 0, sizeof(*ac));
+  assert(__builtin_popcount(channel_mask) <= ADC_CAPTURE_MAX_CHANNELS);
+  ac->flash_dumper = flash_dumper;
+  ac->channel_mask = channel_mask;
+
+  ac->start_usec = wallclock_get_uptime_usec(&flash_dumper->wallclock);
+  ac->rate_hz =
+      adc_stream_start(channel_mask, rate_hz, ac->buf,
+                       ADC_CAPTURE_SCANS_PER_BLOCK, block_ready, ac);
+  LOG("adc capture: channels 0x%lx at %ld Hz", channel_mask, ac->rate_hz);
+}
+
+void adc_capture_stop(adc_capture_t *ac) {
+  adc_stream_stop();
+}
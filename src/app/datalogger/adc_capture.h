@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "flash_dumper.h"
+#include "periph/adc/adc_stream.h"
+
+// Continuous capture of analog waveforms to the log, e.g. current draw
+// through a shunt amplifier at kHz rates.
+//
+// Each half of the ADC's DMA ring becomes one record, whose body is the text
+// prefix "adc," (after the UTC stamp, if any), an adc_block_header_t, then
+// the raw samples: num_scans scans of num_channels little-endian uint16_t
+// each, in ascending channel order. process.py expands them into one line
+// per channel per block.
+
+#ifndef ADC_CAPTURE_SCANS_PER_BLOCK
+#define ADC_CAPTURE_SCANS_PER_BLOCK 256
+#endif
+
+#ifndef ADC_CAPTURE_MAX_CHANNELS
+#define ADC_CAPTURE_MAX_CHANNELS 4
+#endif
+
+typedef struct {
+  uint64_t start_usec;    // wallclock uptime of the block's first scan
+  uint32_t channel_mask;  // bit n set if ADC_INn is in each scan
+  uint32_t rate_hz;       // scans per second
+  uint32_t first_scan;    // index of the block's first scan since start
+  uint32_t overruns;      // blocks lost or overwritten so far
+  uint16_t num_scans;
+  uint16_t num_channels;
+  uint32_t reserved;
+} adc_block_header_t;
+
+typedef struct {
+  flash_dumper_t *flash_dumper;
+  uint32_t channel_mask;
+  uint32_t rate_hz;
+  uint64_t start_usec;
+  uint32_t num_blocks;
+  uint32_t last_overruns;
+
+  uint16_t buf[2 * ADC_CAPTURE_SCANS_PER_BLOCK * ADC_CAPTURE_MAX_CHANNELS];
+} adc_capture_t;
+
+void adc_capture_start(adc_capture_t *ac, uint32_t channel_mask,
+                       uint32_t rate_hz, flash_dumper_t *flash_dumper);
+void adc_capture_stop(adc_capture_t *ac);
@@ -25,11 +25,11 @@
 #define PRINT_INTERVAL_USEC        1000000
 #define POWERMEASURE_POLLTIME_USEC 20000
 
-static void measure_current(currmeas_state_t *cms) {
-  static int16_t current;
-  bool is_ready = ina219_read_microamps(cms->addr, &current);
+static void read_done(void *data) {
+  currmeas_state_t *cms = (currmeas_state_t *)data;
+  int16_t current;
 
-  if (!is_ready) {
+  if (!ina219_get_microamps(&cms->ina, &current)) {
     cms->num_not_ready++;
   } else {
     cms->num_ready++;
@@ -38,6 +38,15 @@ static void measure_current(currmeas_state_t *cms) {
   }
 }
 
+// Queues the read without waiting for the bus; read_done collects the result.
+// Sensors polled on the same tick are read in one burst.
+static void measure_current(currmeas_state_t *cms) {
+  if (!ina219_start_read(&cms->ina, read_done, cms)) {
+    // the previous read is still stuck on the bus
+    cms->num_not_ready++;
+  }
+}
+
 static void print_current(currmeas_state_t *cms) {
   int32_t current = cms->scale * cms->cum_current / cms->num_measurements;
   flash_dumper_write(cms->flash_dumper, NULL, 0, "curr,%d,%ld",
@@ -72,12 +81,11 @@ void currmeas_init(currmeas_state_t *cms, uint8_t device_addr,
                    uint32_t prescale, uint16_t calibration, uint32_t scale,
                    uint32_t channel_num, flash_dumper_t *flash_dumper) {
   memset(cms, 0, sizeof(*cms));
-  cms->addr = device_addr;
   cms->scale = scale;
   cms->channel_num = channel_num;
   cms->flash_dumper = flash_dumper;
 
-  if (ina219_init(device_addr, prescale, calibration)) {
+  if (ina219_init(&cms->ina, device_addr, prescale, calibration)) {
     schedule_now(monitor_current, cms);
   }
 }
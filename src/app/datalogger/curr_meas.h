@@ -21,9 +21,10 @@
 #include <stdint.h>
 
 #include "flash_dumper.h"
+#include "ina219.h"
 
 typedef struct {
-  int addr;
+  ina219_t ina;
   int channel_num;  // used for debug message only
   int scale;
   flash_dumper_t *flash_dumper;
@@ -26,64 +26,401 @@
 #include "core/wallclock.h"
 
 #define FLUSH_PERIOD_MSEC 3000
-#define MAX_FNAME_L       (128)
-
-static const char *makeFileName() {
-  const char *counter_fname = "filenum.dat";
-  static char return_name[MAX_FNAME_L] = {};
-  unsigned int count = 0;
-  strcpy(return_name, "datalog.txt");
-
-  FIL fp;
-
-  // try to open the counter file
-  int open_res = f_open(&fp, counter_fname, FA_READ | FA_WRITE);
-  if (open_res == FR_OK) {
-    uint32_t bytes_count = 0;
-    int file_size = f_size(&fp);
-    // if the size of the file is not exactly four bytes,
-    // then initialize it with four bytes of zeroes,
-    // then jump back to beginning
-    if (file_size != 4) {
-      LOG("Looks like a new counter file.");
-      f_write(&fp, &count, 4, &bytes_count);
-      f_sync(&fp);
-      f_lseek(&fp, 0);
-      if (bytes_count == 4) {
-        LOG("counter initialized");
-      }
+#define MAX_FNAME_L       (20)
+#define FILE_SECTORS      (FLASH_DUMPER_FILE_SIZE / FD_SECTOR_SIZE)
+
+// standard (zlib-compatible) crc32, using a nibble table to keep flash use low
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  static const uint32_t table[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc = table[(crc ^ buf[i]) & 0x0f] ^ (crc >> 4);
+    crc = table[(crc ^ (buf[i] >> 4)) & 0x0f] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static fd_sector_header_t *sector_header(flash_dumper_t *fd, uint8_t idx) {
+  return (fd_sector_header_t *)&fd->batch[idx * FD_SECTOR_SIZE];
+}
+
+static uint8_t *sector_data(flash_dumper_t *fd, uint8_t idx) {
+  return &fd->batch[idx * FD_SECTOR_SIZE + sizeof(fd_sector_header_t)];
+}
+
+static void open_sector(flash_dumper_t *fd) {
+  uint8_t *sector = &fd->batch[fd->curr_sector * FD_SECTOR_SIZE];
+  memset(sector, 0, FD_SECTOR_SIZE);
+
+  fd_sector_header_t *hdr = sector_header(fd, fd->curr_sector);
+  hdr->magic = FD_SECTOR_MAGIC;
+  hdr->base_time_ms = fd->last_time_ms;
+  hdr->first_rec = FD_NO_RECORD;
+}
+
+//// log file management
+
+static void make_file_name(char *buf, uint32_t file_num) {
+  snprintf(buf, MAX_FNAME_L, "log_%03lu.bin", file_num);
+}
+
+// Finds the highest-numbered log_NNN.bin in the root directory. This is a
+// read-only scan, so unlike a counter file it can't be torn by a power loss.
+static bool find_latest_log(uint32_t *file_num /* OUT */) {
+  static FILINFO fno;  // static: it holds a 256-byte long file name
+  DIR dir;
+  bool found = false;
+
+  if (f_opendir(&dir, "") != FR_OK) {
+    return false;
+  }
+
+  while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0') {
+    const char *s = fno.fname;
+    if (strncmp(s, "log_", 4) != 0) {
+      continue;
+    }
+    s += 4;
+    const char *digits = s;
+    uint32_t num = 0;
+    while (*s >= '0' && *s <= '9') {
+      num = num * 10 + (*s++ - '0');
+    }
+    if (s == digits || strcmp(s, ".bin") != 0) {
+      continue;
+    }
+    if (!found || num > *file_num) {
+      *file_num = num;
+      found = true;
+    }
+  }
+
+  f_closedir(&dir);
+  return found;
+}
+
+// Reads sector number 'index' of the current file into the first sector of
+// the batch buffer and checks that it belongs to this log at that position.
+static bool read_valid_sector(flash_dumper_t *fd, uint32_t index) {
+  // don't seek past EOF; in write mode that would extend the file
+  if ((index + 1) * FD_SECTOR_SIZE > f_size(&fd->fp)) {
+    return false;
+  }
+
+  uint32_t bytes_read;
+  if (f_lseek(&fd->fp, index * FD_SECTOR_SIZE) != FR_OK ||
+      f_read(&fd->fp, fd->batch, FD_SECTOR_SIZE, &bytes_read) != FR_OK ||
+      bytes_read != FD_SECTOR_SIZE) {
+    return false;
+  }
+
+  fd_sector_header_t *hdr = sector_header(fd, 0);
+  if (hdr->magic != FD_SECTOR_MAGIC || hdr->log_id != fd->log_id ||
+      hdr->seq != index || hdr->used > FD_SECTOR_DATA_SIZE) {
+    return false;
+  }
+
+  uint32_t crc = hdr->crc;
+  hdr->crc = 0;
+  return crc32_update(0, fd->batch, FD_SECTOR_SIZE) == crc;
+}
+
+// Finds the index of the first sector after the end of valid data. Valid
+// sectors form a prefix of the file, so this is a binary search; afterwards we
+// step over any holes left by a batch that was torn part-way through.
+static uint32_t find_log_end(flash_dumper_t *fd) {
+  uint32_t lo = 1, hi = fd->file_sectors;  // sector 0 is known valid
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (read_valid_sector(fd, mid)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (uint32_t i = 1; i < FLASH_DUMPER_BATCH_SECTORS; i++) {
+    if (lo + i < fd->file_sectors && read_valid_sector(fd, lo + i)) {
+      lo += i + 1;
+      i = 0;
+    }
+  }
+
+  return lo;
+}
+
+// Re-opens an existing log and positions it after its last valid sector.
+// Returns false if the log is full or unusable.
+static bool resume_log(flash_dumper_t *fd, uint32_t file_num) {
+  char fname[MAX_FNAME_L];
+  make_file_name(fname, file_num);
+
+  int retval = f_open(&fd->fp, fname, FA_READ | FA_WRITE | FA_OPEN_EXISTING);
+  if (retval != FR_OK) {
+    LOG("can't reopen %s: %d", fname, retval);
+    return false;
+  }
+
+  fd->file_num = file_num;
+  fd->file_sectors = FILE_SECTORS;
+
+  // sector 0 tells us this file's log_id
+  uint32_t bytes_read;
+  if (f_read(&fd->fp, fd->batch, FD_SECTOR_SIZE, &bytes_read) != FR_OK ||
+      bytes_read != FD_SECTOR_SIZE) {
+    f_close(&fd->fp);
+    return false;
+  }
+  fd->log_id = sector_header(fd, 0)->log_id;
+  if (!read_valid_sector(fd, 0)) {
+    f_close(&fd->fp);
+    return false;
+  }
+
+  fd->next_seq = find_log_end(fd);
+  if (fd->next_seq >= fd->file_sectors ||
+      f_lseek(&fd->fp, fd->next_seq * FD_SECTOR_SIZE) != FR_OK) {
+    f_close(&fd->fp);
+    return false;
+  }
+
+  fd->next_flags = FD_FLAG_RESUME;
+  LOG("resuming %s at sector %ld", fname, fd->next_seq);
+  return true;
+}
+
+// Picks the log_id for a newly created file. It must not match the stale
+// sectors left in the file's clusters by an earlier log, or they'd pass for
+// part of this one. Uptime at boot is nearly the same every time, and file
+// numbers start over when a card is emptied, so it's mixed with the previous
+// log's id and with the stale header at the start of the file: the id of
+// whatever log used to be there.
+static uint32_t choose_log_id(flash_dumper_t *fd, uint32_t file_num) {
+  uint32_t seed[3] = {fd->log_id, file_num, precise_clock_time_us()};
+  uint32_t log_id = crc32_update(0, (uint8_t *)seed, sizeof(seed));
+
+  fd_sector_header_t stale;
+  uint32_t bytes_read;
+  if (f_read(&fd->fp, &stale, sizeof(stale), &bytes_read) == FR_OK) {
+    log_id = crc32_update(log_id, (uint8_t *)&stale, bytes_read);
+  }
+  f_lseek(&fd->fp, 0);
+  return log_id;
+}
+
+// Creates a new log, preallocated as a single contiguous extent so that
+// writing it never has to touch the FAT.
+static bool create_log(flash_dumper_t *fd, uint32_t file_num) {
+  char fname[MAX_FNAME_L];
+  make_file_name(fname, file_num);
+
+  int retval = f_open(&fd->fp, fname, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+  if (retval != FR_OK) {
+    LOG("can't create %s: %d", fname, retval);
+    return false;
+  }
+
+  retval = f_expand(&fd->fp, FLASH_DUMPER_FILE_SIZE, 1);
+  if (retval != FR_OK) {
+    // keep going; the file will just grow a cluster at a time
+    LOG("can't preallocate %s: %d", fname, retval);
+  }
+
+  fd->file_num = file_num;
+  fd->file_sectors = FILE_SECTORS;
+  fd->log_id = choose_log_id(fd, file_num);
+  fd->next_seq = 0;
+  fd->next_flags = 0;
+  LOG("created %s", fname);
+  return true;
+}
+
+// Opens the next log, already created by prepare_next_log(), after its
+// empty first sector.
+static bool open_prepared_log(flash_dumper_t *fd) {
+  char fname[MAX_FNAME_L];
+  make_file_name(fname, fd->file_num + 1);
+
+  int retval = f_open(&fd->fp, fname, FA_READ | FA_WRITE | FA_OPEN_EXISTING);
+  if (retval != FR_OK) {
+    LOG("can't open prepared %s: %d", fname, retval);
+    return false;
+  }
+  if (f_lseek(&fd->fp, FD_SECTOR_SIZE) != FR_OK) {
+    f_close(&fd->fp);
+    return false;
+  }
+
+  fd->file_num++;
+  fd->log_id = fd->next_log_id;
+  fd->next_seq = 1;
+  fd->next_flags = 0;
+  LOG("rotated to %s", fname);
+  return true;
+}
+
+static bool rotate_log(flash_dumper_t *fd) {
+  f_close(&fd->fp);
+  const bool prepared = fd->next_prepared;
+  fd->next_prepared = false;
+  if (prepared && open_prepared_log(fd)) {
+    return true;
+  }
+
+  // the slow way: preallocating here holds up the write
+  if (!create_log(fd, fd->file_num + 1)) {
+    fd->ok = false;
+    return false;
+  }
+  return true;
+}
+
+//// batching
+
+// write all sealed sectors to the card, in as few transactions as possible
+static void write_batch(flash_dumper_t *fd, uint32_t num_sectors) {
+  uint8_t *sector = fd->batch;
+
+  while (num_sectors > 0 && fd->ok) {
+    if (fd->next_seq == fd->file_sectors && !rotate_log(fd)) {
+      return;
     }
-    int rd_ok = f_read(&fp, &count, 4, &bytes_count);
-    if ((rd_ok == FR_OK) && (bytes_count == 4)) {
-      // read four bytes and if successful, use them as the
-      // counter value
-      LOG("Success Reading %s. File count is %u", counter_fname, count);
-      snprintf(return_name, MAX_FNAME_L - 1, "log_%03u.txt", count % 1000);
-      count += 1;
-      f_lseek(&fp, 0);
-      bytes_count = 0;
-      // finally, increment the count and write it back to the file
-      int wr_ok = f_write(&fp, &count, 4, &bytes_count);
-      if ((wr_ok == FR_OK) && (bytes_count == 4)) {
-        LOG("File count updated.");
+
+    // stamp each sector with its final position and checksum
+    uint32_t n = r_min(num_sectors, fd->file_sectors - fd->next_seq);
+    for (uint32_t i = 0; i < n; i++) {
+      fd_sector_header_t *hdr =
+          (fd_sector_header_t *)&sector[i * FD_SECTOR_SIZE];
+      hdr->log_id = fd->log_id;
+      hdr->seq = fd->next_seq++;
+      hdr->flags = fd->next_flags;
+      fd->next_flags = 0;
+      hdr->crc = 0;
+      hdr->crc = crc32_update(0, (uint8_t *)hdr, FD_SECTOR_SIZE);
+    }
+
+    // attempt to write to the SD card
+    uint32_t len = n * FD_SECTOR_SIZE;
+    uint32_t written;
+    int retval = f_write(&fd->fp, sector, len, &written);
+    if (retval != FR_OK) {
+      LOG("couldn't write to sd card: got retval of %d", retval);
+      fd->ok = false;
+      return;
+    }
+    if (written != len) {
+      LOG("tried to write %ld, but wrote %ld!?", len, written);
+      fd->ok = false;
+      return;
+    }
+
+    fd->bytes_written += len;
+    sector += len;
+    num_sectors -= n;
+  }
+}
+
+static void commit_batch(flash_dumper_t *fd) {
+  write_batch(fd, fd->curr_sector);
+  fd->curr_sector = 0;
+  open_sector(fd);
+}
+
+// Creates and preallocates the next log ahead of time, so that rotating to it
+// doesn't stall logging while f_expand searches the FAT. It's given an empty
+// first sector, so that if we reboot before getting to it, it's resumed
+// rather than left behind as an unused file. Must be called with nothing in
+// the batch, i.e. right after a flush.
+static void prepare_next_log(flash_dumper_t *fd) {
+  const uint32_t file_num = fd->file_num;
+  const uint32_t log_id = fd->log_id;
+  const uint32_t next_seq = fd->next_seq;
+  const uint16_t next_flags = fd->next_flags;
+
+  f_close(&fd->fp);
+  if (create_log(fd, file_num + 1)) {
+    write_batch(fd, 1);
+    fd->next_log_id = fd->log_id;
+    fd->next_prepared = fd->ok;
+    f_close(&fd->fp);
+  }
+
+  // back to the current log; a failure to prepare isn't fatal, as rotation
+  // can still create the file itself
+  char fname[MAX_FNAME_L];
+  make_file_name(fname, file_num);
+  fd->ok = f_open(&fd->fp, fname, FA_READ | FA_WRITE | FA_OPEN_EXISTING) ==
+               FR_OK &&
+           f_lseek(&fd->fp, next_seq * FD_SECTOR_SIZE) == FR_OK;
+  if (!fd->ok) {
+    LOG("can't reopen %s", fname);
+  }
+  fd->file_num = file_num;
+  fd->file_sectors = FILE_SECTORS;
+  fd->log_id = log_id;
+  fd->next_seq = next_seq;
+  fd->next_flags = next_flags;
+  open_sector(fd);
+}
+
+// append bytes to the record stream, committing the batch when it fills
+static void append_bytes(flash_dumper_t *fd, const void *buf, uint32_t len) {
+  const uint8_t *src = (const uint8_t *)buf;
+
+  while (len > 0) {
+    fd_sector_header_t *hdr = sector_header(fd, fd->curr_sector);
+    uint32_t chunk = r_min(len, FD_SECTOR_DATA_SIZE - hdr->used);
+    memcpy(sector_data(fd, fd->curr_sector) + hdr->used, src, chunk);
+    hdr->used += chunk;
+    src += chunk;
+    len -= chunk;
+
+    if (hdr->used == FD_SECTOR_DATA_SIZE) {
+      fd->curr_sector++;
+      if (fd->curr_sector == FLASH_DUMPER_BATCH_SECTORS) {
+        commit_batch(fd);
+      } else {
+        open_sector(fd);
       }
-      f_sync(&fp);
-      f_close(&fp);
     }
-    f_close(&fp);
-  } else if ((open_res == FR_NO_FILE) || (open_res == FR_NO_PATH)) {
-    // If there is no counter file, that's ok, we'll just use
-    // the fixed name
-    LOG("No %s found", counter_fname);
-  } else {
-    // there is a counter file but it could not be opened for some
-    // other reasons...
-    LOG("Failed to open %s; Error: %d.", counter_fname, open_res);
   }
+}
 
-  LOG("makeFileName returning: %s", return_name);
+static void start_record(flash_dumper_t *fd, uint16_t body_len) {
+  uint32_t sec, usec;
+  wallclock_get_uptime(&fd->wallclock, &sec, &usec);
+  uint32_t now_ms = sec * 1000 + usec / 1000;
+  uint32_t dt_ms = now_ms - fd->last_time_ms;
+  fd->last_time_ms = now_ms;
+  fd->num_records++;
 
-  return return_name;
+  // note where the first record in this sector starts, so a reader can
+  // resynchronize here if the previous sector was lost
+  fd_sector_header_t *hdr = sector_header(fd, fd->curr_sector);
+  if (hdr->first_rec == FD_NO_RECORD) {
+    hdr->first_rec = hdr->used;
+  }
+
+  uint16_t rec_hdr[2] = {body_len, dt_ms};
+  if (dt_ms >= FD_DT_ABSOLUTE) {
+    rec_hdr[1] = FD_DT_ABSOLUTE;
+    append_bytes(fd, rec_hdr, sizeof(rec_hdr));
+    append_bytes(fd, &now_ms, sizeof(now_ms));
+  } else {
+    append_bytes(fd, rec_hdr, sizeof(rec_hdr));
+  }
+}
+
+void flash_dumper_flush(flash_dumper_t *fd) {
+  if (sector_header(fd, fd->curr_sector)->used > 0) {
+    fd->curr_sector++;
+  }
+  commit_batch(fd);
 }
 
 static void flash_dumper_periodic_flush(void *data) {
@@ -96,6 +433,8 @@ static void flash_dumper_periodic_flush(void *data) {
     return;
   }
 
+  flash_dumper_flush(fd);
+
   // try to sync
   int retval = f_sync(&fd->fp);
   if (retval != FR_OK) {
@@ -104,7 +443,12 @@ static void flash_dumper_periodic_flush(void *data) {
     return;
   }
 
-  LOG("flash dumper: log size %ld bytes", fd->bytes_written);
+  LOG("flash dumper: log %ld at sector %ld, %ld bytes, %ld records",
+      fd->file_num, fd->next_seq, fd->bytes_written, fd->num_records);
+
+  if (!fd->next_prepared && fd->next_seq >= fd->file_sectors / 2) {
+    prepare_next_log(fd);
+  }
 }
 
 void flash_dumper_init(flash_dumper_t *fd) {
@@ -122,81 +466,103 @@ void flash_dumper_init(flash_dumper_t *fd) {
     return;
   }
 
-  const char *filename = makeFileName();
-
-  LOG("trying to create file");
-  int retval = f_open(&fd->fp, filename, FA_WRITE | FA_OPEN_APPEND);
-  if (retval != FR_OK) {
-    LOG("can't open file: %d", retval);
-    return;
+  // append to the most recent log if it has room; otherwise start a new one
+  uint32_t file_num;
+  if (find_latest_log(&file_num)) {
+    fd->ok = resume_log(fd, file_num) || create_log(fd, file_num + 1);
+  } else {
+    fd->ok = create_log(fd, 0);
   }
-  LOG("opened file ok");
-  fd->ok = true;
 
-  flash_dumper_print(fd, "startup," STRINGIFY(GIT_COMMIT));
-}
+  // the recovery scan used the batch buffer as scratch space
+  fd->curr_sector = 0;
+  open_sector(fd);
 
-static bool _write_to_file(flash_dumper_t *fd, const void *buf, uint32_t len) {
-  // attempt to write to the SD card
-  uint32_t written;
-  int retval = f_write(&fd->fp, buf, len, &written);
-  if (retval != FR_OK) {
-    LOG("couldn't write to sd card: got retval of %d", retval);
-    fd->ok = false;
-    return false;
-  }
-  if (written == 0) {
-    LOG("error writing to SD card: nothing written");
-    fd->ok = false;
-    return false;
-  }
-  if (written != len) {
-    LOG("tried to write %ld, but wrote %ld!?", len, written);
-    return false;
+  if (!fd->ok) {
+    return;
   }
 
-  fd->bytes_written += len;
-
-  return true;
+  flash_dumper_print(fd, "startup," STRINGIFY(GIT_COMMIT));
 }
 
 // making this static instead of a local variable so it's accounted for in our
 // total memory use
-static char prefix_buf[50];
+static char prefix_buf[64];
 
-void flash_dumper_write(flash_dumper_t *fd, const void *buf, uint32_t len,
-                        const char *prefix_fmt, ...) {
-  // prepend all lines with the current time in milliseconds and a comma
-  uint32_t sec, usec;
-  wallclock_get_uptime(&fd->wallclock, &sec, &usec);
-  int prefix_len = sprintf(prefix_buf, "\n%ld,", sec * 1000 + usec / 1000);
+// Writes a record whose body is the text prefix, then 'hdr', then 'buf'.
+static void write_record(flash_dumper_t *fd, const void *hdr, uint32_t hdr_len,
+                         const void *buf, uint32_t len, const char *prefix_fmt,
+                         va_list ap) {
+  if (!fd->ok) {
+    return;
+  }
+
+  int prefix_len = 0;
+
+#ifdef FLASH_DUMPER_PPS_CLOCK
+  // stamp the record with UTC, if we have it
+  uint32_t utc_sec, utc_nsec;
+  if (fd->clock != NULL && pps_clock_is_locked(fd->clock) &&
+      pps_clock_now(fd->clock, &utc_sec, &utc_nsec)) {
+    prefix_len = snprintf(prefix_buf, sizeof(prefix_buf), "@%lu.%09lu,",
+                          utc_sec, utc_nsec);
+  }
+#endif
 
-  // append the prefix passed in by the caller
+  // format the prefix passed in by the caller
   if (prefix_fmt != NULL) {
-    va_list ap;
-    va_start(ap, prefix_fmt);
-    prefix_len += vsnprintf(prefix_buf + prefix_len,
+    int fmt_len = vsnprintf(prefix_buf + prefix_len,
                             sizeof(prefix_buf) - prefix_len, prefix_fmt, ap);
+    if (fmt_len > 0) {
+      prefix_len = r_min(prefix_len + fmt_len, (int)sizeof(prefix_buf) - 1);
+    }
   }
 
-  // write the header to the file
-  if (!_write_to_file(fd, prefix_buf, prefix_len)) {
-    return;
+  if (hdr == NULL) {
+    hdr_len = 0;
   }
-
-  // write the data to the file
-  if (buf != NULL && len > 0) {
-    if (!_write_to_file(fd, buf, len)) {
-      return;
-    }
+  if (buf == NULL) {
+    len = 0;
   }
+  hdr_len = r_min(hdr_len, 0xffff - prefix_len);
+  len = r_min(len, 0xffff - prefix_len - hdr_len);
+
+  start_record(fd, prefix_len + hdr_len + len);
+  append_bytes(fd, prefix_buf, prefix_len);
+  append_bytes(fd, hdr, hdr_len);
+  append_bytes(fd, buf, len);
 
 #if DUMP_TO_CONSOLE
   log_write(prefix_buf, prefix_len);
-  log_write(buf, r_min(len, 30));
+  if (hdr_len == 0) {
+    log_write(buf, r_min(len, 30));
+  }
 #endif
 }
 
+void flash_dumper_write(flash_dumper_t *fd, const void *buf, uint32_t len,
+                        const char *prefix_fmt, ...) {
+  va_list ap;
+  va_start(ap, prefix_fmt);
+  write_record(fd, NULL, 0, buf, len, prefix_fmt, ap);
+  va_end(ap);
+}
+
+void flash_dumper_write_block(flash_dumper_t *fd, const void *hdr,
+                              uint32_t hdr_len, const void *buf, uint32_t len,
+                              const char *prefix_fmt, ...) {
+  va_list ap;
+  va_start(ap, prefix_fmt);
+  write_record(fd, hdr, hdr_len, buf, len, prefix_fmt, ap);
+  va_end(ap);
+}
+
 void flash_dumper_print(flash_dumper_t *fd, const char *s) {
   flash_dumper_write(fd, s, strlen(s), NULL);
 }
+
+#ifdef FLASH_DUMPER_PPS_CLOCK
+void flash_dumper_set_clock(flash_dumper_t *fd, pps_clock_t *clock) {
+  fd->clock = clock;
+}
+#endif
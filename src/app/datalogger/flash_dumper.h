@@ -25,12 +25,94 @@
 #include "periph/fatfs/ff.h"
 #include "periph/uart/linereader.h"
 
+#ifdef FLASH_DUMPER_PPS_CLOCK
+#include "periph/pps_clock/pps_clock.h"
+#endif
+
+// On-card log format. Each log file is preallocated as one contiguous extent
+// of FLASH_DUMPER_FILE_SIZE bytes and filled with 512-byte sectors; each
+// sector is a header followed by a slice of the record stream. Records are
+// length-prefixed and may span sector boundaries. A record is:
+//
+//   uint16_t len;    // length of body
+//   uint16_t dt_ms;  // ms since previous record; FD_DT_ABSOLUTE if an
+//                    // absolute uint32_t timestamp (ms) follows instead
+//   char body[len];  // text prefix followed by the payload
+//
+// In apps built with FLASH_DUMPER_PPS_CLOCK, if a GPS-disciplined clock is
+// attached and locked, the text prefix starts with
+// "@<utc seconds>.<nanoseconds>,", the UTC time the record was written, so
+// records from different loggers can be compared directly.
+//
+// Sectors are accumulated in RAM and committed in batches of
+// FLASH_DUMPER_BATCH_SECTORS, so that each f_write is a whole number of
+// sectors. A sector is valid if its CRC is good, its log_id matches the rest
+// of the file, and its seq equals its index in the file; that lets both the
+// logger (at boot) and the reader find where good data ends in a file whose
+// tail still holds stale clusters. When a file is half full, the next
+// log_NNN.bin is created and preallocated, with an empty first sector, and
+// logging rotates to it when the first fills up. process.py converts this
+// format back to CSV.
+
+#define FD_SECTOR_SIZE     512
+#define FD_SECTOR_MAGIC    0x474f4c52  // "RLOG"
+#define FD_NO_RECORD       0xffff
+#define FD_DT_ABSOLUTE     0xffff
+
+// header flags
+#define FD_FLAG_RESUME 0x0001  // first sector after a reboot; resync here
+
+#ifndef FLASH_DUMPER_BATCH_SECTORS
+#define FLASH_DUMPER_BATCH_SECTORS 2
+#endif
+
+#ifndef FLASH_DUMPER_FILE_SIZE
+#define FLASH_DUMPER_FILE_SIZE (32UL * 1024 * 1024)
+#endif
+
+typedef struct {
+  uint32_t magic;
+  uint32_t log_id;        // nonce chosen when the file was created
+  uint32_t seq;           // index of this sector within the file
+  uint32_t base_time_ms;  // time that first_rec's dt_ms is relative to
+  uint16_t used;          // number of record-stream bytes in this sector
+  uint16_t first_rec;     // offset of first record starting here
+  uint16_t flags;
+  uint16_t reserved;
+  uint32_t crc;  // crc32 of header (with crc=0) and data
+} fd_sector_header_t;
+
+#define FD_SECTOR_DATA_SIZE (FD_SECTOR_SIZE - sizeof(fd_sector_header_t))
+
 typedef struct {
   FATFS fatfs;  // SD card filesystem global state
   FIL fp;
   bool ok;
   wallclock_t wallclock;
   uint32_t bytes_written;
+
+  // current log file
+  uint32_t file_num;
+  uint32_t log_id;
+  uint32_t file_sectors;  // capacity of the file, in sectors
+  uint32_t next_seq;      // index of the next sector to be written
+  uint16_t next_flags;    // flags for the next sector to be written
+
+  // the next log, created ahead of time so that rotation is quick
+  bool next_prepared;
+  uint32_t next_log_id;
+
+  // batch of sectors waiting to be committed to the card
+  uint8_t batch[FLASH_DUMPER_BATCH_SECTORS * FD_SECTOR_SIZE]
+      __attribute__((aligned(4)));
+  uint8_t curr_sector;  // index into batch of sector being filled
+  uint32_t last_time_ms;  // timestamp of most recently started record
+  uint32_t num_records;
+
+#ifdef FLASH_DUMPER_PPS_CLOCK
+  // optional source of UTC timestamps; its timebase is wallclock uptime, usec
+  pps_clock_t *clock;
+#endif
 } flash_dumper_t;
 
 void flash_dumper_init(flash_dumper_t *fd);
@@ -38,4 +120,21 @@ void flash_dumper_write(flash_dumper_t *fd, const void *buf, uint32_t len,
                         const char *prefix_fmt, ...)
     __attribute__((format(printf, 4, 5)));
 
+// As flash_dumper_write, but the payload is gathered from a binary header
+// followed by a block of data, e.g. a block of raw samples.
+void flash_dumper_write_block(flash_dumper_t *fd, const void *hdr,
+                              uint32_t hdr_len, const void *buf, uint32_t len,
+                              const char *prefix_fmt, ...)
+    __attribute__((format(printf, 6, 7)));
+
 void flash_dumper_print(flash_dumper_t *fd, const char *s);
+
+#ifdef FLASH_DUMPER_PPS_CLOCK
+// Stamp records with UTC from 'clock' whenever it's locked. The clock's ticks
+// must be the usec of uptime of fd->wallclock.
+void flash_dumper_set_clock(flash_dumper_t *fd, pps_clock_t *clock);
+#endif
+
+// seal any partially filled sector and write it out along with the rest of
+// the pending batch; the file isn't synced until the next periodic flush
+void flash_dumper_flush(flash_dumper_t *fd);
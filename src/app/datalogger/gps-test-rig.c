@@ -16,11 +16,13 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "adc_capture.h"
 #include "core/hardware.h"
 #include "core/rulos.h"
 #include "curr_meas.h"
 #include "flash_dumper.h"
 #include "ina219.h"
+#include "periph/pps_clock/pps_clock.h"
 #include "periph/uart/uart.h"
 #include "serial_reader.h"
 
@@ -45,6 +47,87 @@ UartState_t console;
 flash_dumper_t flash_dumper;
 serial_reader_t refgps, dut1, dut2;
 currmeas_state_t cms1, cms2;
+pps_clock_t refgps_clock;
+
+//// reference gps clock
+
+// The reference GPS disciplines the record timestamps: its NMEA gives the
+// time of day, and, if its PPS output is wired to a pin of port A, define
+// REFGPS_PPS_LINE as that pin's number and the PPS edges steer the clock.
+// Without PPS the clock never locks and records carry only uptime.
+
+static uint64_t uptime_usec(void *data) {
+  return wallclock_get_uptime_usec(&flash_dumper.wallclock);
+}
+
+static void refgps_received(serial_reader_t *sr, const char *line,
+                            void *data) {
+  pps_clock_nmea(&refgps_clock, line);
+}
+
+#ifdef REFGPS_PPS_LINE
+
+#include "stm32g0xx_ll_exti.h"
+
+#define REFGPS_PPS_EXTI        (1UL << REFGPS_PPS_LINE)
+#define EXTI_CONFIG_LINE_(n)   LL_EXTI_CONFIG_LINE##n
+#define EXTI_CONFIG_LINE(n)    EXTI_CONFIG_LINE_(n)
+
+static void refgps_pps_irq(void) {
+  if (LL_EXTI_IsActiveRisingFlag_0_31(REFGPS_PPS_EXTI)) {
+    LL_EXTI_ClearRisingFlag_0_31(REFGPS_PPS_EXTI);
+    pps_clock_pulse(&refgps_clock,
+                    wallclock_get_uptime_usec(&flash_dumper.wallclock));
+  }
+}
+
+#if REFGPS_PPS_LINE < 2
+#define REFGPS_PPS_IRQn EXTI0_1_IRQn
+void EXTI0_1_IRQHandler() {
+  refgps_pps_irq();
+}
+#elif REFGPS_PPS_LINE < 4
+#define REFGPS_PPS_IRQn EXTI2_3_IRQn
+void EXTI2_3_IRQHandler() {
+  refgps_pps_irq();
+}
+#else
+#define REFGPS_PPS_IRQn EXTI4_15_IRQn
+void EXTI4_15_IRQHandler() {
+  refgps_pps_irq();
+}
+#endif
+
+static void refgps_pps_init(void) {
+  const gpio_pin_t pps_pin = {GPIOA, 1UL << REFGPS_PPS_LINE};
+  gpio_make_input_disable_pullup(pps_pin);
+  LL_EXTI_SetEXTISource(LL_EXTI_CONFIG_PORTA,
+                        EXTI_CONFIG_LINE(REFGPS_PPS_LINE));
+  LL_EXTI_EnableRisingTrig_0_31(REFGPS_PPS_EXTI);
+  LL_EXTI_EnableIT_0_31(REFGPS_PPS_EXTI);
+
+  // highest priority, so the edge is timestamped with as little latency as
+  // possible
+  HAL_NVIC_SetPriority(REFGPS_PPS_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(REFGPS_PPS_IRQn);
+}
+
+#endif
+
+//// analog capture
+
+// To log waveforms, e.g. from a current-sense amplifier, define
+// ADC_CAPTURE_CHANNELS as a mask of the ADC inputs to capture.
+
+#ifdef ADC_CAPTURE_CHANNELS
+
+#ifndef ADC_CAPTURE_RATE_HZ
+#define ADC_CAPTURE_RATE_HZ 2000
+#endif
+
+adc_capture_t adc_capture;
+
+#endif
 
 //// sony config
 
@@ -199,8 +282,14 @@ int main() {
   // initialize flash dumper
   flash_dumper_init(&flash_dumper);
 
-  // initialize reference gps
-  serial_reader_init(&refgps, REFGPS_UART_NUM, 9600, &flash_dumper, NULL, NULL);
+  // initialize reference gps, and the clock it disciplines
+  pps_clock_init(&refgps_clock, 1000000, uptime_usec, NULL);
+  flash_dumper_set_clock(&flash_dumper, &refgps_clock);
+  serial_reader_init(&refgps, REFGPS_UART_NUM, 9600, &flash_dumper,
+                     refgps_received, NULL);
+#ifdef REFGPS_PPS_LINE
+  refgps_pps_init();
+#endif
 
   // enable sony on dut1
   serial_reader_init(&dut1, DUT1_UART_NUM, 115200, &flash_dumper,
@@ -238,6 +327,11 @@ int main() {
                 1,  // we read in microamps
                 DUT2_UART_NUM, &flash_dumper);
 
+#ifdef ADC_CAPTURE_CHANNELS
+  adc_capture_start(&adc_capture, ADC_CAPTURE_CHANNELS, ADC_CAPTURE_RATE_HZ,
+                    &flash_dumper);
+#endif
+
   // enable periodic blink to indicate liveness
   schedule_now(indicate_alive, NULL);
 
@@ -16,16 +16,16 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "ina219.h"
+
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "core/hardware.h"
 #include "core/rulos.h"
-#include "stm32g0xx_hal_i2c.h"
-#include "stm32g0xx_hal_rcc.h"
-#include "stm32g0xx_ll_exti.h"
-#include "stm32g0xx_ll_i2c.h"
-#include "stm32g0xx_ll_pwr.h"
+#include "periph/i2c_master/i2c_master.h"
+#include "stm32g0xx_hal_gpio.h"
 
 #if defined(BOARD_GPS_TEST_RIG_REV_B)
 #define SCL_PIN GPIO_PIN_6
@@ -37,36 +37,48 @@
 #error "unknown pins"
 #endif
 
-#define WRITE_ADDR(addr) (addr << 1)
-#define READ_ADDR(addr)  ((addr << 1) | 1)
+#define REG_CONFIG      0x0
+#define REG_BUS_VOLTAGE 0x2
+#define REG_CURRENT     0x4
+#define REG_CALIBRATION 0x5
+
+// transfers point at these to select the register they read
+static const uint8_t bus_voltage_reg = REG_BUS_VOLTAGE;
+static const uint8_t current_reg = REG_CURRENT;
 
-I2C_HandleTypeDef i2c_handle;
+static i2c_master_bus_t *i2c_bus = NULL;
 
 // write to one of the 16-bit registers
-static void reg_write(uint8_t device_addr, uint8_t reg_addr, uint16_t value) {
+static bool reg_write(uint8_t device_addr, uint8_t reg_addr, uint16_t value) {
   uint8_t buf[3];
 
   buf[0] = reg_addr;
   buf[1] = value >> 8;
   buf[2] = value & 0xff;
 
-  HAL_I2C_Master_Transmit(&i2c_handle, WRITE_ADDR(device_addr), buf,
-                          sizeof(buf), HAL_MAX_DELAY);
+  i2c_master_xfer_t xfer = {
+      .addr = device_addr,
+      .tx = buf,
+      .tx_len = sizeof(buf),
+  };
+  i2c_master_submit(i2c_bus, &xfer);
+  return i2c_master_wait(&xfer) == I2C_MASTER_OK;
 }
 
 // read from one of the 16-bit registers, writing results to inbuf
 static bool reg_read(uint8_t device_addr, uint8_t reg_addr,
                      uint16_t *value /* OUT */) {
-  uint8_t outbuf[1];
-
-  outbuf[0] = reg_addr;
-
-  HAL_I2C_Master_Transmit(&i2c_handle, WRITE_ADDR(device_addr), outbuf,
-                          sizeof(outbuf), HAL_MAX_DELAY);
-
   uint8_t inbuf[2];
-  if (HAL_OK != HAL_I2C_Master_Receive(&i2c_handle, READ_ADDR(device_addr),
-                                       inbuf, 2, HAL_MAX_DELAY)) {
+
+  i2c_master_xfer_t xfer = {
+      .addr = device_addr,
+      .tx = &reg_addr,
+      .tx_len = 1,
+      .rx = inbuf,
+      .rx_len = sizeof(inbuf),
+  };
+  i2c_master_submit(i2c_bus, &xfer);
+  if (i2c_master_wait(&xfer) != I2C_MASTER_OK) {
     LOG("error reading from INA219 at 0x%x", device_addr);
     *value = 0;
     return false;
@@ -88,41 +100,41 @@ static void start_i2c() {
   GPIO_InitStruct.Pin = SDA_PIN;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
-  // Enable the I2C peripheral
-  __HAL_RCC_I2C1_CLK_ENABLE();
-  i2c_handle.Instance = I2C1;
-  i2c_handle.Init.Timing =
-      __LL_I2C_CONVERT_TIMINGS(1,   // Prescaler
-                               13,  // SCLDEL, data setup time
-                               13,  // SDADEL, data hold time
-                               54,  // SCLH, clock high period
-                               84   // SCLL, clock low period
-      );
-  i2c_handle.Init.OwnAddress1 = 0;
-  i2c_handle.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
-  i2c_handle.Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
-  i2c_handle.Init.OwnAddress2 = 0;
-  i2c_handle.Init.OwnAddress2Masks = I2C_OA2_NOMASK;
-  i2c_handle.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
-  i2c_handle.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
-  if (HAL_I2C_Init(&i2c_handle) != HAL_OK) {
-    __builtin_trap();
-  }
+  i2c_bus = i2c_master_get_bus(
+      I2C1, __LL_I2C_CONVERT_TIMINGS(1,   // Prescaler
+                                     13,  // SCLDEL, data setup time
+                                     13,  // SDADEL, data hold time
+                                     54,  // SCLH, clock high period
+                                     84   // SCLL, clock low period
+                                     ));
 }
 
-bool ina219_init(uint8_t device_addr, uint32_t prescale, uint16_t calibration) {
-  static bool i2c_started = false;
-  if (!i2c_started) {
-    i2c_started = true;
+bool ina219_init(ina219_t *ina, uint8_t device_addr, uint32_t prescale,
+                 uint16_t calibration) {
+  if (i2c_bus == NULL) {
     start_i2c();
   }
 
+  memset(ina, 0, sizeof(*ina));
+  ina->addr = device_addr;
+  ina->status_xfer.addr = device_addr;
+  ina->status_xfer.tx = &bus_voltage_reg;
+  ina->status_xfer.tx_len = 1;
+  ina->status_xfer.rx = ina->status_buf;
+  ina->status_xfer.rx_len = sizeof(ina->status_buf);
+  ina->current_xfer.addr = device_addr;
+  ina->current_xfer.tx = &current_reg;
+  ina->current_xfer.tx_len = 1;
+  ina->current_xfer.rx = ina->current_buf;
+  ina->current_xfer.rx_len = sizeof(ina->current_buf);
+  ina->current_xfer.done = true;
+
   LOG("Trying to initialize INA219 on address 0x%x...", device_addr);
 
   // reset device
   uint16_t reset_reg = 1 << 15;
-  reg_write(device_addr, 0x0, reset_reg);
-  bool ok = reg_read(device_addr, 0x0, &reset_reg);
+  bool ok = reg_write(device_addr, REG_CONFIG, reset_reg) &&
+            reg_read(device_addr, REG_CONFIG, &reset_reg);
   if (!ok) {
     LOG("...could not initialize!");
     return false;
@@ -137,39 +149,50 @@ bool ina219_init(uint8_t device_addr, uint32_t prescale, uint16_t calibration) {
   // * 128 sample averaging
   // * bus voltage monitoring off, power measurement on
   uint16_t config_reg = 0b0001111111111101 | prescale;
-  reg_write(device_addr, 0x0, config_reg);
 
   // read back the config register and make sure it was set as we requested
-  reg_read(device_addr, 0x0, &reset_reg);
-  if (reset_reg != config_reg) {
+  if (!reg_write(device_addr, REG_CONFIG, config_reg) ||
+      !reg_read(device_addr, REG_CONFIG, &reset_reg) ||
+      reset_reg != config_reg) {
     LOG("...could not write to register");
     return false;
   }
   LOG("INA219@0x%x: configuration set to 0x%x", device_addr, reset_reg);
 
-  reg_write(device_addr, 0x5, calibration);
+  // without calibration, the current register reads 0 forever
+  if (!reg_write(device_addr, REG_CALIBRATION, calibration)) {
+    LOG("...could not write calibration");
+    return false;
+  }
   return true;
 }
 
-bool ina219_read_microamps(uint8_t device_addr, int16_t *val /* OUT */) {
-  uint16_t reg;
+bool ina219_start_read(ina219_t *ina, ActivationFuncPtr done, void *data) {
+  if (!ina->current_xfer.done) {
+    return false;
+  }
 
   // Read the bus voltage register, which also has the "conversion
-  // ready" bit
-  reg_read(device_addr, 0x2, &reg);
+  // ready" bit, and then the current. The second finishes last.
+  ina->current_xfer.done_rec.func = done;
+  ina->current_xfer.done_rec.data = data;
+  i2c_master_submit(i2c_bus, &ina->status_xfer);
+  i2c_master_submit(i2c_bus, &ina->current_xfer);
+  return true;
+}
 
-  if ((reg & (1 << 1)) == 0) {
-    // conversion not ready!
+bool ina219_get_microamps(ina219_t *ina, int16_t *val /* OUT */) {
+  if (ina->status_xfer.status != I2C_MASTER_OK ||
+      ina->current_xfer.status != I2C_MASTER_OK) {
     return false;
   }
 
-  reg_read(device_addr, 0x4, (uint16_t *)val);
-
-#if 0
-  int16_t voltage_register;
-  reg_read(device_addr, 0x1, (uint16_t *) &voltage_register);
-  LOG("device 0x%x voltage %d, current %d", device_addr, voltage_register, *val);
-#endif
+  const uint16_t bus_voltage = ina->status_buf[0] << 8 | ina->status_buf[1];
+  if ((bus_voltage & (1 << 1)) == 0) {
+    // conversion not ready!
+    return false;
+  }
 
+  *val = ina->current_buf[0] << 8 | ina->current_buf[1];
   return true;
 }
@@ -16,10 +16,37 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "periph/i2c_master/i2c_master.h"
+
 #define VOLT_PRESCALE_DIV1 (0b00 << 11)
 #define VOLT_PRESCALE_DIV2 (0b01 << 11)
 #define VOLT_PRESCALE_DIV4 (0b10 << 11)
 #define VOLT_PRESCALE_DIV8 (0b11 << 11)
 
-bool ina219_init(uint8_t device_addr, uint32_t prescale, uint16_t calibration);
-bool ina219_read_microamps(uint8_t device_addr, int16_t *val /* OUT */);
+typedef struct {
+  uint8_t addr;
+
+  // a read is the bus voltage register, for its conversion-ready bit, then
+  // the current register, queued back to back
+  i2c_master_xfer_t status_xfer;
+  i2c_master_xfer_t current_xfer;
+  uint8_t status_buf[2];
+  uint8_t current_buf[2];
+} ina219_t;
+
+bool ina219_init(ina219_t *ina, uint8_t device_addr, uint32_t prescale,
+                 uint16_t calibration);
+
+// Start reading the current without waiting for the bus; 'done' is scheduled
+// when the result is in. Returns false, and does nothing, if the previous
+// read hasn't finished.
+bool ina219_start_read(ina219_t *ina, ActivationFuncPtr done, void *data);
+
+// The result of the last read. Returns false if the bus failed or there
+// wasn't a new conversion.
+bool ina219_get_microamps(ina219_t *ina, int16_t *val /* OUT */);
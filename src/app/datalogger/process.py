@@ -6,6 +6,8 @@ import datetime
 import pandas as pd
 import numpy as np
 import binascii
+import struct
+import zlib
 import geopandas
 from shapely.geometry import Point
 import contextily as cx
@@ -35,6 +37,118 @@ QUECTEL_CONF = {
     },
 }
 
+# Binary log format written by flash_dumper.c; see flash_dumper.h
+FD_SECTOR_SIZE = 512
+FD_SECTOR_MAGIC = 0x474f4c52
+FD_SECTOR_HEADER = struct.Struct("<IIIIHHHHI")
+FD_NO_RECORD = 0xffff
+FD_DT_ABSOLUTE = 0xffff
+FD_FLAG_RESUME = 0x0001
+
+def is_binary_log(filename):
+    with open(filename, "rb") as f:
+        magic = f.read(4)
+    return len(magic) == 4 and struct.unpack("<I", magic)[0] == FD_SECTOR_MAGIC
+
+# Block of raw ADC samples written by adc_capture.c; see adc_capture.h
+ADC_BLOCK_HEADER = struct.Struct("<QIIIIHHI")
+
+def decode_adc_block(timestamp, block):
+    """Yields one line per channel of a block of ADC samples:
+    "timestamp,adc,channel,start_usec,rate_hz,first_scan,overruns,samples",
+    with the samples separated by spaces. start_usec is the uptime of the
+    first sample; the rest follow at rate_hz."""
+    if len(block) < ADC_BLOCK_HEADER.size:
+        return
+    start_usec, channel_mask, rate_hz, first_scan, overruns, num_scans, \
+        num_channels, _ = ADC_BLOCK_HEADER.unpack_from(block)
+    num_samples = num_scans * num_channels
+    if len(block) < ADC_BLOCK_HEADER.size + 2 * num_samples:
+        return
+    samples = struct.unpack_from(f"<{num_samples}H", block, ADC_BLOCK_HEADER.size)
+    channels = [ch for ch in range(32) if channel_mask & (1 << ch)]
+    for i, ch in enumerate(channels):
+        values = " ".join(str(v) for v in samples[i::num_channels])
+        yield f"{timestamp},adc,{ch},{start_usec},{rate_hz},{first_scan},{overruns},{values}\n"
+
+def decode_binary_log(filename):
+    """Yields the lines of a sector-framed binary log in the CSV text format
+    ("timestamp_ms,prefix,payload"). A sector is valid only if its CRC is good
+    and it carries this file's log_id and its own index as its seq; anything
+    else is a torn write or stale preallocated space. Records touching an
+    invalid sector are dropped, and decoding resumes at the first record that
+    starts in the next valid sector."""
+    data = open(filename, "rb").read()
+    stream = b""
+    synced = False
+    log_id = None
+    time_ms = 0
+    bad_sectors = 0
+    unused_sectors = 0
+
+    for index, offset in enumerate(range(0, len(data) - FD_SECTOR_SIZE + 1, FD_SECTOR_SIZE)):
+        sector = bytearray(data[offset:offset+FD_SECTOR_SIZE])
+        magic, sector_log_id, seq, base_time_ms, used, first_rec, flags, _, crc = \
+            FD_SECTOR_HEADER.unpack_from(sector)
+        sector[FD_SECTOR_HEADER.size-4:FD_SECTOR_HEADER.size] = b"\0\0\0\0"
+        # the file's log_id is taken from its first sector that's intact
+        if magic != FD_SECTOR_MAGIC or seq != index or zlib.crc32(sector) != crc \
+           or (log_id is not None and sector_log_id != log_id):
+            unused_sectors += 1
+            synced = False
+            continue
+        log_id = sector_log_id
+        # invalid sectors followed by valid ones are corruption, not just
+        # unused space at the end of the file
+        bad_sectors += unused_sectors
+        unused_sectors = 0
+
+        payload = bytes(sector[FD_SECTOR_HEADER.size:FD_SECTOR_HEADER.size+used])
+
+        if synced and not (flags & FD_FLAG_RESUME):
+            stream += payload
+        elif first_rec != FD_NO_RECORD:
+            # lost continuity (logger rebooted, or a sector is missing): resync
+            stream = payload[first_rec:]
+            time_ms = base_time_ms
+            synced = True
+        else:
+            synced = False
+            continue
+
+        while len(stream) >= 4:
+            body_len, dt_ms = struct.unpack_from("<HH", stream)
+            hdr_len = 4
+            if dt_ms == FD_DT_ABSOLUTE:
+                hdr_len = 8
+            if len(stream) < hdr_len + body_len:
+                break
+            if dt_ms == FD_DT_ABSOLUTE:
+                time_ms = struct.unpack_from("<I", stream, 4)[0]
+            else:
+                time_ms += dt_ms
+            body = stream[hdr_len:hdr_len+body_len]
+            stream = stream[hdr_len+body_len:]
+            # records stamped with the GPS-disciplined clock start "@utc,"
+            timestamp = f"{time_ms}"
+            if body.startswith(b"@"):
+                utc, _, body = body[1:].partition(b",")
+                timestamp += "@" + utc.decode("ascii", errors="replace")
+            if body.startswith(b"adc,"):
+                yield from decode_adc_block(timestamp, body[4:])
+            else:
+                yield f"{timestamp},{body.decode('ascii', errors='replace')}\n"
+
+    if bad_sectors:
+        sys.stderr.write(f"WARNING: skipped {bad_sectors} corrupt sectors\n")
+
+def split_timestamp(field):
+    """Splits a line's timestamp field into ms since boot and, for records
+    stamped by the GPS-disciplined clock ("ms@utc"), UTC seconds since the
+    epoch; otherwise the UTC time is None."""
+    ms, _, utc = field.partition("@")
+    return int(ms), (float(utc) if utc else None)
+
 class Log:
     def _log_found(self, metadata):
         i = len(self.index)
@@ -47,7 +161,10 @@ class Log:
         self.index.append(metadata)
 
     def __init__(self, filename):
-        self.lines = open(filename, "r", errors="replace").readlines()
+        if is_binary_log(filename):
+            self.lines = list(decode_binary_log(filename))
+        else:
+            self.lines = open(filename, "r", errors="replace").readlines()
         self.index = []
         last_timestamp = None
         last_start = None
@@ -58,7 +175,7 @@ class Log:
             fields = line.split(",")
             if len(fields) < 2:
                 continue
-            timestamp = int(fields[0])
+            timestamp, _ = split_timestamp(fields[0])
 
             # If we detected a new log just started, add the log we were in the
             # middle of parsing to the list of logs
@@ -123,6 +240,8 @@ class Log:
 
             if channeltype == "in" or channeltype == "u":
                 sys.stdout.write(",".join(fields[4:]))
+            elif channeltype == "adc":
+                sys.stdout.write(",".join(fields[3:]))
             else:
                 sys.stdout.write(f"{fields[0]},{fields[3]}")
 
@@ -190,8 +309,13 @@ class Log:
 
             dataset = datasets[chan]
 
-            # get time in seconds, rounded
-            timestamp = int(int(fields[0]) / 1000)
+            # get time in seconds, rounded. UTC, if the record has it, lines
+            # up with other loggers' data without any correction.
+            time_ms, utc = split_timestamp(fields[0])
+            if utc is not None:
+                timestamp = int(utc)
+            else:
+                timestamp = int(time_ms / 1000)
 
             if fields[1] == "curr":
                 curr = int(fields[3])
@@ -327,6 +451,7 @@ class Log:
 def usage():
     print("usage:")
     print(f"{sys.argv[0]} <filename>")
+    print(f"{sys.argv[0]} <filename> convert")
     print(f"{sys.argv[0]} <filename> extract <lognum> <channeltype> <channelnum>")
     print(f"{sys.argv[0]} <filename> map <lognum>")
     print(f"{sys.argv[0]} <filename> currents <lognum>")
@@ -339,6 +464,12 @@ def main():
     #conf = SONY_UBLOX_CONF
     conf = QUECTEL_CONF
 
+    # binary-to-CSV conversion mode
+    if len(sys.argv) == 3 and sys.argv[2] == "convert":
+        for line in decode_binary_log(sys.argv[1]):
+            sys.stdout.write(line)
+        return
+
     log = Log(sys.argv[1])
 
     # no args but filename, just print summary of trips in log file
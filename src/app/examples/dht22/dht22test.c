@@ -28,17 +28,22 @@
 
 #define DHT22_IO_PIN GPIO_5
 
-static void tick(void *arg) {
-  schedule_us(1000000, tick, NULL);
-  dht22_data_t d;
-  if (dht22_read(DHT22_IO_PIN, &d)) {
-    LOG("Got data: Temp %.1f, humidity %.1f%%", d.temp_c_tenths / 10.0,
-        d.humidity_pct_tenths / 10.0);
+static dht22_t dht;
+
+static void data_received(dht22_data_t *d, void *user_data) {
+  if (d != NULL) {
+    LOG("Got data: Temp %.1f, humidity %.1f%%", d->temp_c_tenths / 10.0,
+        d->humidity_pct_tenths / 10.0);
   } else {
     LOG("Couldn't read from DHT22 :(");
   }
 }
 
+static void tick(void *arg) {
+  schedule_us(2000000, tick, NULL);
+  dht22_start_read(&dht);
+}
+
 int main() {
   UartState_t uart;
   rulos_hal_init();
@@ -47,6 +52,7 @@ int main() {
   LOG("Log output running!");
 
   init_clock(10000, TIMER0);
+  dht22_init(&dht, DHT22_IO_PIN, data_received, NULL);
   schedule_now(tick, NULL);
   scheduler_run();
 }
@@ -22,10 +22,15 @@
 #include "periph/uart/uart.h"
 
 #define JIFFY_CLOCK_US 10000  // 10 ms jiffy clock
-#define REQ_FREQ_SEC   5      // how often to execute an http request
-#define TEST_URL       "https://secure.megabozo.com/scripts/reverse"
+#define REQ_FREQ_SEC   5      // how often to execute http requests
+#define REQS_PER_CYCLE 3      // requests queued each time
 #define TEST_DATA      "ABCDE12345"
 
+// Can be pointed at a plain-http stand-in server, e.g. test-server.py
+#ifndef TEST_URL
+#define TEST_URL "https://secure.megabozo.com/scripts/reverse"
+#endif
+
 const char cert[] =
     "-----BEGIN CERTIFICATE-----\n"
     "MIIFYDCCBEigAwIBAgIQQAF3ITfU6UK47naqPGQKtzANBgkqhkiG9w0BAQsFADA/\n"
@@ -68,13 +73,12 @@ class TestClient : public HttpsHandlerIfc {
  private:
   const static int HTTPS_TIMEOUT_MS = 5000;
   HttpsClient hc;
-  char response_buffer[100];
+  char response_buffers[REQS_PER_CYCLE][100];
+  int num_queued;
+  int num_done;
 
  public:
-  TestClient() : hc(HTTPS_TIMEOUT_MS, cert) {
-    // set aside one byte for NULL -- we'll null terminate data
-    // in-place after we get it
-    hc.set_response_buffer(response_buffer, sizeof(response_buffer) - 1);
+  TestClient() : hc(HTTPS_TIMEOUT_MS, cert), num_queued(0), num_done(0) {
   }
 
   static void execute_trampoline(void *data) {
@@ -82,13 +86,28 @@ class TestClient : public HttpsHandlerIfc {
     tc->execute_request();
   }
 
+  // queue several requests at once; they're sent one after another on the
+  // same connection
   void execute_request() {
     schedule_us(1000000 * REQ_FREQ_SEC, execute_trampoline, this);
-    LOG("executing http request to: " TEST_URL);
-    hc.post(TEST_URL, TEST_DATA, strlen(TEST_DATA), this);
+    LOG("executing %d http requests to: " TEST_URL, REQS_PER_CYCLE);
+    for (int i = 0; i < REQS_PER_CYCLE; i++) {
+      if (hc.is_in_use()) {
+        LOG("request queue full");
+        return;
+      }
+
+      // set aside one byte for NULL -- we'll null terminate data
+      // in-place after we get it
+      char *response_buffer = response_buffers[num_queued++ % REQS_PER_CYCLE];
+      hc.set_response_buffer(response_buffer, sizeof(response_buffers[0]) - 1);
+      hc.post(TEST_URL, TEST_DATA, strlen(TEST_DATA), this);
+    }
   }
 
+  // requests complete in the order they were queued
   void on_done(HttpsClient *hc, int response_code, size_t response_len) {
+    char *response_buffer = response_buffers[num_done++ % REQS_PER_CYCLE];
     response_buffer[response_len] = '\0';
     LOG("http done with code %d; got %d bytes of data: %s", response_code,
         response_len, response_buffer);
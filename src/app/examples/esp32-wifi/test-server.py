@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+
+# A plain-http stand-in for the https test server, for testing HttpsClient on
+# a local network. POSTs to /scripts/reverse are answered with the body
+# reversed. Connections are kept alive, and each request is logged with the
+# number of requests seen so far on its connection, so it's easy to see
+# whether the client is reusing connections.
+#
+# Build the example pointing at it with:
+#   TEST_URL=http://<this host>:8080/scripts/reverse scons
+
+import argparse
+import http.server
+import socketserver
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        super().setup()
+        self.requests_on_conn = 0
+
+    def log_request(self, code='-', size='-'):
+        self.requests_on_conn += 1
+        self.log_message('"%s" %s: request %d on this connection',
+                         self.requestline, str(code), self.requests_on_conn)
+
+    def reply(self, code, body):
+        self.send_response(code)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        if self.server.close_after and \
+           self.requests_on_conn >= self.server.close_after:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        self.reply(200, b"test-sensor")
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        self.reply(200, body[::-1])
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--timeout", type=float, default=30,
+                        help="seconds an idle connection is kept open")
+    parser.add_argument("--close-after", type=int, default=0,
+                        help="close each connection after this many requests")
+    args = parser.parse_args()
+
+    Handler.timeout = args.timeout
+    server = Server(("", args.port), Handler)
+    server.close_after = args.close_after
+    print(f"listening on port {args.port}")
+    server.serve_forever()
+
+if __name__ == "__main__":
+    main()
@@ -55,6 +55,20 @@ done:
   net_free_received_message_buffer(msg);
 }
 
+static void r6l_bbuf_paint(uint8_t index, SSBitmap *bm, uint8_t mask) {
+  if (index < FIRST_LINE_IDX ||
+      index >= FIRST_LINE_IDX + ROCKET6LINE_NUM_ROWS) {
+    LOG("got unexpected row index %d", index);
+    return;
+  }
+
+  for (int di = 0; di < NUM_DIGITS; di++, mask <<= 1) {
+    if (mask & 0x80) {
+      rocket6line_write_digit(index - FIRST_LINE_IDX, di, bm[di]);
+    }
+  }
+}
+
 static void init_r6l_bbuf_recv(RemoteBBufRecv *rbr, Network *network) {
   rbr->app_receiver.recv_complete_func = r6l_bbuf_recv,
   rbr->app_receiver.port = REMOTE_BBUF_PORT;
@@ -63,6 +77,8 @@ static void init_r6l_bbuf_recv(RemoteBBufRecv *rbr, Network *network) {
   rbr->app_receiver.message_recv_buffers = rbr->recv_ring_alloc;
 
   net_bind_receiver(network, &rbr->app_receiver);
+
+  init_remote_bbuf_delta_recv(rbr, network, r6l_bbuf_paint);
 }
 
 int main() {
@@ -69,6 +69,62 @@
 #define USE_JOYSTICK_USB 1
 #endif
 
+// If the max3421e's INT pin is wired to a pin of port A, the board defines
+// MAX3421E_INT_LINE as that pin's number and the driver runs from its
+// interrupts; otherwise it polls the max3421e for them.
+#if USE_JOYSTICK_USB && defined(MAX3421E_INT_LINE)
+
+#include "stm32f3xx_ll_bus.h"
+#include "stm32f3xx_ll_exti.h"
+#include "stm32f3xx_ll_system.h"
+
+#define MAX3421E_INT_EXTI     (1UL << MAX3421E_INT_LINE)
+#define SYSCFG_EXTI_LINE_(n)  LL_SYSCFG_EXTI_LINE##n
+#define SYSCFG_EXTI_LINE(n)   SYSCFG_EXTI_LINE_(n)
+
+static max3421e_t *int_max;
+
+static void max3421e_int_irq(void) {
+  if (LL_EXTI_IsActiveFlag_0_31(MAX3421E_INT_EXTI)) {
+    LL_EXTI_ClearFlag_0_31(MAX3421E_INT_EXTI);
+    max3421e_interrupt(int_max);
+  }
+}
+
+// The rest of port A is taken: 0-3 by the quadknobs, 4-7 by the SPI bus,
+// 9-10 by the uart, 11-12 by USB and 13-14 by the debugger.
+#if MAX3421E_INT_LINE == 8
+#define MAX3421E_INT_IRQn EXTI9_5_IRQn
+void EXTI9_5_IRQHandler() {
+  max3421e_int_irq();
+}
+#elif MAX3421E_INT_LINE == 15
+#define MAX3421E_INT_IRQn EXTI15_10_IRQn
+void EXTI15_10_IRQHandler() {
+  max3421e_int_irq();
+}
+#else
+#error "the max3421e's INT must be on PA8 or PA15"
+#include <stophere>
+#endif
+
+static void max3421e_int_init(max3421e_t *max) {
+  int_max = max;
+
+  // INT is open-drain, driven low while the max3421e has an interrupt pending
+  const gpio_pin_t int_pin = {GPIOA, 1UL << MAX3421E_INT_LINE};
+  gpio_make_input_enable_pullup(int_pin);
+  LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_SYSCFG);
+  LL_SYSCFG_SetEXTISource(LL_SYSCFG_EXTI_PORTA,
+                          SYSCFG_EXTI_LINE(MAX3421E_INT_LINE));
+  LL_EXTI_EnableFallingTrig_0_31(MAX3421E_INT_EXTI);
+  LL_EXTI_EnableIT_0_31(MAX3421E_INT_EXTI);
+  HAL_NVIC_SetPriority(MAX3421E_INT_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(MAX3421E_INT_IRQn);
+}
+
+#endif
+
 typedef struct {
   DRTCAct dr;
   Network network;
@@ -133,7 +189,7 @@ gpio_pin_t pin_npong_q1 = GPIO_A3;
 
 void init_rocket0(Rocket0 *r0) {
   init_twi_network(&r0->network, 200, ROCKET_ADDR);
-  init_remote_bbuf_send(&r0->rbs, &r0->network);
+  init_remote_bbuf_send_delta(&r0->rbs, &r0->network, ROCKET_ADDR);
   install_remote_bbuf_send(&r0->rbs);
   drtc_init(&r0->dr, 0, clock_time_us() + time_sec(30));
   lunar_distance_init(&r0->ld, 1, 2 /*, SPEED_POT_CHANNEL*/);
@@ -146,6 +202,9 @@ void init_rocket0(Rocket0 *r0) {
 #if USE_JOYSTICK_ADC
   init_joystick_adc(&r0->joystick, JOYSTICK_X_CHAN, JOYSTICK_Y_CHAN);
 #else
+#ifdef MAX3421E_INT_LINE
+  max3421e_int_init(&r0->max);
+#endif
   max3421e_init(&r0->max);
   init_joystick_usb(&r0->joystick, &r0->max);
 #endif
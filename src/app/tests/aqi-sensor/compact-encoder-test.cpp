@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host test of CompactEncoder: batches of data, including edge cases, are
+// encoded a piece at a time and decoded again, the way decode-compact.py
+// does, and must come back unchanged.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "compact-encoder.h"
+#include "sensor-data-cache.h"
+
+// A cache that just holds the columns it's given.
+class FakeCache : public SensorDataCacheIfc {
+ public:
+  std::vector<std::string> names;
+  std::vector<uint32_t> scales;
+  std::vector<uint64_t> times;
+  std::vector<std::vector<int32_t> > columns;
+
+  size_t len() {
+    return times.size();
+  }
+  void pop_n(size_t n) {
+    assert(false);
+  }
+  size_t serialize(size_t index, char *dest, size_t max_len) {
+    assert(false);
+    return 0;
+  }
+  void set_pinned(size_t n) {
+  }
+  size_t num_fields() {
+    return names.size();
+  }
+  const char *field_name(size_t field) {
+    return names[field].c_str();
+  }
+  uint32_t field_scale(size_t field) {
+    return scales[field];
+  }
+  uint64_t get_time_usec(size_t index) {
+    assert(index < times.size());
+    return times[index];
+  }
+  int32_t get_field(size_t index, size_t field) {
+    assert(index < columns[field].size());
+    return columns[field][index];
+  }
+
+  void add_field(const std::string &name, uint32_t scale) {
+    names.push_back(name);
+    scales.push_back(scale);
+    columns.push_back(std::vector<int32_t>());
+  }
+};
+
+//// decoder, after decode-compact.py
+
+class Reader {
+ private:
+  const std::vector<uint8_t> &_buf;
+  size_t _pos;
+
+ public:
+  Reader(const std::vector<uint8_t> &buf) : _buf(buf), _pos(0) {
+  }
+
+  bool done() {
+    return _pos == _buf.size();
+  }
+
+  uint8_t byte() {
+    assert(_pos < _buf.size());
+    return _buf[_pos++];
+  }
+
+  uint64_t varint() {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+      assert(shift < 64);
+      uint8_t b = byte();
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return v;
+      }
+    }
+  }
+
+  int64_t zigzag() {
+    uint64_t v = varint();
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  }
+
+  std::string string() {
+    size_t n = varint();
+    std::string s;
+    for (size_t i = 0; i < n; i++) {
+      s += (char)byte();
+    }
+    return s;
+  }
+};
+
+// Encodes the cache's data in pieces of at most 'piece_len' bytes, checks it
+// decodes to the same thing, and returns the length of the encoding.
+static size_t round_trip(FakeCache *cache, const char *password,
+                         const char *sensor_name, size_t piece_len) {
+  CompactEncoder encoder;
+  encoder.init(cache, cache->len(), password, sensor_name);
+
+  std::vector<uint8_t> buf;
+  uint8_t *piece = new uint8_t[piece_len];
+  size_t len;
+  while ((len = encoder.render_next(piece, piece_len)) > 0) {
+    assert(len <= piece_len);
+    buf.insert(buf.end(), piece, piece + len);
+  }
+  delete[] piece;
+
+  Reader r(buf);
+  assert(r.byte() == 'A' && r.byte() == 'Q' && r.byte() == 'C' &&
+         r.byte() == '1');
+
+  // strings too long for the header are truncated, not dropped
+  std::string p = r.string();
+  assert(p.size() > 0 || strlen(password) == 0);
+  assert(strncmp(p.c_str(), password, p.size()) == 0);
+  std::string s = r.string();
+  assert(s.size() > 0 || strlen(sensor_name) == 0);
+  assert(strncmp(s.c_str(), sensor_name, s.size()) == 0);
+
+  size_t npoints = r.varint();
+  assert(npoints == cache->len());
+  size_t nfields = r.varint();
+  assert(nfields == cache->num_fields());
+  for (size_t f = 0; f < nfields; f++) {
+    std::string name = r.string();
+    assert(name.size() > 0);
+    assert(strncmp(name.c_str(), cache->field_name(f), name.size()) == 0);
+    assert(r.varint() == cache->field_scale(f));
+  }
+
+  uint64_t t = 0;
+  for (size_t i = 0; i < npoints; i++) {
+    t = i == 0 ? r.varint() : t + r.zigzag();
+    assert(t == cache->get_time_usec(i));
+  }
+  for (size_t f = 0; f < nfields; f++) {
+    int64_t v = 0;
+    for (size_t i = 0; i < npoints; i++) {
+      v = i == 0 ? r.zigzag() : v + r.zigzag();
+      assert(v == cache->get_field(i, f));
+    }
+  }
+  assert(r.done());
+  return buf.size();
+}
+
+// round trips with a range of piece sizes, down to the smallest the header
+// fits in
+static void round_trips(FakeCache *cache, const char *password,
+                        const char *sensor_name) {
+  const size_t piece_lens[] = {200, 201, 256, 1000, 1436};
+  for (size_t i = 0; i < sizeof(piece_lens) / sizeof(piece_lens[0]); i++) {
+    round_trip(cache, password, sensor_name, piece_lens[i]);
+  }
+}
+
+static void add_point(FakeCache *cache, uint64_t time, int32_t v0, int32_t v1) {
+  cache->times.push_back(time);
+  cache->columns[0].push_back(v0);
+  cache->columns[1].push_back(v1);
+}
+
+static void make_fields(FakeCache *cache) {
+  cache->add_field("temperature", 10);
+  cache->add_field("humidity", 1);
+}
+
+void test_empty() {
+  printf("empty test\n");
+  FakeCache cache;
+  round_trips(&cache, "", "");
+
+  make_fields(&cache);
+  round_trips(&cache, "pw", "sensor");
+}
+
+void test_one_point() {
+  printf("one point test\n");
+  FakeCache cache;
+  make_fields(&cache);
+  add_point(&cache, 1600000000000000ull, -40, 100);
+  round_trips(&cache, "pw", "sensor");
+}
+
+// extreme values, and deltas between them as large as they get
+void test_boundary_values() {
+  printf("boundary value test\n");
+  FakeCache cache;
+  make_fields(&cache);
+  const int32_t values[] = {0,       -1,     1,      63,        64,
+                            -64,     -65,    8191,   8192,      -8192,
+                            -8193,   INT32_MAX, INT32_MIN, INT32_MAX, 0,
+                            INT32_MIN};
+  const size_t n = sizeof(values) / sizeof(values[0]);
+  const uint64_t times[] = {0, 127, 128, 16383, 16384, 0, UINT32_MAX,
+                            (uint64_t)INT64_MAX};
+  for (size_t i = 0; i < n; i++) {
+    add_point(&cache, times[i % (sizeof(times) / sizeof(times[0]))],
+              values[i], values[n - 1 - i]);
+  }
+  round_trips(&cache, "pw", "sensor");
+}
+
+// strings as long as the header allows, and longer
+void test_long_strings() {
+  printf("long string test\n");
+  std::string long_name(500, 'n');
+  std::string long_pw(500, 'p');
+
+  FakeCache cache;
+  cache.add_field(std::string(100, 'f'), UINT32_MAX);
+  cache.add_field("x", 0);
+  cache.times.push_back(1);
+  cache.columns[0].push_back(1);
+  cache.columns[1].push_back(2);
+  round_trips(&cache, long_pw.c_str(), long_name.c_str());
+  round_trips(&cache, long_pw.substr(0, 40).c_str(),
+              long_name.substr(0, 40).c_str());
+}
+
+// a batch as big as the uploader sends, with realistic data
+void test_large_batch() {
+  printf("large batch test\n");
+  FakeCache cache;
+  make_fields(&cache);
+  uint64_t t = 1600000000000000ull;
+  int32_t temp = 200, hum = 50;
+  for (int i = 0; i < 5000; i++) {
+    t += 2000000 + random() % 1000;
+    temp += random() % 5 - 2;
+    hum += random() % 3 - 1;
+    add_point(&cache, t, temp, hum);
+  }
+  round_trips(&cache, "pw", "sensor");
+
+  // small deltas: well under the 16 bytes per point of the raw data
+  size_t len = round_trip(&cache, "pw", "sensor", 1000);
+  assert(len < cache.len() * 8);
+}
+
+int main(int argc, char *argv[]) {
+  srandom(1);
+  test_empty();
+  test_one_point();
+  test_boundary_values();
+  test_long_strings();
+  test_large_batch();
+  printf("all tests passed\n");
+}
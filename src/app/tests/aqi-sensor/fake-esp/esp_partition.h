@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Just enough of the ESP-IDF partition API to run FlashRecordStore on a host.
+// The partition is kept in RAM and behaves like NOR flash: erasing sets whole
+// sectors to 0xff, and writing can only clear bits.
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_spi_flash.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERROR_CHECK(x) assert((x) == ESP_OK)
+
+typedef enum {
+  ESP_PARTITION_TYPE_DATA = 1,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+  const char *label;
+  uint32_t size;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset,
+                             void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset,
+                              const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *part,
+                                    size_t offset, size_t size);
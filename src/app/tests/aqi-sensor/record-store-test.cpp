@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host tests of the aqi-sensor record stores: the RAM ring, and the flash
+// ring run against an emulated NOR flash partition.
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_partition.h"
+#include "flash-record-store.h"
+#include "record-store.h"
+
+//// emulated flash partition
+
+static const size_t PART_SIZE = 16 * SPI_FLASH_SEC_SIZE;
+static uint8_t flash[PART_SIZE];
+static const esp_partition_t part = {"spiffs", PART_SIZE};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+  return strcmp(label, part.label) == 0 ? &part : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t src_offset,
+                             void *dst, size_t size) {
+  assert(src_offset + size <= p->size);
+  memcpy(dst, &flash[src_offset], size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t dst_offset,
+                              const void *src, size_t size) {
+  assert(dst_offset + size <= p->size);
+  const uint8_t *s = static_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < size; i++) {
+    flash[dst_offset + i] &= s[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset,
+                                    size_t size) {
+  assert(offset % SPI_FLASH_SEC_SIZE == 0 && size % SPI_FLASH_SEC_SIZE == 0);
+  assert(offset + size <= p->size);
+  memset(&flash[offset], 0xff, size);
+  return ESP_OK;
+}
+
+//// tests
+
+typedef struct {
+  uint32_t n;
+  uint32_t check;
+  uint8_t pad[16];
+} record_t;
+
+static record_t make_record(uint32_t n) {
+  record_t r;
+  memset(&r, 0, sizeof(r));
+  r.n = n;
+  r.check = n * 2654435761u;
+  memset(r.pad, n & 0xff, sizeof(r.pad));
+  return r;
+}
+
+// checks that the store holds exactly the records numbered [first, last)
+static void check_contents(RecordStoreIfc *store, uint32_t first,
+                           uint32_t last) {
+  assert(store->len() == last - first);
+  for (size_t i = 0; i < store->len(); i++) {
+    record_t r;
+    store->get(i, &r);
+    record_t expected = make_record(first + i);
+    assert(memcmp(&r, &expected, sizeof(r)) == 0);
+  }
+}
+
+// Pushes and pops through the ring several times over, so every slot is
+// reused, checking the contents after each step.
+static void exercise_ring(RecordStoreIfc *store) {
+  uint32_t first = 0, last = 0;
+  check_contents(store, first, last);
+
+  for (int round = 0; round < 200; round++) {
+    size_t room = store->capacity() - store->len();
+    size_t num_push = random() % (room + 1);
+    for (size_t i = 0; i < num_push; i++) {
+      record_t r = make_record(last++);
+      store->push(&r);
+    }
+    check_contents(store, first, last);
+
+    size_t num_pop = random() % (store->len() + 1);
+    store->pop_n(num_pop);
+    first += num_pop;
+    check_contents(store, first, last);
+  }
+}
+
+void test_ram_store() {
+  printf("ram store test\n");
+  RamRecordStore store(sizeof(record_t), 37);
+  assert(store.capacity() == 37);
+  exercise_ring(&store);
+}
+
+void test_flash_store() {
+  printf("flash store test\n");
+  memset(flash, 0xff, sizeof(flash));
+  FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+  store.init();
+  assert(store.len() == 0);
+  exercise_ring(&store);
+}
+
+// A record rewritten into a sector that was erased must read back as the new
+// record, not as what the sector held before.
+void test_flash_reuse() {
+  printf("flash reuse test\n");
+  memset(flash, 0xff, sizeof(flash));
+  FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+  store.init();
+
+  uint32_t first = 0, last = 0;
+  for (int lap = 0; lap < 3; lap++) {
+    while (store.len() < store.capacity()) {
+      record_t r = make_record(last++);
+      store.push(&r);
+    }
+    check_contents(&store, first, last);
+    size_t n = store.len() - 1;
+    store.pop_n(n);
+    first += n;
+  }
+  check_contents(&store, first, last);
+}
+
+// Records, and pops, survive a reboot; a torn write of the newest record is
+// dropped.
+void test_flash_recovery() {
+  printf("flash recovery test\n");
+  memset(flash, 0xff, sizeof(flash));
+  uint32_t first = 0, last = 0;
+  {
+    FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+    store.init();
+    for (size_t i = 0; i < store.capacity() + store.capacity() / 2; i++) {
+      if (store.len() == store.capacity()) {
+        store.pop_n(store.capacity() / 4);
+        first += store.capacity() / 4;
+      }
+      record_t r = make_record(last++);
+      store.push(&r);
+    }
+    store.pop_n(10);
+    first += 10;
+    check_contents(&store, first, last);
+  }
+
+  {
+    FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+    store.init();
+    check_contents(&store, first, last);
+
+    // tear the write of one more record: clear one of the bits it set
+    record_t r = make_record(last);
+    store.push(&r);
+    assert(store.len() == last + 1 - first);
+    uint8_t *slot = static_cast<uint8_t *>(memmem(flash, sizeof(flash), &r,
+                                                  sizeof(r)));
+    assert(slot != NULL);
+    uint8_t *check = slot + offsetof(record_t, check);
+    assert(*check != 0);
+    *check &= *check - 1;
+  }
+
+  {
+    FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+    store.init();
+    check_contents(&store, first, last);
+  }
+
+  // everything popped: nothing is recovered
+  {
+    FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+    store.init();
+    store.pop_n(store.len());
+  }
+  {
+    FlashRecordStore store("spiffs", PART_SIZE, sizeof(record_t));
+    store.init();
+    assert(store.len() == 0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  srandom(1);
+  test_ram_store();
+  test_flash_store();
+  test_flash_reuse();
+  test_flash_recovery();
+  printf("all tests passed\n");
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host test of the DHT22 driver's non-blocking decoder: synthetic edge trains
+// are fed to dht22_edge() as the chip support would, and the frame decoded
+// back from the last edge is checked.
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core/rulos.h"
+#include "periph/dht22/dht22.h"
+
+//// the parts of RULOS the driver uses
+
+static ActivationFuncPtr scheduled_func;
+static void *scheduled_data;
+
+void schedule_us(Time offset_us, ActivationFuncPtr func, void *data) {
+  scheduled_func = func;
+  scheduled_data = data;
+}
+
+void hal_delay_ms(uint16_t ms) {}
+
+rulos_irq_state_t hal_start_atomic() {
+  return 0;
+}
+
+void hal_end_atomic(rulos_irq_state_t old_interrupts) {}
+
+//// fake chip support: plays back an edge train when the read starts
+
+// what the sensor sends, and how its response is seen
+typedef struct {
+  uint8_t frame[5];
+  bool see_release;   // the rising edge of our own release of the line
+  bool see_response;  // the falling edge that starts the sensor's response
+  bool slow_bits;     // longer low pulses, and highs near the threshold
+  int drop_edges;     // edges missing from the end
+} train_t;
+
+static const train_t *curr_train;
+static int num_hal_stops;
+
+void dht22_hal_start(dht22_t *dht) {
+  const train_t *tr = curr_train;
+  uint32_t edges[DHT22_MAX_EDGES];
+  int n = 0;
+  uint32_t t = 1000;
+
+  if (tr->see_release) {
+    edges[n++] = t;
+  }
+  t += 30;
+  if (tr->see_response) {
+    edges[n++] = t;
+  }
+
+  // the sensor's acknowledgement: 80 usec low, 80 usec high
+  t += 80;
+  edges[n++] = t;
+  t += 80;
+  edges[n++] = t;
+
+  // each bit: a low pulse, then a high pulse that's short for 0, long for 1
+  for (int i = 0; i < 40; i++) {
+    const bool one = (tr->frame[i / 8] >> (7 - i % 8)) & 1;
+    t += tr->slow_bits ? 60 + i % 5 : 50 + i % 3;
+    edges[n++] = t;
+    if (tr->slow_bits) {
+      t += one ? 66 : 35;
+    } else {
+      t += one ? 70 : 27;
+    }
+    edges[n++] = t;
+  }
+
+  // the sensor lets go of the line
+  t += 50;
+  edges[n++] = t;
+
+  for (int i = 0; i < n - tr->drop_edges; i++) {
+    dht22_edge(dht, edges[i]);
+  }
+}
+
+void dht22_hal_stop(dht22_t *dht) {
+  num_hal_stops++;
+}
+
+//// tests
+
+static bool got_result;
+static bool got_data;
+static dht22_data_t last_data;
+
+static void data_received(dht22_data_t *data, void *user_data) {
+  got_result = true;
+  got_data = data != NULL;
+  if (data != NULL) {
+    last_data = *data;
+  }
+}
+
+static void set_checksum(train_t *tr) {
+  tr->frame[4] = tr->frame[0] + tr->frame[1] + tr->frame[2] + tr->frame[3];
+}
+
+// Run one reading of 'tr', and return whether it decoded.
+static bool read_train(dht22_t *dht, const train_t *tr) {
+  curr_train = tr;
+  got_result = false;
+  scheduled_func = NULL;
+  const int stops = num_hal_stops;
+
+  assert(dht22_start_read(dht));
+
+  // only one reading at a time
+  assert(!dht22_start_read(dht));
+
+  assert(scheduled_func != NULL);
+  scheduled_func(scheduled_data);
+  assert(got_result);
+  assert(num_hal_stops == stops + 1);
+  return got_data;
+}
+
+static void test_edge_variants(dht22_t *dht) {
+  // 65.2%, -10.1C
+  train_t tr = {{0x02, 0x8c, 0x80, 0x65}};
+  set_checksum(&tr);
+
+  for (int release = 0; release < 2; release++) {
+    for (int response = 0; response < 2; response++) {
+      for (int slow = 0; slow < 2; slow++) {
+        tr.see_release = release;
+        tr.see_response = response;
+        tr.slow_bits = slow;
+        assert(read_train(dht, &tr));
+        assert(last_data.humidity_pct_tenths == 652);
+        assert(last_data.temp_c_tenths == -101);
+      }
+    }
+  }
+}
+
+static void test_values(dht22_t *dht) {
+  static const struct {
+    uint8_t frame[4];
+    uint16_t humidity_pct_tenths;
+    int16_t temp_c_tenths;
+  } cases[] = {
+      {{0x00, 0x00, 0x00, 0x00}, 0, 0},
+      {{0x03, 0xe8, 0x01, 0x5f}, 1000, 351},
+      {{0x01, 0x90, 0x80, 0x01}, 400, -1},
+      {{0x00, 0xff, 0x7f, 0xff}, 255, 32767},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    train_t tr = {};
+    memcpy(tr.frame, cases[i].frame, 4);
+    set_checksum(&tr);
+    tr.see_response = true;
+    assert(read_train(dht, &tr));
+    assert(last_data.humidity_pct_tenths == cases[i].humidity_pct_tenths);
+    assert(last_data.temp_c_tenths == cases[i].temp_c_tenths);
+  }
+}
+
+static void test_failures(dht22_t *dht) {
+  train_t tr = {{0x02, 0x8c, 0x00, 0xfa}};
+  set_checksum(&tr);
+  tr.see_response = true;
+  assert(read_train(dht, &tr));
+
+  // a corrupted bit is caught by the checksum
+  train_t bad = tr;
+  bad.frame[1] ^= 0x10;
+  assert(!read_train(dht, &bad));
+
+  // Missing the sensor's release of the line shifts every bit by one edge,
+  // which also fails the checksum. Missing more than that leaves too few
+  // edges to decode.
+  train_t short_train = tr;
+  short_train.see_response = false;
+  short_train.drop_edges = 1;
+  assert(!read_train(dht, &short_train));
+  short_train.drop_edges = 4;
+  assert(!read_train(dht, &short_train));
+
+  // and the driver recovers for the next reading
+  assert(read_train(dht, &tr));
+  assert(last_data.temp_c_tenths == 250);
+}
+
+int main() {
+  dht22_t dht;
+  dht22_init(&dht, 5, data_received, NULL);
+
+  test_edge_variants(&dht);
+  test_values(&dht);
+  test_failures(&dht);
+
+  printf("dht22 tests passed\n");
+  return 0;
+}
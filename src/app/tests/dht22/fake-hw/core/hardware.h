@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Just enough of a chip's GPIO API to build the DHT22 driver on a host. The
+// test feeds the driver edges directly, so the pin itself does nothing.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t gpio_pin_t;
+
+static inline void gpio_make_input_enable_pullup(gpio_pin_t pin) {}
+static inline void gpio_make_output(gpio_pin_t pin) {}
+static inline void gpio_clr(gpio_pin_t pin) {}
+static inline bool gpio_is_set(gpio_pin_t pin) { return true; }
+static inline bool gpio_is_clr(gpio_pin_t pin) { return false; }
@@ -25,6 +25,76 @@
 max3421e_t max;
 JoystickState_t joystate;
 
+// If the max3421e's INT pin is wired to a pin of port A, define
+// MAX3421E_INT_LINE as that pin's number and the driver runs from its
+// interrupts; otherwise it polls the max3421e for them.
+#ifdef MAX3421E_INT_LINE
+
+#include "stm32f3xx_ll_bus.h"
+#include "stm32f3xx_ll_exti.h"
+#include "stm32f3xx_ll_system.h"
+
+#define MAX3421E_INT_EXTI     (1UL << MAX3421E_INT_LINE)
+#define SYSCFG_EXTI_LINE_(n)  LL_SYSCFG_EXTI_LINE##n
+#define SYSCFG_EXTI_LINE(n)   SYSCFG_EXTI_LINE_(n)
+
+static void max3421e_int_irq(void) {
+  if (LL_EXTI_IsActiveFlag_0_31(MAX3421E_INT_EXTI)) {
+    LL_EXTI_ClearFlag_0_31(MAX3421E_INT_EXTI);
+    max3421e_interrupt(&max);
+  }
+}
+
+#if MAX3421E_INT_LINE == 0
+#define MAX3421E_INT_IRQn EXTI0_IRQn
+void EXTI0_IRQHandler() {
+  max3421e_int_irq();
+}
+#elif MAX3421E_INT_LINE == 1
+#define MAX3421E_INT_IRQn EXTI1_IRQn
+void EXTI1_IRQHandler() {
+  max3421e_int_irq();
+}
+#elif MAX3421E_INT_LINE == 2
+#define MAX3421E_INT_IRQn EXTI2_TSC_IRQn
+void EXTI2_TSC_IRQHandler() {
+  max3421e_int_irq();
+}
+#elif MAX3421E_INT_LINE == 3
+#define MAX3421E_INT_IRQn EXTI3_IRQn
+void EXTI3_IRQHandler() {
+  max3421e_int_irq();
+}
+#elif MAX3421E_INT_LINE < 8
+#error "pins 4-7 of port A are the SPI bus"
+#include <stophere>
+#elif MAX3421E_INT_LINE < 10
+#define MAX3421E_INT_IRQn EXTI9_5_IRQn
+void EXTI9_5_IRQHandler() {
+  max3421e_int_irq();
+}
+#else
+#define MAX3421E_INT_IRQn EXTI15_10_IRQn
+void EXTI15_10_IRQHandler() {
+  max3421e_int_irq();
+}
+#endif
+
+static void max3421e_int_init(void) {
+  // INT is open-drain, driven low while the max3421e has an interrupt pending
+  const gpio_pin_t int_pin = {GPIOA, 1UL << MAX3421E_INT_LINE};
+  gpio_make_input_enable_pullup(int_pin);
+  LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_SYSCFG);
+  LL_SYSCFG_SetEXTISource(LL_SYSCFG_EXTI_PORTA,
+                          SYSCFG_EXTI_LINE(MAX3421E_INT_LINE));
+  LL_EXTI_EnableFallingTrig_0_31(MAX3421E_INT_EXTI);
+  LL_EXTI_EnableIT_0_31(MAX3421E_INT_EXTI);
+  HAL_NVIC_SetPriority(MAX3421E_INT_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(MAX3421E_INT_IRQn);
+}
+
+#endif
+
 void poll_joystick(void *data) {
   schedule_us(100000, poll_joystick, NULL);
 
@@ -47,6 +117,9 @@ int main() {
 
   init_clock(10000, TIMER1);
 
+#ifdef MAX3421E_INT_LINE
+  max3421e_int_init();
+#endif
   max3421e_init(&max);
   schedule_us(1, poll_joystick, NULL);
 
@@ -1,10 +1,15 @@
 #include "periph/ntp/regression.h"
 
+#include "periph/ntp/epoch-clock.h"
+
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
+#include <algorithm>
+
 int rand_range(int minval, int maxval) {
   int range = maxval - minval + 1;
   return (random() % range) + minval;
@@ -178,6 +183,209 @@ void test_with_observation_error() {
   printf("PASS\n");
 }
 
+// Reference fit for test_incremental: the same quartile filter and
+// least-squares fit, done from scratch in long double, centered on the means.
+bool reference_estimate(const time_observation_t *obs, uint64_t *offset_usec,
+                        int64_t *freq_ppb) {
+  uint32_t rtts[MAX_OBSERVATIONS];
+  int num_obs = 0;
+  for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+    if (obs[i].local_time_usec != 0) {
+      rtts[num_obs++] = obs[i].rtt_usec;
+    }
+  }
+  if (num_obs < MIN_OBSERVATIONS) {
+    return false;
+  }
+  std::sort(rtts, rtts + num_obs);
+  uint32_t rtt_limit = rtts[num_obs * 3 / 4 - 1];
+
+  long double mean_x = 0, mean_y = 0;
+  int n = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    long double sxx = 0, sxy = 0;
+    for (int i = 0; i < MAX_OBSERVATIONS; i++) {
+      if (obs[i].local_time_usec == 0 || obs[i].rtt_usec > rtt_limit) {
+        continue;
+      }
+      long double x = obs[i].local_time_usec;
+      long double y = (int64_t)(obs[i].epoch_time_usec - obs[i].local_time_usec);
+      if (pass == 0) {
+        mean_x += x;
+        mean_y += y;
+        n++;
+      } else {
+        sxx += (x - mean_x) * (x - mean_x);
+        sxy += (x - mean_x) * (y - mean_y);
+      }
+    }
+    if (pass == 0) {
+      mean_x /= n;
+      mean_y /= n;
+    } else {
+      long double slope = sxy / sxx;
+      *freq_ppb = llroundl(-slope * 1e9);
+      *offset_usec = llroundl(mean_y - slope * mean_x);
+    }
+  }
+  return true;
+}
+
+void test_incremental() {
+  printf("incremental estimator test\n");
+  // Feed a long stream of noisy observations, with occasional slow
+  // responses, to an EpochEstimator one at a time, and compare it against a
+  // from-scratch fit of the same window after every observation.
+
+  uint64_t start_local = 3000000;
+  uint64_t start_epoch = 1643967455123456;
+  int32_t freq_error_ppm = rand_range(-500, 500);
+  printf("picked error of %d ppm\n", freq_error_ppm);
+
+  EpochEstimator est;
+  time_observation_t window[MAX_OBSERVATIONS] = {};
+  for (int i = 0; i < 2000; i++) {
+    time_observation_t o;
+    // period changes partway through, as when the client gets synced
+    uint64_t local = start_local + (i < 100 ? i * 4e6 : 400e6 + i * 60e6);
+    o.local_time_usec = local;
+    o.rtt_usec = rand_range(0, 9) == 0 ? rand_range(50000, 200000)
+                                       : rand_range(3000, 6000);
+    o.epoch_time_usec = start_epoch + (local - start_local) +
+                        (int64_t)(local - start_local) * freq_error_ppm / 1000000 +
+                        rand_range(-(int)o.rtt_usec / 2, o.rtt_usec / 2);
+    est.add(&o);
+    window[i % MAX_OBSERVATIONS] = o;
+
+    uint64_t offset_usec, ref_offset_usec;
+    int64_t freq_ppb, ref_freq_ppb;
+    bool ok = est.estimate(&offset_usec, &freq_ppb);
+    bool ref_ok = reference_estimate(window, &ref_offset_usec, &ref_freq_ppb);
+    assert(ok == ref_ok);
+    if (!ok) {
+      continue;
+    }
+
+    // Compare the two fits at the latest observation. The frequencies are
+    // rounded to whole ppb, so they can differ by one, which moves the
+    // estimate by a usec for every 1000 sec of uptime.
+    int64_t err = local_to_epoch(local, offset_usec, freq_ppb) -
+                  local_to_epoch(local, ref_offset_usec, ref_freq_ppb);
+    int64_t max_err = 2 + local / 1000000000;
+    if (llabs(freq_ppb - ref_freq_ppb) > 1 || llabs(err) > max_err) {
+      printf("obs %d: freq=%ld ref_freq=%ld offset=%lu ref_offset=%lu\n", i,
+             freq_ppb, ref_freq_ppb, offset_usec, ref_offset_usec);
+    }
+    assert(llabs(freq_ppb - ref_freq_ppb) <= 1);
+    assert(llabs(err) <= max_err);
+  }
+  printf("PASS\n");
+}
+
+void test_outliers() {
+  printf("outlier test\n");
+  // Bogus replies, hours or ages off but with short RTTs so the filter keeps
+  // them, must be left out of the fit rather than wrecking it, whether they
+  // come first or in the middle of the stream.
+
+  const uint64_t start_local = 2000000;
+  const uint64_t start_epoch = 1643967455123456;
+  const int32_t freq_error_ppm = 40;
+  const int64_t bogus_offsets[] = {
+      (int64_t)5 * 3600 * 1000000,
+      -(int64_t)5 * 3600 * 1000000,
+      (int64_t)1 << 62,
+  };
+
+  for (int first = 0; first < 2; first++) {
+    for (size_t b = 0; b < sizeof(bogus_offsets) / sizeof(bogus_offsets[0]);
+         b++) {
+      EpochEstimator est;
+      for (int i = 0; i < 300; i++) {
+        time_observation_t o;
+        uint64_t local = start_local + i * 15000000ULL;
+        o.local_time_usec = local;
+        o.rtt_usec = rand_range(3000, 6000);
+        o.epoch_time_usec = start_epoch + (local - start_local) +
+                            (int64_t)(local - start_local) * freq_error_ppm /
+                                1000000 +
+                            rand_range(-1000, 1000);
+        const bool bogus = first ? i == 0 : i % 50 == 25;
+        if (bogus) {
+          o.epoch_time_usec += bogus_offsets[b];
+          o.rtt_usec = 1000;
+        }
+        est.add(&o);
+
+        uint64_t offset_usec;
+        int64_t freq_ppb;
+        if (!est.estimate(&offset_usec, &freq_ppb)) {
+          continue;
+        }
+        uint64_t expected = start_epoch + (local - start_local) +
+                            (int64_t)(local - start_local) * freq_error_ppm /
+                                1000000;
+        int64_t err = local_to_epoch(local, offset_usec, freq_ppb) - expected;
+        if (i >= 20) {
+          assert(llabs(freq_ppb + freq_error_ppm * 1000) < 20000);
+          assert(llabs(err) < 2000);
+        }
+      }
+    }
+  }
+  printf("PASS\n");
+}
+
+void test_epoch_clock() {
+  printf("epoch clock test\n");
+  // Update an EpochClock with noisy estimates and read it at random times in
+  // between. Reads must never go backwards, and once the clock has had time
+  // to slew, it must agree with the estimate.
+
+  const uint64_t start_epoch = 1643967455123456;
+  EpochClock clock;
+  uint64_t now = 5000000;
+  uint64_t last_read = 0;
+  uint64_t offset_usec = 0;
+  int64_t freq_ppb = 0;
+
+  for (int i = 0; i < 500; i++) {
+    // the true local clock is 35ppm slow; estimates of it are off by a
+    // couple of msec and a little frequency error
+    freq_ppb = 35000 + rand_range(-50, 50);
+    uint64_t epoch_now = start_epoch + now + now * 35 / 1000000;
+    offset_usec = epoch_now + rand_range(-2000, 2000) - now +
+                  (int64_t)now * freq_ppb / 1000000000;
+    clock.update(now, offset_usec, freq_ppb);
+    assert(clock.is_set());
+
+    uint64_t next_update = now + 60000000;
+    while (now < next_update) {
+      now += rand_range(1, 2000000);
+      if (rand_range(0, 9) == 0) {
+        clock.rebase(now);
+      }
+      uint64_t epoch = clock.to_epoch(now);
+      assert(epoch >= last_read);
+      last_read = epoch;
+    }
+  }
+
+  // an error of 2 msec takes 4 sec to slew out at 500ppm
+  int64_t err = clock.to_epoch(now) - local_to_epoch(now, offset_usec, freq_ppb);
+  printf("final error %ld usec\n", err);
+  assert(llabs(err) <= 2);
+
+  // a big forward error steps the clock
+  clock.update(now, offset_usec + 5000000, freq_ppb);
+  err = clock.to_epoch(now) -
+        local_to_epoch(now, offset_usec + 5000000, freq_ppb);
+  assert(err == 0);
+  assert(clock.to_epoch(now) > last_read);
+
+  printf("PASS\n");
+}
+
 void test_real_data() {
   uint64_t offset_usec;
   int64_t freq_ppb;
@@ -190,5 +398,8 @@ int main(int argc, char *argv[]) {
   test_perfect_clocks();
   test_clock_rate_error();
   test_with_observation_error();
+  test_incremental();
+  test_outliers();
+  test_epoch_clock();
   // test_real_data();
 }
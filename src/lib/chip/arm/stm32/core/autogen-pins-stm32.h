@@ -1,5 +1,5 @@
 // automatically generated pin definitions, do not edit
-// generated by /home/jelson/projects/rulos/src/util/makepins.py
+// generated by makepins.py stm32
 
 
 #if defined(GPIOA)
@@ -99,6 +99,9 @@ static const gpio_pin_t GPIO_A15 = {
    .pin = LL_GPIO_PIN_15,
 };
 
+
+#define GPIO_GROUP_A(first, count) ((gpio_group_t) {    .port = GPIOA,    .mask = ((1UL << (count)) - 1) << (first),    .shift = (first), })
+
 #endif
 
 
@@ -199,6 +202,9 @@ static const gpio_pin_t GPIO_B15 = {
    .pin = LL_GPIO_PIN_15,
 };
 
+
+#define GPIO_GROUP_B(first, count) ((gpio_group_t) {    .port = GPIOB,    .mask = ((1UL << (count)) - 1) << (first),    .shift = (first), })
+
 #endif
 
 
@@ -299,6 +305,9 @@ static const gpio_pin_t GPIO_C15 = {
    .pin = LL_GPIO_PIN_15,
 };
 
+
+#define GPIO_GROUP_C(first, count) ((gpio_group_t) {    .port = GPIOC,    .mask = ((1UL << (count)) - 1) << (first),    .shift = (first), })
+
 #endif
 
 
@@ -399,6 +408,9 @@ static const gpio_pin_t GPIO_D15 = {
    .pin = LL_GPIO_PIN_15,
 };
 
+
+#define GPIO_GROUP_D(first, count) ((gpio_group_t) {    .port = GPIOD,    .mask = ((1UL << (count)) - 1) << (first),    .shift = (first), })
+
 #endif
 
 
@@ -499,4 +511,7 @@ static const gpio_pin_t GPIO_F15 = {
    .pin = LL_GPIO_PIN_15,
 };
 
+
+#define GPIO_GROUP_F(first, count) ((gpio_group_t) {    .port = GPIOF,    .mask = ((1UL << (count)) - 1) << (first),    .shift = (first), })
+
 #endif
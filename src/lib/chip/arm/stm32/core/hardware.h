@@ -27,6 +27,13 @@ typedef struct {
   uint32_t pin;
 } gpio_pin_t;
 
+// Adjacent pins of one port that are written together; see GPIO_GROUP_x().
+typedef struct {
+  GPIO_TypeDef *port;
+  uint32_t mask;
+  uint8_t shift;
+} gpio_group_t;
+
 #include "autogen-pins-stm32.h"
 
 static inline void stm32_gpio_configure(const gpio_pin_t gpio_pin,
@@ -114,6 +121,23 @@ static inline void gpio_set_or_clr(const gpio_pin_t gpio_pin,
   }
 }
 
+/* Configure all the pins of a group as outputs. */
+static inline void gpio_group_make_output(const gpio_group_t group) {
+  const gpio_pin_t pins = {.port = group.port, .pin = group.mask};
+  gpio_make_output(pins);
+}
+
+/*
+ * Write the low bits of 'value' to the pins of a group, lowest bit to the
+ * group's first pin. BSRR resets the pins in its top half and sets those in
+ * its bottom half in one atomic store, with set taking priority.
+ */
+static inline void gpio_group_write(const gpio_group_t group,
+                                    const uint32_t value) {
+  group.port->BSRR =
+      (group.mask << 16) | ((value << group.shift) & group.mask);
+}
+
 /*
  * returns true if an input is being asserted LOW, false otherwise
  */
@@ -16,9 +16,567 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+// ADC1, scanning every enabled channel once per scan period.
+//
+// The scan is started from the scheduler; the ADC converts the channels in
+// ascending order and DMA copies each result into a circular buffer that
+// holds the last ADC_HISTORY scans. No interrupts are involved, and
+// hal_read_adc() just averages a channel's column of the buffer, so reads
+// never wait for or lock out the hardware. On the G0 each conversion is also
+// oversampled in hardware.
+//
+// Values are scaled to 10 bits, the range of the AVR ADC that the callers of
+// hal_read_adc() were written for.
+//
+// The results are carried by DMA1 channel 1. On the F3 that's the channel
+// hardwired to ADC1. On the G0 it's shared with uart 0's receiver, so define
+// ADC_DMA and ADC_DMA_CHANNEL to pick another one if both are in use.
+//
+// The ADC can also be lent out to capture a waveform; see adc_stream.h.
+//
+// Channel numbers are the ADC's (ADC_INx). The common ones have their pins
+// set to analog mode here; others must be configured by the app with
+// gpio_make_adc_input().
+
 #include "core/hal.h"
 #include "core/hardware.h"
+#include "core/logging.h"
+#include "core/rulos.h"
+#include "periph/adc/adc_stream.h"
+
+#if defined(RULOS_ARM_stm32f3)
+#include "stm32f3xx_hal_rcc.h"
+#include "stm32f3xx_ll_adc.h"
+#include "stm32f3xx_ll_bus.h"
+#include "stm32f3xx_ll_dma.h"
+#include "stm32f3xx_ll_rcc.h"
+#include "stm32f3xx_ll_tim.h"
+#elif defined(RULOS_ARM_stm32g0)
+#include "stm32g0xx_hal_rcc.h"
+#include "stm32g0xx_ll_adc.h"
+#include "stm32g0xx_ll_bus.h"
+#include "stm32g0xx_ll_dma.h"
+#include "stm32g0xx_ll_rcc.h"
+#include "stm32g0xx_ll_tim.h"
+#else
+#error "ADC not yet supported on this chip"
+#include <stophere>
+#endif
+
+#include "core/dma.h"
+
+#ifndef ADC_DMA
+#define ADC_DMA DMA1
+#endif
+
+#ifndef ADC_DMA_CHANNEL
+#define ADC_DMA_CHANNEL LL_DMA_CHANNEL_1
+#endif
+
+// number of scans averaged by hal_read_adc()
+#define ADC_HISTORY 4
+
+#define ADC_MAX_CHANNELS 16
+
+typedef struct {
+  bool hw_initted;
+  bool scanning;
+  Time scan_period;
+
+  uint32_t channel_mask;  // channels that have been initialized
+  uint32_t scan_mask;     // channels in the periodic scan
+  uint8_t num_channels;
+  uint8_t rank[32];  // position of each scanned channel within a scan
+
+  volatile uint16_t samples[ADC_HISTORY * ADC_MAX_CHANNELS];
+
+  // streaming capture
+  bool streaming;
+  bool stream_poll_scheduled;
+  uint16_t *stream_buf;
+  uint16_t stream_scans_per_half;
+  uint8_t stream_num_channels;
+  uint8_t stream_next_half;
+  uint32_t stream_next_scan;
+  uint32_t stream_overruns;
+  Time stream_poll_period;
+  adc_stream_cb_t stream_cb;
+  void *stream_user_data;
+} ADCState;
+
+static ADCState g_theADC;
+
+static void busy_wait_us(uint32_t us) {
+  // at least 4 cycles per iteration
+  volatile uint32_t n = us * (SystemCoreClock / 4000000 + 1);
+  while (n > 0) {
+    n--;
+  }
+}
+
+static void configure_pin(uint8_t idx) {
+  switch (idx) {
+#if defined(RULOS_ARM_stm32f3)
+    case 1:
+      gpio_make_adc_input(GPIO_A0);
+      break;
+    case 2:
+      gpio_make_adc_input(GPIO_A1);
+      break;
+    case 3:
+      gpio_make_adc_input(GPIO_A2);
+      break;
+    case 4:
+      gpio_make_adc_input(GPIO_A3);
+      break;
+#elif defined(RULOS_ARM_stm32g0)
+    case 0:
+      gpio_make_adc_input(GPIO_A0);
+      break;
+    case 1:
+      gpio_make_adc_input(GPIO_A1);
+      break;
+    case 2:
+      gpio_make_adc_input(GPIO_A2);
+      break;
+    case 3:
+      gpio_make_adc_input(GPIO_A3);
+      break;
+    case 4:
+      gpio_make_adc_input(GPIO_A4);
+      break;
+    case 5:
+      gpio_make_adc_input(GPIO_A5);
+      break;
+    case 6:
+      gpio_make_adc_input(GPIO_A6);
+      break;
+    case 7:
+      gpio_make_adc_input(GPIO_A7);
+      break;
+    case 8:
+      gpio_make_adc_input(GPIO_B0);
+      break;
+    case 9:
+      gpio_make_adc_input(GPIO_B1);
+      break;
+    case 10:
+      gpio_make_adc_input(GPIO_B2);
+      break;
+#endif
+  }
+}
+
+static void init_hardware(ADCState *adc) {
+#ifdef DMA2
+  if (ADC_DMA == DMA2) {
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2);
+  } else
+#endif
+  {
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+  }
+
+#if defined(RULOS_ARM_stm32f3)
+  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_ADC12);
+  LL_ADC_SetCommonClock(__LL_ADC_COMMON_INSTANCE(ADC1),
+                        LL_ADC_CLOCK_SYNC_PCLK_DIV2);
+
+  // the regulator has to pass through the intermediate state on its way
+  // from disabled to enabled
+  CLEAR_BIT(ADC1->CR, ADC_CR_ADVREGEN);
+  LL_ADC_EnableInternalRegulator(ADC1);
+  busy_wait_us(LL_ADC_DELAY_INTERNAL_REGUL_STAB_US);
+
+  LL_ADC_StartCalibration(ADC1, LL_ADC_SINGLE_ENDED);
+  while (LL_ADC_IsCalibrationOnGoing(ADC1)) {
+  }
+#else
+  LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_ADC);
+  LL_ADC_SetClock(ADC1, LL_ADC_CLOCK_SYNC_PCLK_DIV2);
+
+  LL_ADC_EnableInternalRegulator(ADC1);
+  busy_wait_us(LL_ADC_DELAY_INTERNAL_REGUL_STAB_US);
+
+  LL_ADC_StartCalibration(ADC1);
+  while (LL_ADC_IsCalibrationOnGoing(ADC1)) {
+  }
+
+  // 16x oversampling, shifted back down to 12 bits
+  LL_ADC_SetOverSamplingScope(ADC1, LL_ADC_OVS_GRP_REGULAR_CONTINUED);
+  LL_ADC_ConfigOverSamplingRatioShift(ADC1, LL_ADC_OVS_RATIO_16,
+                                      LL_ADC_OVS_SHIFT_RIGHT_4);
+
+  // convert the channels in CHSELR in ascending order; all of them use
+  // sampling time 1
+  LL_ADC_REG_SetSequencerConfigurable(ADC1, LL_ADC_REG_SEQ_FIXED);
+  LL_ADC_SetSamplingTimeCommonChannels(ADC1, LL_ADC_SAMPLINGTIME_COMMON_1,
+                                       LL_ADC_SAMPLINGTIME_79CYCLES_5);
+#endif
+
+  // the ADC needs a few of its clocks after calibration before it can be
+  // enabled
+  busy_wait_us(1);
+
+  LL_ADC_SetResolution(ADC1, LL_ADC_RESOLUTION_12B);
+  LL_ADC_SetDataAlignment(ADC1, LL_ADC_DATA_ALIGN_RIGHT);
+  LL_ADC_REG_SetTriggerSource(ADC1, LL_ADC_REG_TRIG_SOFTWARE);
+  LL_ADC_REG_SetContinuousMode(ADC1, LL_ADC_REG_CONV_SINGLE);
+  LL_ADC_REG_SetOverrun(ADC1, LL_ADC_REG_OVR_DATA_OVERWRITTEN);
+  LL_ADC_REG_SetDMATransfer(ADC1, LL_ADC_REG_DMA_TRANSFER_UNLIMITED);
+
+#if defined(RULOS_ARM_stm32g0)
+  LL_DMA_SetPeriphRequest(ADC_DMA, ADC_DMA_CHANNEL, LL_DMAMUX_REQ_ADC1);
+#endif
+  LL_DMA_ConfigTransfer(ADC_DMA, ADC_DMA_CHANNEL,
+                        LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                            LL_DMA_MODE_CIRCULAR | LL_DMA_PERIPH_NOINCREMENT |
+                            LL_DMA_MEMORY_INCREMENT |
+                            LL_DMA_PDATAALIGN_HALFWORD |
+                            LL_DMA_MDATAALIGN_HALFWORD | LL_DMA_PRIORITY_LOW);
+  LL_DMA_ConfigAddresses(
+      ADC_DMA, ADC_DMA_CHANNEL,
+      LL_ADC_DMA_GetRegAddr(ADC1, LL_ADC_DMA_REG_REGULAR_DATA),
+      (uint32_t)adc->samples, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+
+  LL_ADC_ClearFlag_ADRDY(ADC1);
+  LL_ADC_Enable(ADC1);
+  while (!LL_ADC_IsActiveFlag_ADRDY(ADC1)) {
+  }
+
+  adc->hw_initted = true;
+}
+
+static uint32_t dma_len(ADCState *adc) {
+  return ADC_HISTORY * adc->num_channels;
+}
+
+// Point the DMA at the start of a buffer of 'len' samples.
+static void restart_dma(volatile uint16_t *buf, uint32_t len) {
+  LL_DMA_DisableChannel(ADC_DMA, ADC_DMA_CHANNEL);
+  LL_DMA_SetMemoryAddress(ADC_DMA, ADC_DMA_CHANNEL, (uint32_t)buf);
+  LL_DMA_SetDataLength(ADC_DMA, ADC_DMA_CHANNEL, len);
+  LL_DMA_ClearFlag_HT(ADC_DMA, ADC_DMA_CHANNEL);
+  LL_DMA_ClearFlag_TC(ADC_DMA, ADC_DMA_CHANNEL);
+  LL_DMA_EnableChannel(ADC_DMA, ADC_DMA_CHANNEL);
+}
+
+static void start_scan(ADCState *adc) {
+  LL_ADC_ClearFlag_OVR(ADC1);
+  LL_ADC_REG_StartConversion(ADC1);
+}
+
+// Program the ADC to convert the channels in 'mask', in ascending order, each
+// time it's triggered. Returns the number of channels.
+static uint8_t program_sequence(uint32_t mask) {
+  uint8_t n = 0;
+  for (uint8_t ch = 0; ch < 32; ch++) {
+    if (!(mask & (1UL << ch))) {
+      continue;
+    }
+#if defined(RULOS_ARM_stm32f3)
+    static const uint32_t ranks[ADC_MAX_CHANNELS] = {
+        LL_ADC_REG_RANK_1,  LL_ADC_REG_RANK_2,  LL_ADC_REG_RANK_3,
+        LL_ADC_REG_RANK_4,  LL_ADC_REG_RANK_5,  LL_ADC_REG_RANK_6,
+        LL_ADC_REG_RANK_7,  LL_ADC_REG_RANK_8,  LL_ADC_REG_RANK_9,
+        LL_ADC_REG_RANK_10, LL_ADC_REG_RANK_11, LL_ADC_REG_RANK_12,
+        LL_ADC_REG_RANK_13, LL_ADC_REG_RANK_14, LL_ADC_REG_RANK_15,
+        LL_ADC_REG_RANK_16,
+    };
+    LL_ADC_REG_SetSequencerRanks(ADC1, ranks[n],
+                                 __LL_ADC_DECIMAL_NB_TO_CHANNEL(ch));
+    LL_ADC_SetChannelSamplingTime(ADC1, __LL_ADC_DECIMAL_NB_TO_CHANNEL(ch),
+                                  LL_ADC_SAMPLINGTIME_181CYCLES_5);
+#endif
+    n++;
+  }
+
+#if defined(RULOS_ARM_stm32f3)
+  // the length field holds the number of ranks minus one
+  LL_ADC_REG_SetSequencerLength(ADC1, (uint32_t)(n - 1) << ADC_SQR1_L_Pos);
+#else
+  LL_ADC_ClearFlag_CCRDY(ADC1);
+  LL_ADC_REG_SetSequencerChannels(ADC1, mask);
+  while (!LL_ADC_IsActiveFlag_CCRDY(ADC1)) {
+  }
+#endif
+  return n;
+}
+
+// Reprogram the sequence after a channel is added, or a stream ends, then run
+// enough scans back-to-back to fill the buffer, so hal_read_adc() is
+// meaningful as soon as the channel has been initialized.
+static void configure_sequence(ADCState *adc) {
+  while (LL_ADC_REG_IsConversionOngoing(ADC1)) {
+  }
+
+  if (adc->channel_mask == 0) {
+    return;
+  }
+
+  uint8_t n = 0;
+  for (uint8_t ch = 0; ch < 32; ch++) {
+    if (adc->channel_mask & (1UL << ch)) {
+      adc->rank[ch] = n++;
+    }
+  }
+  adc->num_channels = program_sequence(adc->channel_mask);
+  adc->scan_mask = adc->channel_mask;
+
+  restart_dma(adc->samples, dma_len(adc));
+  for (uint32_t i = 1; i <= ADC_HISTORY; i++) {
+    const uint32_t remaining =
+        i == ADC_HISTORY ? dma_len(adc) : dma_len(adc) - i * n;
+    start_scan(adc);
+    while (LL_DMA_GetDataLength(ADC_DMA, ADC_DMA_CHANNEL) != remaining) {
+    }
+  }
+}
+
+static void adc_scan(void *data) {
+  ADCState *adc = (ADCState *)data;
+  schedule_us(adc->scan_period, adc_scan, adc);
+
+  if (adc->streaming || adc->num_channels == 0 ||
+      LL_ADC_REG_IsConversionOngoing(ADC1)) {
+    return;
+  }
+
+  // Between scans the DMA should be at a row boundary. If it isn't, a
+  // result was dropped, and every channel after it would be misattributed.
+  if (LL_DMA_GetDataLength(ADC_DMA, ADC_DMA_CHANNEL) % adc->num_channels !=
+      0) {
+    restart_dma(adc->samples, dma_len(adc));
+  }
+  start_scan(adc);
+}
+
+//// streaming capture
+
+#ifdef TIM6
+
+static uint32_t timer_clock_hz(void) {
+  // timers run at twice PCLK when the APB prescaler divides it down
+  const uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+  return LL_RCC_GetAPB1Prescaler() == LL_RCC_APB1_DIV_1 ? pclk : 2 * pclk;
+}
+
+// Set up TIM6 to pulse TRGO at 'rate_hz', without starting it. Returns the
+// rate it will actually run at.
+static uint32_t setup_trigger_timer(uint32_t rate_hz) {
+  LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM6);
+  LL_TIM_DisableCounter(TIM6);
+
+  const uint32_t clk = timer_clock_hz();
+  const uint32_t ticks = r_max(clk / rate_hz, 1);
+  const uint32_t prescale = (ticks - 1) / 65536 + 1;
+  const uint32_t reload = ticks / prescale;
+  LL_TIM_SetPrescaler(TIM6, prescale - 1);
+  LL_TIM_SetAutoReload(TIM6, reload - 1);
+  LL_TIM_SetTriggerOutput(TIM6, LL_TIM_TRGO_UPDATE);
+  LL_TIM_SetCounter(TIM6, 0);
+
+  // load the prescaler now rather than at the first update; the ADC isn't
+  // armed yet, so the TRGO this generates is ignored
+  LL_TIM_GenerateEvent_UPDATE(TIM6);
+
+  return clk / (prescale * reload);
+}
+
+// which half of the ring the DMA is writing
+static uint8_t stream_dma_half(ADCState *adc) {
+  const uint32_t half_len =
+      (uint32_t)adc->stream_scans_per_half * adc->stream_num_channels;
+  const uint32_t remaining = LL_DMA_GetDataLength(ADC_DMA, ADC_DMA_CHANNEL);
+  return remaining > half_len ? 0 : 1;
+}
+
+static void stream_poll(void *data) {
+  ADCState *adc = (ADCState *)data;
+  if (!adc->streaming) {
+    adc->stream_poll_scheduled = false;
+    return;
+  }
+  schedule_us(adc->stream_poll_period, stream_poll, adc);
+
+  // HT is set when the first half fills, TC when the second does
+  bool done[2] = {LL_DMA_IsActiveFlag_HT(ADC_DMA, ADC_DMA_CHANNEL),
+                  LL_DMA_IsActiveFlag_TC(ADC_DMA, ADC_DMA_CHANNEL)};
+  if (done[0]) {
+    LL_DMA_ClearFlag_HT(ADC_DMA, ADC_DMA_CHANNEL);
+  }
+  if (done[1]) {
+    LL_DMA_ClearFlag_TC(ADC_DMA, ADC_DMA_CHANNEL);
+  }
+
+  // hand over the filled halves in order; the callback may stop the stream
+  while (adc->streaming && done[adc->stream_next_half]) {
+    const uint8_t h = adc->stream_next_half;
+    done[h] = false;
+    adc->stream_next_half = h ^ 1;
+    const uint32_t first_scan = adc->stream_next_scan;
+    adc->stream_next_scan += adc->stream_scans_per_half;
+
+    // If the DMA is back in this half already, both halves filled since the
+    // last poll, and this one's being overwritten.
+    if (stream_dma_half(adc) == h) {
+      adc->stream_overruns++;
+      continue;
+    }
+
+    const adc_stream_block_t block = {
+        .samples = adc->stream_buf + (uint32_t)h * adc->stream_scans_per_half *
+                                         adc->stream_num_channels,
+        .num_scans = adc->stream_scans_per_half,
+        .num_channels = adc->stream_num_channels,
+        .first_scan = first_scan,
+        .overruns = adc->stream_overruns,
+    };
+    adc->stream_cb(adc->stream_user_data, &block);
+
+    // it may also have come back around while the callback was busy
+    if (adc->streaming && stream_dma_half(adc) == h) {
+      adc->stream_overruns++;
+    }
+  }
+}
+
+uint32_t adc_stream_start(uint32_t channel_mask, uint32_t scan_rate_hz,
+                          uint16_t *buf, uint16_t scans_per_half,
+                          adc_stream_cb_t cb, void *user_data) {
+  ADCState *adc = &g_theADC;
+
+  assert(!adc->streaming);
+  assert(channel_mask != 0 && scan_rate_hz > 0 && scans_per_half > 0);
+  assert(__builtin_popcount(channel_mask) <= ADC_MAX_CHANNELS);
+#if defined(RULOS_ARM_stm32f3)
+  assert(!(channel_mask & 1));
+#endif
+
+  if (!adc->hw_initted) {
+    init_hardware(adc);
+  }
+  for (uint8_t ch = 0; ch < 32; ch++) {
+    if (channel_mask & (1UL << ch)) {
+      configure_pin(ch);
+    }
+  }
+
+  // let the periodic scan finish, if one's underway
+  while (LL_ADC_REG_IsConversionOngoing(ADC1)) {
+  }
+  adc->streaming = true;
+
+  adc->stream_buf = buf;
+  adc->stream_scans_per_half = scans_per_half;
+  adc->stream_num_channels = program_sequence(channel_mask);
+  adc->stream_next_half = 0;
+  adc->stream_next_scan = 0;
+  adc->stream_overruns = 0;
+  adc->stream_cb = cb;
+  adc->stream_user_data = user_data;
+
+  const uint32_t rate = setup_trigger_timer(scan_rate_hz);
+  adc->stream_poll_period =
+      (uint64_t)scans_per_half * 1000000 / rate / 4;
+
+  restart_dma(buf, 2 * (uint32_t)scans_per_half * adc->stream_num_channels);
+
+  // arm the ADC, so that each TRGO starts a scan, then start the timer
+  LL_ADC_REG_SetTriggerSource(ADC1, LL_ADC_REG_TRIG_EXT_TIM6_TRGO);
+  start_scan(adc);
+  LL_TIM_EnableCounter(TIM6);
+
+  if (!adc->stream_poll_scheduled) {
+    adc->stream_poll_scheduled = true;
+    schedule_us(adc->stream_poll_period, stream_poll, adc);
+  }
+  return rate;
+}
+
+void adc_stream_stop(void) {
+  ADCState *adc = &g_theADC;
+
+  if (!adc->streaming) {
+    return;
+  }
+
+  LL_TIM_DisableCounter(TIM6);
+  if (LL_ADC_REG_IsConversionOngoing(ADC1)) {
+    LL_ADC_REG_StopConversion(ADC1);
+    while (LL_ADC_REG_IsStopConversionOngoing(ADC1)) {
+    }
+  }
+  LL_ADC_REG_SetTriggerSource(ADC1, LL_ADC_REG_TRIG_SOFTWARE);
+
+  // back to the periodic scan
+  adc->streaming = false;
+  configure_sequence(adc);
+}
+
+#endif  // TIM6
+
+/////////////// HAL (public interface) functions ////////////////
+
+void hal_init_adc(Time scan_period) {
+  ADCState *adc = &g_theADC;
+
+  if (!adc->hw_initted) {
+    init_hardware(adc);
+  }
+
+  if (adc->scanning) {
+    // take the min of all requested periods
+    if (scan_period < adc->scan_period) {
+      adc->scan_period = scan_period;
+    }
+  } else {
+    adc->scan_period = scan_period;
+    adc->scanning = true;
+    schedule_us(1, adc_scan, adc);
+  }
+}
+
+void hal_init_adc_channel(uint8_t idx) {
+  ADCState *adc = &g_theADC;
+
+  assert(idx < 32);
+#if defined(RULOS_ARM_stm32f3)
+  assert(idx != 0);
+#endif
+  if (adc->channel_mask & (1UL << idx)) {
+    return;
+  }
+  assert(__builtin_popcount(adc->channel_mask) < ADC_MAX_CHANNELS);
+
+  if (!adc->hw_initted) {
+    init_hardware(adc);
+  }
+
+  configure_pin(idx);
+  adc->channel_mask |= 1UL << idx;
+
+  // if a stream is running, the sequence is reprogrammed when it stops
+  if (!adc->streaming) {
+    configure_sequence(adc);
+  }
+}
+
+uint16_t hal_read_adc(uint8_t idx) {
+  ADCState *adc = &g_theADC;
+
+  if (idx >= 32 || !(adc->scan_mask & (1UL << idx))) {
+    return 0;
+  }
+
+  // Each sample is written by a single DMA transfer, so it can be read at
+  // any time; the average may just mix in a scan that's still underway.
+  const uint8_t n = adc->num_channels;
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < ADC_HISTORY; i++) {
+    sum += adc->samples[i * n + adc->rank[idx]];
+  }
 
-void hal_init_adc(Time scan_period) {}
-void hal_init_adc_channel(uint8_t idx) {}
-uint16_t hal_read_adc(uint8_t idx) { return 0; }
+  // 12-bit samples down to 10 bits
+  return sum / ADC_HISTORY >> 2;
+}
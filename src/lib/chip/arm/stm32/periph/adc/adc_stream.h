@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Streaming capture from ADC1, for recording waveforms rather than reading
+// single values.
+//
+// TIM6 triggers a scan of the selected channels at a fixed rate, and DMA
+// writes the results into a caller-supplied ring of two halves. Each time a
+// half fills, the callback is handed its samples from the scheduler (not
+// from an interrupt), so it may do slow things like writing them to an SD
+// card, as long as it's done with them before the DMA comes back around.
+// Keep each half several scheduler ticks long; the flags are polled four
+// times per half.
+//
+// While a stream runs, it has the ADC to itself: hal_read_adc() keeps
+// returning the values from before it started, and the periodic scan
+// resumes when it stops. On the G0 each conversion is still oversampled 16x,
+// which takes about 50us per channel and so bounds the scan rate.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  // num_scans scans, each num_channels samples long, in ascending order of
+  // channel number; 12-bit values
+  const uint16_t *samples;
+  uint16_t num_scans;
+  uint8_t num_channels;
+
+  uint32_t first_scan;  // index of the first scan since the stream started
+  uint32_t overruns;    // halves lost or overwritten so far
+} adc_stream_block_t;
+
+typedef void (*adc_stream_cb_t)(void *user_data,
+                                const adc_stream_block_t *block);
+
+// Start converting the channels in channel_mask (bit n is ADC_INn) at
+// scan_rate_hz. 'buf' holds 2 * scans_per_half * (number of channels)
+// samples, and must stay valid until the stream is stopped. Returns the
+// actual scan rate, which may be rounded to what the timer can produce.
+uint32_t adc_stream_start(uint32_t channel_mask, uint32_t scan_rate_hz,
+                          uint16_t *buf, uint16_t scans_per_half,
+                          adc_stream_cb_t cb, void *user_data);
+
+void adc_stream_stop(void);
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "periph/i2c_master/i2c_master.h"
+
+#include <string.h>
+
+#ifndef I2C_MASTER_DMA
+#define I2C_MASTER_DMA DMA1
+#endif
+
+#ifndef I2C_MASTER_DMA_TX_CHANNEL
+#define I2C_MASTER_DMA_TX_CHANNEL LL_DMA_CHANNEL_6
+#endif
+
+#ifndef I2C_MASTER_DMA_RX_CHANNEL
+#define I2C_MASTER_DMA_RX_CHANNEL LL_DMA_CHANNEL_7
+#endif
+
+static i2c_master_bus_t i2c1_bus;
+static bool i2c1_bus_initted = false;
+
+static void start_dma(uint32_t channel, uint32_t src, uint32_t dst,
+                      uint32_t direction, uint8_t len) {
+  LL_DMA_DisableChannel(I2C_MASTER_DMA, channel);
+  LL_DMA_ConfigAddresses(I2C_MASTER_DMA, channel, src, dst, direction);
+  LL_DMA_SetDataLength(I2C_MASTER_DMA, channel, len);
+  LL_DMA_EnableChannel(I2C_MASTER_DMA, channel);
+}
+
+static void start_read(i2c_master_bus_t *bus, i2c_master_xfer_t *xfer,
+                       uint32_t request) {
+  start_dma(I2C_MASTER_DMA_RX_CHANNEL,
+            LL_I2C_DMA_GetRegAddr(bus->i2c, LL_I2C_DMA_REG_DATA_RECEIVE),
+            (uint32_t)xfer->rx, LL_DMA_DIRECTION_PERIPH_TO_MEMORY,
+            xfer->rx_len);
+  LL_I2C_EnableDMAReq_RX(bus->i2c);
+  LL_I2C_HandleTransfer(bus->i2c, xfer->addr << 1, LL_I2C_ADDRSLAVE_7BIT,
+                        xfer->rx_len, LL_I2C_MODE_AUTOEND, request);
+}
+
+static void start_xfer(i2c_master_bus_t *bus, i2c_master_xfer_t *xfer) {
+  bus->curr = xfer;
+  bus->curr_status = I2C_MASTER_OK;
+
+  if (xfer->tx_len == 0 && xfer->rx_len > 0) {
+    start_read(bus, xfer, LL_I2C_GENERATE_START_READ);
+    return;
+  }
+
+  // With nothing to write or read, this just addresses the device, which is
+  // a handy way to see if it's there. Otherwise the write ends without a
+  // stop if a read is to follow, and the TC interrupt turns the bus around.
+  if (xfer->tx_len > 0) {
+    start_dma(I2C_MASTER_DMA_TX_CHANNEL, (uint32_t)xfer->tx,
+              LL_I2C_DMA_GetRegAddr(bus->i2c, LL_I2C_DMA_REG_DATA_TRANSMIT),
+              LL_DMA_DIRECTION_MEMORY_TO_PERIPH, xfer->tx_len);
+    LL_I2C_EnableDMAReq_TX(bus->i2c);
+  }
+  LL_I2C_HandleTransfer(
+      bus->i2c, xfer->addr << 1, LL_I2C_ADDRSLAVE_7BIT, xfer->tx_len,
+      xfer->rx_len > 0 ? LL_I2C_MODE_SOFTEND : LL_I2C_MODE_AUTOEND,
+      LL_I2C_GENERATE_START_WRITE);
+}
+
+// Start the next queued transfer if the bus is free. Called with interrupts
+// disabled, or from the I2C interrupt.
+static void kick(i2c_master_bus_t *bus) {
+  if (bus->curr == NULL && bus->head != NULL) {
+    i2c_master_xfer_t *xfer = bus->head;
+    bus->head = xfer->next;
+    if (bus->head == NULL) {
+      bus->tail = NULL;
+    }
+    start_xfer(bus, xfer);
+  }
+}
+
+// Reset the I2C after an error, which also lets go of the bus. PE has to
+// stay low for at least 3 APB cycles for the reset to take; each read of
+// the register takes at least one.
+static void reset_i2c(I2C_TypeDef *i2c) {
+  LL_I2C_Disable(i2c);
+  for (int i = 0; i < 3; i++) {
+    (void)LL_I2C_IsEnabled(i2c);
+  }
+  LL_I2C_Enable(i2c);
+}
+
+static void end_xfer(i2c_master_bus_t *bus) {
+  LL_I2C_DisableDMAReq_TX(bus->i2c);
+  LL_I2C_DisableDMAReq_RX(bus->i2c);
+  LL_DMA_DisableChannel(I2C_MASTER_DMA, I2C_MASTER_DMA_TX_CHANNEL);
+  LL_DMA_DisableChannel(I2C_MASTER_DMA, I2C_MASTER_DMA_RX_CHANNEL);
+
+  // a write cut short by a NACK can leave a byte behind in TXDR
+  LL_I2C_ClearFlag_TXE(bus->i2c);
+
+  i2c_master_xfer_t *xfer = bus->curr;
+  bus->curr = NULL;
+  if (xfer != NULL) {
+    bus->num_xfers++;
+    if (bus->curr_status == I2C_MASTER_NACK) {
+      bus->num_nacks++;
+    } else if (bus->curr_status == I2C_MASTER_ERROR) {
+      bus->num_errors++;
+    } else if (bus->curr_status == I2C_MASTER_TIMEOUT) {
+      bus->num_timeouts++;
+    }
+
+    xfer->status = bus->curr_status;
+    xfer->done = true;
+    if (xfer->done_rec.func != NULL) {
+      schedule_now(xfer->done_rec.func, xfer->done_rec.data);
+    }
+  }
+  kick(bus);
+}
+
+static void i2c_master_irq(i2c_master_bus_t *bus) {
+  I2C_TypeDef *i2c = bus->i2c;
+
+  // After a bus error, lost arbitration or a clock timeout the peripheral
+  // has already let go of the bus, so no stop will follow; restart it to be
+  // sure it's idle.
+  if (LL_I2C_IsActiveSMBusFlag_TIMEOUT(i2c)) {
+    LL_I2C_ClearSMBusFlag_TIMEOUT(i2c);
+    reset_i2c(i2c);
+    bus->curr_status = I2C_MASTER_TIMEOUT;
+    end_xfer(bus);
+    return;
+  }
+  if (LL_I2C_IsActiveFlag_BERR(i2c) || LL_I2C_IsActiveFlag_ARLO(i2c) ||
+      LL_I2C_IsActiveFlag_OVR(i2c)) {
+    LL_I2C_ClearFlag_BERR(i2c);
+    LL_I2C_ClearFlag_ARLO(i2c);
+    LL_I2C_ClearFlag_OVR(i2c);
+    reset_i2c(i2c);
+    bus->curr_status = I2C_MASTER_ERROR;
+    end_xfer(bus);
+    return;
+  }
+
+  if (LL_I2C_IsActiveFlag_NACK(i2c)) {
+    LL_I2C_ClearFlag_NACK(i2c);
+    bus->curr_status = I2C_MASTER_NACK;
+
+    // the hardware only sends the stop itself in autoend mode
+    if (!LL_I2C_IsEnabledAutoEndMode(i2c)) {
+      LL_I2C_GenerateStopCondition(i2c);
+    }
+  } else if (LL_I2C_IsActiveFlag_TC(i2c) && bus->curr != NULL) {
+    // the write half is done; turn around and read
+    LL_I2C_DisableDMAReq_TX(i2c);
+    start_read(bus, bus->curr, LL_I2C_GENERATE_RESTART_7BIT_READ);
+  }
+
+  if (LL_I2C_IsActiveFlag_STOP(i2c)) {
+    LL_I2C_ClearFlag_STOP(i2c);
+    end_xfer(bus);
+  }
+}
+
+#if defined(RULOS_ARM_stm32g0)
+void I2C1_IRQHandler(void) {
+  i2c_master_irq(&i2c1_bus);
+}
+#elif defined(RULOS_ARM_stm32f3)
+void I2C1_EV_IRQHandler(void) {
+  i2c_master_irq(&i2c1_bus);
+}
+void I2C1_ER_IRQHandler(void) {
+  i2c_master_irq(&i2c1_bus);
+}
+#endif
+
+static void init_dma_channel(uint32_t channel, uint32_t direction) {
+  LL_DMA_DisableChannel(I2C_MASTER_DMA, channel);
+  LL_DMA_ConfigTransfer(I2C_MASTER_DMA, channel,
+                        direction | LL_DMA_PRIORITY_LOW | LL_DMA_MODE_NORMAL |
+                            LL_DMA_PERIPH_NOINCREMENT |
+                            LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+                            LL_DMA_MDATAALIGN_BYTE);
+}
+
+i2c_master_bus_t *i2c_master_get_bus(I2C_TypeDef *i2c, uint32_t timing) {
+  assert(i2c == I2C1);
+  i2c_master_bus_t *bus = &i2c1_bus;
+  if (i2c1_bus_initted) {
+    return bus;
+  }
+
+  memset(bus, 0, sizeof(*bus));
+  bus->i2c = i2c;
+
+#ifdef DMA2
+  if (I2C_MASTER_DMA == DMA2) {
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2);
+  } else
+#endif
+  {
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+  }
+  init_dma_channel(I2C_MASTER_DMA_TX_CHANNEL,
+                   LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+  init_dma_channel(I2C_MASTER_DMA_RX_CHANNEL,
+                   LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+#if defined(RULOS_ARM_stm32g0)
+  LL_DMA_SetPeriphRequest(I2C_MASTER_DMA, I2C_MASTER_DMA_TX_CHANNEL,
+                          LL_DMAMUX_REQ_I2C1_TX);
+  LL_DMA_SetPeriphRequest(I2C_MASTER_DMA, I2C_MASTER_DMA_RX_CHANNEL,
+                          LL_DMAMUX_REQ_I2C1_RX);
+#endif
+
+  LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_I2C1);
+  LL_I2C_Disable(i2c);
+  LL_I2C_SetTiming(i2c, timing);
+  LL_I2C_DisableOwnAddress1(i2c);
+  LL_I2C_EnableClockStretching(i2c);
+  LL_I2C_SetMode(i2c, LL_I2C_MODE_I2C);
+
+  // The timeout counts in units of 2048 kernel clocks, up to 4096 of them.
+  const uint64_t clk_hz = LL_RCC_GetI2CClockFreq(LL_RCC_I2C1_CLKSOURCE);
+  const uint32_t timeout_ticks =
+      r_max(r_min(clk_hz * I2C_MASTER_TIMEOUT_US / 2048 / 1000000, 4096), 1);
+  LL_I2C_SetSMBusTimeoutA(i2c, timeout_ticks - 1);
+  LL_I2C_SetSMBusTimeoutAMode(i2c, LL_I2C_SMBUS_TIMEOUTA_MODE_SCL_LOW);
+  LL_I2C_EnableSMBusTimeout(i2c, LL_I2C_SMBUS_TIMEOUTA);
+
+  LL_I2C_EnableIT_TC(i2c);
+  LL_I2C_EnableIT_STOP(i2c);
+  LL_I2C_EnableIT_NACK(i2c);
+  LL_I2C_EnableIT_ERR(i2c);
+#if defined(RULOS_ARM_stm32g0)
+  NVIC_SetPriority(I2C1_IRQn, 2);
+  NVIC_EnableIRQ(I2C1_IRQn);
+#elif defined(RULOS_ARM_stm32f3)
+  NVIC_SetPriority(I2C1_EV_IRQn, 2);
+  NVIC_EnableIRQ(I2C1_EV_IRQn);
+  NVIC_SetPriority(I2C1_ER_IRQn, 2);
+  NVIC_EnableIRQ(I2C1_ER_IRQn);
+#endif
+
+  LL_I2C_Enable(i2c);
+
+  i2c1_bus_initted = true;
+  return bus;
+}
+
+void i2c_master_submit(i2c_master_bus_t *bus, i2c_master_xfer_t *xfer) {
+  xfer->done = false;
+  xfer->next = NULL;
+
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  if (bus->tail != NULL) {
+    bus->tail->next = xfer;
+  } else {
+    bus->head = xfer;
+  }
+  bus->tail = xfer;
+  kick(bus);
+  hal_end_atomic(old_interrupts);
+}
+
+i2c_master_status_t i2c_master_wait(i2c_master_xfer_t *xfer) {
+  while (!xfer->done) {
+    __WFI();
+  }
+  return xfer->status;
+}
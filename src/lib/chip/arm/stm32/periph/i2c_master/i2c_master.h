@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Asynchronous I2C master for talking to sensors, as opposed to the twi
+// media, which carries RULOS network packets between nodes.
+//
+// Drivers queue transfer descriptors with i2c_master_submit(). Each writes
+// 'tx' to a device and then, after a repeated start, reads 'rx' back from it,
+// which is the usual way of reading a register; either part may be empty.
+// Transfers run back-to-back in the order they were submitted, each started
+// from the interrupt that ends the one before it, so several sensors can be
+// polled in one burst without the scheduler waiting on the bus. When a
+// transfer ends its status is filled in and its done_rec is scheduled.
+//
+// The bytes are moved by DMA, on DMA1 channels 6 (TX) and 7 (RX) by
+// default; define I2C_MASTER_DMA, I2C_MASTER_DMA_TX_CHANNEL and
+// I2C_MASTER_DMA_RX_CHANNEL to use others. The end of each phase is taken
+// from the I2C's own interrupts, so the DMA channels' interrupts are left
+// alone. Only I2C1 is supported for now. Its pins are configured by the code
+// that owns the board's pin map, and it can't be used along with the twi
+// media, which owns the same interrupt.
+//
+// A device that holds the clock low for longer than I2C_MASTER_TIMEOUT_US
+// (the SMBus limit of 25 msec by default) trips the I2C's timeout detector,
+// which fails the transfer rather than leaving it, and the queue behind it,
+// stuck for good.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/hardware.h"
+#include "core/rulos.h"
+
+#if defined(RULOS_ARM_stm32f3)
+#include "stm32f3xx_ll_bus.h"
+#include "stm32f3xx_ll_dma.h"
+#include "stm32f3xx_ll_i2c.h"
+#include "stm32f3xx_ll_rcc.h"
+#elif defined(RULOS_ARM_stm32g0)
+#include "stm32g0xx_ll_bus.h"
+#include "stm32g0xx_ll_dma.h"
+#include "stm32g0xx_ll_i2c.h"
+#include "stm32g0xx_ll_rcc.h"
+#else
+#error "i2c_master not yet supported on this chip"
+#include <stophere>
+#endif
+
+#ifndef I2C_MASTER_TIMEOUT_US
+#define I2C_MASTER_TIMEOUT_US 25000
+#endif
+
+typedef enum {
+  I2C_MASTER_OK,
+  I2C_MASTER_NACK,     // the device didn't acknowledge its address or data
+  I2C_MASTER_ERROR,    // bus error, lost arbitration, or overrun
+  I2C_MASTER_TIMEOUT,  // the clock was held low for too long
+} i2c_master_status_t;
+
+typedef struct i2c_master_xfer_s {
+  uint8_t addr;  // 7-bit device address
+  const uint8_t *tx;
+  uint8_t tx_len;
+  uint8_t *rx;
+  uint8_t rx_len;
+  ActivationRecord done_rec;  // scheduled when the transfer ends
+
+  // set by the engine
+  volatile bool done;
+  i2c_master_status_t status;
+  struct i2c_master_xfer_s *next;
+} i2c_master_xfer_t;
+
+typedef struct {
+  I2C_TypeDef *i2c;
+
+  // queued transfers; 'curr' is the one on the bus, if any
+  i2c_master_xfer_t *head;
+  i2c_master_xfer_t *tail;
+  i2c_master_xfer_t *curr;
+  i2c_master_status_t curr_status;
+
+  // statistics
+  uint32_t num_xfers;
+  uint32_t num_nacks;
+  uint32_t num_errors;
+  uint32_t num_timeouts;
+} i2c_master_bus_t;
+
+// Returns the bus for an I2C peripheral, initializing it the first time with
+// the given TIMINGR value (see __LL_I2C_CONVERT_TIMINGS), which depends on
+// the I2C's kernel clock. Later calls get the same bus and ignore 'timing'.
+i2c_master_bus_t *i2c_master_get_bus(I2C_TypeDef *i2c, uint32_t timing);
+
+// Queue a transfer. The descriptor and its buffers must stay valid until
+// done_rec runs (or 'done' becomes true). Safe to call from interrupt
+// handlers and from completion activations.
+void i2c_master_submit(i2c_master_bus_t *bus, i2c_master_xfer_t *xfer);
+
+// Wait for a submitted transfer to end, and return its status. Blocks; for
+// use at startup, and not from an interrupt handler.
+i2c_master_status_t i2c_master_wait(i2c_master_xfer_t *xfer);
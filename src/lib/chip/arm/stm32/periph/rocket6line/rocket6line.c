@@ -26,12 +26,22 @@
 #include "stm32f3xx_hal_rcc.h"
 #include "stm32f3xx_hal_rcc_ex.h"
 #include "stm32f3xx_hal_spi.h"
+#include "stm32f3xx_ll_dma.h"
 #include "stm32f3xx_ll_spi.h"
 #include "stm32f3xx_ll_tim.h"
 
+// needs the family's ll_dma declarations first
+#include "core/dma.h"
+
 #define PRINT_STATS 0
 #define USE_HAL 0
 
+// With USE_DMA, each row is shifted out to the LED drivers by DMA while the
+// previous row is lit, so the refresh interrupt never waits on SPI. Without
+// it, the interrupt handler writes the row to the SPI FIFO and spins until it
+// drains.
+#define USE_DMA 1
+
 typedef struct {
   SPI_HandleTypeDef hspi;
   int curr_row;
@@ -39,6 +49,7 @@ typedef struct {
 #if PRINT_STATS
   MinMaxMean_t refresh_time_stats;
 #endif
+  bool dma_started;  // USE_DMA: a row has been handed to the DMA
   bool initted;
 } Rocket6Line_t;
 
@@ -80,6 +91,10 @@ static Rocket6Line_t r6l_g;
 
 #define LEDDRIVER_SPI_AF GPIO_AF5_SPI1
 
+// SPI1_TX is on DMA1 channel 3 on the STM32F3.
+#define LEDDRIVER_DMA         DMA1
+#define LEDDRIVER_DMA_CHANNEL LL_DMA_CHANNEL_3
+
 #define DEBUG_PIN GPIO_A15
 
 static void init_pins(Rocket6Line_t *r6l) {
@@ -140,6 +155,22 @@ static void init_pins(Rocket6Line_t *r6l) {
   __HAL_SPI_ENABLE(&r6l->hspi);
   SPI_1LINE_TX(&r6l->hspi);
 
+#if USE_DMA
+  // One byte per SPI frame; the DMA is started for each row from the refresh
+  // interrupt, and its completion is polled there, so it needs no interrupt of
+  // its own.
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  LL_DMA_ConfigTransfer(
+      LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL,
+      LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_HIGH |
+          LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+          LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+          LL_DMA_MDATAALIGN_BYTE);
+  LL_DMA_SetPeriphAddress(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL,
+                          LL_SPI_DMA_GetRegAddr(SPI1));
+  LL_SPI_EnableDMAReq_TX(SPI1);
+#endif
+
   // Initialize the refresh timer
   __HAL_RCC_TIM2_CLK_ENABLE();
   HAL_NVIC_SetPriority(TIM2_IRQn, 3, 0);
@@ -249,6 +280,57 @@ static inline void enable_row(const uint8_t row_num) {
 
 // This is the high-update-rate path that drives the persistence-of-vision of
 // the matrix display. It's important this run quickly!
+#if USE_DMA
+
+static void start_row_dma(Rocket6Line_t *r6l, int row) {
+  LL_DMA_DisableChannel(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL);
+  LL_DMA_ClearFlag_TC(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL);
+  LL_DMA_SetMemoryAddress(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL,
+                          (uint32_t)r6l->row_data[row]);
+  LL_DMA_SetDataLength(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL,
+                       ROCKET6LINE_NUM_COLUMNS);
+  LL_DMA_EnableChannel(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL);
+}
+
+// The row that was shifted out during the last period is latched and lit,
+// and the DMA is started on the row after it.
+static void refresh_display(Rocket6Line_t *r6l) {
+  // The transfer takes a few microseconds out of a ~100usec period, so it
+  // should always be done; if it isn't, keep the current row lit and try again
+  // next time rather than latching half a row.
+  if (r6l->dma_started &&
+      (!LL_DMA_IsActiveFlag_TC(LEDDRIVER_DMA, LEDDRIVER_DMA_CHANNEL) ||
+       LL_SPI_IsActiveFlag_BSY(SPI1))) {
+    return;
+  }
+
+  r6l->curr_row++;
+  if (r6l->curr_row == ROCKET6LINE_NUM_ROWS) {
+    r6l->curr_row = 0;
+  }
+
+  if (r6l->dma_started) {
+    // Disable old display line.
+    disable_all_rows();
+
+    // Latch in the shifted data.
+    gpio_set(LEDDRIVER_LE);
+    gpio_clr(LEDDRIVER_LE);
+
+    // Enable new display line.
+    enable_row(r6l->curr_row);
+  }
+
+  int next_row = r6l->curr_row + 1;
+  if (next_row == ROCKET6LINE_NUM_ROWS) {
+    next_row = 0;
+  }
+  start_row_dma(r6l, next_row);
+  r6l->dma_started = true;
+}
+
+#else  // USE_DMA
+
 static void refresh_display(Rocket6Line_t *r6l) {
   r6l->curr_row++;
   if (r6l->curr_row == ROCKET6LINE_NUM_ROWS) {
@@ -292,6 +374,8 @@ static void refresh_display(Rocket6Line_t *r6l) {
   enable_row(r6l->curr_row);
 }
 
+#endif  // USE_DMA
+
 // Timer callback that fires at the update rate (~10khz).
 void TIM2_IRQHandler() {
   if (LL_TIM_IsActiveFlag_UPDATE(TIM2)) {
@@ -30,6 +30,7 @@
 
 #include "core/hardware.h"
 #include "periph/spi/hal_spi.h"
+#include "periph/spi_dma/spi_dma.h"
 #include "stm32f3xx_hal.h"
 #include "stm32f3xx_hal_gpio.h"
 #include "stm32f3xx_hal_rcc.h"
@@ -38,11 +39,27 @@
 
 SPI_HandleTypeDef hspi;
 
-void hal_init_spi(void) {
-  // Configure GPIO: chip select
-  gpio_make_output(GPIO_CHIPSELECT);
-  gpio_set(GPIO_CHIPSELECT);
+// Each hal_spi transfer is queued on the shared DMA engine, holding the
+// chip-select so the next one continues the same transaction; deselecting
+// queues an empty transfer that lets go of it. Other devices' queued
+// transfers run between selections. The hal_spi calls still block until
+// their transfer is done.
+static spi_dma_device_t hal_spi_dev;
+
+static void hal_spi_xfer(uint8_t *buf_out, uint8_t *buf_in, uint16_t len,
+                         bool hold_cs) {
+  spi_dma_xfer_t xfer;
+  memset(&xfer, 0, sizeof(xfer));
+  xfer.dev = &hal_spi_dev;
+  xfer.tx = buf_out;
+  xfer.rx = buf_in;
+  xfer.len = len;
+  xfer.hold_cs = hold_cs;
+  spi_dma_submit(&xfer);
+  spi_dma_wait(&xfer);
+}
 
+void hal_init_spi(void) {
   // Configure GPIO: SCK
   GPIO_InitTypeDef gpio;
   memset(&gpio, 0, sizeof(gpio));
@@ -80,19 +97,25 @@ void hal_init_spi(void) {
   hspi.Init.CRCPolynomial = 10;
   HAL_SPI_Init(&hspi);
   __HAL_SPI_ENABLE(&hspi);
+
+  spi_dma_device_init(&hal_spi_dev, spi_dma_get_bus(SPI1), GPIO_CHIPSELECT,
+                      LL_SPI_BAUDRATEPRESCALER_DIV128);
 }
 
+// the chip is selected by the first transfer after this
 void hal_spi_select_slave(bool select) {
-  gpio_set_or_clr(GPIO_CHIPSELECT, !select);
+  if (!select) {
+    hal_spi_xfer(NULL, NULL, 0, false);
+  }
 }
 
 void hal_spi_send(uint8_t byte) { hal_spi_send_multi(&byte, 1); }
 
 void hal_spi_send_multi(uint8_t *buf_out, const uint16_t len) {
-  HAL_SPI_Transmit(&hspi, buf_out, len, 1000);
+  hal_spi_xfer(buf_out, NULL, len, true);
 }
 
 void hal_spi_sendrecv_multi(uint8_t *buf_out, uint8_t *buf_in,
                             const uint16_t len) {
-  HAL_SPI_TransmitReceive(&hspi, buf_out, buf_in, len, 1000);
+  hal_spi_xfer(buf_out, buf_in, len, true);
 }
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "periph/spi_dma/spi_dma.h"
+
+#include <string.h>
+
+#define SPI_DMA_RX_CHAN LL_DMA_CHANNEL_2
+#define SPI_DMA_TX_CHAN LL_DMA_CHANNEL_3
+
+static spi_dma_bus_t spi1_bus;
+static bool spi1_bus_initted = false;
+
+// Compares against the register itself rather than a copy of it, since the
+// SPI's owner may reconfigure it, and a write made before the SPI is clocked
+// is lost.
+static void set_prescaler(spi_dma_bus_t *bus, uint32_t prescaler) {
+  if (LL_SPI_GetBaudRatePrescaler(bus->spi) == prescaler) {
+    return;
+  }
+
+  // the baud rate may only be changed while the SPI is disabled
+  LL_SPI_Disable(bus->spi);
+  LL_SPI_SetBaudRatePrescaler(bus->spi, prescaler);
+  LL_SPI_Enable(bus->spi);
+}
+
+static void start_dma(spi_dma_bus_t *bus, const uint8_t *tx, uint8_t *rx,
+                      uint16_t len, uint8_t fill) {
+  bus->fill = fill;
+
+  // RX side; without an rx buffer, every byte is sunk to the same place
+  LL_DMA_ConfigTransfer(
+      DMA1, SPI_DMA_RX_CHAN,
+      LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_HIGH |
+          LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+          (rx != NULL ? LL_DMA_MEMORY_INCREMENT : LL_DMA_MEMORY_NOINCREMENT) |
+          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+  LL_DMA_ConfigAddresses(DMA1, SPI_DMA_RX_CHAN,
+                         LL_SPI_DMA_GetRegAddr(bus->spi),
+                         rx != NULL ? (uint32_t)rx : (uint32_t)&bus->sink,
+                         LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+  LL_DMA_SetDataLength(DMA1, SPI_DMA_RX_CHAN, len);
+
+  // TX side; without a tx buffer, the fill byte is sent over and over
+  LL_DMA_ConfigTransfer(
+      DMA1, SPI_DMA_TX_CHAN,
+      LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_HIGH |
+          LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+          (tx != NULL ? LL_DMA_MEMORY_INCREMENT : LL_DMA_MEMORY_NOINCREMENT) |
+          LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+  LL_DMA_ConfigAddresses(DMA1, SPI_DMA_TX_CHAN,
+                         tx != NULL ? (uint32_t)tx : (uint32_t)&bus->fill,
+                         LL_SPI_DMA_GetRegAddr(bus->spi),
+                         LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+  LL_DMA_SetDataLength(DMA1, SPI_DMA_TX_CHAN, len);
+
+#if defined(RULOS_ARM_stm32g0)
+  LL_DMA_SetPeriphRequest(DMA1, SPI_DMA_RX_CHAN, LL_DMAMUX_REQ_SPI1_RX);
+  LL_DMA_SetPeriphRequest(DMA1, SPI_DMA_TX_CHAN, LL_DMAMUX_REQ_SPI1_TX);
+#endif
+
+  // RX request first, so no received byte is missed; TX last, since that
+  // starts the clock
+  LL_SPI_EnableDMAReq_RX(bus->spi);
+  LL_DMA_EnableChannel(DMA1, SPI_DMA_RX_CHAN);
+  LL_DMA_EnableChannel(DMA1, SPI_DMA_TX_CHAN);
+  LL_SPI_EnableDMAReq_TX(bus->spi);
+}
+
+static void stop_dma(spi_dma_bus_t *bus) {
+  LL_DMA_DisableChannel(DMA1, SPI_DMA_RX_CHAN);
+  LL_DMA_DisableChannel(DMA1, SPI_DMA_TX_CHAN);
+  LL_SPI_DisableDMAReq_RX(bus->spi);
+  LL_SPI_DisableDMAReq_TX(bus->spi);
+}
+
+static void finish(spi_dma_bus_t *bus, spi_dma_xfer_t *xfer, bool ok) {
+  if (xfer->hold_cs) {
+    bus->held = xfer->dev;
+  } else {
+    gpio_set(xfer->dev->cs);
+  }
+
+  xfer->ok = ok;
+  xfer->done = true;
+  if (xfer->done_rec.func != NULL) {
+    schedule_now(xfer->done_rec.func, xfer->done_rec.data);
+  }
+}
+
+// Takes the next transfer that may run off the queue: the first one, or while
+// a device is held, that device's first one.
+static spi_dma_xfer_t *dequeue(spi_dma_bus_t *bus) {
+  spi_dma_xfer_t *prev = NULL;
+  for (spi_dma_xfer_t *xfer = bus->head; xfer != NULL; xfer = xfer->next) {
+    if (bus->held == NULL || xfer->dev == bus->held) {
+      if (prev != NULL) {
+        prev->next = xfer->next;
+      } else {
+        bus->head = xfer->next;
+      }
+      if (bus->tail == xfer) {
+        bus->tail = prev;
+      }
+      return xfer;
+    }
+    prev = xfer;
+  }
+  return NULL;
+}
+
+// Start the next queued transfer if the bus is free. A held device goes ahead
+// of a pending acquire, which waits for it to let go. Called with interrupts
+// disabled, or from the DMA interrupt.
+static void kick(spi_dma_bus_t *bus) {
+  while (bus->curr == NULL && !bus->exchange_busy && bus->owner == NULL &&
+         (!bus->acquire_pending || bus->held != NULL)) {
+    spi_dma_xfer_t *xfer = dequeue(bus);
+    if (xfer == NULL) {
+      return;
+    }
+
+    // an empty transfer only matters to a device that's selected
+    if (xfer->len == 0 && bus->held == NULL && !xfer->hold_cs) {
+      finish(bus, xfer, true);
+      continue;
+    }
+
+    if (bus->held == NULL) {
+      set_prescaler(bus, xfer->dev->baud_prescaler);
+      gpio_clr(xfer->dev->cs);
+    }
+    bus->held = NULL;
+
+    if (xfer->len == 0) {
+      finish(bus, xfer, true);
+      continue;
+    }
+    bus->curr = xfer;
+    start_dma(bus, xfer->tx, xfer->rx, xfer->len, xfer->fill);
+  }
+}
+
+// The RX channel finishes last, so its completion is the end of the
+// transfer. An error on either channel also ends it, and fails it.
+static void spi_dma_irq(spi_dma_bus_t *bus) {
+  const bool error =
+      LL_DMA_IsActiveFlag_TE2(DMA1) || LL_DMA_IsActiveFlag_TE3(DMA1);
+  if (!LL_DMA_IsActiveFlag_TC2(DMA1) && !error) {
+    return;
+  }
+  LL_DMA_ClearFlag_GI2(DMA1);
+  LL_DMA_ClearFlag_GI3(DMA1);
+  stop_dma(bus);
+
+  if (bus->exchange_busy) {
+    bus->exchange_ok = !error;
+    bus->exchange_busy = false;
+    return;
+  }
+
+  spi_dma_xfer_t *xfer = bus->curr;
+  bus->curr = NULL;
+  if (xfer != NULL) {
+    finish(bus, xfer, !error);
+  }
+  kick(bus);
+}
+
+#if defined(RULOS_ARM_stm32g0)
+void DMA1_Channel2_3_IRQHandler(void) {
+  spi_dma_irq(&spi1_bus);
+}
+#elif defined(RULOS_ARM_stm32f3)
+void DMA1_Channel2_IRQHandler(void) {
+  spi_dma_irq(&spi1_bus);
+}
+void DMA1_Channel3_IRQHandler(void) {
+  spi_dma_irq(&spi1_bus);
+}
+#endif
+
+spi_dma_bus_t *spi_dma_get_bus(SPI_TypeDef *spi) {
+  assert(spi == SPI1);
+  spi_dma_bus_t *bus = &spi1_bus;
+  if (spi1_bus_initted) {
+    return bus;
+  }
+
+  // The SPI itself may not be clocked yet; its owner configures it, and the
+  // baud rate is set before the first transfer.
+  memset(bus, 0, sizeof(*bus));
+  bus->spi = spi;
+
+  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+  LL_DMA_DisableChannel(DMA1, SPI_DMA_RX_CHAN);
+  LL_DMA_DisableChannel(DMA1, SPI_DMA_TX_CHAN);
+
+#if defined(RULOS_ARM_stm32g0)
+  NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0);
+  NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+#elif defined(RULOS_ARM_stm32f3)
+  NVIC_SetPriority(DMA1_Channel2_IRQn, 0);
+  NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+  NVIC_SetPriority(DMA1_Channel3_IRQn, 0);
+  NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+#endif
+
+  LL_DMA_EnableIT_TC(DMA1, SPI_DMA_RX_CHAN);
+  LL_DMA_EnableIT_TE(DMA1, SPI_DMA_RX_CHAN);
+  LL_DMA_EnableIT_TE(DMA1, SPI_DMA_TX_CHAN);
+
+  spi1_bus_initted = true;
+  return bus;
+}
+
+void spi_dma_device_init(spi_dma_device_t *dev, spi_dma_bus_t *bus,
+                         gpio_pin_t cs, uint32_t baud_prescaler) {
+  dev->bus = bus;
+  dev->cs = cs;
+  dev->baud_prescaler = baud_prescaler;
+  gpio_set(cs);
+  gpio_make_output(cs);
+}
+
+void spi_dma_submit(spi_dma_xfer_t *xfer) {
+  spi_dma_bus_t *bus = xfer->dev->bus;
+  xfer->done = false;
+  xfer->next = NULL;
+
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  if (bus->tail != NULL) {
+    bus->tail->next = xfer;
+  } else {
+    bus->head = xfer;
+  }
+  bus->tail = xfer;
+  kick(bus);
+  hal_end_atomic(old_interrupts);
+}
+
+void spi_dma_wait(spi_dma_xfer_t *xfer) {
+  while (!xfer->done) {
+    __WFI();
+  }
+}
+
+void spi_dma_acquire(spi_dma_device_t *dev) {
+  spi_dma_bus_t *bus = dev->bus;
+
+  while (true) {
+    rulos_irq_state_t old_interrupts = hal_start_atomic();
+    if (bus->curr == NULL && bus->owner == NULL && bus->held == NULL) {
+      bus->owner = dev;
+      bus->acquire_pending = false;
+      hal_end_atomic(old_interrupts);
+      break;
+    }
+
+    // keep queued transfers from being started until we've had a turn
+    bus->acquire_pending = true;
+    hal_end_atomic(old_interrupts);
+    __WFI();
+  }
+
+  set_prescaler(bus, dev->baud_prescaler);
+}
+
+void spi_dma_release(spi_dma_device_t *dev) {
+  spi_dma_bus_t *bus = dev->bus;
+  assert(bus->owner == dev);
+
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  bus->owner = NULL;
+  kick(bus);
+  hal_end_atomic(old_interrupts);
+}
+
+void spi_dma_set_prescaler(spi_dma_device_t *dev, uint32_t baud_prescaler) {
+  dev->baud_prescaler = baud_prescaler;
+  if (dev->bus->owner == dev) {
+    set_prescaler(dev->bus, baud_prescaler);
+  }
+}
+
+bool spi_dma_exchange(spi_dma_device_t *dev, const uint8_t *tx, uint8_t *rx,
+                      uint16_t len, uint8_t fill) {
+  spi_dma_bus_t *bus = dev->bus;
+  assert(bus->owner == dev);
+  if (len == 0) {
+    return true;
+  }
+
+  bus->exchange_busy = true;
+  start_dma(bus, tx, rx, len, fill);
+
+  // the interrupt handler clears exchange_busy
+  while (bus->exchange_busy) {
+    __WFI();
+  }
+  return bus->exchange_ok;
+}
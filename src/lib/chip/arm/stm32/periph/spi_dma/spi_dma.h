@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// DMA-driven SPI transaction engine, shared by all the devices on one SPI
+// bus (SD card, MAX3421E, displays).
+//
+// Devices queue transfer descriptors with spi_dma_submit(). Each names its
+// device, whose chip-select is asserted for the length of the transfer, TX
+// and RX buffers, and an activation that's scheduled when it completes.
+// Transfers run back-to-back from the DMA completion interrupt, in the order
+// they were submitted, so the CPU is free while the bus is busy. A transfer
+// marked hold_cs leaves its device selected, and the bus reserved for the
+// device's next transfer, so a transaction can be built of several parts.
+//
+// Code that has to talk to its device synchronously (e.g. FatFS, whose disk
+// API blocks) instead acquires the bus with spi_dma_acquire(). That waits for
+// the transfer in progress, holds off queued ones until spi_dma_release(),
+// and in the meantime the owner handles its own chip-select and may use
+// spi_dma_exchange() or poll the SPI peripheral directly.
+//
+// The SPI peripheral's pins and format (mode, bit order, 8-bit frames with
+// the RX FIFO threshold at a quarter) are configured by the code that owns
+// the board's pin map; the engine only sets the baud rate, per device. Only
+// SPI1 is supported for now, on DMA1 channels 2 (RX) and 3 (TX); on the G0,
+// UART_SURRENDER_DMA1_CHAN2_3 must be defined if the uart is also in use.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/hardware.h"
+#include "core/rulos.h"
+
+#if defined(RULOS_ARM_stm32f3)
+#include "stm32f3xx_ll_bus.h"
+#include "stm32f3xx_ll_dma.h"
+#include "stm32f3xx_ll_spi.h"
+#elif defined(RULOS_ARM_stm32g0)
+#include "stm32g0xx_ll_bus.h"
+#include "stm32g0xx_ll_dma.h"
+#include "stm32g0xx_ll_spi.h"
+#else
+#error "spi_dma not yet supported on this chip"
+#include <stophere>
+#endif
+
+typedef struct spi_dma_bus_s spi_dma_bus_t;
+
+typedef struct {
+  spi_dma_bus_t *bus;
+  gpio_pin_t cs;            // active low
+  uint32_t baud_prescaler;  // LL_SPI_BAUDRATEPRESCALER_DIVx
+} spi_dma_device_t;
+
+typedef struct spi_dma_xfer_s {
+  spi_dma_device_t *dev;
+  const uint8_t *tx;  // NULL to clock out 'fill' instead
+  uint8_t *rx;        // NULL to discard the received bytes
+  uint16_t len;
+  uint8_t fill;
+  bool hold_cs;  // keep the device selected for its next transfer
+  ActivationRecord done_rec;  // scheduled when the transfer completes
+
+  // set by the engine
+  volatile bool done;
+  bool ok;  // false if a DMA error cut the transfer short
+  struct spi_dma_xfer_s *next;
+} spi_dma_xfer_t;
+
+struct spi_dma_bus_s {
+  SPI_TypeDef *spi;
+
+  // queued transfers; 'curr' is the one on the bus, if any
+  spi_dma_xfer_t *head;
+  spi_dma_xfer_t *tail;
+  spi_dma_xfer_t *curr;
+
+  // device left selected by a hold_cs transfer; only its transfers may run
+  spi_dma_device_t *held;
+
+  // synchronous use of the bus
+  spi_dma_device_t *owner;
+  volatile bool acquire_pending;
+  volatile bool exchange_busy;
+  bool exchange_ok;
+
+  uint8_t fill;   // source of TX data when a transfer has no tx buffer
+  uint8_t sink;   // destination of RX data when it has no rx buffer
+};
+
+// Returns the bus for an SPI peripheral, initializing it the first time.
+// Every device on the bus shares this one object.
+spi_dma_bus_t *spi_dma_get_bus(SPI_TypeDef *spi);
+
+void spi_dma_device_init(spi_dma_device_t *dev, spi_dma_bus_t *bus,
+                         gpio_pin_t cs, uint32_t baud_prescaler);
+
+// Queue a transfer. The descriptor and its buffers must stay valid until
+// done_rec runs (or 'done' becomes true). Safe to call from interrupt
+// handlers and from completion activations. A zero-length transfer without
+// hold_cs just deselects a held device.
+void spi_dma_submit(spi_dma_xfer_t *xfer);
+
+// Wait for a submitted transfer to finish. Blocks; don't call from an
+// interrupt handler.
+void spi_dma_wait(spi_dma_xfer_t *xfer);
+
+// Wait until the bus is idle and reserve it for 'dev', switching to its baud
+// rate. Blocks; don't call from an interrupt handler.
+void spi_dma_acquire(spi_dma_device_t *dev);
+void spi_dma_release(spi_dma_device_t *dev);
+
+// Change a device's baud rate; takes effect at its next transfer, or
+// immediately if it owns the bus.
+void spi_dma_set_prescaler(spi_dma_device_t *dev, uint32_t baud_prescaler);
+
+// Run one DMA transfer for the device that owns the bus and wait for it to
+// finish. Chip-select is left to the caller. Returns false if a DMA error cut
+// it short.
+bool spi_dma_exchange(spi_dma_device_t *dev, const uint8_t *tx, uint8_t *rx,
+                      uint16_t len, uint8_t fill);
@@ -25,6 +25,7 @@
 #include "core/hardware.h"
 #include "core/hardware_types.h"
 #include "core/rulos.h"
+#include "periph/twi/twi_stats.h"
 
 #if defined(RULOS_ARM_stm32f0)
 #define RULOS_I2C_V2
@@ -128,20 +129,51 @@
 #include <stophere>
 #endif
 
+#ifndef TWI_MAX_RETRIES
+#define TWI_MAX_RETRIES 4
+#endif
+
+#ifndef TWI_RETRY_BACKOFF_US
+#define TWI_RETRY_BACKOFF_US 1000
+#endif
+
+typedef enum {
+  TWI_SEND_IDLE,
+  TWI_SEND_ACTIVE,   // on the bus, or waiting in hardware for it to be free
+  TWI_SEND_BACKOFF,  // waiting to retry
+} TwiSendState;
+
+typedef enum {
+  TWI_RESULT_OK,
+  TWI_RESULT_NACK,       // the address was NACKed
+  TWI_RESULT_DATA_NACK,  // the address was ACKed, then some data NACKed
+  TWI_RESULT_ARB_LOST,
+  TWI_RESULT_ERROR,
+} TwiResult;
+
 typedef struct {
   MediaStateIfc media;
   I2C_TypeDef *handle;
 
   // sending
+  TwiSendState send_state;
   MediaSendDoneFunc send_done_cb;
   void *send_done_cb_data;
   uint8_t send_addr;
-  uint32_t packets_sent;
-  uint32_t packets_nacked;
-  uint32_t send_errors;
+  const void *send_data;
+  uint8_t send_len;
+  uint8_t send_retries;
+  Time send_start_us;
+  bool send_preempted;  // our start was cancelled by being addressed
 
   // receiving
   MediaRecvSlot *slaveRecvSlot;
+  bool slave_receiving;
+
+  // statistics
+  TwiDestStats dest_stats[TWI_STATS_MAX_DESTS];
+  TwiDestStats other_stats;
+  uint32_t bus_resets;
 } TwiState;
 
 // Right now the RULOS HAL interface doesn't even support multiple
@@ -164,8 +196,60 @@ static void reset_bus(TwiState *twi) {
 #endif
 }
 
+/// statistics ////
+
+static TwiDestStats *dest_stats(TwiState *twi, Addr addr) {
+  for (int i = 0; i < TWI_STATS_MAX_DESTS; i++) {
+    TwiDestStats *ds = &twi->dest_stats[i];
+    if (ds->addr == addr) {
+      return ds;
+    }
+    if (ds->addr == TWI_STATS_OTHER_ADDR) {
+      ds->addr = addr;
+      return ds;
+    }
+  }
+  return &twi->other_stats;
+}
+
+uint8_t twi_get_stats(TwiDestStats *out, uint8_t max) {
+  TwiState *twi = &g_twi[0];
+  uint8_t n = 0;
+
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  for (int i = 0; i < TWI_STATS_MAX_DESTS && n < max; i++) {
+    if (twi->dest_stats[i].addr != TWI_STATS_OTHER_ADDR) {
+      out[n++] = twi->dest_stats[i];
+    }
+  }
+  if (n < max && (twi->other_stats.sends > 0 ||
+                  twi->other_stats.failures > 0)) {
+    out[n++] = twi->other_stats;
+  }
+  hal_end_atomic(old_interrupts);
+  return n;
+}
+
+void twi_log_stats(void) {
+  TwiDestStats stats[TWI_STATS_MAX_DESTS + 1];
+  const uint8_t n = twi_get_stats(stats, TWI_STATS_MAX_DESTS + 1);
+
+  LOG("twi: %ld bus resets", g_twi[0].bus_resets);
+  for (int i = 0; i < n; i++) {
+    const TwiDestStats *ds = &stats[i];
+    LOG("twi dest 0x%x: %ld sent, %ld failed; %ld retries (%ld nack, %ld arb "
+        "lost, %ld error); latency avg %ld max %ld us",
+        ds->addr, ds->sends, ds->failures, ds->retries, ds->nacks,
+        ds->arb_lost, ds->errors,
+        ds->sends > 0 ? (uint32_t)(ds->latency_total_us / ds->sends) : 0,
+        ds->latency_max_us);
+  }
+}
+
 /////////////////////// receiving /////////////////////////////////////////
 
+static void twi_start_attempt(TwiState *twi);
+
 // Warning: runs in interrupt context.
 static void twi_recv_done(TwiState *twi) {
   // Real packet received!
@@ -200,19 +284,48 @@ static void twi_recv_event_interrupt(TwiState *twi) {
                          twi->slaveRecvSlot->capacity);
     LL_DMA_EnableChannel(rI2C1_DMA, rI2C1_DMA_RX_CHAN);
     LL_I2C_EnableDMAReq_RX(I2C1);
+    twi->slave_receiving = true;
+
+#ifdef RULOS_I2C_V2
+    // Being addressed cancels a start we're waiting to send; the send is
+    // started again once this packet is over.
+    if (twi->send_state == TWI_SEND_ACTIVE) {
+      twi->send_preempted = true;
+    }
+#endif
     LL_I2C_ClearFlag_ADDR(I2C1);
   } else if (LL_I2C_IsActiveFlag_STOP(I2C1)) {
     // Stop detected. Clear the stop flag and run the receive handler.
     LL_I2C_ClearFlag_STOP(I2C1);
+    if (!twi->slave_receiving) {
+      // the tail end of a send that has already been given up on
+      return;
+    }
+    twi->slave_receiving = false;
     LL_I2C_DisableDMAReq_RX(I2C1);
     LL_DMA_DisableChannel(rI2C1_DMA, rI2C1_DMA_RX_CHAN);
     twi_recv_done(twi);
+
+    if (twi->send_preempted) {
+      twi->send_preempted = false;
+      twi_start_attempt(twi);
+    }
   }
 }
 
 // Warning: runs in interrupt context.
-static void twi_recv_error_interrupt(TwiState *twi) {
+static void twi_recv_error_interrupt(TwiState *twi, bool bus_reset) {
   LL_I2C_DisableDMAReq_RX(I2C1);
+
+  // after a reset no stop will arrive to end the packet, so drop it
+  if (bus_reset && twi->slave_receiving) {
+    twi->slave_receiving = false;
+    LL_DMA_DisableChannel(rI2C1_DMA, rI2C1_DMA_RX_CHAN);
+    if (twi->send_preempted) {
+      twi->send_preempted = false;
+      twi_start_attempt(twi);
+    }
+  }
 }
 
 void I2C1_DMA_RX_IRQHandler(void) {
@@ -227,21 +340,86 @@ void I2C1_DMA_RX_IRQHandler(void) {
 
 /////////////////////// sending /////////////////////////////////////////
 
-#define MASTER_ACTIVE(twi) ((twi)->send_done_cb != NULL)
+#define MASTER_ACTIVE(twi) ((twi)->send_state == TWI_SEND_ACTIVE)
 
 // Warning: runs in interrupt context.
 static void twi_send_done_upcall(TwiState *twi) {
-  assert(MASTER_ACTIVE(twi));
-
-  // NB: send_done_cb must be nulled before the callback runs, since
-  // the callback is likely to want to send another packet. But,
+  // NB: the state must be idle before the callback runs, since the
+  // callback is likely to want to send another packet. But,
   // schedule_now doesn't run the callback until the scheduler runs
   // again, so this works.
-  schedule_now((ActivationFuncPtr)twi->send_done_cb, twi->send_done_cb_data);
+  if (twi->send_done_cb != NULL) {
+    schedule_now((ActivationFuncPtr)twi->send_done_cb,
+                 twi->send_done_cb_data);
+  }
+  twi->send_state = TWI_SEND_IDLE;
   twi->send_done_cb = NULL;
   twi->send_done_cb_data = NULL;
 }
 
+static void twi_retry(void *data) {
+  TwiState *twi = (TwiState *)data;
+
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  if (twi->send_state == TWI_SEND_BACKOFF) {
+    twi->send_state = TWI_SEND_ACTIVE;
+    twi_start_attempt(twi);
+  }
+  hal_end_atomic(old_interrupts);
+}
+
+// Tells apart the two ways a send can be NACKed. The TX DMA channel
+// hasn't moved a byte until the address is ACKed, so if it's still got the
+// whole packet, it was the address that the destination refused.
+static TwiResult twi_nack_result(TwiState *twi) {
+  return LL_DMA_GetDataLength(rI2C1_DMA, rI2C1_DMA_TX_CHAN) == twi->send_len
+             ? TWI_RESULT_NACK
+             : TWI_RESULT_DATA_NACK;
+}
+
+// An attempt to send the packet has ended; retry it if it failed, the
+// destination hasn't seen any of it, and it hasn't run out of retries.
+// Warning: runs in interrupt context.
+static void twi_attempt_done(TwiState *twi, TwiResult result) {
+  assert(MASTER_ACTIVE(twi));
+  TwiDestStats *ds = dest_stats(twi, twi->send_addr >> 1);
+
+  switch (result) {
+    case TWI_RESULT_OK:
+      break;
+    case TWI_RESULT_NACK:
+    case TWI_RESULT_DATA_NACK:
+      ds->nacks++;
+      break;
+    case TWI_RESULT_ARB_LOST:
+      ds->arb_lost++;
+      break;
+    case TWI_RESULT_ERROR:
+      ds->errors++;
+      break;
+  }
+
+  if (result != TWI_RESULT_OK && result != TWI_RESULT_DATA_NACK &&
+      twi->send_retries < TWI_MAX_RETRIES) {
+    ds->retries++;
+    twi->send_state = TWI_SEND_BACKOFF;
+    schedule_us((Time)TWI_RETRY_BACKOFF_US << twi->send_retries, twi_retry,
+                twi);
+    twi->send_retries++;
+    return;
+  }
+
+  if (result == TWI_RESULT_OK) {
+    const Time latency = precise_clock_time_us() - twi->send_start_us;
+    ds->sends++;
+    ds->latency_total_us += latency;
+    ds->latency_max_us = r_max(ds->latency_max_us, latency);
+  } else {
+    ds->failures++;
+  }
+  twi_send_done_upcall(twi);
+}
+
 #if defined(RULOS_I2C_V1)
 static void twi_generate_stop(TwiState *twi) {
   LL_I2C_GenerateStopCondition(I2C1);
@@ -256,10 +434,9 @@ static void twi_generate_stop(TwiState *twi) {
     timeout--;
   }
   if (timeout == 0) {
+    twi->bus_resets++;
     reset_bus(twi);
   }
-
-  twi_send_done_upcall(twi);
 }
 
 // Send event interrupts for I2C V1. Warning: runs in interrupt context.
@@ -279,41 +456,47 @@ static void twi_send_event_interrupt(TwiState *twi) {
     // is ready for the next outgoing byte. We can either respond with
     // data or a STOP to indicate there's no more. We send a stop.
     twi_generate_stop(twi);
+    twi_attempt_done(twi, TWI_RESULT_OK);
   }
 }
 
 // Send error interrupts for I2C V1. Warning: runs in interrupt context.
-static void twi_send_error_interrupt(TwiState *twi) {
-  // Generate a stop in case of any error.
-  twi_generate_stop(twi);
+static void twi_send_error_interrupt(TwiState *twi, TwiResult result) {
+  // Generate a stop in case of any error, unless we lost arbitration, in
+  // which case the bus belongs to the winner and the hardware has already
+  // let go of it.
+  LL_I2C_DisableDMAReq_TX(I2C1);
+  if (result != TWI_RESULT_ARB_LOST) {
+    twi_generate_stop(twi);
+  }
+  twi_attempt_done(twi, result);
 }
 
 #elif defined(RULOS_I2C_V2)
 
 // Send event interrupts for I2C V2. Warning: runs in interrupt context.
 static void twi_send_event_interrupt(TwiState *twi) {
-  // Transmit-complete: successful transmission.
+  // Transmit-complete: successful transmission, unless the packet was
+  // NACKed, after which the hardware sends the stop itself.
   if (LL_I2C_IsActiveFlag_STOP(I2C1)) {
     LL_I2C_ClearFlag_STOP(I2C1);
+    LL_I2C_DisableDMAReq_TX(I2C1);
 
-    // Check to see if we got a NACK. Doesn't really do anything but
-    // statistics collection.
     if (LL_I2C_IsActiveFlag_NACK(I2C1)) {
       LL_I2C_ClearFlag_NACK(I2C1);
-      twi->packets_nacked++;
+      twi_attempt_done(twi, twi_nack_result(twi));
     } else {
-      twi->packets_sent++;
+      twi_attempt_done(twi, TWI_RESULT_OK);
     }
-    twi_send_done_upcall(twi);
   }
 }
 
 // Warning: runs in interrupt context.
-static void twi_send_error_interrupt(TwiState *twi) {
-  // V2 uses autostop, so generate send-done upcall; no need to
-  // generate a stop.
-  twi->send_errors++;
-  twi_send_done_upcall(twi);
+static void twi_send_error_interrupt(TwiState *twi, TwiResult result) {
+  // V2 uses autostop, and after losing arbitration the hardware has
+  // already let go of the bus, so there's no need to generate a stop.
+  LL_I2C_DisableDMAReq_TX(I2C1);
+  twi_attempt_done(twi, result);
 }
 #else
 #include <stophere>
@@ -327,33 +510,26 @@ void rI2C1_DMA_TX_IRQHandler(void) {
   LL_I2C_DisableDMAReq_TX(I2C1);
 }
 
-static void twi_send(MediaStateIfc *media, Addr dest_addr, const void *data,
-                     uint8_t len, MediaSendDoneFunc send_done_cb,
-                     void *send_done_cb_data) {
-#ifdef TIMING_DEBUG_PIN
-  gpio_set(TIMING_DEBUG_PIN);
-#endif
-
-  // If we ever support multiple TWI interfaces, add a lookup based on
-  // id here.
-  TwiState *twi = &g_twi[0];
-
-  assert(!MASTER_ACTIVE(twi));
-
+// Start (or restart) sending the current packet. The hardware holds the
+// start condition until the bus is free, and the I2C interrupts report how
+// it went, so nothing here waits for another master to finish.
+static void twi_start_attempt(TwiState *twi) {
   LL_DMA_DisableChannel(rI2C1_DMA, rI2C1_DMA_TX_CHAN);
   LL_DMA_ConfigAddresses(
-      rI2C1_DMA, rI2C1_DMA_TX_CHAN, (uint32_t)data,
+      rI2C1_DMA, rI2C1_DMA_TX_CHAN, (uint32_t)twi->send_data,
 #if defined(RULOS_I2C_V1)
       LL_I2C_DMA_GetRegAddr(I2C1),
 #elif defined(RULOS_I2C_V2)
       LL_I2C_DMA_GetRegAddr(I2C1, LL_I2C_DMA_REG_DATA_TRANSMIT),
 #endif
       LL_DMA_GetDataTransferDirection(rI2C1_DMA, rI2C1_DMA_TX_CHAN));
-  LL_DMA_SetDataLength(rI2C1_DMA, rI2C1_DMA_TX_CHAN, len);
+  LL_DMA_SetDataLength(rI2C1_DMA, rI2C1_DMA_TX_CHAN, twi->send_len);
   LL_DMA_EnableChannel(rI2C1_DMA, rI2C1_DMA_TX_CHAN);
 #ifdef RULOS_I2C_V2
-  // V2 enables DMA immediately because it auto-transmits the
+  // A NACKed attempt can leave a byte behind in TXDR; flush it. V2
+  // enables DMA immediately because it auto-transmits the
   // address. V1 only enables DMA once address has been transmitted.
+  LL_I2C_ClearFlag_TXE(I2C1);
   LL_I2C_EnableDMAReq_TX(I2C1);
 #endif
 
@@ -366,29 +542,51 @@ static void twi_send(MediaStateIfc *media, Addr dest_addr, const void *data,
   CLEAR_BIT(I2C1->CR1, I2C_CR1_STOP);
 #endif
 
-  // Wait for the current transaction to be complete, if any. Then,
-  // atomically enable master mode.
+  // Don't start while a packet is arriving; being addressed would just
+  // cancel the start. The receive handler starts us once it's over.
   rulos_irq_state_t old_interrupts = hal_start_atomic();
-  while (LL_I2C_IsActiveFlag_BUSY(I2C1)) {
+  if (twi->slave_receiving) {
+    twi->send_preempted = true;
     hal_end_atomic(old_interrupts);
-    __WFI();
-    old_interrupts = hal_start_atomic();
+    return;
   }
 
-  twi->send_done_cb = send_done_cb;
-  twi->send_done_cb_data = send_done_cb_data;
-  twi->send_addr = dest_addr << 1;  // add "write" bit
   LL_I2C_AcknowledgeNextData(I2C1, LL_I2C_ACK);
 
 #if defined(RULOS_I2C_V1)
   LL_I2C_GenerateStartCondition(I2C1);
 #elif defined(RULOS_I2C_V2)
-  LL_I2C_HandleTransfer(I2C1, twi->send_addr, LL_I2C_ADDRSLAVE_7BIT, len,
-                        LL_I2C_MODE_AUTOEND, LL_I2C_GENERATE_START_WRITE);
+  LL_I2C_HandleTransfer(I2C1, twi->send_addr, LL_I2C_ADDRSLAVE_7BIT,
+                        twi->send_len, LL_I2C_MODE_AUTOEND,
+                        LL_I2C_GENERATE_START_WRITE);
 #else
 #include <stophere>
 #endif
   hal_end_atomic(old_interrupts);
+}
+
+static void twi_send(MediaStateIfc *media, Addr dest_addr, const void *data,
+                     uint8_t len, MediaSendDoneFunc send_done_cb,
+                     void *send_done_cb_data) {
+#ifdef TIMING_DEBUG_PIN
+  gpio_set(TIMING_DEBUG_PIN);
+#endif
+
+  // If we ever support multiple TWI interfaces, add a lookup based on
+  // id here.
+  TwiState *twi = &g_twi[0];
+
+  assert(twi->send_state == TWI_SEND_IDLE);
+
+  twi->send_done_cb = send_done_cb;
+  twi->send_done_cb_data = send_done_cb_data;
+  twi->send_addr = dest_addr << 1;  // add "write" bit
+  twi->send_data = data;
+  twi->send_len = len;
+  twi->send_retries = 0;
+  twi->send_start_us = precise_clock_time_us();
+  twi->send_state = TWI_SEND_ACTIVE;
+  twi_start_attempt(twi);
 
 #ifdef TIMING_DEBUG_PIN
   gpio_clr(TIMING_DEBUG_PIN);
@@ -406,6 +604,10 @@ MediaStateIfc *hal_twi_init(uint32_t speed_khz, Addr local_addr,
   twi->handle = I2C1;
   twi->media.send = &twi_send;
   twi->slaveRecvSlot = slaveRecvSlot;
+  for (int i = 0; i < TWI_STATS_MAX_DESTS; i++) {
+    twi->dest_stats[i].addr = TWI_STATS_OTHER_ADDR;
+  }
+  twi->other_stats.addr = TWI_STATS_OTHER_ADDR;
 
   // Enable clocks
   rI2C1_SCL_GPIO_CLK_ENABLE();
@@ -542,10 +744,20 @@ MediaStateIfc *hal_twi_init(uint32_t speed_khz, Addr local_addr,
 
 //// interrupt handler trampolines
 
+// A send may be waiting for the bus while someone else addresses us, so
+// events go to the sender only once it's actually the master.
 void I2C1_EV_IRQHandler(void) {
   TwiState *twi = &g_twi[0];
 
-  if (MASTER_ACTIVE(twi)) {
+#if defined(RULOS_I2C_V1)
+  const bool to_sender = MASTER_ACTIVE(twi) && LL_I2C_IsActiveFlag_MSL(I2C1);
+#elif defined(RULOS_I2C_V2)
+  const bool to_sender = MASTER_ACTIVE(twi) && !twi->slave_receiving &&
+                         !LL_I2C_IsActiveFlag_ADDR(I2C1);
+#else
+#include <stophere>
+#endif
+  if (to_sender) {
     twi_send_event_interrupt(twi);
   } else {
     twi_recv_event_interrupt(twi);
@@ -555,31 +767,36 @@ void I2C1_EV_IRQHandler(void) {
 void I2C1_ER_IRQHandler(void) {
   TwiState *twi = &g_twi[0];
 
-  // In the future, if the send-done callback wants to differentiate
-  // between different kinds of error, it can be recorded here and
-  // passed into twi_send_done.
+  // The cause decides whether a send is retried, and is counted in the
+  // statistics.
+  TwiResult result = TWI_RESULT_ERROR;
+  bool bus_reset = false;
   if (LL_I2C_IsActiveFlag_BERR(I2C1)) {
     // Bus error. Reset the I2C interface in hopes of recovering.
     LL_I2C_ClearFlag_BERR(I2C1);
+    twi->bus_resets++;
     reset_bus(twi);
+    bus_reset = true;
   }
   if (LL_I2C_IsActiveFlag_ARLO(I2C1)) {
-    // Arbitration lost, meaning we couldn't acquire the bus.
+    // Arbitration lost, meaning another master got the bus.
     LL_I2C_ClearFlag_ARLO(I2C1);
+    result = TWI_RESULT_ARB_LOST;
   }
 #ifdef RULOS_I2C_V1
   if (LL_I2C_IsActiveFlag_AF(I2C1)) {
-    // Destination address didn't ack when we sent their address.
+    // Destination didn't ack their address, or some of the data.
     LL_I2C_ClearFlag_AF(I2C1);
+    result = twi_nack_result(twi);
   }
 #endif
   if (LL_I2C_IsActiveFlag_OVR(I2C1)) {
     LL_I2C_ClearFlag_OVR(I2C1);
   }
 
-  if (MASTER_ACTIVE(twi)) {
-    twi_send_error_interrupt(twi);
+  if (MASTER_ACTIVE(twi) && !twi->slave_receiving) {
+    twi_send_error_interrupt(twi, result);
   } else {
-    twi_recv_error_interrupt(twi);
+    twi_recv_error_interrupt(twi, bus_reset);
   }
 }
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Statistics kept by the STM32 TWI media about the packets it sends.
+//
+// A send whose address is NACKed, that loses arbitration to another master,
+// or that hits a bus error is retried up to TWI_MAX_RETRIES times, waiting
+// TWI_RETRY_BACKOFF_US before the first retry and twice as long before each
+// one after that. A packet that still hasn't gone through is dropped, and
+// counted as a failure. A NACK of the data is a failure right away: the
+// receiver has already taken part of the packet, and sending it again would
+// deliver it twice. The media's send-done callback doesn't say which
+// happened, so this is where to look when packets go missing.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/time.h"
+
+// counts are kept for this many destinations; the rest share one entry
+#ifndef TWI_STATS_MAX_DESTS
+#define TWI_STATS_MAX_DESTS 8
+#endif
+
+// the 'addr' of the entry shared by destinations that didn't fit
+#define TWI_STATS_OTHER_ADDR 0xff
+
+typedef struct {
+  uint8_t addr;
+
+  // packets
+  uint32_t sends;     // delivered, possibly after retries
+  uint32_t failures;  // dropped after the last retry
+
+  // failed attempts, by cause; each one that isn't the last is a retry
+  uint32_t retries;
+  uint32_t nacks;  // of the address or the data
+  uint32_t arb_lost;
+  uint32_t errors;
+
+  // time from the send being handed to the media until it was delivered
+  uint64_t latency_total_us;  // a Time would wrap after about 70 minutes
+  Time latency_max_us;
+} TwiDestStats;
+
+// Copies the stats of up to 'max' destinations into 'out', and returns how
+// many there were.
+uint8_t twi_get_stats(TwiDestStats *out, uint8_t max);
+
+// LOG a line for each destination
+void twi_log_stats(void);
@@ -1,3 +1,5 @@
+// automatically generated pin definitions, do not edit
+// generated by makepins.py avr
 
 #define GPIO_A0 (gpio_pin_t) {     .ddr = &DDRA,     .port = &PORTA,     .pin = &PINA,     .bit = PORTA0, }
 
@@ -94,3 +96,15 @@
 
 #define GPIO_D7 (gpio_pin_t) {     .ddr = &DDRD,     .port = &PORTD,     .pin = &PIND,     .bit = PORTD7, }
 
+
+#define GPIO_GROUP_A(first, count) (gpio_group_t) {     .ddr = &DDRA,     .port = &PORTA,     .mask = (uint8_t)(((1 << (count)) - 1) << (first)),     .shift = (first), }
+
+
+#define GPIO_GROUP_B(first, count) (gpio_group_t) {     .ddr = &DDRB,     .port = &PORTB,     .mask = (uint8_t)(((1 << (count)) - 1) << (first)),     .shift = (first), }
+
+
+#define GPIO_GROUP_C(first, count) (gpio_group_t) {     .ddr = &DDRC,     .port = &PORTC,     .mask = (uint8_t)(((1 << (count)) - 1) << (first)),     .shift = (first), }
+
+
+#define GPIO_GROUP_D(first, count) (gpio_group_t) {     .ddr = &DDRD,     .port = &PORTD,     .mask = (uint8_t)(((1 << (count)) - 1) << (first)),     .shift = (first), }
+
@@ -49,6 +49,14 @@ typedef struct {
   uint8_t bit;
 } gpio_pin_t;
 
+// Adjacent pins of one port that are written together; see GPIO_GROUP_x().
+typedef struct {
+  volatile uint8_t *ddr;
+  volatile uint8_t *port;
+  uint8_t mask;
+  uint8_t shift;
+} gpio_group_t;
+
 #include "autogen-pins-avr.h"
 
 /*
@@ -127,6 +135,22 @@ static inline void gpio_set_or_clr(const gpio_pin_t gpio_pin, uint8_t onoff) {
     gpio_clr(gpio_pin);
 }
 
+/* configure all the pins of a group as outputs */
+static inline void gpio_group_make_output(const gpio_group_t group) {
+  *group.ddr |= group.mask;
+}
+
+/*
+ * write the low bits of 'value' to the pins of a group, lowest bit to the
+ * group's first pin, with a single store to the port register. Like
+ * gpio_set(), this is a read-modify-write of the port, so it must not race
+ * an interrupt handler that writes other pins of the same port.
+ */
+static inline void gpio_group_write(const gpio_group_t group, uint8_t value) {
+  uint8_t bits = (uint8_t)(value << group.shift) & group.mask;
+  *group.port = (*group.port & ~group.mask) | bits;
+}
+
 /*
  * returns true if an input is being asserted LOW, false otherwise
  */
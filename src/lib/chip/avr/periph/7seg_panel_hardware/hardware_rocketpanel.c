@@ -25,6 +25,7 @@
 #include <avr/boot.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <util/delay_basic.h>
 
 #include "core/board_defs.h"
@@ -45,48 +46,10 @@ void boardbus_sleep();
 
 //////////////////////////////////////////////////////////////////////////////
 
-static uint8_t segmentRemapTables[4][8] = {
-#define SRT_SUBU 0
-    {0, 1, 2, 3, 4, 5, 6, 7},
-#define SRT_SDBU 1
-    // swap decimal point with segment H, which are the nodes reversed
-    // when an LED is mounted upside-down
-    {0, 1, 2, 3, 4, 5, 7, 6},
-#define SRT_SUBD 2
-    {3, 4, 5, 0, 1, 2, 6, 7},
-#define SRT_SDBD 3
-    {3, 4, 5, 0, 1, 2, 7, 6},
-};
-typedef uint8_t SegmentRemapIndex;
-
-typedef struct {
-  bool reverseDigits;
-  SegmentRemapIndex segmentRemapIndices[8];
-} BoardRemap;
-
-static BoardRemap boardRemapTables[] = {
-#define BRT_SOLDERED_UP_BOARD_UP 0
-    {FALSE,
-     {SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SUBU,
-      SRT_SUBU}},
-#define BRT_SOLDERED_DN_BOARD_DN 1
-    {TRUE,
-     {SRT_SDBD, SRT_SDBD, SRT_SDBD, SRT_SDBD, SRT_SDBD, SRT_SDBD, SRT_SDBD,
-      SRT_SDBD}},
-#define BRT_WALLCLOCK 2
-    //	{ FALSE, { SRT_SUBU, SRT_SUBU, SRT_SDBU, SRT_SUBU, SRT_SDBU, SRT_SUBU,
-    // SRT_SUBU, SRT_SUBU }},
-    {FALSE,
-     {SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SDBU, SRT_SUBU, SRT_SDBU, SRT_SUBU,
-      SRT_SUBU}},
-#define BRT_CHASECLOCK 3
-    {FALSE,
-     {SRT_SUBU, SRT_SDBU, SRT_SUBU, SRT_SUBU, SRT_SUBU, SRT_SDBU, SRT_SUBU,
-      SRT_SUBU}},
-};
-typedef uint8_t BoardRemapIndex;
-
-static BoardRemapIndex displayConfiguration[NUM_LOCAL_BOARDS];
+// rocketpanel_remap[board][digit][segment] gives the physical digit and
+// segment to select, packed as (digit << 3) | segment. The table is generated
+// at build time for the BOARDCONFIG by src/util/rocketpanel_remap.py.
+#include "lib/chip/avr/periph/7seg_panel_hardware/rocketpanel_remap.ch"
 
 static const uint16_t g_epb_delay_constant = 1;
 void epb_delay() {
@@ -99,46 +62,73 @@ void epb_delay() {
 
 void hal_program_segment(uint8_t board, uint8_t digit, uint8_t segment,
                          uint8_t onoff) {
+  hal_program_segments(board, digit, 1 << segment, onoff ? (1 << segment) : 0);
+}
+
+// The board and digit select lines are set up once; then each segment only
+// needs its select lines, data and a strobe.
+void hal_program_segments(uint8_t board, uint8_t digit, uint8_t segment_mask,
+                          uint8_t onoff_bits) {
   if (!g_boardbus_is_awake) {
     boardbus_wake();
   }
-  BoardRemap *br = &boardRemapTables[displayConfiguration[board]];
-  uint8_t rdigit;
-  if (br->reverseDigits) {
-    rdigit = digit;
-  } else {
-    rdigit = NUM_DIGITS - 1 - digit;
-  }
-  uint8_t asegment =
-      segmentRemapTables[br->segmentRemapIndices[rdigit]][segment];
-
+  const uint8_t *remap = rocketpanel_remap[board][digit];
+  uint8_t rdigit = pgm_read_byte(&remap[0]) >> 3;
+
+  // Boards whose select lines are adjacent pins of one port define them as a
+  // pin group in board_defs.h, so each 3-bit value is one port write.
+#ifdef DIGSEL_GROUP
+  gpio_group_write(DIGSEL_GROUP, rdigit);
+#else
   gpio_set_or_clr(DIGSEL0, rdigit & (1 << 0));
   gpio_set_or_clr(DIGSEL1, rdigit & (1 << 1));
   gpio_set_or_clr(DIGSEL2, rdigit & (1 << 2));
+#endif
 
-  gpio_set_or_clr(SEGSEL0, asegment & (1 << 0));
-  gpio_set_or_clr(SEGSEL1, asegment & (1 << 1));
-  gpio_set_or_clr(SEGSEL2, asegment & (1 << 2));
-
+#ifdef BOARDSEL_GROUP
+  gpio_group_write(BOARDSEL_GROUP, board);
+#else
   gpio_set_or_clr(BOARDSEL0, board & (1 << 0));
   gpio_set_or_clr(BOARDSEL1, board & (1 << 1));
   gpio_set_or_clr(BOARDSEL2, board & (1 << 2));
+#endif
+
+  for (uint8_t segment = 0; segment_mask != 0;
+       segment++, segment_mask >>= 1, onoff_bits >>= 1) {
+    if (!(segment_mask & 1)) {
+      continue;
+    }
+
+    uint8_t asegment = pgm_read_byte(&remap[segment]) & 0x7;
+#ifdef SEGSEL_GROUP
+    gpio_group_write(SEGSEL_GROUP, asegment);
+#else
+    gpio_set_or_clr(SEGSEL0, asegment & (1 << 0));
+    gpio_set_or_clr(SEGSEL1, asegment & (1 << 1));
+    gpio_set_or_clr(SEGSEL2, asegment & (1 << 2));
+#endif
 
-  /* sense reversed because cathode is common */
-  gpio_set_or_clr(DATA, !onoff);
+    /* sense reversed because cathode is common */
+    gpio_set_or_clr(DATA, !(onoff_bits & 1));
 
-  epb_delay();
+    epb_delay();
 
-  gpio_clr(STROBE);
+    gpio_clr(STROBE);
 
-  epb_delay();
+    epb_delay();
 
-  gpio_set(STROBE);
+    gpio_set(STROBE);
 
-  epb_delay();
+    epb_delay();
+  }
 }
 
-void hal_7seg_bus_enter_sleep() { boardbus_sleep(); }
+// Nothing to do if no segments were programmed since the last sleep
+void hal_7seg_bus_enter_sleep() {
+  if (g_boardbus_is_awake) {
+    boardbus_sleep();
+  }
+}
 
 /*************************************************************************************/
 
@@ -184,30 +174,6 @@ void boardbus_sleep() {
 void hal_init_rocketpanel() {
   // Init pins used by rocketpanel bus
   boardbus_sleep();
-
-  // This code is static per binary; could save some code space
-  // by using #ifdefs instead of dynamic code.
-  for (int i = 0; i < NUM_LOCAL_BOARDS; i++) {
-    displayConfiguration[i] = BRT_SOLDERED_UP_BOARD_UP;
-  }
-
-#if defined(BOARDCONFIG_ROCKET0)
-  displayConfiguration[0] = BRT_WALLCLOCK;
-  displayConfiguration[3] = BRT_SOLDERED_DN_BOARD_DN;
-  displayConfiguration[4] = BRT_SOLDERED_DN_BOARD_DN;
-#elif defined(BOARDCONFIG_ROCKET1)
-  displayConfiguration[2] = BRT_SOLDERED_DN_BOARD_DN;
-#elif defined(BOARDCONFIG_ROCKETDONGLENORTH)
-  displayConfiguration[0] = BRT_WALLCLOCK;
-  displayConfiguration[3] = BRT_SOLDERED_DN_BOARD_DN;
-  displayConfiguration[4] = BRT_SOLDERED_DN_BOARD_DN;
-#elif defined(BOARDCONFIG_ROCKETDONGLESOUTH)
-  displayConfiguration[2] = BRT_SOLDERED_DN_BOARD_DN;
-#elif defined(BOARDCONFIG_WALLCLOCK)
-  displayConfiguration[0] = BRT_WALLCLOCK;
-#elif defined(BOARDCONFIG_CHASECLOCK)
-  displayConfiguration[0] = BRT_CHASECLOCK;
-#endif
 }
 
 void debug_abuse_epb() {
@@ -56,7 +56,8 @@ void glcd_complete_init(GLCD *glcd);
 // kudos for reference code from:
 // http://en.radzio.dxp.pl/sed1520/sed1520.zip
 
-#define DISPLAY_WIDTH 122
+#define DISPLAY_WIDTH GLCD_DISPLAY_WIDTH
+#define UNIT_WIDTH    (DISPLAY_WIDTH / 2)
 
 #define GLCD_EVENT_BUSY 0x80
 #define GLCD_EVENT_RESET 0x10
@@ -195,6 +196,12 @@ static void glcd_write_data(uint8_t data, uint8_t unit) {
 void glcd_init(GLCD *glcd, ActivationFuncPtr done_func, void *done_data) {
   glcd->done_act.func = done_func;
   glcd->done_act.data = done_data;
+  glcd->ready = false;
+  glcd->flush_scheduled = false;
+  glcd->panel_unknown = (1 << GLCD_NUM_PAGES) - 1;
+  memset(glcd->dirty_x0, 0, sizeof(glcd->dirty_x0));
+  memset(glcd->dirty_x1, 0, sizeof(glcd->dirty_x1));
+  glcd_clear_framebuffer(glcd);
 
   // set up fixed I/O pins
   glcd_set_bus_dir(GLCD_WRITE);
@@ -230,6 +237,7 @@ void glcd_complete_init(GLCD *glcd) {
 
   // turn on the backlight
   gpio_set(GLCD_VBL);
+  glcd->ready = true;
 
   {
     glcd_clear_framebuffer(glcd);
@@ -310,6 +318,24 @@ static uint8_t _glcd_fetch_column(GLCD *glcd, uint8_t page, uint8_t col) {
          (((glcd->framebuffer[y_base + 7][x_byte] >> x_bit_shift) & 1) << 7);
 }
 
+void glcd_mark_dirty(GLCD *glcd, int16_t x0, int16_t x1) {
+  x0 = r_max(x0, 0);
+  x1 = r_min(x1, DISPLAY_WIDTH);
+  if (x0 >= x1) {
+    return;
+  }
+  uint8_t page;
+  for (page = 0; page < GLCD_NUM_PAGES; page++) {
+    if (glcd->dirty_x0[page] >= glcd->dirty_x1[page]) {
+      glcd->dirty_x0[page] = x0;
+      glcd->dirty_x1[page] = x1;
+    } else {
+      glcd->dirty_x0[page] = r_min(glcd->dirty_x0[page], x0);
+      glcd->dirty_x1[page] = r_max(glcd->dirty_x1[page], x1);
+    }
+  }
+}
+
 void glcd_clear_framebuffer(GLCD *glcd) {
   int r, b;
   for (r = 0; r < BITMAP_NUM_ROWS; r++) {
@@ -317,24 +343,73 @@ void glcd_clear_framebuffer(GLCD *glcd) {
       glcd->framebuffer[r][b] = 0;
     }
   }
+  glcd_mark_dirty(glcd, 0, DISPLAY_WIDTH);
 }
 
-void glcd_draw_framebuffer(GLCD *glcd) {
-  uint8_t page, column;
-  for (page = 0; page < 4; page++) {
-    glcd_write_cmd(GLCD_CMD_SET_PAGE | page, 0);
-    glcd_write_cmd(GLCD_CMD_SET_COLUMN | 0, 0);
-    for (column = 0; column < (DISPLAY_WIDTH / 2); column++) {
-      uint8_t colval = _glcd_fetch_column(glcd, page, column);
-      glcd_write_data(colval, 0);
+// Writes the columns in [x0, x1) of one page that differ from what's on the
+// panel. x0 and x1 must be on the same controller unit.
+static void _glcd_flush_range(GLCD *glcd, uint8_t page, uint8_t x0,
+                              uint8_t x1) {
+  const uint8_t unit = (x0 >= UNIT_WIDTH) ? 1 : 0;
+  const uint8_t unit_x0 = unit ? UNIT_WIDTH : 0;
+  const bool force = glcd->panel_unknown & (1 << page);
+  bool positioned = false;
+  uint8_t column;
+  for (column = x0; column < x1; column++) {
+    uint8_t colval = _glcd_fetch_column(glcd, page, column);
+    if (!force && colval == glcd->panel[page][column]) {
+      // The controller's column address won't match the next write.
+      positioned = false;
+      continue;
     }
-    glcd_write_cmd(GLCD_CMD_SET_PAGE | page, 1);
-    glcd_write_cmd(GLCD_CMD_SET_COLUMN | 0, 1);
-    for (column = (DISPLAY_WIDTH / 2); column < DISPLAY_WIDTH; column++) {
-      uint8_t colval = _glcd_fetch_column(glcd, page, column);
-      glcd_write_data(colval, 1);
+    if (!positioned) {
+      glcd_write_cmd(GLCD_CMD_SET_PAGE | page, unit);
+      glcd_write_cmd(GLCD_CMD_SET_COLUMN | (column - unit_x0), unit);
+      positioned = true;
+    }
+    glcd_write_data(colval, unit);
+    glcd->panel[page][column] = colval;
+  }
+}
+
+// Flushes one dirty page, then yields to the scheduler if there are more.
+static void _glcd_flush(GLCD *glcd) {
+  glcd->flush_scheduled = false;
+
+  uint8_t page;
+  for (page = 0; page < GLCD_NUM_PAGES; page++) {
+    if (glcd->dirty_x0[page] < glcd->dirty_x1[page]) {
+      break;
     }
   }
+  if (page == GLCD_NUM_PAGES) {
+    return;
+  }
+
+  uint8_t x0 = glcd->dirty_x0[page];
+  uint8_t x1 = glcd->dirty_x1[page];
+  glcd->dirty_x0[page] = glcd->dirty_x1[page] = 0;
+
+  if (x0 < UNIT_WIDTH) {
+    _glcd_flush_range(glcd, page, x0, r_min(x1, UNIT_WIDTH));
+  }
+  if (x1 > UNIT_WIDTH) {
+    _glcd_flush_range(glcd, page, r_max(x0, UNIT_WIDTH), x1);
+  }
+  if (x0 == 0 && x1 == DISPLAY_WIDTH) {
+    glcd->panel_unknown &= ~(1 << page);
+  }
+
+  glcd_draw_framebuffer(glcd);
+}
+
+void glcd_draw_framebuffer(GLCD *glcd) {
+  // Before the controller is reset, the dirty ranges just accumulate;
+  // glcd_complete_init flushes them.
+  if (glcd->ready && !glcd->flush_scheduled) {
+    glcd->flush_scheduled = true;
+    schedule_now((ActivationFuncPtr)_glcd_flush, glcd);
+  }
 }
 
 uint8_t _glcd_find_glyph_index(char glyph) {
@@ -378,5 +453,6 @@ uint8_t glcd_paint_char(GLCD *glcd, char glyph, int16_t dx0, bool invert) {
       }
     }
   }
+  glcd_mark_dirty(glcd, dx0, dx);
   return dx - dx0;
 }
@@ -1,5 +1,5 @@
 // automatically generated pin definitions, do not edit
-// generated by /home/jelson/projects/rocket/src/util/makepins.py
+// generated by makepins.py esp32
 #define GPIO_0 0
 #define GPIO_1 1
 #define GPIO_2 2
@@ -32,3 +32,7 @@
 #define GPIO_29 29
 #define GPIO_30 30
 #define GPIO_31 31
+
+// Groups are limited to GPIOs 0-31, which share one set of registers.
+#define GPIO_GROUP(first, count) ((gpio_group_t) {     .mask = ((1UL << (count)) - 1) << (first),     .shift = (first), })
+
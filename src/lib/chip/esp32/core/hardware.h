@@ -39,6 +39,12 @@ static const int RULOS_ESP32_CORE_ID = 1;
 
 typedef uint32_t gpio_pin_t;
 
+// Adjacent GPIOs below 32 that are written together; see GPIO_GROUP().
+typedef struct {
+  uint32_t mask;
+  uint8_t shift;
+} gpio_group_t;
+
 /* configure a pin as output */
 static inline void gpio_make_output(const gpio_pin_t pin) {
   if (pin > 33) {
@@ -83,6 +89,21 @@ static inline void gpio_set_or_clr(const gpio_pin_t pin, uint8_t onoff) {
   }
 }
 
+/* configure all the pins of a group as outputs */
+static inline void gpio_group_make_output(const gpio_group_t group) {
+  GPIO.enable_w1ts = group.mask;
+}
+
+/*
+ * write the low bits of 'value' to the pins of a group, lowest bit to the
+ * group's first pin, using the set and clear registers so no read is needed
+ */
+static inline void gpio_group_write(const gpio_group_t group, uint32_t value) {
+  uint32_t bits = (value << group.shift) & group.mask;
+  GPIO.out_w1ts = bits;
+  GPIO.out_w1tc = group.mask & ~bits;
+}
+
 /*
  * configure a pin as input, without touching the pullup config register
  *
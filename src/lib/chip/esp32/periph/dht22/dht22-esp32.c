@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// rulos includes
+#include "core/hardware.h"
+#include "core/rulos.h"
+#include "periph/dht22/dht22.h"
+
+// esp32 includes
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+// Datasheet says "at least 1ms"
+#define DHT22_START_PULSE_US 1100
+
+static void dht22_edge_isr(void *arg) {
+  dht22_edge((dht22_t *)arg, (uint32_t)esp_timer_get_time());
+}
+
+// End of the start pulse: let the pullup raise the line, after which the
+// sensor responds, and watch for its edges. (Setting the pullup rewrites the
+// pin's interrupt configuration, so it has to come first.)
+static void dht22_release(void *arg) {
+  dht22_t *dht = (dht22_t *)arg;
+  gpio_make_input_enable_pullup(dht->pin);
+  gpio_set_intr_type((gpio_num_t)dht->pin, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable((gpio_num_t)dht->pin);
+}
+
+void dht22_hal_start(dht22_t *dht) {
+  // The start pulse is timed with an esp_timer, since it's much shorter
+  // than the jiffy clock's period.
+  if (dht->hal == NULL) {
+    const esp_timer_create_args_t args = {
+        .callback = dht22_release,
+        .arg = dht,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "dht22",
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+    dht->hal = timer;
+    gpio_isr_handler_add((gpio_num_t)dht->pin, dht22_edge_isr, dht);
+  }
+
+  gpio_make_output(dht->pin);
+  gpio_clr(dht->pin);
+  ESP_ERROR_CHECK(
+      esp_timer_start_once((esp_timer_handle_t)dht->hal, DHT22_START_PULSE_US));
+}
+
+void dht22_hal_stop(dht22_t *dht) {
+  esp_timer_stop((esp_timer_handle_t)dht->hal);
+  gpio_intr_disable((gpio_num_t)dht->pin);
+}
@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 
 #include <algorithm>
 
@@ -140,9 +141,17 @@ void inet_wifi_client_start(const inet_wifi_creds_t *wifi_creds,
 HttpsClient::HttpsClient(int timeout_ms, const char *cert) {
   _timeout_ms = timeout_ms;
   _cert = cert;
-  _in_use = false;
+  _num_headers = 0;
+  _response_buffer = NULL;
+  _response_buffer_len = 0;
   _terminate = false;
+  _queue_head = 0;
+  _num_queued = 0;
   _client = NULL;
+  _worker_idx = 0;
+  _curr_req = NULL;
+  _connected = false;
+  _server_closing = false;
   _worker_thread_running = false;
 }
 
@@ -151,8 +160,9 @@ void HttpsClient::_maybeStartWorkerThread() {
     return;
   }
 
-  // Create semaphores used for inter-task coordination
-  _req_ready = xSemaphoreCreateBinary();
+  // Create semaphores used for inter-task coordination. _req_ready counts the
+  // requests the worker has not yet started.
+  _req_ready = xSemaphoreCreateCounting(HTTPS_QUEUE_LEN + 1, 0);
   _worker_ready = xSemaphoreCreateBinary();
 
   // Create a task to perform the blocking HTTPS requests.
@@ -177,12 +187,21 @@ HttpsClient::~HttpsClient() {
 }
 
 bool HttpsClient::is_in_use() {
-  return _in_use;
+  return _num_queued == HTTPS_QUEUE_LEN;
 }
 
 void HttpsClient::set_header(const char *header, const char *value) {
-  _maybeStartWorkerThread();
-  ESP_ERROR_CHECK(esp_http_client_set_header(_client, header, value));
+  for (int i = 0; i < _num_headers; i++) {
+    if (!strcasecmp(_headers[i][0], header)) {
+      _headers[i][1] = value;
+      return;
+    }
+  }
+
+  assert(_num_headers < HTTPS_MAX_HEADERS);
+  _headers[_num_headers][0] = header;
+  _headers[_num_headers][1] = value;
+  _num_headers++;
 }
 
 void HttpsClient::set_response_buffer(char *buf, size_t len) {
@@ -195,22 +214,34 @@ esp_err_t HttpsClient::_event_handler_trampoline(esp_http_client_event_t *evt) {
   return c->_event_handler(evt);
 }
 
+// warning: runs on a separate task!
 esp_err_t HttpsClient::_event_handler(esp_http_client_event_t *evt) {
   switch (evt->event_id) {
     case HTTP_EVENT_ERROR:
       LOG("HTTPS Client: Error on http operation");
       break;
+    case HTTP_EVENT_ON_CONNECTED:
+      LOG("HTTPS Client: connected to server");
+      break;
+    case HTTP_EVENT_DISCONNECTED:
+      _connected = false;
+      break;
     case HTTP_EVENT_ON_HEADER:
       LOG("HTTPS Client: got an http header: key=%s, value=%s", evt->header_key,
           evt->header_value);
+      if (!strcasecmp(evt->header_key, "Connection") &&
+          !strcasecmp(evt->header_value, "close")) {
+        _server_closing = true;
+      }
       break;
     case HTTP_EVENT_ON_DATA: {
+      request_t *req = _curr_req;
       size_t data_to_store =
           r_min((size_t)evt->data_len,
-                _response_buffer_len - _response_bytes_written);
-      memcpy(_response_buffer + _response_bytes_written, evt->data,
+                req->response_buffer_len - req->response_bytes_written);
+      memcpy(req->response_buffer + req->response_bytes_written, evt->data,
              data_to_store);
-      _response_bytes_written += data_to_store;
+      req->response_bytes_written += data_to_store;
     }
     default:
       break;
@@ -219,31 +250,63 @@ esp_err_t HttpsClient::_event_handler(esp_http_client_event_t *evt) {
   return ESP_OK;
 }
 
-void HttpsClient::get(const char *url, HttpsHandlerIfc *on_done) {
-  post(url, NULL, 0, on_done);
-}
-
-void HttpsClient::post(const char *url, const char *post_body, size_t body_len,
-                       HttpsHandlerIfc *on_done) {
+// Fills in the common parts of a new request at the end of the queue. The
+// request is not visible to the worker until _submit_request() is called.
+HttpsClient::request_t *HttpsClient::_new_request(const char *url,
+                                                  HttpsHandlerIfc *on_done) {
   _maybeStartWorkerThread();
 
-  assert(!_in_use);
+  assert(_num_queued < HTTPS_QUEUE_LEN);
   assert(_response_buffer != NULL);
   assert(_response_buffer_len != 0);
-  _response_bytes_written = 0;
-  _on_done = on_done;
-  _in_use = true;
+  assert(strlen(url) < HTTPS_MAX_URL_LEN);
+
+  request_t *req = &_queue[(_queue_head + _num_queued) % HTTPS_QUEUE_LEN];
+  strcpy(req->url, url);
+  req->body = NULL;
+  req->body_len = 0;
+  req->body_source = NULL;
+  memcpy(req->headers, _headers, sizeof(_headers));
+  req->num_headers = _num_headers;
+  req->on_done = on_done;
+  req->response_buffer = _response_buffer;
+  req->response_buffer_len = _response_buffer_len;
+  req->response_bytes_written = 0;
+  req->result_code = -1;
+  return req;
+}
 
-  ESP_ERROR_CHECK(esp_http_client_set_url(_client, url));
+void HttpsClient::_submit_request() {
+  _num_queued++;
+  xSemaphoreGive(_req_ready);
+}
 
-  if (post_body != NULL) {
-    esp_http_client_set_method(_client, HTTP_METHOD_POST);
-    esp_http_client_set_post_field(_client, post_body, body_len);
-  } else {
-    esp_http_client_set_method(_client, HTTP_METHOD_GET);
+void HttpsClient::get(const char *url, HttpsHandlerIfc *on_done) {
+  request_t *req = _new_request(url, on_done);
+  req->method = HTTP_METHOD_GET;
+  _submit_request();
+}
+
+void HttpsClient::post(const char *url, const char *post_body, size_t body_len,
+                       HttpsHandlerIfc *on_done) {
+  if (post_body == NULL) {
+    get(url, on_done);
+    return;
   }
 
-  xSemaphoreGive(_req_ready);
+  request_t *req = _new_request(url, on_done);
+  req->method = HTTP_METHOD_POST;
+  req->body = post_body;
+  req->body_len = body_len;
+  _submit_request();
+}
+
+void HttpsClient::post(const char *url, HttpsBodySourceIfc *body_source,
+                       HttpsHandlerIfc *on_done) {
+  request_t *req = _new_request(url, on_done);
+  req->method = HTTP_METHOD_POST;
+  req->body_source = body_source;
+  _submit_request();
 }
 
 void HttpsClient::_create_esp32_client_object() {
@@ -266,6 +329,7 @@ void HttpsClient::_create_esp32_client_object() {
 
   // ensure the client object creation did not fail
   assert(_client != NULL);
+  _connected = false;
 }
 
 void HttpsClient::_destroy_esp32_client_object() {
@@ -273,6 +337,7 @@ void HttpsClient::_destroy_esp32_client_object() {
   assert(_client != NULL);
   esp_http_client_cleanup(_client);
   _client = NULL;
+  _connected = false;
 }
 
 // little trampoline until the RULOS scheduler understands C++
@@ -283,7 +348,6 @@ void HttpsClient::_worker_thread_trampoline(void *context) {
 }
 
 void HttpsClient::_worker_thread() {
-  // create an http object so that set_header works
   _create_esp32_client_object();
 
   // tell the main thread that the worker is ready
@@ -299,22 +363,125 @@ void HttpsClient::_worker_thread() {
       return;
     }
 
-    _perform_one_op();
+    _perform_one_op(&_queue[_worker_idx]);
+    _worker_idx = (_worker_idx + 1) % HTTPS_QUEUE_LEN;
   }
 }
 
+// Sends one request and reads the response, on the current connection if
+// there is one. The connection is left open afterwards unless the server
+// said it would close it. may_retry is left set on failure only if the server
+// can't have acted on the request: nothing of the body was sent, or the
+// request is a GET and no response arrived.
+//
 // warning: runs on a separate task!
-void HttpsClient::_perform_one_op() {
-  LOG("HTTPS Client: executing request");
+esp_err_t HttpsClient::_send_request(request_t *req, bool *may_retry) {
+  *may_retry = true;
+  _server_closing = false;
+  req->response_bytes_written = 0;
+
+  // measure a streamed body first, so we can send a Content-Length header
+  size_t body_len = req->body_len;
+  size_t chunk_len;
+  if (req->body_source != NULL) {
+    body_len = 0;
+    req->body_source->rewind();
+    while ((chunk_len = req->body_source->read(_body_chunk,
+                                               sizeof(_body_chunk))) > 0) {
+      body_len += chunk_len;
+    }
+  }
 
-  esp_err_t err = esp_http_client_perform(_client);
+  esp_err_t err = esp_http_client_open(_client, body_len);
+  if (err != ESP_OK) {
+    return err;
+  }
+  _connected = true;
+
+  // once any of the body is written, the server may get the whole request
+  int written;
+  if (req->body_source != NULL) {
+    req->body_source->rewind();
+    while ((chunk_len = req->body_source->read(_body_chunk,
+                                               sizeof(_body_chunk))) > 0) {
+      written = esp_http_client_write(_client, _body_chunk, chunk_len);
+      if (written > 0) {
+        *may_retry = false;
+      }
+      if (written != (int)chunk_len) {
+        err = ESP_FAIL;
+        break;
+      }
+    }
+  } else if (body_len > 0) {
+    written = esp_http_client_write(_client, req->body, body_len);
+    if (written > 0) {
+      *may_retry = false;
+    }
+    if (written != (int)body_len) {
+      err = ESP_FAIL;
+    }
+  }
+  // without a body, the request is complete once open sends the headers;
+  // after that only a GET is safe to send again
+  if (body_len == 0 && req->method != HTTP_METHOD_GET) {
+    *may_retry = false;
+  }
+
+  if (err == ESP_OK && esp_http_client_fetch_headers(_client) < 0) {
+    err = ESP_FAIL;
+  }
 
+  // drain the response; the event handler copies it to the response buffer
   if (err == ESP_OK) {
-    _result_code = esp_http_client_get_status_code(_client);
+    *may_retry = false;
+    int read_len;
+    while ((read_len = esp_http_client_read(_client, _body_chunk,
+                                            sizeof(_body_chunk))) > 0) {
+    }
+    if (read_len < 0 || !esp_http_client_is_complete_data_received(_client)) {
+      err = ESP_FAIL;
+    }
+  }
+
+  if (err != ESP_OK || _server_closing) {
+    esp_http_client_close(_client);
+    _connected = false;
+  }
+  return err;
+}
+
+// warning: runs on a separate task!
+void HttpsClient::_perform_one_op(request_t *req) {
+  LOG("HTTPS Client: executing request: %s", req->url);
+  _curr_req = req;
+
+  for (int i = 0; i < req->num_headers; i++) {
+    esp_http_client_set_header(_client, req->headers[i][0],
+                               req->headers[i][1]);
+  }
+  esp_http_client_set_url(_client, req->url);
+  esp_http_client_set_method(_client, req->method);
+  esp_http_client_set_post_field(_client, NULL, 0);
+
+  // A kept-alive connection may have been closed by the server while it was
+  // idle, which we only find out when we try to use it. If that happens
+  // before the server could have acted on the request, try again once on a
+  // fresh connection; otherwise retrying could upload the same data twice.
+  bool reused = _connected;
+  bool may_retry;
+  esp_err_t err = _send_request(req, &may_retry);
+  if (err != ESP_OK && reused && may_retry) {
+    LOG("HTTPS Client: kept-alive connection failed; reconnecting");
+    err = _send_request(req, &may_retry);
+  }
+
+  if (err == ESP_OK) {
+    req->result_code = esp_http_client_get_status_code(_client);
     LOG("HTTPS Client: request complete: status=%d, content_length=%d",
-        _result_code, esp_http_client_get_content_length(_client));
+        req->result_code, esp_http_client_get_content_length(_client));
   } else {
-    _result_code = -1;
+    req->result_code = -1;
     LOG("HTTPS Client: error: %s", esp_err_to_name(err));
 
     // destroy and re-create client; some failures leave the client in a state
@@ -322,14 +489,24 @@ void HttpsClient::_perform_one_op() {
     _destroy_esp32_client_object();
     _create_esp32_client_object();
   }
+  _curr_req = NULL;
 
   // invoke the done callback from the main rulos thread
   schedule_now(HttpsClient::_invoke_done_callback, this);
 }
 
+// Requests finish in the order they were queued, so each callback is for the
+// request at the head of the queue.
 void HttpsClient::_invoke_done_callback(void *context) {
   HttpsClient *hc = static_cast<HttpsClient *>(context);
 
-  hc->_in_use = false;
-  hc->_on_done->on_done(hc, hc->_result_code, hc->_response_bytes_written);
+  request_t *req = &hc->_queue[hc->_queue_head];
+  HttpsHandlerIfc *on_done = req->on_done;
+  int result_code = req->result_code;
+  size_t response_len = req->response_bytes_written;
+
+  // free the slot before calling the handler, so it can queue another request
+  hc->_queue_head = (hc->_queue_head + 1) % HTTPS_QUEUE_LEN;
+  hc->_num_queued--;
+  on_done->on_done(hc, result_code, response_len);
 }
@@ -47,36 +47,103 @@ class HttpsHandlerIfc {
                        size_t response_len) = 0;
 };
 
+// Produces a request body incrementally, so that it never has to exist in
+// memory all at once. Called from the https client's worker task. The body is
+// read twice: once to measure its length and once to send it, so it must be
+// the same both times.
+class HttpsBodySourceIfc {
+ public:
+  virtual void rewind() = 0;
+
+  // fill up to max_len bytes of buf; returns the number of bytes written, or
+  // 0 at the end of the body
+  virtual size_t read(char *buf, size_t max_len) = 0;
+};
+
+// Maximum number of requests that can be queued on one HttpsClient
+#ifndef HTTPS_QUEUE_LEN
+#define HTTPS_QUEUE_LEN 4
+#endif
+
+#ifndef HTTPS_MAX_URL_LEN
+#define HTTPS_MAX_URL_LEN 128
+#endif
+
+#ifndef HTTPS_MAX_HEADERS
+#define HTTPS_MAX_HEADERS 4
+#endif
+
+// An https (or plain http) client. Requests are queued and performed in order
+// by a worker task, which keeps the connection to the server open between
+// requests so that a TLS handshake is only needed when the server has closed
+// it. Each request's handler is called from the main rulos thread when it
+// completes.
 class HttpsClient {
  public:
   HttpsClient(int timeout_ms, const char *cert);
   ~HttpsClient();
+
+  // true if the request queue is full
   bool is_in_use();
+
+  // Headers apply to all requests queued after they're set. The strings are
+  // not copied and must remain valid until those requests are done.
   void set_header(const char *header, const char *value);
+
+  // The buffer for the responses of requests queued after it's set
   void set_response_buffer(char *buf, size_t len);
+
   void get(const char *url, HttpsHandlerIfc *on_done);
   void post(const char *url, const char *post_body, size_t body_len,
             HttpsHandlerIfc *on_done);
+  void post(const char *url, HttpsBodySourceIfc *body_source,
+            HttpsHandlerIfc *on_done);
 
  private:
+  typedef struct {
+    char url[HTTPS_MAX_URL_LEN];
+    esp_http_client_method_t method;
+    const char *body;
+    size_t body_len;
+    HttpsBodySourceIfc *body_source;
+    const char *headers[HTTPS_MAX_HEADERS][2];
+    int num_headers;
+    HttpsHandlerIfc *on_done;
+    char *response_buffer;
+    size_t response_buffer_len;
+    size_t response_bytes_written;
+    int result_code;
+  } request_t;
+
   // params from the caller
   const char *_cert;
   int _timeout_ms;
-  HttpsHandlerIfc *_on_done;
+
+  // settings for the next request, owned by the main thread
+  const char *_headers[HTTPS_MAX_HEADERS][2];
+  int _num_headers;
+  char *_response_buffer;
+  size_t _response_buffer_len;
 
   // state of the client
   bool _worker_thread_running;
-  bool _in_use;
   bool _terminate;
   SemaphoreHandle_t _req_ready;
   SemaphoreHandle_t _worker_ready;
 
-  // state of the request
+  // The request queue. Requests are added and removed by the main thread;
+  // the worker performs them in order.
+  request_t _queue[HTTPS_QUEUE_LEN];
+  int _queue_head;
+  int _num_queued;
+
+  // state of the worker
   esp_http_client_handle_t _client;
-  char *_response_buffer;
-  size_t _response_buffer_len;
-  size_t _response_bytes_written;
-  int _result_code;
+  int _worker_idx;
+  request_t *_curr_req;
+  bool _connected;
+  bool _server_closing;
+  char _body_chunk[512];
 
   void _destroy_esp32_client_object();
   void _create_esp32_client_object();
@@ -85,6 +152,9 @@ class HttpsClient {
   static void _worker_thread_trampoline(void *context);
   void _maybeStartWorkerThread();
   void _worker_thread();
-  void _perform_one_op();
+  request_t *_new_request(const char *url, HttpsHandlerIfc *on_done);
+  void _submit_request();
+  void _perform_one_op(request_t *req);
+  esp_err_t _send_request(request_t *req, bool *may_retry);
   static void _invoke_done_callback(void *context);
 };
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "periph/ntp/epoch-clock.h"
+
+#include "periph/ntp/regression.h"
+
+EpochClock::EpochClock() {
+  reset();
+}
+
+void EpochClock::reset() {
+  _set = false;
+  _slew.local = _slew.epoch = 0;
+  _slew.corr = 0;
+  _steady = _slew;
+}
+
+void EpochClock::update(uint64_t now_usec, uint64_t offset_usec,
+                        int64_t freq_ppb) {
+  if (freq_ppb > MAX_FREQ_PPB) {
+    freq_ppb = MAX_FREQ_PPB;
+  } else if (freq_ppb < -MAX_FREQ_PPB) {
+    freq_ppb = -MAX_FREQ_PPB;
+  }
+
+  // freq_ppb is the local clock's error, so the epoch clock's rate relative
+  // to it is the opposite.
+  const int64_t corr = -freq_ppb * ((int64_t)1 << CORR_SHIFT) / 1000000000;
+  const uint64_t target = local_to_epoch(now_usec, offset_usec, freq_ppb);
+
+  const uint64_t current = to_epoch(now_usec);
+  const int64_t err = (int64_t)(target - current);
+
+  if (!_set || err > STEP_THRESHOLD_USEC) {
+    _set = true;
+    _steady.local = now_usec;
+    _steady.epoch = target;
+    _steady.corr = corr;
+    _slew = _steady;
+    return;
+  }
+
+  // Run fast or slow until the error is gone, then at the new rate.
+  const int64_t slew_corr =
+      MAX_SLEW_PPM * ((int64_t)1 << CORR_SHIFT) / 1000000;
+  _slew.local = now_usec;
+  _slew.epoch = current;
+  _slew.corr = corr + (err >= 0 ? slew_corr : -slew_corr);
+
+  const uint64_t err_usec = err >= 0 ? err : -err;
+  _steady.local = now_usec + err_usec * 1000000 / MAX_SLEW_PPM;
+  _steady.epoch = _eval(&_slew, _steady.local);
+  _steady.corr = corr;
+}
+
+void EpochClock::rebase(uint64_t now_usec) {
+  if (now_usec < _slew.local) {
+    return;
+  }
+  if (now_usec >= _steady.local) {
+    _steady.epoch = _eval(&_steady, now_usec);
+    _steady.local = now_usec;
+  } else if (now_usec - _slew.local > MAX_SLEW_DT_USEC) {
+    // Only a very large backwards correction slews this long. The rebased
+    // slew can round differently at its end, so rejoin the steady segment.
+    _slew.epoch = _eval(&_slew, now_usec);
+    _slew.local = now_usec;
+    _steady.epoch = _eval(&_slew, _steady.local);
+  }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Converts local time to epoch time, following the estimates made by
+// EpochEstimator without ever stepping backwards.
+//
+// The clock is a piecewise-linear function of local time. Each segment is
+//
+//   epoch = base_epoch + dt + ((dt * corr) >> CORR_SHIFT)
+//
+// where dt is local time since the segment's base, and corr is the epoch
+// clock's rate relative to the local clock, less 1, in fixed point. A read is
+// one multiply and a few adds.
+//
+// When a new estimate arrives, the clock doesn't jump to it. It runs
+// MAX_SLEW_PPM fast or slow until it has caught up, then runs at the
+// estimate's rate. Segments join end to end and always run forward, so reads
+// are monotonic. The exception is a forward error of more than
+// STEP_THRESHOLD_USEC, such as at first sync, which is stepped immediately.
+// Stepping forward keeps the clock monotonic too.
+class EpochClock {
+ public:
+  static const int CORR_SHIFT = 32;
+  static const int64_t MAX_SLEW_PPM = 500;
+  static const int64_t MAX_FREQ_PPB = 1000000;
+  static const int64_t STEP_THRESHOLD_USEC = 1000000;
+  static const uint64_t MAX_SLEW_DT_USEC = (uint64_t)1 << 36;
+
+  EpochClock();
+  void reset();
+
+  bool is_set() const {
+    return _set;
+  }
+
+  // Starts moving toward a new estimate, as of local time now_usec.
+  void update(uint64_t now_usec, uint64_t offset_usec, int64_t freq_ppb);
+
+  // Restarts the current segment at now_usec without changing the clock.
+  // dt * corr overflows after a couple of weeks, so this should be called
+  // every so often, e.g. on each sync attempt. A slew in progress is left
+  // alone unless it has been running for MAX_SLEW_DT_USEC.
+  void rebase(uint64_t now_usec);
+
+  uint64_t to_epoch(uint64_t local_usec) const {
+    return _eval(local_usec >= _steady.local ? &_steady : &_slew, local_usec);
+  }
+
+ private:
+  typedef struct {
+    uint64_t local;
+    uint64_t epoch;
+    int64_t corr;
+  } Segment;
+
+  bool _set;
+  Segment _slew;    // in effect until _steady.local
+  Segment _steady;  // in effect from _steady.local on
+
+  static uint64_t _eval(const Segment *seg, uint64_t local_usec) {
+    const int64_t dt = (int64_t)(local_usec - seg->local);
+    return seg->epoch + dt +
+           ((dt * seg->corr + ((int64_t)1 << (CORR_SHIFT - 1))) >> CORR_SHIFT);
+  }
+};
@@ -112,6 +112,7 @@ void NtpClient::_schedule_next_sync() {
 
 void NtpClient::_sync() {
   _schedule_next_sync();
+  _clock.rebase(wallclock_get_uptime_usec(&_uptime));
 
   ntp_packet_t req;
   memset(&req, 0, sizeof(req));
@@ -219,19 +220,20 @@ void NtpClient::_try_receive() {
   // and receive directions of the esp32's wifi stack
   epoch_time_when_received -= SEND_TIME_BIAS_USEC;
 
-  uint64_t offset_usec = epoch_time_when_received - _resp_time_usec;
-
-  // record this observation in the circlular buffer
-  time_observation_t *this_obs = &_obs[_obs_idx];
-  _obs_idx++;
-  if (_obs_idx >= MAX_OBSERVATIONS) {
-    _obs_idx = 0;
+  time_observation_t obs;
+  obs.local_time_usec = _resp_time_usec;
+  obs.epoch_time_usec = epoch_time_when_received;
+  obs.rtt_usec = rtt_usec;
+  _estimator.add(&obs);
+  _locked = _estimator.estimate(&_offset_usec, &_freq_error_ppb);
+  if (_locked) {
+    _clock.update(wallclock_get_uptime_usec(&_uptime), _offset_usec,
+                  _freq_error_ppb);
   }
-  this_obs->local_time_usec = _resp_time_usec;
-  this_obs->epoch_time_usec = epoch_time_when_received;
-  this_obs->rtt_usec = rtt_usec;
 
+#ifdef NTP_DEBUG
   // log statistics
+  uint64_t offset_usec = epoch_time_when_received - _resp_time_usec;
   char logbuf[1000];
   int logcapacity = sizeof(logbuf);
   logcapacity -= snprintf(
@@ -242,13 +244,12 @@ void NtpClient::_try_receive() {
       "this_offset_usec=%lld,",
       _req_time_usec, _resp_time_usec, server_delay_usec, server_epoch_usec,
       rtt_usec, oneway_latency_usec, epoch_time_when_received, offset_usec);
-
-  _locked =
-      update_epoch_estimate(_obs, &logbuf[sizeof(logbuf) - logcapacity],
-                            &logcapacity, &_offset_usec, &_freq_error_ppb);
-  logbuf[sizeof(logbuf) - logcapacity] = '\n';
-  logcapacity--;
+  _estimator.log_state(&logbuf[sizeof(logbuf) - logcapacity], &logcapacity);
+  logcapacity -= snprintf(&logbuf[sizeof(logbuf) - logcapacity], logcapacity,
+                          "offset=%llu,freq=%lld\n", _offset_usec,
+                          _freq_error_ppb);
   log_write(logbuf, sizeof(logbuf) - logcapacity);
+#endif
   _req_time_usec = 0;
 }
 
@@ -264,7 +265,7 @@ bool NtpClient::is_synced(void) {
 void NtpClient::get_epoch_and_local_usec(uint64_t *epoch, uint64_t *local) {
   if (is_synced()) {
     *local = wallclock_get_uptime_usec(&_uptime);
-    *epoch = local_to_epoch(*local, _offset_usec, _freq_error_ppb);
+    *epoch = _clock.to_epoch(*local);
   } else {
     *local = 0;
     *epoch = 0;
@@ -294,8 +295,8 @@ void NtpClient::start(void) {
 void NtpClient::_init(const char *hostname) {
   _sock = -1;
   _hostname = hostname;
-  memset(&_obs, 0, sizeof(_obs));
-  _obs_idx = 0;
+  _estimator.reset();
+  _clock.reset();
 }
 
 NtpClient::NtpClient() {
@@ -25,6 +25,7 @@
 #include "core/rulos.h"
 #include "core/wallclock.h"
 #include "esp_wifi.h"
+#include "periph/ntp/epoch-clock.h"
 #include "periph/ntp/ntp-packet.h"
 #include "periph/ntp/regression.h"
 
@@ -56,15 +57,16 @@ class NtpClient {
 
   bool _locked;
   int64_t _most_recent_offset_usec;
-  // circular buffer of recent observations
-  time_observation_t _obs[MAX_OBSERVATIONS];
-  // index of last obs written
-  uint16_t _obs_idx;
+  // fit over recent observations
+  EpochEstimator _estimator;
 
   // linear regression outputs
   uint64_t _offset_usec;
   int64_t _freq_error_ppb;
 
+  // slews toward the regression outputs; this is what reads come from
+  EpochClock _clock;
+
   void _init(const char *hostname);
   void _schedule_next_sync();
   void _sync();
@@ -18,12 +18,11 @@
 
 #include "periph/ntp/regression.h"
 
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <algorithm>
-#include <functional>
 
 #define logappend(...)                                     \
   do {                                                     \
@@ -35,92 +34,343 @@
 // This is not part of the NtpClient class so it can be compiled
 // separately as part of a unit test that's compiled natively on an
 // x64 host
-bool update_epoch_estimate(const time_observation_t *obs, char *logbuf,
-                           int *logbufcap, uint64_t *offset_usec /* OUT */,
-                           int64_t *freq_ppb /* OUT */) {
-  // Make a sorted list of RTTs so we can compute quartile statistics.
-  // Also, find the minimum epoch time of all observations.
-  uint32_t rtts[MAX_OBSERVATIONS];
-  int num_obs = 0;
-  uint64_t min_epoch = obs[0].epoch_time_usec;
 
-  logappend("rtts_now:");
+//////////////////////////////////////////////////////////////////////////////
+// 128-bit arithmetic for the few products in the final solve that don't fit
+// in 64 bits. There's no native 128-bit type on the esp32.
+
+typedef struct {
+  uint64_t hi, lo;  // two's complement
+} wide_t;
+
+static wide_t wide_neg(wide_t a) {
+  wide_t r;
+  r.lo = ~a.lo + 1;
+  r.hi = ~a.hi + (r.lo == 0);
+  return r;
+}
+
+static wide_t wide_sub(wide_t a, wide_t b) {
+  wide_t r;
+  r.lo = a.lo - b.lo;
+  r.hi = a.hi - b.hi - (a.lo < b.lo);
+  return r;
+}
+
+static wide_t wide_mul(int64_t a, int64_t b) {
+  const bool neg = (a < 0) != (b < 0);
+  const uint64_t ua = a < 0 ? -(uint64_t)a : a;
+  const uint64_t ub = b < 0 ? -(uint64_t)b : b;
+
+  const uint64_t p00 = (ua & 0xffffffff) * (ub & 0xffffffff);
+  const uint64_t p01 = (ua & 0xffffffff) * (ub >> 32);
+  const uint64_t p10 = (ua >> 32) * (ub & 0xffffffff);
+  const uint64_t p11 = (ua >> 32) * (ub >> 32);
+  const uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+
+  wide_t r;
+  r.lo = (mid << 32) | (p00 & 0xffffffff);
+  r.hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+  return neg ? wide_neg(r) : r;
+}
+
+static wide_t wide_half(wide_t a) {
+  wide_t r;
+  r.lo = (a.lo >> 1) | (a.hi << 63);
+  r.hi = (uint64_t)((int64_t)a.hi >> 1);
+  return r;
+}
+
+// True if a is within +/- 2^62.
+static bool wide_fits(wide_t a) {
+  const uint64_t limit = (uint64_t)1 << 62;
+  if (a.hi == 0) {
+    return a.lo < limit;
+  }
+  return a.hi == ~(uint64_t)0 && a.lo >= -limit;
+}
+
+// a * b / c, rounded to nearest; c must be positive and below 2^63, and the
+// result must fit in 64 bits.
+static int64_t muldiv(int64_t a, int64_t b, int64_t c) {
+  wide_t p = wide_mul(a, b);
+  const bool neg = (int64_t)p.hi < 0;
+  if (neg) {
+    p = wide_neg(p);
+  }
+  const uint64_t half = (uint64_t)c / 2;
+  p.lo += half;
+  p.hi += (p.lo < half);
+
+  uint64_t rem = 0, q = 0;
+  for (int i = 127; i >= 0; i--) {
+    const uint64_t bit = i >= 64 ? (p.hi >> (i - 64)) & 1 : (p.lo >> i) & 1;
+    rem = (rem << 1) | bit;
+    q <<= 1;
+    if (rem >= (uint64_t)c) {
+      rem -= c;
+      q |= 1;
+    }
+  }
+  return neg ? -(int64_t)q : (int64_t)q;
+}
+
+// a / b rounded to nearest, for positive b
+static int64_t div_round(int64_t a, int64_t b) {
+  if (a >= 0) {
+    return (a + b / 2) / b;
+  } else {
+    return -((-a + b / 2) / b);
+  }
+}
+
+static int64_t shift_round(int64_t a, int shift) {
+  return shift == 0 ? a : div_round(a, (int64_t)1 << shift);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+EpochEstimator::EpochEstimator() {
+  reset();
+}
+
+void EpochEstimator::reset() {
+  memset(_obs, 0, sizeof(_obs));
+  _obs_idx = 0;
+  _num_obs = 0;
+  _num_included = 0;
+  _num_summed = 0;
+  _x_base = 0;
+  _y_base = 0;
+  _x_shift = 0;
+  _sum_x = _sum_x2 = _sum_y = _sum_xy = 0;
+}
+
+static int64_t clock_difference(const time_observation_t *obs) {
+  return (int64_t)(obs->epoch_time_usec - obs->local_time_usec);
+}
+
+// An observation's y, or false if it's out of range: a bogus reply, or one
+// from before the clocks were stepped.
+bool EpochEstimator::_y_of(const time_observation_t *obs, int64_t *y) const {
+  *y = (int64_t)((uint64_t)clock_difference(obs) - (uint64_t)_y_base);
+  const int64_t limit = (int64_t)1 << Y_BITS;
+  return *y > -limit && *y < limit;
+}
+
+bool EpochEstimator::_fits(const time_observation_t *obs) const {
+  if (obs->local_time_usec < _x_base) {
+    return false;
+  }
+  const uint64_t half = _x_shift ? (uint64_t)1 << (_x_shift - 1) : 0;
+  if (((obs->local_time_usec - _x_base + half) >> _x_shift) >=
+      ((uint64_t)1 << X_BITS)) {
+    return false;
+  }
+  int64_t y;
+  return _y_of(obs, &y);
+}
+
+// Observations whose y is out of range are left out of the sums; whether one
+// is depends only on _y_base, so it's left out consistently until the next
+// rebuild.
+void EpochEstimator::_accumulate(const time_observation_t *obs, int sign) {
+  int64_t y;
+  if (!_y_of(obs, &y)) {
+    return;
+  }
+  const uint64_t half = _x_shift ? (uint64_t)1 << (_x_shift - 1) : 0;
+  const int64_t x = (obs->local_time_usec - _x_base + half) >> _x_shift;
+  _num_summed += sign;
+  _sum_x += sign * x;
+  _sum_x2 += sign * x * x;
+  _sum_y += sign * y;
+  _sum_xy += sign * x * y;
+}
+
+// The filter throws away the top quartile of RTTs: it keeps every
+// observation whose RTT is no longer than the one at the 3/4 mark.
+uint16_t EpochEstimator::_target_included() const {
+  uint16_t k = _num_obs * 3 / 4;
+  if (k == 0) {
+    return 0;
+  }
+  const uint32_t rtt_limit = _obs[_by_rtt[k - 1]].rtt_usec;
+  while (k < _num_obs && _obs[_by_rtt[k]].rtt_usec <= rtt_limit) {
+    k++;
+  }
+  return k;
+}
+
+// Rebases x on the oldest observation, and y on the median of the included
+// ones, so that a minority of outliers can't set the base and push everything
+// else out of range; then recomputes the sums.
+void EpochEstimator::_rebuild() {
+  const time_observation_t *oldest = NULL;
+  uint64_t max_x = 0;
+  int64_t ys[MAX_OBSERVATIONS];
+  int num_ys = 0;
   for (int i = 0; i < MAX_OBSERVATIONS; i++) {
-    if (obs[i].local_time_usec == 0) {
+    const time_observation_t *to = &_obs[i];
+    if (to->local_time_usec == 0) {
       continue;
     }
+    if (oldest == NULL || to->local_time_usec < oldest->local_time_usec) {
+      oldest = to;
+    }
+    if (to->local_time_usec > max_x) {
+      max_x = to->local_time_usec;
+    }
+    if (_num_included == 0) {
+      ys[num_ys++] = clock_difference(to);
+    }
+  }
+  for (int i = 0; i < _num_included; i++) {
+    ys[num_ys++] = clock_difference(&_obs[_by_rtt[i]]);
+  }
+  std::nth_element(ys, ys + num_ys / 2, ys + num_ys);
+
+  _x_base = oldest->local_time_usec;
+  _y_base = ys[num_ys / 2];
+  _x_shift = 0;
+  while (((max_x - _x_base) >> _x_shift) >= ((uint64_t)1 << (X_BITS - 1))) {
+    _x_shift++;
+  }
+
+  _num_summed = 0;
+  _sum_x = _sum_x2 = _sum_y = _sum_xy = 0;
+  for (int i = 0; i < _num_included; i++) {
+    _accumulate(&_obs[_by_rtt[i]], 1);
+  }
+}
+
+void EpochEstimator::add(const time_observation_t *obs) {
+  if (obs->local_time_usec == 0) {
+    return;
+  }
+
+  const uint8_t slot = _obs_idx;
+  _obs_idx = (_obs_idx + 1) % MAX_OBSERVATIONS;
+
+  // age out the observation we're replacing
+  if (_obs[slot].local_time_usec != 0) {
+    uint16_t r = 0;
+    while (_by_rtt[r] != slot) {
+      r++;
+    }
+    if (r < _num_included) {
+      _accumulate(&_obs[slot], -1);
+      _num_included--;
+    }
+    memmove(&_by_rtt[r], &_by_rtt[r + 1], _num_obs - r - 1);
+    _num_obs--;
+  }
 
-    rtts[num_obs] = obs[i].rtt_usec;
-    logappend("%u,", rtts[num_obs]);
-    num_obs++;
+  _obs[slot] = *obs;
+  const bool rebuild = _num_obs == 0 || !_fits(obs);
 
-    if (obs[i].epoch_time_usec < min_epoch) {
-      min_epoch = obs[i].epoch_time_usec;
+  // insert it in RTT order, after any with the same RTT
+  uint16_t lo = 0, hi = _num_obs;
+  while (lo < hi) {
+    const uint16_t mid = (lo + hi) / 2;
+    if (_obs[_by_rtt[mid]].rtt_usec <= obs->rtt_usec) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  memmove(&_by_rtt[lo + 1], &_by_rtt[lo], _num_obs - lo);
+  _by_rtt[lo] = slot;
+  _num_obs++;
+  if (lo < _num_included) {
+    if (!rebuild) {
+      _accumulate(obs, 1);
     }
+    _num_included++;
+  }
+
+  // move the filter's threshold to match the new set of RTTs
+  const uint16_t target = _target_included();
+  if (rebuild) {
+    _num_included = target;
+    _rebuild();
+    return;
+  }
+  while (_num_included < target) {
+    _accumulate(&_obs[_by_rtt[_num_included++]], 1);
+  }
+  while (_num_included > target) {
+    _accumulate(&_obs[_by_rtt[--_num_included]], -1);
+  }
+}
+
+bool EpochEstimator::estimate(uint64_t *offset_usec, int64_t *freq_ppb) const {
+  const int64_t n = _num_summed;
+  if (_num_obs < MIN_OBSERVATIONS || n < 2) {
+    return false;
   }
 
-  // If we don't have enough observations yet, stop
-  if (num_obs < MIN_OBSERVATIONS) {
-    logappend("insufficient_obs");
+  // Least-squares slope of y over x is num / den. Both can need more than
+  // 64 bits; scaling them down together doesn't change the slope.
+  wide_t num = wide_sub(wide_mul(n, _sum_xy), wide_mul(_sum_x, _sum_y));
+  wide_t den = wide_sub(wide_mul(n, _sum_x2), wide_mul(_sum_x, _sum_x));
+  while (!wide_fits(num) || !wide_fits(den)) {
+    num = wide_half(num);
+    den = wide_half(den);
+  }
+  const int64_t slope_num = (int64_t)num.lo;
+  const int64_t slope_den = (int64_t)den.lo;
+  if (slope_den <= 0) {
     return false;
   }
 
-  // Sort the list of RTTs
-  std::sort(rtts, rtts + num_obs);
+  // y is the epoch clock minus the local clock, so the slope is how much
+  // faster the epoch clock runs, in usec per 2^x_shift usec. The local clock's
+  // frequency error is the opposite. 1e9 is 1953125 << 9.
+  if (_x_shift <= 9) {
+    *freq_ppb = -muldiv(slope_num, (int64_t)1953125 << (9 - _x_shift),
+                        slope_den);
+  } else {
+    *freq_ppb =
+        -shift_round(muldiv(slope_num, 1953125, slope_den), _x_shift - 9);
+  }
+
+  // The fit's y at x = 0 (local time _x_base), extrapolated back to local
+  // time 0.
+  const int64_t y0 =
+      div_round(_sum_y - muldiv(slope_num, _sum_x, slope_den), n);
+  *offset_usec =
+      _y_base + y0 -
+      shift_round(muldiv(slope_num, _x_base, slope_den), _x_shift);
+  return true;
+}
+
+void EpochEstimator::log_state(char *logbuf, int *logbufcap) const {
   logappend("rtts_sorted:");
-  for (int i = 0; i < num_obs; i++) {
-    logappend("%u,", rtts[i]);
-  }
-
-  // Select the max rtt we're willing to accept; throw away the top
-  // quartile
-  int rtt_limit_idx = (num_obs * 3 / 4) - 1;
-  uint32_t rtt_limit = rtts[rtt_limit_idx];
-  logappend("rtt_limit_idx=%d,rtt_limit=%u,", rtt_limit_idx, rtt_limit);
-
-#if SIMULATOR
-  printf("[\n");
-#endif
-  // Compute subterms used in the linear regression. Subtract off the
-  // minimum epoch time from all y values so we get more bits of free
-  // precision.
-  double sumX = 0, sumX2 = 0, sumY = 0, sumXY = 0;
-  int n = 0;
+  for (int i = 0; i < _num_obs; i++) {
+    logappend("%u,", (unsigned)_obs[_by_rtt[i]].rtt_usec);
+  }
+  logappend("num_obs=%u,num_included=%u,num_summed=%u,", _num_obs,
+            _num_included, _num_summed);
+  if (_num_included > 0) {
+    logappend("rtt_limit=%u,",
+              (unsigned)_obs[_by_rtt[_num_included - 1]].rtt_usec);
+  }
+  logappend("x_base=%llu,x_shift=%u,y_base=%lld,",
+            (unsigned long long)_x_base, _x_shift, (long long)_y_base);
+}
+
+bool update_epoch_estimate(const time_observation_t *obs, char *logbuf,
+                           int *logbufcap, uint64_t *offset_usec /* OUT */,
+                           int64_t *freq_ppb /* OUT */) {
+  EpochEstimator est;
   for (int i = 0; i < MAX_OBSERVATIONS; i++) {
-    const time_observation_t *to = &obs[i];
-    if (to->rtt_usec == 0 || to->rtt_usec > rtt_limit) {
-      continue;
-    }
-    double x = to->local_time_usec;
-    double y = to->epoch_time_usec - min_epoch;
-#if SIMULATOR
-    printf("[ %9u , %12.12g , %13lu , %12.12g ]%s\n", to->rtt_usec, x,
-           to->epoch_time_usec, y, i == MAX_OBSERVATIONS - 1 ? "" : ",");
-#endif
-    sumX += x;
-    sumX2 += x * x;
-    sumY += y;
-    sumXY += x * y;
-    n++;
-  }
-#if SIMULATOR
-  printf("]\n");
-#endif
-
-  // Compute the linear regression
-  double f_m = (n * sumXY - sumX * sumY) / (n * sumX2 - sumX * sumX);
-  double f_b_shifted = (sumY - f_m * sumX) / n;
-  logappend("shifted_offset_usec=%f,slope=%f,", f_b_shifted, f_m);
-
-  // Convert slope into a frequency error in parts-per-billion
-  double f_ppb = (1.0 - f_m) * 1e9;
-  logappend("ppb=%f,", f_ppb);
-
-  // Convert the floats back into 64-bit integers. Add back in the
-  // offset we subtracted out earlier.
-  *offset_usec = ((uint64_t)round(f_b_shifted)) + min_epoch;
-  *freq_ppb = (int64_t)round(f_ppb);
-  return true;
+    est.add(&obs[i]);
+  }
+  if (logbuf != NULL) {
+    est.log_state(logbuf, logbufcap);
+  }
+  return est.estimate(offset_usec, freq_ppb);
 }
 
 uint64_t local_to_epoch(uint64_t local_time_usec, uint64_t offset_usec,
@@ -29,8 +29,73 @@ typedef struct {
 } time_observation_t;
 
 static const uint16_t MIN_OBSERVATIONS = 10;
-static const uint16_t MAX_OBSERVATIONS = 40;
+static const uint16_t MAX_OBSERVATIONS = 64;
 
+// Fits epoch time as a linear function of local time over the most recent
+// MAX_OBSERVATIONS observations, ignoring the quarter with the longest
+// round-trip times.
+//
+// Rather than refitting from scratch on every sync, the estimator keeps the
+// observations' slots sorted by RTT and keeps running sums over the ones
+// that pass the RTT filter, adjusting them as observations arrive, age out,
+// or cross the filter's threshold. The sums are 64-bit integers: x is local
+// time relative to x_base, in units of 2^x_shift usec, and y is (epoch -
+// local) relative to y_base, in usec. Regressing the difference between the
+// clocks rather than epoch time itself keeps y small, and makes the error from
+// rounding x off to 2^x_shift usec a tiny fraction of a usec per usec of
+// frequency error. Whenever x or y outgrows its range, the sums are rebuilt
+// with the oldest observation as the new x base and the median y as the new y
+// base; observations whose y is still out of range are left out of the fit.
+class EpochEstimator {
+ public:
+  EpochEstimator();
+  void reset();
+
+  // Adds an observation, replacing the oldest once MAX_OBSERVATIONS are held.
+  void add(const time_observation_t *obs);
+
+  // Returns false if there aren't enough observations yet to estimate.
+  bool estimate(uint64_t *offset_usec /* OUT */,
+                int64_t *freq_ppb /* OUT */) const;
+
+  uint16_t num_obs() const {
+    return _num_obs;
+  }
+
+  // Describes the observations and filter state, for debugging.
+  void log_state(char *logbuf, int *logbufcap) const;
+
+ private:
+  // x values are kept below 2^X_BITS and y values within +/- 2^Y_BITS, which
+  // keeps the sums from overflowing; observations with y out of range aren't
+  // summed. A rebuild picks a shift that leaves room for the window to double
+  // in span before the next one.
+  static const int X_BITS = 24;
+  static const int Y_BITS = 32;
+
+  time_observation_t _obs[MAX_OBSERVATIONS];
+  uint16_t _obs_idx;  // next slot to write
+  uint16_t _num_obs;
+
+  // slots in order of increasing RTT; the first _num_included pass the filter
+  uint8_t _by_rtt[MAX_OBSERVATIONS];
+  uint16_t _num_included;
+  uint16_t _num_summed;  // included observations with y in range
+
+  uint64_t _x_base;
+  int64_t _y_base;
+  uint8_t _x_shift;
+  int64_t _sum_x, _sum_x2, _sum_y, _sum_xy;
+
+  bool _y_of(const time_observation_t *obs, int64_t *y) const;
+  bool _fits(const time_observation_t *obs) const;
+  void _accumulate(const time_observation_t *obs, int sign);
+  uint16_t _target_included() const;
+  void _rebuild();
+};
+
+// Estimates from a batch of observations; slots with a local time of 0 are
+// unused. If logbuf is not NULL, the estimator's state is appended to it.
 bool update_epoch_estimate(const time_observation_t *obs, char *logbuf,
                            int *logbufcap, uint64_t *offset_usec /* OUT */,
                            int64_t *freq_ppb /* OUT */);
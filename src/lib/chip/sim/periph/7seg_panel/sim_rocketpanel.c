@@ -147,6 +147,15 @@ void hal_program_segment(uint8_t board, uint8_t digit, uint8_t segment,
   wrefresh(curses_get_window());
 }
 
+void hal_program_segments(uint8_t board, uint8_t digit, uint8_t segment_mask,
+                          uint8_t onoff_bits) {
+  for (uint8_t segment = 0; segment < 8; segment++) {
+    if (segment_mask & (1 << segment)) {
+      hal_program_segment(board, digit, segment, (onoff_bits >> segment) & 1);
+    }
+  }
+}
+
 void hal_7seg_bus_enter_sleep() {
   // simulator can spare some power.
 }
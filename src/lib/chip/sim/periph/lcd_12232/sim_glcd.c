@@ -45,6 +45,8 @@ void glcd_draw_framebuffer(GLCD *glcd) {}
 
 void glcd_clear_framebuffer(GLCD *glcd) {}
 
+void glcd_mark_dirty(GLCD *glcd, int16_t x0, int16_t x1) {}
+
 uint8_t glcd_paint_char(GLCD *glcd, char glyph, int16_t dx0, bool invert) {
   return 0;
 }
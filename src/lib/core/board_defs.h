@@ -41,6 +41,11 @@
 #define DATA      GPIO_B0
 #define STROBE    GPIO_B1
 
+// the select lines that are adjacent pins of one port
+#define BOARDSEL_GROUP GPIO_GROUP_B(2, 3)
+#define DIGSEL_GROUP   GPIO_GROUP_C(0, 3)
+#define SEGSEL_GROUP   GPIO_GROUP_D(5, 3)
+
 #define AVAILABLE_ADCS 0x38
 #define ASSERT_TO_BOARD
 
@@ -58,6 +63,11 @@
 #define DATA      GPIO_D4
 #define STROBE    GPIO_B1
 
+// the select lines that are adjacent pins of one port
+#define BOARDSEL_GROUP GPIO_GROUP_B(2, 3)
+#define DIGSEL_GROUP   GPIO_GROUP_C(0, 3)
+#define SEGSEL_GROUP   GPIO_GROUP_D(5, 3)
+
 #define KEYPAD_ROW0 GPIO_D4
 #define KEYPAD_ROW1 GPIO_B2
 #define KEYPAD_ROW2 GPIO_B3
@@ -87,6 +97,11 @@
 #define DATA      GPIO_B6
 #define STROBE    GPIO_B7
 
+// the select lines that are adjacent pins of one port
+#define BOARDSEL_GROUP GPIO_GROUP_B(0, 3)
+#define DIGSEL_GROUP   GPIO_GROUP_D(5, 3)
+#define SEGSEL_GROUP   GPIO_GROUP_B(3, 3)
+
 #define KEYPAD_ROW0 DATA
 #define KEYPAD_ROW1 BOARDSEL0
 #define KEYPAD_ROW2 BOARDSEL1
@@ -124,6 +139,10 @@
 #define DATA      GPIO_D6
 #define STROBE    GPIO_D7
 
+// the select lines that are adjacent pins of one port
+#define BOARDSEL_GROUP GPIO_GROUP_C(2, 3)
+#define SEGSEL_GROUP   GPIO_GROUP_C(5, 3)
+
 #define JOYSTICK_X_CHAN 3
 #define JOYSTICK_Y_CHAN 2
 
@@ -159,6 +178,9 @@
 
 #define AVAILABLE_ADCS 0xff
 
+// the USB host's INT pin, on PA8
+#define MAX3421E_INT_LINE 8
+
 #elif defined(BOARD_FLASHCARD)
 
 #define KEYPAD_ROW0 GPIO_B7
@@ -67,6 +67,10 @@ void hal_delay_ms(uint16_t ms);
 
 void hal_program_segment(uint8_t board, uint8_t digit, uint8_t segment,
                          uint8_t onoff);
+// Programs several segments of one digit: each segment whose bit is set in
+// segment_mask is set to the value of that bit in onoff_bits.
+void hal_program_segments(uint8_t board, uint8_t digit, uint8_t segment_mask,
+                          uint8_t onoff_bits);
 void hal_7seg_bus_enter_sleep();  // Call to stop driving 7seg bus
 
 //// keypad
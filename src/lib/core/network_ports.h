@@ -46,3 +46,5 @@
 #define SET_VOLUME_PORT       (0x19)
 #define MUSIC_CONTROL_PORT    (0x20)
 #define MUSIC_METADATA_PORT   (0x21)
+#define REMOTE_BBUF_DELTA_PORT  (0x22)
+#define REMOTE_BBUF_RESYNC_PORT (0x23)
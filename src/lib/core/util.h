@@ -57,4 +57,5 @@ void debug_delay(int ms);
 #else
 #define PROGMEM             /**/
 #define pgm_read_byte(addr) (*((uint8_t *)addr))
+#define pgm_read_word(addr) (*((uint16_t *)addr))
 #endif
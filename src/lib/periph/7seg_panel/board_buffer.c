@@ -44,6 +44,7 @@ void dump(const char *prefix) {
 #endif  // BBDEBUG
 
 RemoteBBufSend *g_remote_bbuf_send;
+static bool g_in_frame = FALSE;
 
 void board_buffer_module_init() {
   int i;
@@ -63,23 +64,32 @@ void board_buffer_init(BoardBuffer *buf DBG_BBUF_LABEL_DECL) {
     buf->buffer[i] = 0;
   }
   buf->next = NULL;
+  buf->prev = NULL;
   buf->board_index = BBUF_UNMAPPED_INDEX;
   buf->alpha = 0xff;
+  buf->mask = 0;
   assert(sizeof(buf->alpha) * 8 >= NUM_DIGITS);
 #if BBDEBUG
   buf->label = label;
 #endif
 }
 
-void _board_buffer_compute_mask(BoardBuffer *buf, uint8_t redraw) {
+static void _board_buffer_draw_digits(BoardBuffer *buf, uint8_t mask);
+
+// Recomputes which digits of each buffer on the board are visible. A digit is
+// only repainted when the buffer it comes from changes; digits that stay with
+// the same buffer are already on the display.
+static void _board_buffer_compute_mask(uint8_t board_index) {
   uint8_t left = 0xff;
-  while (buf != NULL) {
+  BoardBuffer *buf;
+  for (buf = foreground[board_index]; buf != NULL; buf = buf->next) {
+    uint8_t old_mask = buf->mask;
     buf->mask = left & buf->alpha;
     left = left & (~buf->alpha);
-    if (redraw) {
-      board_buffer_draw(buf);
+    uint8_t gained = buf->mask & ~old_mask;
+    if (gained) {
+      _board_buffer_draw_digits(buf, gained);
     }
-    buf = buf->next;
   }
 }
 
@@ -92,35 +102,34 @@ void clear_board(uint8_t index) {
 }
 
 void board_buffer_pop(BoardBuffer *buf) {
-  if (board_buffer_is_foreground(buf)) {
-    if (buf->next == NULL) {
-      // will the last buffer to leave, please turn out the lights?
-#if NUM_LOCAL_BOARDS > 0
-      clear_board(buf->board_index);
-#endif
-      foreground[buf->board_index] = NULL;
-    } else {
-      foreground[buf->board_index] = buf->next;
-    }
+  assert(buf->board_index < NUM_TOTAL_BOARDS);
+  uint8_t board_index = buf->board_index;
+
+  if (buf->prev == NULL) {
+    assert(foreground[board_index] == buf);
+    foreground[board_index] = buf->next;
   } else {
-    // TODO if restoring remote display code: this path not implemented.
-    assert(buf->board_index < NUM_TOTAL_BOARDS);
-    BoardBuffer *prevbuf = foreground[buf->board_index];
-    uint8_t loopcheck = 0;
-    while (prevbuf->next != buf) {
-      prevbuf = prevbuf->next;
-      assert(prevbuf != NULL);
-      loopcheck += 1;
-      assert(loopcheck < 100);
-    }
-    prevbuf->next = buf->next;
+    buf->prev->next = buf->next;
+  }
+  if (buf->next != NULL) {
+    buf->next->prev = buf->prev;
   }
-
-  _board_buffer_compute_mask(buf->next,
-                             TRUE);  // fyi okay even when buf->next==NULL
   buf->next = NULL;
+  buf->prev = NULL;
+  buf->mask = 0;
   buf->board_index = BBUF_UNMAPPED_INDEX;
 
+  if (foreground[board_index] == NULL) {
+    // will the last buffer to leave, please turn out the lights?
+#if NUM_LOCAL_BOARDS > 0
+    if (board_index < NUM_LOCAL_BOARDS) {
+      clear_board(board_index);
+    }
+#endif
+  } else {
+    _board_buffer_compute_mask(board_index);
+  }
+
 #if BBDEBUG
   dump("  after pop");
 #endif
@@ -133,33 +142,44 @@ void board_buffer_push(BoardBuffer *buf, int board) {
 #endif  // BBDEBUG
   buf->board_index = board;
   buf->next = foreground[board];
+  buf->prev = NULL;
+  if (buf->next != NULL) {
+    buf->next->prev = buf;
+  }
   foreground[board] = buf;
-  _board_buffer_compute_mask(buf, FALSE);  // no redraw because...
-  board_buffer_draw(buf);  // ...this line will overwrite existing
+  buf->mask = 0;  // so that all of its visible digits get painted
+  _board_buffer_compute_mask(board);
 #if BBDEBUG
   dump(" after push");
 #endif  // BBDEBUG
 }
 
 void board_buffer_set_alpha(BoardBuffer *buf, uint8_t alpha) {
+  if (buf->alpha == alpha) {
+    return;
+  }
   buf->alpha = alpha;
 
   if (board_buffer_is_stacked(buf)) {
-    _board_buffer_compute_mask(foreground[buf->board_index], TRUE);
+    _board_buffer_compute_mask(buf->board_index);
   }
 }
 
 void board_buffer_draw(BoardBuffer *buf) {
+  _board_buffer_draw_digits(buf, buf->mask);
+}
+
+static void _board_buffer_draw_digits(BoardBuffer *buf, uint8_t mask) {
   uint8_t board_index = buf->board_index;
 #if BBDEBUG
   LOG("bb_draw(3, buf %016" PRIxPTR " %s, mask %x)", (uintptr_t)buf, buf->label,
-      buf->mask);
+      mask);
 #endif  // BBDEBUG
 
 // draw locally, if we can.
 #if NUM_LOCAL_BOARDS > 0
   if (0 <= board_index && board_index < NUM_LOCAL_BOARDS) {
-    board_buffer_paint(buf->buffer, board_index, buf->mask);
+    board_buffer_paint(buf->buffer, board_index, mask);
   }
 #endif  // NUM_LOCAL_BOARDS > 0
 #if NUM_REMOTE_BOARDS > 0
@@ -169,7 +189,7 @@ void board_buffer_draw(BoardBuffer *buf) {
     // objecty about it, because doing this well with polymorphism
     // really wants a dynamic memory allocator.
     send_remote_bbuf(g_remote_bbuf_send, buf->buffer,
-                     board_index - NUM_LOCAL_BOARDS, buf->mask);
+                     board_index - NUM_LOCAL_BOARDS, mask);
   }
 #endif  // NUM_REMOTE_BOARDS > 0
 }
@@ -182,6 +202,17 @@ void board_buffer_paint(SSBitmap *bm, uint8_t board_index, uint8_t mask) {
       display_controller_program_cell(board_index, idx, tmp);
     }
   }
+  if (!g_in_frame) {
+    display_controller_enter_sleep();
+  }
+}
+
+void board_buffer_begin_frame() {
+  g_in_frame = TRUE;
+}
+
+void board_buffer_end_frame() {
+  g_in_frame = FALSE;
   display_controller_enter_sleep();
 }
 
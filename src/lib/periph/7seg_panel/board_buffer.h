@@ -29,6 +29,7 @@ typedef struct s_board_buffer {
   uint8_t alpha;
   uint8_t mask;  // visible alpha
   struct s_board_buffer *next;
+  struct s_board_buffer *prev;  // NULL when foreground
 #if BBDEBUG
 #define DBG_BBUF_LABEL(s)   , s
 #define DBG_BBUF_LABEL_DECL , const char *label
@@ -53,5 +54,11 @@ void board_buffer_draw(BoardBuffer *buf);
 uint8_t board_buffer_is_foreground(BoardBuffer *buf);
 bool board_buffer_is_stacked(BoardBuffer *buf);
 
+// Between these calls, draws go to the display without putting the display
+// bus to sleep after each one; board_buffer_end_frame does that once. Used by
+// display_frame.
+void board_buffer_begin_frame();
+void board_buffer_end_frame();
+
 // internal method used by remote_bbuf:
 void board_buffer_paint(SSBitmap *bm, uint8_t board_index, uint8_t mask);
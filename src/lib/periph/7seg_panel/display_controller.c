@@ -27,18 +27,57 @@ static const uint8_t sevseg_ascii[] PROGMEM = {
 #include "lib/periph/7seg_panel/sevseg_bitmaps.ch"
 };
 
-void display_controller_program_cell(uint8_t board, uint8_t digit,
-                                     SSBitmap bitmap) {
+#if NUM_LOCAL_BOARDS > 0
+// Shadow of the state last programmed into each digit of the local boards,
+// so that only segments that change are sent to the hardware. A digit whose
+// bit is clear in shadow_valid is in an unknown state, and the next time it's
+// programmed, all of its segments are sent.
+static SSBitmap shadow[NUM_LOCAL_BOARDS][NUM_DIGITS];
+static uint8_t shadow_valid[NUM_LOCAL_BOARDS];
+#endif
+
+// Converts a bitmap to the hal's segment numbering: bits 6..0 of the bitmap
+// are segments 0..6, and the high bit, the decimal, is segment 7.
+static uint8_t bitmap_to_segments(SSBitmap bitmap) {
+  uint8_t segments = bitmap & SSB_DECIMAL;
   int segment; /* must be signed! */
-  uint8_t shape = (uint8_t)bitmap;
 
   for (segment = 6; segment >= 0; segment--) {
-    hal_program_segment(board, digit, segment, shape & 0x1);
-    shape >>= 1;
+    segments |= (bitmap & 0x1) << segment;
+    bitmap >>= 1;
+  }
+  return segments;
+}
+
+void display_controller_program_cell(uint8_t board, uint8_t digit,
+                                     SSBitmap bitmap) {
+  SSBitmap changed = 0xff;
+
+#if NUM_LOCAL_BOARDS > 0
+  if (board < NUM_LOCAL_BOARDS && digit < NUM_DIGITS) {
+    uint8_t digit_bit = 1 << digit;
+    if (shadow_valid[board] & digit_bit) {
+      changed = shadow[board][digit] ^ bitmap;
+    }
+    shadow[board][digit] = bitmap;
+    shadow_valid[board] |= digit_bit;
+  }
+#endif
+
+  if (changed == 0) {
+    return;
   }
 
-  /* consider the high bit to be the decimal */
-  hal_program_segment(board, digit, 7, shape);
+  hal_program_segments(board, digit, bitmap_to_segments(changed),
+                       bitmap_to_segments(bitmap));
+}
+
+void display_controller_invalidate_board(uint8_t board) {
+#if NUM_LOCAL_BOARDS > 0
+  if (board < NUM_LOCAL_BOARDS) {
+    shadow_valid[board] = 0;
+  }
+#endif
 }
 
 void display_controller_program_board(uint8_t board, SSBitmap *bitmap) {
@@ -100,11 +100,17 @@
 
 typedef uint8_t SSBitmap;
 
+// Segments that are already in the requested state are not reprogrammed.
 void display_controller_program_cell(uint8_t board, uint8_t digit,
                                      SSBitmap bitmap);
 void display_controller_program_board(uint8_t board, SSBitmap *bitmap);
 void display_controller_enter_sleep();
 
+// Forget what's displayed on a board, so it is programmed in full the next
+// time. Needed if something else writes to it with hal_program_segment, or
+// it may have lost power.
+void display_controller_invalidate_board(uint8_t board);
+
 SSBitmap ascii_to_bitmap(char a);
 void ascii_to_bitmap_str(SSBitmap *b, int max_len, const char *a);
 
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "periph/7seg_panel/display_frame.h"
+
+#include "core/rulos.h"
+#include "periph/7seg_panel/board_buffer.h"
+
+static DisplayFrameClient *g_display_frame_clients = NULL;
+
+// when the frame timer is next due, if it's running
+static bool g_frame_scheduled = false;
+static Time g_frame_time;
+
+static void display_frame_update(void *data);
+
+// Runs a frame at 'when', unless one is already due by then.
+static void schedule_frame(Time when) {
+  if (g_frame_scheduled && !later_than(g_frame_time, when)) {
+    return;
+  }
+  g_frame_scheduled = true;
+  g_frame_time = when;
+  schedule_absolute(when, display_frame_update, NULL);
+}
+
+static void display_frame_update(void *data) {
+  Time now = clock_time_us();
+
+  // ignore a frame that was superseded by an earlier one
+  if (!g_frame_scheduled || later_than(g_frame_time, now)) {
+    return;
+  }
+  g_frame_scheduled = false;
+
+  bool any_active = false;
+  Time next_frame = 0;
+  board_buffer_begin_frame();
+  for (DisplayFrameClient *client = g_display_frame_clients; client != NULL;
+       client = client->next) {
+    if (client->active && later_than_or_eq(now, client->next_update)) {
+      client->next_update += client->period_us;
+      if (later_than(now, client->next_update)) {
+        // We fell behind; skip the missed updates rather than catching up.
+        client->next_update = now + client->period_us;
+      }
+      client->func(client->data);
+    }
+    if (client->active &&
+        (!any_active || later_than(next_frame, client->next_update))) {
+      next_frame = client->next_update;
+      any_active = true;
+    }
+  }
+  board_buffer_end_frame();
+
+  // Sleep until the next client is due, but for at least a frame. With no
+  // active clients the timer stops until one is activated.
+  if (any_active) {
+    Time earliest = now + DISPLAY_FRAME_PERIOD_US;
+    schedule_frame(later_than(next_frame, earliest) ? next_frame : earliest);
+  }
+}
+
+void display_frame_register(DisplayFrameClient *client, DisplayFrameFunc func,
+                            void *data, Time period_us) {
+  client->func = func;
+  client->data = data;
+  client->period_us = period_us;
+  client->active = true;
+  client->next_update = clock_time_us();
+  client->next = g_display_frame_clients;
+  g_display_frame_clients = client;
+  schedule_frame(client->next_update);
+}
+
+void display_frame_set_active(DisplayFrameClient *client, bool active) {
+  if (active && !client->active) {
+    client->next_update = clock_time_us();
+    schedule_frame(client->next_update);
+  }
+  client->active = active;
+}
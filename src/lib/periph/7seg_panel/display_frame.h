@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "core/clock.h"
+
+// The display frame runs the update functions of animated widgets from a
+// single timer, then flushes the display once, instead of each widget
+// scheduling its own timer and painting on its own clock. Frames run only as
+// often as the clients need them, at most every DISPLAY_FRAME_PERIOD_US, and
+// not at all while no client is active.
+
+#ifndef DISPLAY_FRAME_PERIOD_US
+#define DISPLAY_FRAME_PERIOD_US 20000  // 50 frames per second
+#endif
+
+typedef void (*DisplayFrameFunc)(void *data);
+
+typedef struct s_display_frame_client {
+  DisplayFrameFunc func;
+  void *data;
+  Time period_us;
+  bool active;
+  Time next_update;
+  struct s_display_frame_client *next;
+} DisplayFrameClient;
+
+// Calls func(data) in the display frame every period_us, starting with the
+// next frame. The client storage must stay valid for as long as the program
+// runs.
+void display_frame_register(DisplayFrameClient *client, DisplayFrameFunc func,
+                            void *data, Time period_us);
+
+// Stops or restarts the client's updates, for while it has nothing to
+// animate. A client is active when it's registered; reactivating it updates
+// it in the next frame.
+void display_frame_set_active(DisplayFrameClient *client, bool active);
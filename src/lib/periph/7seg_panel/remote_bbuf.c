@@ -32,8 +32,9 @@
 static void rbs_update(RemoteBBufSend *rbs);
 void rbs_refresh(RemoteBBufSend *rbs);
 void rbs_send_complete(SendSlot *slot);
+static void rbs_resync_recv(MessageRecvBuffer *msg);
 
-void init_remote_bbuf_send(RemoteBBufSend *rbs, Network *network) {
+static void rbs_init_common(RemoteBBufSend *rbs, Network *network) {
   rbs->network = network;
   rbs->sendSlot.func = rbs_send_complete;
   rbs->sendSlot.wire_msg = (WireMessage *)rbs->send_msg_alloc;
@@ -42,24 +43,52 @@ void init_remote_bbuf_send(RemoteBBufSend *rbs, Network *network) {
 #if NUM_REMOTE_BOARDS > 0
   memset(rbs->offscreen, 0, NUM_REMOTE_BOARDS * NUM_DIGITS * sizeof(SSBitmap));
 #endif
-  memset(rbs->changed, FALSE, NUM_REMOTE_BOARDS * sizeof(bool));
+  memset(rbs->changed, 0, sizeof(rbs->changed));
   rbs->last_index = 0;
+  rbs->delta = FALSE;
+}
+
+void init_remote_bbuf_send(RemoteBBufSend *rbs, Network *network) {
+  rbs_init_common(rbs, network);
 
   schedule_us(1, (ActivationFuncPtr)rbs_update, rbs);
   schedule_us(1, (ActivationFuncPtr)rbs_refresh, rbs);
 }
 
+// In delta mode there's no periodic refresh: everything is sent once at
+// startup, and after that a board is only resent when a receiver notices a
+// lost message and asks for it.
+void init_remote_bbuf_send_delta(RemoteBBufSend *rbs, Network *network,
+                                 Addr local_addr) {
+  rbs_init_common(rbs, network);
+  rbs->delta = TRUE;
+  rbs->local_addr = local_addr;
+  memset(rbs->seq, 0, sizeof(rbs->seq));
+  rbs->resync = 0;
+  memset(rbs->changed, 0xff, sizeof(rbs->changed));
+
+  rbs->resync_receiver.recv_complete_func = rbs_resync_recv;
+  rbs->resync_receiver.port = REMOTE_BBUF_RESYNC_PORT;
+  rbs->resync_receiver.num_receive_buffers = REMOTE_BBUF_RESYNC_RING_SIZE;
+  rbs->resync_receiver.payload_capacity = sizeof(BBufResyncMessage);
+  rbs->resync_receiver.message_recv_buffers = rbs->resync_ring_alloc;
+  rbs->resync_receiver.user_data = rbs;
+  net_bind_receiver(network, &rbs->resync_receiver);
+
+  schedule_us(1, (ActivationFuncPtr)rbs_update, rbs);
+}
+
 void send_remote_bbuf(RemoteBBufSend *rbs, SSBitmap *bm, uint8_t index,
                       uint8_t mask) {
   assert(0 <= index && index < NUM_REMOTE_BOARDS);
 
   for (int di = 0; di < NUM_DIGITS; di++) {
-    if (mask & 0x80) {
+    if ((mask & 0x80) && rbs->offscreen[index][di] != bm[di]) {
       rbs->offscreen[index][di] = bm[di];
+      rbs->changed[index] |= (0x80 >> di);
     }
     mask <<= 1;
   }
-  rbs->changed[index] = TRUE;
 }
 
 // Finds the next changed board since we last sent a board.
@@ -77,27 +106,136 @@ int rbs_find_changed_index(RemoteBBufSend *rbs) {
   return -1;
 }
 
-// Extract the remote address mappings from the DBOARD definitions into a
-// static.
-#define DBOARD(name, syms, x, y, remote_addr, remote_idx) \
-  { remote_addr, remote_idx }
-#define B_NO_BOARD /**/
-#define B_END      /**/
-#include "periph/7seg_panel/display_tree.ch"
-
+// Board routing tables, generated at build time from display_tree.ch by
+// src/util/display_tree_routes.py. remote_route is indexed by board number in
+// the display tree; remote board n is board NUM_LOCAL_BOARDS + n.
 typedef struct {
   uint8_t remote_addr;
   uint8_t remote_index;
-} RemoteMapping;
-static const RemoteMapping remote_mapping[] = {ROCKET_TREE};
+} RemoteRoute;
+#include "lib/periph/7seg_panel/display_tree_routes.ch"
 
-int remote_mapping_count = sizeof(remote_mapping) / sizeof(RemoteMapping);
+#if DISPLAY_TREE_NUM_DONGLES > REMOTE_BBUF_MAX_DONGLES
+#error "display tree has more dongles than REMOTE_BBUF_MAX_DONGLES"
+#endif
+
+static inline uint8_t rbs_remote_addr(int index) {
+  return pgm_read_byte(&remote_route[NUM_LOCAL_BOARDS + index].remote_addr);
+}
+
+static inline uint8_t rbs_remote_index(int index) {
+  return pgm_read_byte(&remote_route[NUM_LOCAL_BOARDS + index].remote_index);
+}
+
+// The boards on a dongle are rbs_dongle_board(i) for first <= i < last. Local
+// boards come out negative.
+static inline uint8_t rbs_dongle_first(uint8_t dongle) {
+  return pgm_read_byte(&dongle_boards_start[dongle]);
+}
+
+static inline uint8_t rbs_dongle_last(uint8_t dongle) {
+  return pgm_read_byte(&dongle_boards_start[dongle + 1]);
+}
+
+static inline int rbs_dongle_board(uint8_t i) {
+  return pgm_read_byte(&dongle_boards[i]) - NUM_LOCAL_BOARDS;
+}
 
 void rbs_send_complete(SendSlot *sendSlot) {
   RemoteBBufSend *rbs = (RemoteBBufSend *)sendSlot->user_data;
   rbs_update(rbs);
 }
 
+#if NUM_REMOTE_BOARDS > 0
+static uint8_t rbs_count_digits(uint8_t mask) {
+  uint8_t n = 0;
+  for (; mask; mask &= mask - 1) {
+    n++;
+  }
+  return n;
+}
+#endif
+
+// Packs every changed board on the same dongle as board 'first' that fits into
+// one message, and sends it.
+static void rbs_update_delta(RemoteBBufSend *rbs, int first) {
+#if NUM_REMOTE_BOARDS > 0
+  const uint8_t remote_addr = rbs_remote_addr(first);
+  const uint8_t dfirst = rbs_dongle_first(remote_addr);
+  const uint8_t dlast = rbs_dongle_last(remote_addr);
+
+  BBufDeltaMessage *bdm = (BBufDeltaMessage *)&rbs->sendSlot.wire_msg->data;
+  bdm->seq = rbs->seq[remote_addr];
+  bdm->src_addr = rbs->local_addr;
+  bdm->remote_addr = remote_addr;
+  bdm->flags = (rbs->resync & (1 << remote_addr)) ? BBUF_DELTA_FLAG_RESYNC : 0;
+
+  // Walk the dongle's boards starting at 'first' so that, when they don't all
+  // fit, they get their turn round-robin.
+  uint8_t start = dfirst;
+  while (rbs_dongle_board(start) != first) {
+    start++;
+  }
+
+  uint8_t sent[NUM_REMOTE_BOARDS];
+  memset(sent, 0, sizeof(sent));
+  uint8_t len = sizeof(BBufDeltaMessage);
+  uint8_t i = start;
+  do {
+    const int idx = rbs_dongle_board(i);
+    const uint8_t mask = idx >= 0 ? rbs->changed[idx] : 0;
+    if (mask != 0 &&
+        len + 2 + rbs_count_digits(mask) <= REMOTE_BBUF_DELTA_MAX_PAYLOAD) {
+      bdm->data[len - sizeof(BBufDeltaMessage)] = rbs_remote_index(idx);
+      bdm->data[len + 1 - sizeof(BBufDeltaMessage)] = mask;
+      len += 2;
+      for (int di = 0; di < NUM_DIGITS; di++) {
+        if (mask & (0x80 >> di)) {
+          bdm->data[len - sizeof(BBufDeltaMessage)] = rbs->offscreen[idx][di];
+          len++;
+        }
+      }
+      sent[idx] = mask;
+      rbs->last_index = idx;
+    }
+    if (++i == dlast) {
+      i = dfirst;
+    }
+  } while (i != start);
+
+#if BBDEBUG
+  LOG("rbs_update: delta to %d seq %d, %d bytes", remote_addr, bdm->seq, len);
+#endif
+
+  rbs->sendSlot.dest_addr = DONGLE_BASE_ADDR + remote_addr;
+  rbs->sendSlot.wire_msg->dest_port = REMOTE_BBUF_DELTA_PORT;
+  rbs->sendSlot.payload_len = len;
+
+  if (!net_send_message(rbs->network, &rbs->sendSlot)) {
+    // the send queue is full; nothing will call us back, so try again later.
+    schedule_us(REMOTE_BBUF_SEND_RATE, (ActivationFuncPtr)rbs_update, rbs);
+    return;
+  }
+
+  rbs->seq[remote_addr]++;
+
+  // The resync is done once nothing is left to send to that dongle.
+  bool done = TRUE;
+  for (i = dfirst; i < dlast; i++) {
+    const int idx = rbs_dongle_board(i);
+    if (idx >= 0) {
+      rbs->changed[idx] &= ~sent[idx];
+      if (rbs->changed[idx]) {
+        done = FALSE;
+      }
+    }
+  }
+  if (done) {
+    rbs->resync &= ~(1 << remote_addr);
+  }
+#endif
+}
+
 // This thread looks for a board that has been changed since we last sent it,
 // and transmits it. It finds boards round-robin to avoid starvation. It runs
 // on a regular schedule avoid swamping the network with board traffic.
@@ -114,21 +252,27 @@ void rbs_update(RemoteBBufSend *rbs) {
     return;
   }
 
+  if (rbs->delta) {
+    rbs_update_delta(rbs, index);
+    return;
+  }
+
 #if BBDEBUG
   LOG("rbs_update: update[%d]", index);
 #endif
 
   // send a packet for this changed line
-  const RemoteMapping *mapping = &remote_mapping[index];
-  rbs->sendSlot.dest_addr = DONGLE_BASE_ADDR + mapping->remote_addr;
+  rbs->sendSlot.dest_addr = DONGLE_BASE_ADDR + rbs_remote_addr(index);
   rbs->sendSlot.wire_msg->dest_port = REMOTE_BBUF_PORT;
   rbs->sendSlot.payload_len = sizeof(BBufMessage);
   BBufMessage *bbm = (BBufMessage *)&rbs->sendSlot.wire_msg->data;
   memcpy(bbm->buf, rbs->offscreen[index], NUM_DIGITS);
-  bbm->index = mapping->remote_index;
+  bbm->index = rbs_remote_index(index);
 
   if (net_send_message(rbs->network, &rbs->sendSlot)) {
-    rbs->changed[index] = FALSE;
+    rbs->changed[index] = 0;
+  } else {
+    schedule_us(REMOTE_BBUF_SEND_RATE, (ActivationFuncPtr)rbs_update, rbs);
   }
 
   rbs->last_index = index;
@@ -142,17 +286,51 @@ void rbs_refresh(RemoteBBufSend *rbs) {
 #if NUM_REMOTE_BOARDS > 0
   int idx;
   for (idx = 0; idx < NUM_REMOTE_BOARDS; idx++) {
-    rbs->changed[idx] = TRUE;
+    rbs->changed[idx] = 0xff;
   }
 #endif
 }
 
+// A receiver lost a message; resend everything on that dongle.
+static void rbs_resync_recv(MessageRecvBuffer *msg) {
+  RemoteBBufSend *rbs = (RemoteBBufSend *)msg->app_receiver->user_data;
+  BBufResyncMessage *brm = (BBufResyncMessage *)msg->data;
+
+  if (msg->payload_len != sizeof(BBufResyncMessage) ||
+      brm->remote_addr >= DISPLAY_TREE_NUM_DONGLES) {
+    LOG("rbs_resync_recv: Error: bad resync request");
+    goto done;
+  }
+
+#if BBDEBUG
+  LOG("rbs: resync requested by dongle %d", brm->remote_addr);
+#endif
+
+  const uint8_t dlast = rbs_dongle_last(brm->remote_addr);
+  for (uint8_t i = rbs_dongle_first(brm->remote_addr); i < dlast; i++) {
+    const int idx = rbs_dongle_board(i);
+    if (idx >= 0) {
+      rbs->changed[idx] = 0xff;
+    }
+  }
+  rbs->resync |= (1 << brm->remote_addr);
+
+done:
+  net_free_received_message_buffer(msg);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Receive side
 // TODO we should probably put this in a separate file, huh?
 
+#define REMOTE_BBUF_RESYNC_RETRY_US 250000
+
 void rbr_recv(MessageRecvBuffer *msg);
 
+static void rbr_paint_local(uint8_t index, SSBitmap *bm, uint8_t mask) {
+  board_buffer_paint(bm, index, mask);
+}
+
 void init_remote_bbuf_recv(RemoteBBufRecv *rbr, Network *network) {
   rbr->app_receiver.recv_complete_func = rbr_recv;
   rbr->app_receiver.port = REMOTE_BBUF_PORT;
@@ -161,6 +339,8 @@ void init_remote_bbuf_recv(RemoteBBufRecv *rbr, Network *network) {
   rbr->app_receiver.message_recv_buffers = rbr->recv_ring_alloc;
 
   net_bind_receiver(network, &rbr->app_receiver);
+
+  init_remote_bbuf_delta_recv(rbr, network, rbr_paint_local);
 }
 
 void rbr_recv(MessageRecvBuffer *msg) {
@@ -183,3 +363,114 @@ void rbr_recv(MessageRecvBuffer *msg) {
 done:
   net_free_received_message_buffer(msg);
 }
+
+static void rbr_delta_recv(MessageRecvBuffer *msg);
+static void rbr_resync_sent(SendSlot *slot);
+static void rbr_resync_retry(RemoteBBufRecv *rbr);
+
+void init_remote_bbuf_delta_recv(RemoteBBufRecv *rbr, Network *network,
+                                 RemoteBBufPaintFunc paint) {
+  rbr->network = network;
+  rbr->paint = paint;
+  rbr->synced = FALSE;
+  rbr->expected_seq = 0;
+  rbr->resync_pending = FALSE;
+  rbr->resync_queued = FALSE;
+
+  rbr->resync_slot.func = rbr_resync_sent;
+  rbr->resync_slot.wire_msg = (WireMessage *)rbr->resync_msg_alloc;
+  rbr->resync_slot.sending = FALSE;
+  rbr->resync_slot.user_data = rbr;
+
+  rbr->delta_receiver.recv_complete_func = rbr_delta_recv;
+  rbr->delta_receiver.port = REMOTE_BBUF_DELTA_PORT;
+  rbr->delta_receiver.num_receive_buffers = REMOTE_BBUF_DELTA_RING_SIZE;
+  rbr->delta_receiver.payload_capacity = REMOTE_BBUF_DELTA_MAX_PAYLOAD;
+  rbr->delta_receiver.message_recv_buffers = rbr->delta_ring_alloc;
+  rbr->delta_receiver.user_data = rbr;
+
+  net_bind_receiver(network, &rbr->delta_receiver);
+  schedule_us(REMOTE_BBUF_RESYNC_RETRY_US, (ActivationFuncPtr)rbr_resync_retry,
+              rbr);
+}
+
+static void rbr_resync_sent(SendSlot *slot) {
+  RemoteBBufRecv *rbr = (RemoteBBufRecv *)slot->user_data;
+  rbr->resync_queued = FALSE;
+}
+
+static void rbr_send_resync(RemoteBBufRecv *rbr) {
+  if (rbr->resync_queued) {
+    return;
+  }
+
+  rbr->resync_slot.dest_addr = rbr->resync_addr;
+  rbr->resync_slot.wire_msg->dest_port = REMOTE_BBUF_RESYNC_PORT;
+  rbr->resync_slot.payload_len = sizeof(BBufResyncMessage);
+  BBufResyncMessage *brm =
+      (BBufResyncMessage *)&rbr->resync_slot.wire_msg->data;
+  brm->remote_addr = rbr->remote_addr;
+
+  rbr->resync_queued = net_send_message(rbr->network, &rbr->resync_slot);
+}
+
+// Keeps asking until a resync message arrives, in case the request or the
+// reply was lost.
+static void rbr_resync_retry(RemoteBBufRecv *rbr) {
+  schedule_us(REMOTE_BBUF_RESYNC_RETRY_US, (ActivationFuncPtr)rbr_resync_retry,
+              rbr);
+  if (rbr->resync_pending) {
+    rbr_send_resync(rbr);
+  }
+}
+
+static void rbr_delta_recv(MessageRecvBuffer *msg) {
+  RemoteBBufRecv *rbr = (RemoteBBufRecv *)msg->app_receiver->user_data;
+  BBufDeltaMessage *bdm = (BBufDeltaMessage *)msg->data;
+  const uint8_t *p = bdm->data;
+  const uint8_t *end = msg->data + msg->payload_len;
+
+  if (msg->payload_len < sizeof(BBufDeltaMessage)) {
+    LOG("rbr_delta_recv: Error: short message of %d bytes", msg->payload_len);
+    goto done;
+  }
+
+  if (bdm->flags & BBUF_DELTA_FLAG_RESYNC) {
+    rbr->resync_pending = FALSE;
+  }
+
+  // Even after a gap, what we did get is the latest data for those digits,
+  // so it's painted either way.
+  bool gap = !rbr->synced || bdm->seq != rbr->expected_seq;
+  rbr->synced = TRUE;
+  rbr->expected_seq = bdm->seq + 1;
+
+  while (p + 2 <= end) {
+    const uint8_t index = *p++;
+    const uint8_t mask = *p++;
+    SSBitmap bm[NUM_DIGITS];
+    for (int di = 0; di < NUM_DIGITS; di++) {
+      if (mask & (0x80 >> di)) {
+        if (p >= end) {
+          LOG("rbr_delta_recv: Error: truncated board %d", index);
+          goto done;
+        }
+        bm[di] = *p++;
+      }
+    }
+    rbr->paint(index, bm, mask);
+  }
+
+  if (gap && !rbr->resync_pending) {
+#if BBDEBUG
+    LOG("rbr: seq gap at %d, requesting resync", bdm->seq);
+#endif
+    rbr->resync_pending = TRUE;
+    rbr->resync_addr = bdm->src_addr;
+    rbr->remote_addr = bdm->remote_addr;
+    rbr_send_resync(rbr);
+  }
+
+done:
+  net_free_received_message_buffer(msg);
+}
@@ -28,18 +28,61 @@ typedef struct {
   uint8_t index;
 } BBufMessage;
 
+// The delta protocol. Each message carries the changed digits of one or more
+// boards on the same remote dongle: a BBufDeltaMessage header, then for each
+// board,
+//   uint8_t index      remote board index
+//   uint8_t mask       digits included; 0x80 is digit 0, as in board_buffer
+//   SSBitmap digits[]  one for each bit set in mask
+// Messages to each dongle have consecutive sequence numbers. A receiver that
+// sees a gap asks the sender, at src_addr, to resend all of its boards.
+#define REMOTE_BBUF_DELTA_MAX_PAYLOAD 40  // room for three whole boards
+#define REMOTE_BBUF_DELTA_RING_SIZE   2
+#define REMOTE_BBUF_MAX_DONGLES       16
+
+#define BBUF_DELTA_FLAG_RESYNC 0x01  // message is part of a resync
+
+typedef struct {
+  uint8_t seq;
+  Addr src_addr;
+  uint8_t remote_addr;  // the receiving dongle, relative to DONGLE_BASE_ADDR
+  uint8_t flags;
+  uint8_t data[0];
+} BBufDeltaMessage;
+
+typedef struct {
+  uint8_t remote_addr;
+} BBufResyncMessage;
+
+#define REMOTE_BBUF_RESYNC_RING_SIZE 2
+
 typedef struct s_remote_bbuf_send {
   Network *network;
-  uint8_t send_msg_alloc[sizeof(WireMessage) + sizeof(BBufMessage)];
+  uint8_t send_msg_alloc[sizeof(WireMessage) + REMOTE_BBUF_DELTA_MAX_PAYLOAD];
   SendSlot sendSlot;
   struct s_remote_bbuf_send *send_this;
   SSBitmap offscreen[NUM_REMOTE_BOARDS][NUM_DIGITS];
-  bool changed[NUM_REMOTE_BOARDS];
+  uint8_t changed[NUM_REMOTE_BOARDS];  // digits not yet sent; 0x80 is digit 0
   uint8_t last_index;
+
+  // delta protocol only
+  bool delta;
+  Addr local_addr;
+  uint8_t seq[REMOTE_BBUF_MAX_DONGLES];
+  uint16_t resync;  // dongles that asked for a resync; bit n is remote_addr n
+  uint8_t resync_ring_alloc[RECEIVE_RING_SIZE(REMOTE_BBUF_RESYNC_RING_SIZE,
+                                              sizeof(BBufResyncMessage))];
+  AppReceiver resync_receiver;
 } RemoteBBufSend;
 
+// Sends whole boards, one per message, and refreshes every board periodically
+// in case messages are lost.
 void init_remote_bbuf_send(RemoteBBufSend *rbs, Network *network);
 
+// Sends with the delta protocol. Receivers send resync requests to local_addr.
+void init_remote_bbuf_send_delta(RemoteBBufSend *rbs, Network *network,
+                                 Addr local_addr);
+
 // Inbound interface from callsite in board_buffer that delivers remote boards.
 void send_remote_bbuf(RemoteBBufSend *rbs, SSBitmap *bm, uint8_t index,
                       uint8_t mask);
@@ -49,11 +92,35 @@ void send_remote_bbuf(RemoteBBufSend *rbs, SSBitmap *bm, uint8_t index,
 // Thread context for rbs_update and rbs_refresh.
 #define RING_INVALID_INDEX (255)
 
+// Displays the digits of a received board that are set in mask (0x80 is
+// digit 0).
+typedef void (*RemoteBBufPaintFunc)(uint8_t index, SSBitmap *bm, uint8_t mask);
+
 typedef struct s_remote_bbuf_recv {
   uint8_t recv_ring_alloc[RECEIVE_RING_SIZE(REMOTE_BBUF_RING_SIZE,
                                             sizeof(BBufMessage))];
   AppReceiver app_receiver;
+
+  // delta protocol
+  Network *network;
+  RemoteBBufPaintFunc paint;
+  uint8_t delta_ring_alloc[RECEIVE_RING_SIZE(REMOTE_BBUF_DELTA_RING_SIZE,
+                                             REMOTE_BBUF_DELTA_MAX_PAYLOAD)];
+  AppReceiver delta_receiver;
+  uint8_t resync_msg_alloc[sizeof(WireMessage) + sizeof(BBufResyncMessage)];
+  SendSlot resync_slot;
+  bool resync_queued;
+  bool resync_pending;
+  Addr resync_addr;
+  uint8_t remote_addr;
+  bool synced;
+  uint8_t expected_seq;
 } RemoteBBufRecv;
 
-// Initialize the remote bbuf service.
+// Initialize the remote bbuf service, painting received boards on the local
+// display. Both protocols are accepted.
 void init_remote_bbuf_recv(RemoteBBufRecv *rbr, Network *network);
+
+// Accept delta protocol messages only, displaying them with paint.
+void init_remote_bbuf_delta_recv(RemoteBBufRecv *rbr, Network *network,
+                                 RemoteBBufPaintFunc paint);
@@ -21,11 +21,30 @@ static uint32_t expect_pulse(gpio_pin_t pin, bool level) {
   return count;
 }
 
-bool dht22_read(gpio_pin_t pin, dht22_data_t *dht22_data) {
-  // Reset 40 bits of received data to zero.
-  uint8_t data[DHT22_BUFLEN];
-  memset(data, 0, DHT22_BUFLEN);
+// Check the frame's checksum and, if it's good, decode it.
+static bool decode_frame(const uint8_t *data, dht22_data_t *dht22_data) {
+#if 0
+  LOG("Got: 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x", data[0], data[1], data[2],
+      data[3], data[4]);
+#endif
+
+  if (data[4] != ((data[0] + data[1] + data[2] + data[3]) & 0xFF)) {
+    LOG("DHT22: Checksum failure, got 0x%02x",
+        data[0] + data[1] + data[2] + data[3]);
+    return false;
+  }
+
+  // Decode
+  dht22_data->humidity_pct_tenths = ((uint16_t)data[0]) << 8 | data[1];
+  dht22_data->temp_c_tenths = ((int16_t)(data[2] & 0x7F)) << 8 | data[3];
+  if (data[2] & 0x80) {
+    dht22_data->temp_c_tenths = -dht22_data->temp_c_tenths;
+  }
+
+  return true;
+}
 
+bool dht22_read(gpio_pin_t pin, dht22_data_t *dht22_data) {
   // Go into high impedence state to let pull-up raise data line level and start
   // the reading process.
   gpio_make_input_enable_pullup(pin);
@@ -88,6 +107,8 @@ release_irq:
 
   // Inspect pulses and determine which ones are 0 (high state cycle count < low
   // state cycle count), or 1 (high state cycle count > low state cycle count).
+  uint8_t data[DHT22_BUFLEN];
+  memset(data, 0, DHT22_BUFLEN);
   for (int i = 0; i < NUM_BITS; ++i) {
     uint32_t lowCycles = cycles[2 * i];
     uint32_t highCycles = cycles[2 * i + 1];
@@ -107,23 +128,71 @@ release_irq:
     // stored data.
   }
 
-#if 0
-  LOG("Got: 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x", data[0], data[1], data[2],
-      data[3], data[4]);
-#endif
+  return decode_frame(data, dht22_data);
+}
 
-  if (data[4] != ((data[0] + data[1] + data[2] + data[3]) & 0xFF)) {
-    LOG("DHT22: Checksum failure, got 0x%02x",
-        data[0] + data[1] + data[2] + data[3]);
-    return false;
+//// non-blocking reader
+
+// The frame lasts about 5 msec from when the line is released; give it
+// plenty of margin, as the scheduler may only run every jiffy.
+#define DHT22_READ_US 25000
+
+static void dht22_finish(void *arg) {
+  dht22_t *dht = (dht22_t *)arg;
+  dht22_hal_stop(dht);
+  dht->busy = false;
+
+  // The line idles high, so the last edge is the sensor letting go of it
+  // after the final bit, and the edges before it alternate falling and
+  // rising. Working back from there, each bit is a low pulse of ~50 usec
+  // followed by a high pulse that's shorter (0) or longer (1) than it. That
+  // way it doesn't matter whether we saw our own release of the line, or
+  // the start of the sensor's response.
+  const int n = dht->num_edges;
+  if (n < 2 * NUM_BITS + 2) {
+    LOG("DHT22: timeout waiting for pulse (%d edges)", n);
+    dht->cb(NULL, dht->user_data);
+    return;
   }
 
-  // Decode
-  dht22_data->humidity_pct_tenths = ((uint16_t)data[0]) << 8 | data[1];
-  dht22_data->temp_c_tenths = ((int16_t)(data[2] & 0x7F)) << 8 | data[3];
-  if (data[2] & 0x80) {
-    dht22_data->temp_c_tenths = -dht22_data->temp_c_tenths;
+  uint8_t data[DHT22_BUFLEN];
+  memset(data, 0, DHT22_BUFLEN);
+  const uint32_t *e = &dht->edge_usec[n - 2 * NUM_BITS - 2];
+  for (int i = 0; i < NUM_BITS; i++, e += 2) {
+    const uint32_t low_usec = e[1] - e[0];
+    const uint32_t high_usec = e[2] - e[1];
+    data[i / 8] <<= 1;
+    if (high_usec > low_usec) {
+      data[i / 8] |= 1;
+    }
   }
 
+  dht22_data_t dht22_data;
+  dht->cb(decode_frame(data, &dht22_data) ? &dht22_data : NULL,
+          dht->user_data);
+}
+
+void dht22_init(dht22_t *dht, gpio_pin_t pin, dht22_cb_t cb, void *user_data) {
+  memset(dht, 0, sizeof(*dht));
+  dht->pin = pin;
+  dht->cb = cb;
+  dht->user_data = user_data;
+  gpio_make_input_enable_pullup(pin);
+}
+
+bool dht22_start_read(dht22_t *dht) {
+  if (dht->busy) {
+    return false;
+  }
+  dht->busy = true;
+  dht->num_edges = 0;
+  dht22_hal_start(dht);
+  schedule_us(DHT22_READ_US, dht22_finish, dht);
   return true;
 }
+
+void dht22_edge(dht22_t *dht, uint32_t usec) {
+  if (dht->num_edges < DHT22_MAX_EDGES) {
+    dht->edge_usec[dht->num_edges++] = usec;
+  }
+}
@@ -9,5 +9,49 @@ typedef struct {
   uint16_t humidity_pct_tenths;  // humidity in units of 0.1 percent
 } dht22_data_t;
 
-// Returns true if data is valid, false if not.
+// Returns true if data is valid, false if not. Blocks for the start pulse,
+// and keeps interrupts off for the whole ~5 msec frame.
 bool dht22_read(gpio_pin_t pin, dht22_data_t *d);
+
+// Non-blocking reader. The start pulse is timed, and the sensor's pulses are
+// timestamped, by chip support in lib/chip/<chip>/periph/dht22 (currently
+// esp32 only) using a pin-change interrupt; interrupts stay on throughout.
+// The frame is decoded from the scheduler once it's over.
+
+// Enough for the sensor's whole response: its 80 usec acknowledgement, 40
+// bits, and the edges at either end.
+#ifndef DHT22_MAX_EDGES
+#define DHT22_MAX_EDGES 96
+#endif
+
+// Called with the reading, or NULL if it failed.
+typedef void (*dht22_cb_t)(dht22_data_t *data, void *user_data);
+
+typedef struct {
+  gpio_pin_t pin;
+  dht22_cb_t cb;
+  void *user_data;
+  bool busy;
+
+  // chip support's state, e.g. the start pulse timer
+  void *hal;
+
+  // timestamps of the edges seen since the line was released, in usec
+  volatile uint8_t num_edges;
+  uint32_t edge_usec[DHT22_MAX_EDGES];
+} dht22_t;
+
+void dht22_init(dht22_t *dht, gpio_pin_t pin, dht22_cb_t cb, void *user_data);
+
+// Start a reading; the callback runs when it's done, about 25 msec later.
+// Returns false, without starting one, if a reading is already in progress.
+// The sensor shouldn't be read more often than every 2 seconds.
+bool dht22_start_read(dht22_t *dht);
+
+// Called by the chip support's interrupt handler for each edge on the pin.
+void dht22_edge(dht22_t *dht, uint32_t usec);
+
+// Provided by the chip support: drive the start pulse, then release the line
+// and pass each of its edges to dht22_edge(); and stop doing so.
+void dht22_hal_start(dht22_t *dht);
+void dht22_hal_stop(dht22_t *dht);
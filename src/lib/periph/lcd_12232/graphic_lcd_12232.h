@@ -23,14 +23,33 @@
 #define BITMAP_ROW_LEN  16 /* bytes; 128 pixels, six offscreen */
 #define BITMAP_NUM_ROWS 32
 
+#define GLCD_DISPLAY_WIDTH 122
+#define GLCD_NUM_PAGES     (BITMAP_NUM_ROWS / 8) /* controller rows of 8 px */
+
 typedef struct {
   ActivationRecord done_act;
   uint8_t framebuffer[BITMAP_NUM_ROWS][BITMAP_ROW_LEN];
+
+  // What's on the panel, in the controller's page/column layout, and for each
+  // page the range of columns [dirty_x0, dirty_x1) that may differ from it.
+  uint8_t panel[GLCD_NUM_PAGES][GLCD_DISPLAY_WIDTH];
+  uint8_t dirty_x0[GLCD_NUM_PAGES];
+  uint8_t dirty_x1[GLCD_NUM_PAGES];
+  uint8_t panel_unknown;  // pages whose panel contents aren't known; bit n
+  bool ready;             // controller reset is complete
+  bool flush_scheduled;
 } GLCD;
 
 void glcd_init(GLCD *glcd, ActivationFuncPtr done_func, void *done_data);
 // void glcd_clear_screen(GLCD *glcd);
+
+// Schedules the changed parts of the framebuffer to be written to the panel.
+// The flush runs from the scheduler a page at a time, so it doesn't hold up
+// other work, and only columns that differ from the panel are written.
 void glcd_draw_framebuffer(GLCD *glcd);
 void glcd_clear_framebuffer(GLCD *glcd);
 
+// Code that changes the framebuffer directly should mark what it changed.
+void glcd_mark_dirty(GLCD *glcd, int16_t x0, int16_t x1);
+
 uint8_t glcd_paint_char(GLCD *glcd, char glyph, int16_t dx0, bool invert);
@@ -18,8 +18,10 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "core/rulos.h"
 #include "usbstructs.h"
 
 // Maximum number of USB devices we can talk to simultaneously.
@@ -36,6 +38,12 @@
 #define USB_BUFSIZE 64
 #endif
 
+// Longest report kept for an endpoint polled in the background; longer ones
+// are truncated.
+#ifndef MAX_USB_REPORT_LEN
+#define MAX_USB_REPORT_LEN 8
+#endif
+
 // The offset from the position of the device in the devices array to
 // its USB address. (During configuration the address might be zero.)
 #define ADDR_OFFSET 10
@@ -55,9 +63,27 @@ typedef struct {
   // endpoint to another.
   uint8_t last_rx_toggle;
   uint8_t last_tx_toggle;
+
+  // Polling interval in frames (msec), from the endpoint descriptor.
+  uint8_t interval;
+
+  // Background polling of an interrupt IN endpoint; see
+  // max3421e_poll_endpoint(). 'report' holds the most recent report
+  // received, and report_seq counts them.
+  bool polled;
+  Time next_poll_us;
+  ActivationRecord report_rec;
+  uint8_t report_seq;
+  uint8_t report_len;
+  uint8_t report[MAX_USB_REPORT_LEN];
 } usb_endpoint_t;
 
+struct max3421e_s;
+
 typedef struct {
+  // The max3421e the device is attached to.
+  struct max3421e_s *max;
+
   // Is the device ready? Clients shouldn't access the device until this is set.
   uint8_t ready;
 
@@ -75,7 +101,7 @@ typedef struct {
   usb_endpoint_t endpoints[MAX_USB_ENDPOINTS];
 } usb_device_t;
 
-typedef struct {
+typedef struct max3421e_s {
   // revision number of the max3421
   uint8_t chip_ver;
 
@@ -90,6 +116,23 @@ typedef struct {
 
   // transfer buffer
   uint8_t xferbuf[USB_BUFSIZE];
+
+  // Interrupts enabled in rHIEN. Once max3421e_interrupt() has been called,
+  // we know the INT pin is wired up and only poll rHIRQ as a backstop.
+  uint8_t hien;
+  bool int_wired;
+  volatile bool service_pending;
+
+  // Enumeration steps waiting on a hardware event: a bus reset finishing,
+  // or a delay passing.
+  ActivationFuncPtr bus_event_func;
+  ActivationFuncPtr frame_func;
+  Time frame_func_time;
+
+  // Polling of interrupt endpoints in the background: whether the polling
+  // timer is running, and the IN transaction in flight, if any.
+  bool polling;
+  usb_endpoint_t *xfer_endpoint;
 } max3421e_t;
 
 // MAX3421E Registers in PERIPHERAL mode. Preshifted left three places
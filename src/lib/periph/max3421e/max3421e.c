@@ -26,11 +26,19 @@
 #include "usbstructs.h"
 
 // Set transfer bounds
-#define NAK_LIMIT                3
-#define TIMEOUT_LIMIT            3
-#define USB_BUS_PROBE_PERIOD_MS  500
-#define USB_SETTLE_DELAY_MS      200
-#define USB_RESET_WAIT_PERIOD_MS 50
+#define NAK_LIMIT           3
+#define TIMEOUT_LIMIT       3
+#define USB_SETTLE_DELAY_MS 200
+
+// SOF frames are 1 msec apart. The enumeration delays and polling intervals
+// are timed with the clock, though, since neither the frame interrupts (when
+// INT isn't wired) nor our timers (which run once a jiffy) come every frame.
+#define USB_FRAME_US 1000
+
+// How often we poll rHIRQ from a timer. Until the INT pin is seen to work,
+// that's as often as the scheduler allows while waiting on the hardware;
+// otherwise it's just often enough to notice a device being plugged in.
+#define USB_BUS_PROBE_PERIOD_MS 500
 
 // USB 2.0 section 9.2.6.3 requires a 2msec delay after setting an address but
 // apparently the older spec requires at least a 200msec wait? The USB Host
@@ -83,6 +91,28 @@ static uint8_t read_reg(uint8_t reg_shifted) {
   return bufIn[1];
 }
 
+// Read multiple values from a MAX3421E register, e.g. draining a FIFO, in one
+// SPI transaction.
+static void multi_read_reg(uint8_t reg_shifted, uint8_t *buf, uint16_t len) {
+  uint8_t bufOut[USB_BUFSIZE + 1], bufIn[USB_BUFSIZE + 1];
+  assert(len <= USB_BUFSIZE);
+  memset(bufOut, 0, len + 1);
+  bufOut[0] = reg_shifted;
+  hal_spi_select_slave(TRUE);
+  hal_spi_sendrecv_multi(bufOut, bufIn, len + 1);
+  hal_spi_select_slave(FALSE);
+  memcpy(buf, &bufIn[1], len);
+}
+
+// Wait for the transaction in progress to finish.
+static void wait_xfer_done() {
+  while (!(read_reg(rHIRQ) & bmHXFRDNIRQ)) {
+  }
+  write_reg(rHIRQ, bmHXFRDNIRQ);
+}
+
+static void finish_background_xfer(max3421e_t *max);
+
 usb_word_t host_word_to_usb(const uint16_t value) {
   usb_word_t w;
   w.high = (value >> 8) & 0xFF;
@@ -96,6 +126,13 @@ usb_word_t host_word_to_usb(const uint16_t value) {
 // etc.
 static uint8_t execute_transaction(usb_device_t *dev, usb_endpoint_t *endpoint,
                                    const uint8_t transaction_type) {
+  // The max3421e runs one transaction at a time. If a background poll is in
+  // flight, let it finish first.
+  if (dev->max->xfer_endpoint != NULL) {
+    wait_xfer_done();
+    finish_background_xfer(dev->max);
+  }
+
   // Set the peer address in the max3421's address register and the
   // endpoint's data toggle.
   write_reg(rPERADDR, dev->addr);
@@ -109,14 +146,10 @@ static uint8_t execute_transaction(usb_device_t *dev, usb_endpoint_t *endpoint,
     // transaction
     write_reg(rHXFR, transaction_type | endpoint->endpoint_addr.addr);
 
-    // Wait for a frame to arrive
-    int wait_cycles = 0;
-    do {
-      wait_cycles++;
-    } while (!(read_reg(rHIRQ) & bmHXFRDNIRQ));
-    write_reg(rHIRQ, bmHXFRDNIRQ);
+    wait_xfer_done();
 
     // Get the result of the transaction
+    int wait_cycles = 0;
     uint8_t status, result;
     do {
       wait_cycles++;
@@ -517,26 +550,165 @@ static bool max_reset() {
   return false;
 }
 
-void step1_probe_bus(void *data);
 void initiate_periph_config(max3421e_t *max, uint8_t is_lowspeed);
 void step2_reset_device(void *data);
 void step3_enable_framemarker(void *data);
-void step4_delay_after_first_frameirq(void *data);
-void step5_configure_address(void *data);
-void step6_get_metadata(void *data);
+void step4_configure_address(void *data);
+void step5_get_metadata(void *data);
 
 // Resets internal state both when USB starts and when a disconnect occurs.
 static void reset_state(max3421e_t *max) {
   memset(max->devices, 0, sizeof(max->devices));
+  for (int i = 0; i < MAX_USB_DEVICES; i++) {
+    max->devices[i].max = max;
+  }
   max->connected = false;
+  max->bus_event_func = NULL;
+  max->frame_func = NULL;
+  max->xfer_endpoint = NULL;
+}
+
+static bool any_endpoint_polled(max3421e_t *max) {
+  for (int i = 0; i < MAX_USB_DEVICES; i++) {
+    for (int j = 0; j < max->devices[i].num_endpoints; j++) {
+      if (max->devices[i].endpoints[j].polled) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Enable the interrupts we're currently waiting on. A connect or disconnect,
+// or a transaction finishing, is always of interest; frames are only watched
+// while enumerating a device, since they come every msec.
+static void update_hien(max3421e_t *max) {
+  uint8_t hien = bmCONDETIE | bmHXFRDNIE;
+  if (max->bus_event_func != NULL) {
+    hien |= bmBUSEVENTIE;
+  }
+  if (max->frame_func != NULL) {
+    hien |= bmFRAMEIE;
+  }
+
+  if (hien != max->hien) {
+    // Don't act on events that happened before we were waiting for them.
+    write_reg(rHIRQ, hien & ~max->hien);
+    write_reg(rHIEN, hien);
+    max->hien = hien;
+  }
+}
+
+// Run 'func' after the bus reset that's about to be started has finished.
+static void wait_bus_event(max3421e_t *max, ActivationFuncPtr func) {
+  max->bus_event_func = func;
+  update_hien(max);
+}
+
+// Run 'func' at the first frame after 'ms' msec have passed.
+static void wait_ms(max3421e_t *max, uint16_t ms, ActivationFuncPtr func) {
+  max->frame_func_time = precise_clock_time_us() + ms * (Time)1000;
+  max->frame_func = func;
+  update_hien(max);
+}
+
+// Start an IN transaction to a polled endpoint, without waiting for it to
+// finish; finish_background_xfer() picks up the result.
+static void start_background_xfer(max3421e_t *max, usb_device_t *dev,
+                                  usb_endpoint_t *endpoint) {
+  write_reg(rPERADDR, dev->addr);
+  write_reg(rHCTL, endpoint->last_rx_toggle ? bmRCVTOG1 : bmRCVTOG0);
+  write_reg(rHXFR, tokIN | endpoint->endpoint_addr.addr);
+  max->xfer_endpoint = endpoint;
+}
+
+// Called once the max3421e has signalled that the background transaction is
+// done (and the HXFRDN interrupt has been cleared).
+static void finish_background_xfer(max3421e_t *max) {
+  usb_endpoint_t *endpoint = max->xfer_endpoint;
+  max->xfer_endpoint = NULL;
+
+  uint8_t status, result;
+  do {
+    status = read_reg(rHRSL);
+    result = status & 0xF;
+  } while (result == hrBUSY);
+  endpoint->last_rx_toggle = (status & bmRCVTOGRD) ? 1 : 0;
+
+  // A NAK means the device has nothing new to report, which is the usual
+  // case; there's nothing more to read.
+  if (result == hrNAK) {
+    return;
+  }
+
+  if (result) {
+    VLOG("USB: polling endpoint 0x%x failed: %d",
+         endpoint->endpoint_addr.addr, result);
+    return;
+  }
+
+  uint8_t buf[USB_BUFSIZE];
+  uint8_t len = r_min(read_reg(rRCVBC), sizeof(buf));
+  multi_read_reg(rRCVFIFO, buf, len);
+  write_reg(rHIRQ, bmRCVDAVIRQ);
+
+  endpoint->report_len = r_min(len, sizeof(endpoint->report));
+  memcpy(endpoint->report, buf, endpoint->report_len);
+  endpoint->report_seq++;
+  if (endpoint->report_rec.func != NULL) {
+    schedule_now(endpoint->report_rec.func, endpoint->report_rec.data);
+  }
 }
 
-// Bus probe step 1: check to see if anything new is attached to the bus.
-void step1_probe_bus(void *data) {
+static void max3421e_service(void *data);
+
+// Runs as often as once a frame while any endpoint is being polled, starting
+// each one's poll when its interval has passed and the max3421e is free. The
+// max3421e sends the IN token at the start of the next frame; it costs no SPI
+// traffic until then.
+static void poll_endpoints(void *data) {
   max3421e_t *max = (max3421e_t *)data;
 
+  if (!any_endpoint_polled(max)) {
+    max->polling = false;
+    return;
+  }
+  schedule_us(USB_FRAME_US, poll_endpoints, max);
+
+  // Without the INT pin, this is also when we check whether the previous
+  // poll has finished.
+  if (!max->int_wired && max->xfer_endpoint != NULL) {
+    max3421e_service(max);
+  }
+
+  const Time now = precise_clock_time_us();
+  for (int i = 0; i < MAX_USB_DEVICES; i++) {
+    usb_device_t *dev = &max->devices[i];
+    for (int j = 0; j < dev->num_endpoints; j++) {
+      usb_endpoint_t *endpoint = &dev->endpoints[j];
+      if (!endpoint->polled || max->xfer_endpoint != NULL ||
+          later_than(endpoint->next_poll_us, now)) {
+        continue;
+      }
+      start_background_xfer(max, dev, endpoint);
+
+      // A poll that's late pushes the next one back, rather than polls being
+      // bunched up to catch up.
+      endpoint->next_poll_us = now + endpoint->interval * (Time)USB_FRAME_US;
+    }
+  }
+}
+
+// Check to see if anything new is attached to the bus; called at startup and
+// whenever the max3421e detects a connect or disconnect.
+static void probe_bus(max3421e_t *max) {
   VLOG("probing bus");
 
+  // While we're resetting the bus, it looks like the device has gone away.
+  if (max->bus_event_func != NULL) {
+    return;
+  }
+
   // Probe bus to see if anything is attached. We sometimes see spurious
   // disconnects for some reason, so we keep sampling the bus until we get 3 of
   // the same value in a row.
@@ -560,16 +732,16 @@ void step1_probe_bus(void *data) {
     }
   } while (num_consistent_samples < 3);
 
-  // If nothing has changed since our last probe, just reschedule another bus
-  // probe for later.
+  // If nothing has changed since our last probe, there's nothing to do.
   if (max->last_bus_state == bus_state) {
-    goto probe_again_later;
+    return;
   }
 
-  // If we're in an illegal state, report an error and try again later.
+  // If we're in an illegal state, report an error and wait for the next
+  // change.
   if (bus_state == (bmJSTATUS | bmKSTATUS)) {
     LOG("USB Warning: bus seems to be in an illegal state!");
-    goto probe_again_later;
+    return;
   }
 
   max->last_bus_state = bus_state;
@@ -579,14 +751,14 @@ void step1_probe_bus(void *data) {
     case 0:
       // If both lines are low, the device has disconnected.
       LOG("USB: Disconnect detected");
-      max->connected = false;
       reset_state(max);
-      goto probe_again_later;
+      update_hien(max);
+      return;
 
     case bmJSTATUS:
       // Idle state detected. If we're already connected, do nothing.
       if (max->connected) {
-        goto probe_again_later;
+        return;
       }
 
       // A device just connected with the "correct polarity" -- meaning the
@@ -598,21 +770,73 @@ void step1_probe_bus(void *data) {
     case bmKSTATUS:
       if (max->connected) {
         LOG("USB: Got K status while already connected!?");
-        goto probe_again_later;
       } else {
         // If we're not connected and we see a K status it means we have to flip
         // the lowspeed bit.
         initiate_periph_config(max, !is_lowspeed);
-        return;
       }
+      return;
 
     default:
       assert(false);
   }
+}
+
+// Handle every interrupt the max3421e has pending. The INT pin stays
+// asserted as long as any enabled interrupt is, so we go around until none
+// are; otherwise the next one wouldn't produce an edge.
+static void max3421e_service(void *data) {
+  max3421e_t *max = (max3421e_t *)data;
+  max->service_pending = false;
+
+  uint8_t irq;
+  while ((irq = read_reg(rHIRQ) & max->hien) != 0) {
+    write_reg(rHIRQ, irq);
+
+    // Transactions started by the enumeration code are waited for as they
+    // run; only background ones are finished here.
+    if ((irq & bmHXFRDNIRQ) && max->xfer_endpoint != NULL) {
+      finish_background_xfer(max);
+    }
 
-probe_again_later:
-  schedule_us(USB_BUS_PROBE_PERIOD_MS * 1000, step1_probe_bus, max);
-  return;
+    if (irq & bmCONDETIRQ) {
+      probe_bus(max);
+    }
+
+    if ((irq & bmBUSEVENTIRQ) && max->bus_event_func != NULL) {
+      ActivationFuncPtr func = max->bus_event_func;
+      max->bus_event_func = NULL;
+      update_hien(max);
+      func(max);
+    }
+
+    if ((irq & bmFRAMEIRQ) && max->frame_func != NULL &&
+        later_than_or_eq(precise_clock_time_us(), max->frame_func_time)) {
+      ActivationFuncPtr func = max->frame_func;
+      max->frame_func = NULL;
+      update_hien(max);
+      func(max);
+    }
+  }
+}
+
+static void max3421e_poll_timer(void *data) {
+  max3421e_t *max = (max3421e_t *)data;
+
+  max3421e_service(max);
+
+  const bool waiting = max->hien & (bmBUSEVENTIE | bmFRAMEIE);
+  schedule_us(waiting && !max->int_wired ? USB_FRAME_US
+                                         : USB_BUS_PROBE_PERIOD_MS * 1000,
+              max3421e_poll_timer, max);
+}
+
+void max3421e_interrupt(max3421e_t *max) {
+  max->int_wired = true;
+  if (!max->service_pending) {
+    max->service_pending = true;
+    schedule_now(max3421e_service, max);
+  }
 }
 
 void initiate_periph_config(max3421e_t *max, uint8_t is_lowspeed) {
@@ -627,7 +851,7 @@ void initiate_periph_config(max3421e_t *max, uint8_t is_lowspeed) {
 
   max->connected = true;
   write_reg(rMODE, new_mode);
-  schedule_us(USB_SETTLE_DELAY_MS * 1000, step2_reset_device, max);
+  wait_ms(max, USB_SETTLE_DELAY_MS, step2_reset_device);
 }
 
 // Bus probe step 2: after the device has settled, perform a bus reset to put
@@ -636,45 +860,29 @@ void step2_reset_device(void *data) {
   max3421e_t *max = (max3421e_t *)data;
 
   VLOG("bus probe step2");
+  wait_bus_event(max, step3_enable_framemarker);
   write_reg(rHCTL, bmBUSRST);
-  schedule_us(USB_RESET_WAIT_PERIOD_MS * 1000, step3_enable_framemarker, max);
 }
 
-// Bus probe step 3: enable frame markers, then wait for the first FRAMEIRQ.
+// Bus probe step 3: once the reset is done, make sure frame markers are
+// enabled, then wait an additional 20msec after the first frame before
+// configuring.
 void step3_enable_framemarker(void *data) {
   max3421e_t *max = (max3421e_t *)data;
 
   VLOG("bus probe step3");
-  // Ensure reset has completed. If not, wait 10ms more.
-  if (read_reg(rHCTL) & bmBUSRST) {
-    schedule_us(10000, step3_enable_framemarker, max);
-  } else {
-    uint8_t mode = read_reg(rMODE);
-    mode |= bmSOFKAENAB;
-    write_reg(rMODE, mode);
-    schedule_us(20000, step4_delay_after_first_frameirq, max);
-  }
+  uint8_t mode = read_reg(rMODE);
+  mode |= bmSOFKAENAB;
+  write_reg(rMODE, mode);
+  wait_ms(max, 20, step4_configure_address);
 }
 
-// Bus probe step 4: After the first frameirq has been received, wait an
-// additional 20msec before configuring.
-void step4_delay_after_first_frameirq(void *data) {
-  max3421e_t *max = (max3421e_t *)data;
-
-  VLOG("bus probe step4");
-  if (read_reg(rHIRQ) & bmFRAMEIRQ) {
-    schedule_us(20000, step5_configure_address, max);
-  } else {
-    schedule_us(20000, step4_delay_after_first_frameirq, max);
-  }
-}
-
-// Bus probe step 5: Now that the bus traffic is flowing, query the new device
+// Bus probe step 4: Now that the bus traffic is flowing, query the new device
 // for its parameters, configure an address, etc.
-void step5_configure_address(void *data) {
+void step4_configure_address(void *data) {
   max3421e_t *max = (max3421e_t *)data;
 
-  VLOG("bus probe step5");
+  VLOG("bus probe step4");
 
   // Find an empty slot in the USB array
   usb_device_t *dev = NULL;
@@ -704,7 +912,7 @@ void step5_configure_address(void *data) {
     LOG("couldn't configure device address: %d", result);
   }
 
-  schedule_us(USB_POST_ADDRESS_WAIT_MS * 1000, step6_get_metadata, max);
+  wait_ms(max, USB_POST_ADDRESS_WAIT_MS, step5_get_metadata);
 }
 
 static void parse_endpoint(usb_device_t *dev, const uint8_t interface_id,
@@ -718,6 +926,7 @@ static void parse_endpoint(usb_device_t *dev, const uint8_t interface_id,
   endpoint->interface_id = interface_id;
   endpoint->endpoint_addr = ued->bEndpointAddress;
   endpoint->max_packet_len = ued->wMaxPacketSize;
+  endpoint->interval = r_max(ued->bInterval, 1);
 
   LOG("USB: device %d: interface %d has endpoint #%d at addr 0x%x (%s), "
       "max packet len %d",
@@ -829,32 +1038,43 @@ static void get_metadata_one_device(max3421e_t *max, usb_device_t *dev) {
   dev->ready = true;
 }
 
-// Bus probe step 6: Get metadata from just-configured devices, which we can
+// Bus probe step 5: Get metadata from just-configured devices, which we can
 // identify because the vid/pid are 0.
-void step6_get_metadata(void *data) {
+void step5_get_metadata(void *data) {
   max3421e_t *max = (max3421e_t *)data;
 
-  VLOG("bus probe step6");
+  VLOG("bus probe step5");
 
   for (int i = 0; i < MAX_USB_DEVICES; i++) {
     if (max->devices[i].addr != 0 && max->devices[i].vid == 0) {
       get_metadata_one_device(max, &max->devices[i]);
     }
   }
+}
 
-  // Now that the device address has been configured, we can also restart bus
-  // probing without seeing the same device again. Or, if address setting
-  // failed, bus probe will cause us to try again. Either way, we are ready to
-  // probe the bus again.
-  schedule_us(USB_BUS_PROBE_PERIOD_MS * 1000, step1_probe_bus, max);
+void max3421e_poll_endpoint(usb_device_t *dev, usb_endpoint_t *endpoint,
+                            ActivationFuncPtr func, void *data) {
+  assert(endpoint->endpoint_addr.direction);
+  endpoint->report_rec.func = func;
+  endpoint->report_rec.data = data;
+  endpoint->next_poll_us = precise_clock_time_us();
+  endpoint->polled = true;
+
+  max3421e_t *max = dev->max;
+  if (!max->polling) {
+    max->polling = true;
+    schedule_now(poll_endpoints, max);
+  }
 }
 
 bool max3421e_init(max3421e_t *max) {
+  memset(max, 0, sizeof(*max));
   reset_state(max);
   hal_init_spi();
 
-  // Set full duplex SPI mode
-  write_reg(rPINCTL, bmFDUPSPI);
+  // Set full duplex SPI mode, with INT active-low and level-triggered: it's
+  // held low as long as any enabled interrupt is pending.
+  write_reg(rPINCTL, bmFDUPSPI | bmINTLEVEL);
 
   // Attempt reset
   if (!max_reset()) {
@@ -868,6 +1088,15 @@ bool max3421e_init(max3421e_t *max) {
   // Activate host mode and turn on the pulldown resistors on D+ and D-
   write_reg(rMODE, bmDPPULLDN | bmDMPULLDN | bmHOST);
 
-  schedule_us(1, step1_probe_bus, max);
+  // From here on, we're driven by the max3421e's interrupts: a device being
+  // connected, bus reset finishing, the start of each frame while we're
+  // waiting on them, and background transactions finishing.
+  update_hien(max);
+  write_reg(rCPUCTL, bmIE);
+
+  // Something may already be plugged in.
+  probe_bus(max);
+
+  schedule_us(USB_FRAME_US, max3421e_poll_timer, max);
   return true;
 }
@@ -25,9 +25,26 @@
 #include "usbstructs.h"
 
 // Public interface to the max3421e library
+//
+// The driver is paced by the max3421e's own interrupts rather than timers.
+// If its INT pin is wired to the micro, call max3421e_interrupt() from the
+// pin's falling-edge interrupt handler; otherwise the driver polls for them
+// once a jiffy whenever it's waiting on the chip. Delays and polling
+// intervals are timed with precise_clock_time_us() either way.
 bool max3421e_init(max3421e_t *max);
+void max3421e_interrupt(max3421e_t *max);
+
+// Blocking transfers; these run to completion before returning.
 uint8_t max3421e_read_data(usb_device_t *dev, usb_endpoint_t *endpoint,
                            uint8_t *result_buf, uint16_t max_result_len,
                            uint16_t *result_len_received);
 uint8_t max3421e_set_hid_idle(usb_device_t *dev, usb_endpoint_t *endpoint,
                               const uint8_t idle_rate);
+
+// Fetch reports from an interrupt IN endpoint in the background, once per
+// polling interval given by the endpoint's descriptor. The device NAKs polls
+// when it has nothing new; each report it does send is copied to
+// endpoint->report, endpoint->report_seq is incremented, and 'func' (if not
+// NULL) is scheduled.
+void max3421e_poll_endpoint(usb_device_t *dev, usb_endpoint_t *endpoint,
+                            ActivationFuncPtr func, void *data);
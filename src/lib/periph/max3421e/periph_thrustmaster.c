@@ -43,22 +43,19 @@ bool thrustmaster_read(max3421e_t *max, JoystickState_t *joystate) {
     return false;
   }
 
-  uint8_t buf[6];
-  uint16_t result_len;
-  uint8_t result = max3421e_read_data(dev, &dev->endpoints[1], buf, sizeof(buf),
-                                      &result_len);
-
-  // NAK means data has not changed since last call. Return true without
-  // touching the state.
-  if (result == hrNAK) {
+  // The joystick's reports are fetched in the background as it sends them,
+  // which it only does when something has changed. Until the first one
+  // arrives, return true without touching the state.
+  usb_endpoint_t *endpoint = &dev->endpoints[1];
+  if (!endpoint->polled) {
+    max3421e_poll_endpoint(dev, endpoint, NULL, NULL);
+  }
+  if (endpoint->report_len == 0) {
     return true;
   }
 
-  // If there's some other error, return false, since there's no joystick
-  // indication.
-  if (result) {
-    return false;
-  }
+  const uint8_t *buf = endpoint->report;
+  const uint16_t result_len = endpoint->report_len;
 
 #if 0
   char s[100], *end = s;
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "periph/pps_clock/pps_clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/rulos.h"
+
+#define NS_PER_SEC        1000000000ULL
+#define PPS_CLOCK_POLL_US 100000
+
+// (dt * slope) >> 32 for a Q32 slope, without overflowing for any dt
+static uint64_t scale(uint64_t dt, uint64_t slope) {
+  const uint64_t dt_lo = dt & 0xffffffff;
+  return (dt >> 32) * slope + dt_lo * (slope >> 32) +
+         ((dt_lo * (slope & 0xffffffff)) >> 32);
+}
+
+static uint64_t to_ns(pps_clock_t *pc, uint64_t ticks) {
+  if (ticks >= pc->base_ticks) {
+    return pc->base_ns + scale(ticks - pc->base_ticks, pc->slope);
+  } else {
+    return pc->base_ns - scale(pc->base_ticks - ticks, pc->slope);
+  }
+}
+
+static uint64_t nominal_period(pps_clock_t *pc) {
+  return (NS_PER_SEC << 32) / pc->nominal_hz;
+}
+
+static void unlock(pps_clock_t *pc) {
+  pc->locked = false;
+  pc->good_pulses = 0;
+}
+
+static void step(pps_clock_t *pc, uint64_t ticks, uint64_t ns,
+                 uint64_t period) {
+  pc->base_ticks = ticks;
+  pc->base_ns = ns;
+  pc->period = period;
+  pc->slope = period;
+  pc->valid = true;
+  pc->num_steps++;
+  unlock(pc);
+}
+
+// Process an edge that marks the start of UTC second pc->edge_sec, 'dt' ticks
+// (and 'n' seconds) after the previous one.
+static void discipline(pps_clock_t *pc, uint64_t ticks, uint64_t dt,
+                       uint32_t n) {
+  const uint64_t target = (uint64_t)pc->edge_sec * NS_PER_SEC;
+
+  // The first time, and after a step, the interval from the previous edge
+  // gives the frequency directly, unless it's implausibly far from nominal.
+  uint64_t measured = nominal_period(pc);
+  if (n == 1 && llabs((int64_t)dt - (int64_t)pc->nominal_hz) <
+                    (int64_t)pc->nominal_hz / 1000) {
+    measured = (NS_PER_SEC << 32) / dt;
+  }
+
+  if (!pc->valid) {
+    pc->phase_err_ns = 0;
+    step(pc, ticks, target, measured);
+    return;
+  }
+
+  const uint64_t predicted = to_ns(pc, ticks);
+  const int64_t err = (int64_t)(target - predicted);
+  if (err > PPS_CLOCK_STEP_NS || err < -PPS_CLOCK_STEP_NS) {
+    pc->phase_err_ns = err > 0 ? INT32_MAX : INT32_MIN;
+    step(pc, ticks, target, measured);
+    return;
+  }
+  pc->phase_err_ns = err;
+
+  // err accumulated over dt ticks; trim the frequency by 1/KI of that, and
+  // slew 1/KP of the error out over the next second. The edge may have been
+  // captured a while ago, and the current segment has been read since then,
+  // so the new one starts now, from where the current one has got to;
+  // starting it at the edge could step the clock backwards.
+  const int64_t err_q32 = err * ((int64_t)1 << 32);
+  const uint64_t now = pc->get_ticks(pc->get_ticks_data);
+  pc->period = (uint64_t)((int64_t)pc->period +
+                          err_q32 / (int64_t)dt / PPS_CLOCK_KI);
+  pc->base_ns = to_ns(pc, now);
+  pc->base_ticks = now;
+  pc->slope = (uint64_t)((int64_t)pc->period + err_q32 /
+                                                   (int64_t)pc->nominal_hz /
+                                                   PPS_CLOCK_KP);
+
+  if (err < PPS_CLOCK_LOCK_NS && err > -PPS_CLOCK_LOCK_NS) {
+    if (pc->good_pulses < PPS_CLOCK_LOCK_PULSES) {
+      pc->good_pulses++;
+    }
+    if (pc->good_pulses == PPS_CLOCK_LOCK_PULSES) {
+      pc->locked = true;
+    }
+  } else if (!pc->locked) {
+    pc->good_pulses = 0;
+  }
+}
+
+static void process_edge(pps_clock_t *pc, uint64_t ticks) {
+  pc->num_pulses++;
+
+  if (!pc->have_edge) {
+    pc->have_edge = true;
+    pc->edge_ticks = ticks;
+    return;
+  }
+
+  const uint64_t dt = ticks - pc->edge_ticks;
+  if ((int64_t)dt < (int64_t)pc->nominal_hz / 2) {
+    pc->num_glitches++;
+    return;
+  }
+  const uint32_t n = (dt + pc->nominal_hz / 2) / pc->nominal_hz;
+  pc->edge_ticks = ticks;
+
+  // until NMEA has told us which second an edge marks, there's nothing to
+  // discipline to
+  if (pc->edge_sec == 0) {
+    return;
+  }
+  pc->edge_sec += n;
+  discipline(pc, ticks, dt, n);
+}
+
+static void pps_clock_service(pps_clock_t *pc) {
+  rulos_irq_state_t old_interrupts = hal_start_atomic();
+  const bool pending = pc->pulse_pending;
+  const uint64_t ticks = pc->pulse_ticks;
+  pc->pulse_pending = false;
+  hal_end_atomic(old_interrupts);
+
+  if (pending) {
+    process_edge(pc, ticks);
+  }
+
+  if (pc->locked && pc->get_ticks(pc->get_ticks_data) - pc->edge_ticks >
+                        (uint64_t)PPS_CLOCK_HOLDOVER_SEC * pc->nominal_hz) {
+    unlock(pc);
+  }
+}
+
+static void pps_clock_poll(void *data) {
+  pps_clock_t *pc = (pps_clock_t *)data;
+  schedule_us(PPS_CLOCK_POLL_US, pps_clock_poll, pc);
+  pps_clock_service(pc);
+}
+
+void pps_clock_init(pps_clock_t *pc, uint32_t nominal_hz,
+                    pps_clock_ticks_t get_ticks, void *get_ticks_data) {
+  memset(pc, 0, sizeof(*pc));
+  pc->nominal_hz = nominal_hz;
+  pc->get_ticks = get_ticks;
+  pc->get_ticks_data = get_ticks_data;
+  schedule_us(PPS_CLOCK_POLL_US, pps_clock_poll, pc);
+}
+
+void pps_clock_pulse(pps_clock_t *pc, uint64_t ticks) {
+  if (pc->pulse_pending) {
+    pc->num_missed++;
+  }
+  pc->pulse_ticks = ticks;
+  pc->pulse_pending = true;
+}
+
+//// NMEA
+
+static bool nmea_checksum_ok(const char *line) {
+  if (line[0] != '$') {
+    return false;
+  }
+
+  uint8_t sum = 0;
+  const char *p;
+  for (p = line + 1; *p != '\0' && *p != '*'; p++) {
+    sum ^= *p;
+  }
+  if (*p != '*' || p[1] == '\0' || p[2] == '\0') {
+    return false;
+  }
+  return strtoul(p + 1, NULL, 16) == sum;
+}
+
+// returns the start of the n'th comma-separated field, or NULL
+static const char *nmea_field(const char *line, int n) {
+  while (n-- > 0) {
+    line = strchr(line, ',');
+    if (line == NULL) {
+      return NULL;
+    }
+    line++;
+  }
+  return line;
+}
+
+static bool parse_digits(const char *s, int len, uint32_t *out) {
+  if (s == NULL) {
+    return false;
+  }
+  uint32_t v = 0;
+  for (int i = 0; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    v = v * 10 + (s[i] - '0');
+  }
+  *out = v;
+  return true;
+}
+
+// hhmmss, with an optional fraction that must be zero, as sentences only
+// name the second that began at a PPS edge if they're on a whole second
+static bool parse_time_of_day(const char *s, uint32_t *sec) {
+  uint32_t h, m, ss;
+  if (!parse_digits(s, 2, &h) || !parse_digits(s + 2, 2, &m) ||
+      !parse_digits(s + 4, 2, &ss) || h > 23 || m > 59 || ss > 59) {
+    return false;
+  }
+  s += 6;
+  if (*s == '.') {
+    for (s++; *s >= '0' && *s <= '9'; s++) {
+      if (*s != '0') {
+        return false;
+      }
+    }
+  }
+  if (*s != ',') {
+    return false;
+  }
+  *sec = h * 3600 + m * 60 + ss;
+  return true;
+}
+
+// days from 1970-01-01 to the given date in the proleptic Gregorian calendar
+static uint32_t days_since_epoch(uint32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  const uint32_t era = y / 400;
+  const uint32_t yoe = y - era * 400;
+  const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// Returns the UTC second named by an RMC or ZDA sentence, or 0.
+static uint32_t nmea_utc(const char *line) {
+  if (strlen(line) < 7 || !nmea_checksum_ok(line)) {
+    return 0;
+  }
+
+  uint32_t tod, day, month, year;
+  if (!strncmp(line + 3, "RMC,", 4)) {
+    // $xxRMC,hhmmss.ss,A,lat,N,lon,E,speed,course,ddmmyy,...
+    const char *status = nmea_field(line, 2);
+    const char *date = nmea_field(line, 9);
+    if (status == NULL || *status != 'A' ||
+        !parse_time_of_day(nmea_field(line, 1), &tod) ||
+        !parse_digits(date, 2, &day) || !parse_digits(date + 2, 2, &month) ||
+        !parse_digits(date + 4, 2, &year)) {
+      return 0;
+    }
+    year += 2000;
+  } else if (!strncmp(line + 3, "ZDA,", 4)) {
+    // $xxZDA,hhmmss.ss,dd,mm,yyyy,...
+    if (!parse_time_of_day(nmea_field(line, 1), &tod) ||
+        !parse_digits(nmea_field(line, 2), 2, &day) ||
+        !parse_digits(nmea_field(line, 3), 2, &month) ||
+        !parse_digits(nmea_field(line, 4), 4, &year)) {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  if (month < 1 || month > 12 || day < 1 || day > 31 || year < 1970) {
+    return 0;
+  }
+  return days_since_epoch(year, month, day) * 86400 + tod;
+}
+
+void pps_clock_nmea(pps_clock_t *pc, const char *line) {
+  const uint32_t sec = nmea_utc(line);
+  if (sec == 0) {
+    return;
+  }
+
+  // make sure the edge this sentence follows has been processed
+  pps_clock_service(pc);
+
+  // The sentence names the second that began at the most recent edge, which
+  // should be less than a second old; otherwise the PPS isn't arriving.
+  if (!pc->have_edge || pc->get_ticks(pc->get_ticks_data) - pc->edge_ticks >=
+                            pc->nominal_hz) {
+    return;
+  }
+
+  if (pc->edge_sec == sec) {
+    pc->label_mismatches = 0;
+    return;
+  }
+
+  // Once labeled, the edges are counted, so a disagreement is most likely a
+  // sentence that was delayed past the next edge. Relabel only if it
+  // persists.
+  if (pc->edge_sec != 0 && ++pc->label_mismatches < 2) {
+    return;
+  }
+  pc->label_mismatches = 0;
+  pc->edge_sec = sec;
+
+  // the timebase is set from the next edge
+  pc->valid = false;
+  unlock(pc);
+}
+
+////
+
+bool pps_clock_is_locked(pps_clock_t *pc) {
+  return pc->locked;
+}
+
+bool pps_clock_utc(pps_clock_t *pc, uint64_t ticks, uint32_t *sec,
+                   uint32_t *nsec) {
+  if (!pc->valid) {
+    return false;
+  }
+  const uint64_t ns = to_ns(pc, ticks);
+  *sec = ns / NS_PER_SEC;
+  *nsec = ns % NS_PER_SEC;
+  return true;
+}
+
+bool pps_clock_now(pps_clock_t *pc, uint32_t *sec, uint32_t *nsec) {
+  return pps_clock_utc(pc, pc->get_ticks(pc->get_ticks_data), sec, nsec);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson
+ * (jelson@gmail.com).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GPS-disciplined clock. Maps a free-running local timebase (any 64-bit tick
+// count: wallclock uptime in usec, a timer's input-capture count, ...) to UTC
+// with nanosecond resolution.
+//
+// The GPS's PPS edges are timestamped in local ticks by the app, typically
+// from a capture or pin-change interrupt, and handed to pps_clock_pulse().
+// NMEA sentences from the same receiver are handed to pps_clock_nmea(); an
+// RMC or ZDA sentence names the UTC second that began at the preceding edge.
+//
+// The timebase is a line segment with a slope in ns per tick (Q32). The
+// frequency is first measured directly from the interval between two edges
+// (FLL), then tracked by a proportional-integral loop on each edge's phase
+// error (PLL): the integral term trims the frequency, and the proportional
+// term slews a fraction of the phase error out over the following second.
+// Edges are processed from the scheduler, up to 100 ms after they arrive;
+// each new segment starts at that moment, where the previous one had got to,
+// so the time read from the clock is continuous and never goes backwards.
+// The timebase is only stepped when the error is too large to slew, e.g. at
+// startup.
+
+// nanoseconds of phase error above which the timebase is stepped
+#ifndef PPS_CLOCK_STEP_NS
+#define PPS_CLOCK_STEP_NS 500000
+#endif
+
+// the clock is locked after this many consecutive edges within
+// PPS_CLOCK_LOCK_NS of the timebase's prediction
+#ifndef PPS_CLOCK_LOCK_NS
+#define PPS_CLOCK_LOCK_NS 2000
+#endif
+
+#ifndef PPS_CLOCK_LOCK_PULSES
+#define PPS_CLOCK_LOCK_PULSES 8
+#endif
+
+// lock is lost if no edge arrives for this long
+#ifndef PPS_CLOCK_HOLDOVER_SEC
+#define PPS_CLOCK_HOLDOVER_SEC 10
+#endif
+
+// loop gains: each edge slews out 1/KP of the phase error over the next
+// second, and adjusts the frequency by 1/KI of it
+#define PPS_CLOCK_KP 4
+#define PPS_CLOCK_KI 32
+
+typedef uint64_t (*pps_clock_ticks_t)(void *data);
+
+typedef struct {
+  uint32_t nominal_hz;
+  pps_clock_ticks_t get_ticks;
+  void *get_ticks_data;
+
+  // edge stored by pps_clock_pulse(), waiting to be processed
+  volatile bool pulse_pending;
+  uint64_t pulse_ticks;
+
+  // most recently processed edge, and the UTC second it marks (0 if unknown)
+  bool have_edge;
+  uint64_t edge_ticks;
+  uint32_t edge_sec;
+  uint8_t label_mismatches;
+
+  // the timebase: utc_ns(t) = base_ns + (t - base_ticks) * slope
+  bool valid;
+  uint64_t base_ticks;
+  uint64_t base_ns;
+  uint64_t slope;   // ns per tick, Q32, including the phase slew
+  uint64_t period;  // ns per tick, Q32, frequency estimate
+
+  bool locked;
+  uint8_t good_pulses;
+
+  // statistics
+  int32_t phase_err_ns;  // phase error at the most recent edge
+  uint32_t num_pulses;
+  uint32_t num_missed;   // edges overwritten before they were processed
+  uint32_t num_glitches;  // edges too close to the previous one
+  uint32_t num_steps;
+} pps_clock_t;
+
+// get_ticks returns the current local time, in ticks of nominal_hz; it's the
+// timebase the PPS edges are captured in.
+void pps_clock_init(pps_clock_t *pc, uint32_t nominal_hz,
+                    pps_clock_ticks_t get_ticks, void *get_ticks_data);
+
+// Record a PPS edge captured at local time 'ticks'. Safe to call from an
+// interrupt handler; the edge is processed later from the scheduler.
+void pps_clock_pulse(pps_clock_t *pc, uint64_t ticks);
+
+// Pass in each NMEA sentence received from the GPS. Sentences other than a
+// checksummed RMC with a valid fix, or a ZDA, are ignored.
+void pps_clock_nmea(pps_clock_t *pc, const char *line);
+
+bool pps_clock_is_locked(pps_clock_t *pc);
+
+// Convert local time 'ticks' to UTC, as seconds since the Unix epoch and
+// nanoseconds. Returns false if the clock hasn't yet been set from a labeled
+// PPS edge; check pps_clock_is_locked() for whether it's disciplined.
+bool pps_clock_utc(pps_clock_t *pc, uint64_t ticks, uint32_t *sec,
+                   uint32_t *nsec);
+
+// the current time in UTC, as pps_clock_utc()
+bool pps_clock_now(pps_clock_t *pc, uint32_t *sec, uint32_t *nsec);
@@ -24,61 +24,81 @@ void raster_big_digit_update(RasterBigDigit *digit);
 
 #include "lib/periph/rasters/rasters_auto.ch"
 
-uint16_t get_bitfield(uint16_t offset, uint8_t len) {
-  uint8_t bitsAvaiableThisByte = 8 - (offset % 8);
-  uint8_t bitsUsedThisByte = r_min(bitsAvaiableThisByte, len);
-  uint8_t byte = pgm_read_byte(&(rasterData[offset / 8]));
-  uint16_t v = byte >> (bitsAvaiableThisByte - bitsUsedThisByte);
-  v &= ((1 << bitsUsedThisByte) - 1);
-  uint16_t outVal = (v << (len - bitsUsedThisByte));
-
-  uint8_t rest_len = len - bitsUsedThisByte;
-  uint16_t rest_offset = offset + bitsUsedThisByte;
-  if (rest_len > 0) {
-    assert(rest_offset > offset);
-    assert((rest_offset % 8) == 0);
-    outVal |= get_bitfield(rest_offset, rest_len);
-  }
-  return outVal;
+// The pixels of each cell, by row, for each set of the row's four columns
+// (bit n set for column n)
+#define SPAN_ROW(m0, m1, m2, m3)                                             \
+  {                                                                          \
+    0, m0, m1, m0 | m1, m2, m0 | m2, m1 | m2, m0 | m1 | m2, m3, m0 | m3,     \
+        m1 | m3, m0 | m1 | m3, m2 | m3, m0 | m2 | m3, m1 | m2 | m3,          \
+        m0 | m1 | m2 | m3                                                    \
+  }
+
+static const SSBitmap _sevseg_span_mask[6][16] PROGMEM = {
+    SPAN_ROW(0b00000000, 0b01000000, 0b00000000, 0b00000000),
+    SPAN_ROW(0b00000010, 0b00000000, 0b00100000, 0b00000000),
+    SPAN_ROW(0b00000000, 0b00000001, 0b00000000, 0b00000000),
+    SPAN_ROW(0b00000100, 0b00000000, 0b00010000, 0b00000000),
+    SPAN_ROW(0b00000000, 0b00001000, 0b00000000, 0b10000000),
+    SPAN_ROW(0b00000000, 0b00000000, 0b00000000, 0b00000000),
+};
+
+// Paints pixels x0 up to (not including) x1 of row y. Rather than painting
+// pixel by pixel, each cell the span crosses gets one OR of the mask of all
+// the span's pixels in that cell.
+static void raster_paint_span(RectRegion *rrect, int x0, int x1, int y) {
+  int maj_y = int_div_with_correct_truncation(y, 6);
+  if (maj_y < 0 || maj_y >= rrect->ylen) {
+    return;
+  }
+  const SSBitmap *row_masks = _sevseg_span_mask[y - (maj_y * 6)];
+  SSBitmap *buffer = rrect->bbuf[maj_y]->buffer;
+
+  // clip to the region; after that, x0 and x1 are not negative
+  x0 = r_max(x0, rrect->x * 4);
+  x1 = r_min(x1, (rrect->x + rrect->xlen) * 4);
+  if (x0 >= x1) {
+    return;
+  }
+
+  uint8_t cell = x0 >> 2;
+  uint8_t last_cell = (x1 - 1) >> 2;
+  uint8_t first_cols = (0xf << (x0 & 3)) & 0xf;
+  uint8_t last_cols = 0xf >> (3 - ((x1 - 1) & 3));
+
+  if (cell == last_cell) {
+    buffer[cell] |= pgm_read_byte(&row_masks[first_cols & last_cols]);
+    return;
+  }
+
+  buffer[cell++] |= pgm_read_byte(&row_masks[first_cols]);
+  SSBitmap full = pgm_read_byte(&row_masks[0xf]);
+  while (cell < last_cell) {
+    buffer[cell++] |= full;
+  }
+  buffer[cell] |= pgm_read_byte(&row_masks[last_cols]);
 }
 
 void raster_draw_sym(RectRegion *rrect, char sym, int8_t dx, int8_t dy) {
-  const RasterIndex *ri = rasterIndex;
-  while (ri->sym != '\0' && ri->sym != sym) {
-    ri++;
+  uint8_t glyph_index = (uint8_t)(sym - RASTER_FIRST_SYM);
+  uint8_t num_runs = 0;
+  if (glyph_index < RASTER_NUM_SYMS) {
+    num_runs = pgm_read_byte(&rasterGlyphs[glyph_index].num_runs);
   }
-  if (ri->sym == '\0') {
+  if (num_runs == 0) {
     LOG("sym = %d (%c)", sym, sym);
     assert(FALSE);  // symbol not found
     return;
   }
 
-  int y = 0;
-  for (int idx = 0; idx < ri->len; idx++) {
-    uint16_t bitfield = get_bitfield(ri->offset_bits + idx * 11, 11);
-    uint8_t ybit = (bitfield >> 10) & 1;
-    uint8_t x0 = (bitfield >> 5) & 0x1f;
-    uint8_t x1 = (bitfield >> 0) & 0x1f;
-    if (ybit) {
-      y += 1;
-    }
-    // LOG("raster_draw_sym(%c idx %2d/%2d) y%d x0 %2d x1 %2d", sym, idx,
-    // ri->len, y, x0, x1);
-    for (int x = x0; x < x1; x++) {
-      // LOG("paintpixel(%d,%d)", dx+x, dy+y);
-      raster_paint_pixel(rrect, dx + x, dy + y);
-    }
+  const uint16_t *run = &rasterRuns[pgm_read_word(
+      &rasterGlyphs[glyph_index].first_run)];
+  for (; num_runs > 0; num_runs--, run++) {
+    uint16_t r = pgm_read_word(run);
+    raster_paint_span(rrect, dx + ((r >> 5) & 0x1f), dx + (r & 0x1f),
+                      dy + (r >> 10));
   }
 }
 
-static SSBitmap _sevseg_pixel_mask[6][4] = {
-    {0b00000000, 0b01000000, 0b00000000, 0b00000000},
-    {0b00000010, 0b00000000, 0b00100000, 0b00000000},
-    {0b00000000, 0b00000001, 0b00000000, 0b00000000},
-    {0b00000100, 0b00000000, 0b00010000, 0b00000000},
-    {0b00000000, 0b00001000, 0b00000000, 0b10000000},
-    {0b00000000, 0b00000000, 0b00000000, 0b00000000}};
-
 void raster_paint_pixel(RectRegion *rrect, int x, int y) {
   raster_paint_pixel_v(rrect, x, y, TRUE);
 }
@@ -98,10 +118,11 @@ void raster_paint_pixel_v(RectRegion *rrect, int x, int y, bool on) {
   }
 
   // LOG("PAINT!");
+  SSBitmap mask = pgm_read_byte(&_sevseg_span_mask[min_y][1 << min_x]);
   if (on) {
-    rrect->bbuf[maj_y]->buffer[maj_x] |= _sevseg_pixel_mask[min_y][min_x];
+    rrect->bbuf[maj_y]->buffer[maj_x] |= mask;
   } else {
-    rrect->bbuf[maj_y]->buffer[maj_x] &= ~(_sevseg_pixel_mask[min_y][min_x]);
+    rrect->bbuf[maj_y]->buffer[maj_x] &= ~mask;
   }
 }
 
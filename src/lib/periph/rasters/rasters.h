@@ -22,14 +22,19 @@
 #include "periph/7seg_panel/region.h"
 #include "periph/rocket/screen4.h"
 
+// Glyphs are drawn as a list of runs: horizontal spans of lit pixels.
 typedef struct {
-  char sym;
-  uint8_t len;           // units: 11-bit fields
-  uint16_t offset_bits;  // units: bits
-} RasterIndex;
+  uint16_t first_run;  // index into rasterRuns
+  uint8_t num_runs;
+} RasterGlyph;
 
-extern const RasterIndex rasterIndex[];
-extern const uint8_t rasterData[];
+// A run lights pixels x0 up to (not including) x1 of row y
+#define RASTER_RUN(y, x0, x1) (((y) << 10) | ((x0) << 5) | (x1))
+
+// generated by bitmaploader.py; rasterGlyphs is indexed by
+// (sym - RASTER_FIRST_SYM)
+extern const RasterGlyph rasterGlyphs[];
+extern const uint16_t rasterRuns[];
 
 void raster_draw_sym(RectRegion *rrect, char sym, int8_t dx, int8_t dy);
 void raster_paint_pixel(RectRegion *rrect, int x, int y);
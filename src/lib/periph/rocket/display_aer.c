@@ -39,12 +39,11 @@ void daer_init(DisplayAzimuthElevationRoll *daer, uint8_t board,
       (FetchCalcDecorationValuesFunc)daer_fetchCalcDecorationValues;
   daer->decoration_ifc.daer = daer;
 
-  schedule_us(1, (ActivationFuncPtr)daer_update, daer);
+  display_frame_register(&daer->frame, (DisplayFrameFunc)daer_update, daer,
+                         Exp2Time(16));
 }
 
 void daer_update(DisplayAzimuthElevationRoll *daer) {
-  schedule_us(Exp2Time(16), (ActivationFuncPtr)daer_update, daer);
-
   Time t = clock_time_us();
   if (t - daer->last_impulse > daer->impulse_frequency_us) {
     da_random_impulse(&daer->azimuth);
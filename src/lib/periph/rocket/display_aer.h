@@ -20,6 +20,7 @@
 
 #include "core/clock.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 #include "periph/rocket/calculator_decoration.h"
 #include "periph/rocket/drift_anim.h"
 
@@ -38,6 +39,7 @@ typedef struct s_d_aer {
   Time impulse_frequency_us;
   Time last_impulse;
   decoration_ifc_t decoration_ifc;
+  DisplayFrameClient frame;
 } DisplayAzimuthElevationRoll;
 
 void daer_init(DisplayAzimuthElevationRoll *daer, uint8_t board,
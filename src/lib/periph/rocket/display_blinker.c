@@ -29,13 +29,19 @@ void blinker_init(DBlinker *blinker, uint16_t period) {
   blinker->msg = NULL;
   blinker->cur_line = 0;
   board_buffer_init(&blinker->bbuf DBG_BBUF_LABEL("blinker"));
-  schedule_us(1, (ActivationFuncPtr)blinker_update, blinker);
+  display_frame_register(&blinker->frame, (DisplayFrameFunc)blinker_update,
+                         blinker, ((Time)period) * 1000);
+  display_frame_set_active(&blinker->frame, false);
 }
 
 void blinker_set_msg(DBlinker *blinker, const char **msg) {
   blinker->msg = msg;
   blinker->cur_line = 0;
   blinker_update_once(blinker);
+
+  // only a message of more than one line blinks
+  display_frame_set_active(&blinker->frame, msg != NULL && msg[0] != NULL &&
+                                                msg[1] != NULL);
 }
 
 void blinker_update_once(DBlinker *blinker) {
@@ -49,8 +55,6 @@ void blinker_update_once(DBlinker *blinker) {
 }
 
 void blinker_update(DBlinker *blinker) {
-  schedule_us(blinker->period * 1000, (ActivationFuncPtr)blinker_update,
-              blinker);
   blinker_update_once(blinker);
 
   blinker->cur_line += 1;
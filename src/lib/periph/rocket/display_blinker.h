@@ -20,12 +20,14 @@
 
 #include "core/clock.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 
 typedef struct {
   uint16_t period;
   const char **msg;
   uint8_t cur_line;
   BoardBuffer bbuf;
+  DisplayFrameClient frame;
 } DBlinker;
 
 void blinker_init(DBlinker *blinker, uint16_t period);
@@ -78,7 +78,8 @@ void ddock_init(DDockAct *act, Screen4 *s4, uint8_t auxboard_base,
 
   ddock_hide(act);
 
-  schedule_us(1, (ActivationFuncPtr)ddock_update, act);
+  display_frame_register(&act->frame, (DisplayFrameFunc)ddock_update, act,
+                         Exp2Time(17));
 }
 
 void ddock_hide(DDockAct *dd) {
@@ -115,8 +116,6 @@ void ddock_reset(DDockAct *dd) {
 #define IMPULSE_FREQUENCY_US 5000000
 
 void ddock_update(DDockAct *act) {
-  schedule_us(Exp2Time(17), (ActivationFuncPtr)ddock_update, act);
-
   ddock_update_once(act);
 
 #if RANDOM_DRIFT
@@ -20,6 +20,7 @@
 
 #include "core/clock.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 #include "periph/input_controller/focus.h"
 #include "periph/joystick/joystick.h"
 #include "periph/rocket/booster.h"
@@ -53,6 +54,7 @@ typedef struct s_ddockact {
   AudioClient *audioClient;
   Booster *booster;
   JoystickState_t *joystick;
+  DisplayFrameClient frame;
 } DDockAct;
 
 void ddock_init(DDockAct *act, Screen4 *s4, uint8_t auxboard_base,
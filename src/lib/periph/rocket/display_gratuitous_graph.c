@@ -36,11 +36,11 @@ void dgg_init(DGratuitousGraph *dgg, uint8_t board, char *name,
   dgg->name = name;
   dgg->impulse_frequency_us = impulse_frequency_us;
   dgg->last_impulse = 0;
-  schedule_us(1, (ActivationFuncPtr)dgg_update, dgg);
+  display_frame_register(&dgg->frame, (DisplayFrameFunc)dgg_update, dgg,
+                         Exp2Time(16));
 }
 
 void dgg_update(DGratuitousGraph *dgg) {
-  schedule_us(Exp2Time(16), (ActivationFuncPtr)dgg_update, dgg);
   Time t = clock_time_us();
   if (t - dgg->last_impulse > dgg->impulse_frequency_us) {
     dgg->last_impulse = t;
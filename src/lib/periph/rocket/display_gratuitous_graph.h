@@ -20,6 +20,7 @@
 
 #include "core/clock.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 #include "periph/rocket/drift_anim.h"
 
 typedef struct s_d_gratuitous_graph {
@@ -28,6 +29,7 @@ typedef struct s_d_gratuitous_graph {
   char *name;
   Time impulse_frequency_us;
   Time last_impulse;
+  DisplayFrameClient frame;
 } DGratuitousGraph;
 
 void dgg_init(DGratuitousGraph *dgg, uint8_t board, char *name,
@@ -32,8 +32,11 @@ void dscrlmsg_init(DScrollMsgAct *act, uint8_t board, const char *msg,
   act->len = 0;
   act->speed_ms = speed_ms;
   act->index = 0;
+  if (speed_ms > 0) {
+    display_frame_register(&act->frame, (DisplayFrameFunc)dscrlmsg_update, act,
+                           ((Time)speed_ms) * 1000);
+  }
   dscrlmsg_set_msg(act, msg);
-  schedule_us(1, (ActivationFuncPtr)dscrlmsg_update, act);
 }
 
 int dscrlmsg_nexti(DScrollMsgAct *act, int i) {
@@ -56,14 +59,10 @@ void dscrlmsg_update_once(DScrollMsgAct *act) {
 }
 
 void dscrlmsg_update(DScrollMsgAct *act) {
-  if (act->speed_ms > 0) {
-    schedule_us(((Time)act->speed_ms) * 1000,
-                (ActivationFuncPtr)dscrlmsg_update, act);
-    if (act->len > NUM_DIGITS) {
-      act->index = dscrlmsg_nexti(act, act->index);
-    } else {
-      act->index = 0;
-    }
+  if (act->len > NUM_DIGITS) {
+    act->index = dscrlmsg_nexti(act, act->index);
+  } else {
+    act->index = 0;
   }
   dscrlmsg_update_once(act);
 }
@@ -75,4 +74,9 @@ void dscrlmsg_set_msg(DScrollMsgAct *act, const char *msg) {
     act->index = 0;
   }
   dscrlmsg_update_once(act);
+
+  // a message that fits on the display doesn't scroll
+  if (act->speed_ms > 0) {
+    display_frame_set_active(&act->frame, act->len > NUM_DIGITS);
+  }
 }
@@ -20,6 +20,7 @@
 
 #include "core/clock.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 
 typedef struct s_dscrollmsgact {
   BoardBuffer bbuf;
@@ -27,6 +28,7 @@ typedef struct s_dscrollmsgact {
   uint8_t speed_ms;
   int index;
   const char *msg;
+  DisplayFrameClient frame;
 } DScrollMsgAct;
 
 void dscrlmsg_init(struct s_dscrollmsgact *act, uint8_t board, const char *msg,
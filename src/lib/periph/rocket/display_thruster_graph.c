@@ -37,7 +37,8 @@ void dtg_init_local(DThrusterGraph *dtg, uint8_t board) {
   board_buffer_init(&dtg->bbuf DBG_BBUF_LABEL("thrustergraph"));
   board_buffer_push(&dtg->bbuf, board);
 
-  schedule_us(1, (ActivationFuncPtr)dtg_update, dtg);
+  display_frame_register(&dtg->frame, (DisplayFrameFunc)dtg_update, dtg,
+                         Exp2Time(16));
 }
 
 void dtg_init_remote(DThrusterGraph *dtg, uint8_t board, Network *network) {
@@ -55,8 +56,6 @@ void dtg_init_remote(DThrusterGraph *dtg, uint8_t board, Network *network) {
 }
 
 void dtg_update(DThrusterGraph *dtg) {
-  schedule_us(Exp2Time(16), (ActivationFuncPtr)dtg_update, dtg);
-
   int d;
   for (d = 0; d < NUM_DIGITS; d++) {
     dtg->bbuf.buffer[d] = 0;
@@ -21,6 +21,7 @@
 #include "core/clock.h"
 #include "core/network.h"
 #include "periph/7seg_panel/board_buffer.h"
+#include "periph/7seg_panel/display_frame.h"
 #include "periph/rocket/thruster_protocol.h"
 
 typedef struct s_d_thruster_graph {
@@ -30,6 +31,7 @@ typedef struct s_d_thruster_graph {
   AppReceiver app_receiver;
   uint8_t thruster_bits;
   uint32_t value[4];
+  DisplayFrameClient frame;
 } DThrusterGraph;
 
 void dtg_init_local(DThrusterGraph *dtg, uint8_t board);
@@ -20,6 +20,7 @@
 
 #include "core/hardware.h"
 #include "core/rulos.h"
+#include "periph/spi_dma/spi_dma.h"
 
 ////////////////////////////////////////////////////////////////
 ////// Implementation of the SD module's expecting down-facing API.
@@ -54,6 +55,14 @@ uint32_t TM_DELAY_Time2() {
   }
 }
 
+// The card shares the bus, and its DMA, with any other devices on it. It's
+// set up by disk_initialize(), which then holds the bus while this runs.
+static spi_dma_device_t sd_spi_dev;
+
+// Set if a DMA error cut a block transfer short; the card's driver can't
+// tell, so the disk_ functions below check it and fail the operation.
+static bool sd_spi_failed;
+
 void TM_SPI_Init() {
   // Disable SD_SPI_PERIPH so parameters can be changed
   LL_SPI_Disable(SD_SPI_PERIPH);
@@ -77,7 +86,6 @@ void TM_SPI_Init() {
   LL_GPIO_SetPinPull(SD_LL_MOSI_PORT, SD_LL_MOSI_PIN, LL_GPIO_PULL_DOWN);
 
   LL_APB2_GRP1_EnableClock(SD_LL_SPI_CLOCK);
-  LL_SPI_SetBaudRatePrescaler(SD_SPI_PERIPH, LL_SPI_BAUDRATEPRESCALER_DIV256);
   LL_SPI_SetTransferDirection(SD_SPI_PERIPH, LL_SPI_FULL_DUPLEX);
   LL_SPI_SetClockPhase(SD_SPI_PERIPH, LL_SPI_PHASE_1EDGE);
   LL_SPI_SetClockPolarity(SD_SPI_PERIPH, LL_SPI_POLARITY_LOW);
@@ -87,34 +95,10 @@ void TM_SPI_Init() {
   LL_SPI_SetRxFIFOThreshold(SD_SPI_PERIPH, LL_SPI_RX_FIFO_TH_QUARTER);
   LL_SPI_SetMode(SD_SPI_PERIPH, LL_SPI_MODE_MASTER);
 
-  // Enable SD_SPI_PERIPH!
+  // Enable SD_SPI_PERIPH! The bus sets the baud rate.
   LL_SPI_Enable(SD_SPI_PERIPH);
+  TM_SPI_SetSlow();
 
-  // Set chip-enable pin as an output
-  gpio_make_output(SD_PIN_CHIPENABLE);
-
-  // Configure DMA
-  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
-
-  LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_2);
-  LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_3);
-
-#if defined (RULOS_ARM_stm32g0)
-  NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0);
-  NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
-#elif defined (RULOS_ARM_stm32f3)
-  NVIC_SetPriority(DMA1_Channel2_IRQn, 0);
-  NVIC_EnableIRQ(DMA1_Channel2_IRQn);
-  NVIC_SetPriority(DMA1_Channel3_IRQn, 0);
-  NVIC_EnableIRQ(DMA1_Channel3_IRQn);
-#else
-  #include <stophere>
-#endif
-
-  LL_DMA_EnableIT_TC(DMA1, LL_DMA_CHANNEL_2);
-  LL_DMA_EnableIT_TE(DMA1, LL_DMA_CHANNEL_2);
-  LL_DMA_EnableIT_TC(DMA1, LL_DMA_CHANNEL_3);
-  LL_DMA_EnableIT_TE(DMA1, LL_DMA_CHANNEL_3);
 }
 
 // void TM_SPI_SendMulti(SPI_TypeDef* SPIx, uint8_t* dataOut, uint8_t* dataIn,
@@ -122,11 +106,11 @@ void TM_SPI_Init() {
 //}
 
 void TM_SPI_SetSlow() {
-  LL_SPI_SetBaudRatePrescaler(SD_SPI_PERIPH, LL_SPI_BAUDRATEPRESCALER_DIV256);
+  spi_dma_set_prescaler(&sd_spi_dev, LL_SPI_BAUDRATEPRESCALER_DIV256);
 }
 
 void TM_SPI_SetFast() {
-  LL_SPI_SetBaudRatePrescaler(SD_SPI_PERIPH, LL_SPI_BAUDRATEPRESCALER_DIV2);
+  spi_dma_set_prescaler(&sd_spi_dev, LL_SPI_BAUDRATEPRESCALER_DIV2);
 }
 
 //#define DO_NOT_USE_DMA
@@ -177,139 +161,17 @@ void TM_SPI_ReadMulti(SPI_TypeDef* SPIx, uint8_t* dataIn, uint8_t dummy,
 
 #else // DO_NOT_USE_DMA
 
-static int transmissionComplete;
-
-static void check_channel_2() {
-  if (LL_DMA_IsActiveFlag_TC2(DMA1)) {
-    LL_DMA_ClearFlag_GI2(DMA1);
-    transmissionComplete = true;
-  } else if (LL_DMA_IsActiveFlag_TE2(DMA1)) {
-    transmissionComplete = true;
-  }
-}
-
-static void check_channel_3() {
-  if (LL_DMA_IsActiveFlag_TC3(DMA1)) {
-    LL_DMA_ClearFlag_GI3(DMA1);
-    transmissionComplete = true;
-  } else if (LL_DMA_IsActiveFlag_TE3(DMA1)) {
-    transmissionComplete = true;
-  }
-}
-
-#if defined (RULOS_ARM_stm32g0)
-void DMA1_Channel2_3_IRQHandler(void) {
-  check_channel_2();
-  check_channel_3();
-}
-#elif defined (RULOS_ARM_stm32f3)
-void DMA1_Channel2_IRQHandler(void) {
-  check_channel_2();
-}
-void DMA1_Channel3_IRQHandler(void) {
-  check_channel_3();
-}
-#else
-#include <stophere>
-#endif
-
-static void DMA_EnableAndWait(SPI_TypeDef* SPIx) {
-  transmissionComplete = false;
-
-  // Enable DMA for SPI
-  LL_SPI_EnableDMAReq_RX(SD_SPI_PERIPH);
-  LL_SPI_EnableDMAReq_TX(SD_SPI_PERIPH);
-  LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_2);
-  LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_3);
-
-  // Block until the DMA finishes; the interrupt handler sets
-  // transmissionComplete to true.
-  while (!transmissionComplete) {
-    __WFI();
-  }
-
-  // Disable DMA again
-  LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_2);
-  LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_3);
-  LL_SPI_DisableDMAReq_RX(SD_SPI_PERIPH);
-  LL_SPI_DisableDMAReq_TX(SD_SPI_PERIPH);
-}
-
 void TM_SPI_WriteMulti(SPI_TypeDef* SPIx, uint8_t* dataOut, uint32_t count) {
-  uint8_t dummy;
-
-  // Configure RX side to write incoming data to dummy, since it's
-  // being discarded. Note that having *both* directions be
-  // NOINCREMENT is unusual: I'm *not* incrementing the destination
-  // address of the rx side so we pull all data out of the RX buffer
-  // and sink it to the same dummy memory location.
-  LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_2,
-                        LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
-                            LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
-                            LL_DMA_PERIPH_NOINCREMENT |
-                            LL_DMA_MEMORY_NOINCREMENT | LL_DMA_PDATAALIGN_BYTE |
-                            LL_DMA_MDATAALIGN_BYTE);
-  LL_DMA_ConfigAddresses(
-      DMA1, LL_DMA_CHANNEL_2, LL_SPI_DMA_GetRegAddr(SD_SPI_PERIPH), (uint32_t)&dummy,
-      LL_DMA_GetDataTransferDirection(DMA1, LL_DMA_CHANNEL_2));
-  LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_2, count);
-#if defined (RULOS_ARM_stm32g0)
-  LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_2, LL_DMAMUX_REQ_SPI1_RX);
-#endif
-
-  // Configure TX side to send data from dataOut
-  LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_3,
-                        LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
-                            LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
-                            LL_DMA_PERIPH_NOINCREMENT |
-                            LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
-                            LL_DMA_MDATAALIGN_BYTE);
-  LL_DMA_ConfigAddresses(
-      DMA1, LL_DMA_CHANNEL_3, (uint32_t)dataOut, LL_SPI_DMA_GetRegAddr(SD_SPI_PERIPH),
-      LL_DMA_GetDataTransferDirection(DMA1, LL_DMA_CHANNEL_3));
-  LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_3, count);
-#if defined (RULOS_ARM_stm32g0)
-  LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_3, LL_DMAMUX_REQ_SPI1_TX);
-#endif
-
-  DMA_EnableAndWait(SD_SPI_PERIPH);
+  if (!spi_dma_exchange(&sd_spi_dev, dataOut, NULL, count, 0xff)) {
+    sd_spi_failed = true;
+  }
 }
 
 void TM_SPI_ReadMulti(SPI_TypeDef* SPIx, uint8_t* dataIn, uint8_t dummy,
                       uint32_t count) {
-  // Configure RX side to write incoming data to dataIn
-  LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_2,
-                        LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
-                            LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
-                            LL_DMA_PERIPH_NOINCREMENT |
-                            LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
-                            LL_DMA_MDATAALIGN_BYTE);
-  LL_DMA_ConfigAddresses(
-      DMA1, LL_DMA_CHANNEL_2, LL_SPI_DMA_GetRegAddr(SD_SPI_PERIPH), (uint32_t)dataIn,
-      LL_DMA_GetDataTransferDirection(DMA1, LL_DMA_CHANNEL_2));
-  LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_2, count);
-#if defined (RULOS_ARM_stm32g0)
-  LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_2, LL_DMAMUX_REQ_SPI1_RX);
-#endif
-
-  // Configure TX side to keep sending dummy over and over.  Note that having
-  // *both* directions be NOINCREMENT is unusual: I'm *not* incrementing the
-  // source address of the tx side so we just transmit the same byte over and
-  // over.
-  LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_3,
-                        LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
-                            LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL |
-                            LL_DMA_PERIPH_NOINCREMENT |
-                            LL_DMA_MEMORY_NOINCREMENT | LL_DMA_PDATAALIGN_BYTE |
-                            LL_DMA_MDATAALIGN_BYTE);
-  LL_DMA_ConfigAddresses(
-      DMA1, LL_DMA_CHANNEL_3, (uint32_t)&dummy, LL_SPI_DMA_GetRegAddr(SD_SPI_PERIPH),
-      LL_DMA_GetDataTransferDirection(DMA1, LL_DMA_CHANNEL_3));
-  LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_3, count);
-#if defined (RULOS_ARM_stm32g0)
-  LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_3, LL_DMAMUX_REQ_SPI1_TX);
-#endif
-  DMA_EnableAndWait(SD_SPI_PERIPH);
+  if (!spi_dma_exchange(&sd_spi_dev, NULL, dataIn, count, dummy)) {
+    sd_spi_failed = true;
+  }
 }
 
 #endif
@@ -317,10 +179,22 @@ void TM_SPI_ReadMulti(SPI_TypeDef* SPIx, uint8_t* dataIn, uint8_t dummy,
 ///////////////////////////
 
 // Implementation of FATFS's down-facing API for RULOS, hardwired to the SD
-// card. Note the original SD card library.
+// card. Note the original SD card library. The card's driver polls the SPI
+// and drives its own chip-enable, so it holds the bus for each operation.
 
 DSTATUS disk_initialize(BYTE pdrv) {
-  return TM_FATFS_SD_disk_initialize();
+  if (sd_spi_dev.bus == NULL) {
+    spi_dma_device_init(&sd_spi_dev, spi_dma_get_bus(SD_SPI_PERIPH),
+                        SD_PIN_CHIPENABLE, LL_SPI_BAUDRATEPRESCALER_DIV256);
+  }
+  spi_dma_acquire(&sd_spi_dev);
+  sd_spi_failed = false;
+  DSTATUS retval = TM_FATFS_SD_disk_initialize();
+  if (sd_spi_failed) {
+    retval |= STA_NOINIT;
+  }
+  spi_dma_release(&sd_spi_dev);
+  return retval;
 }
 
 DSTATUS disk_status(BYTE pdrv) {
@@ -328,13 +202,34 @@ DSTATUS disk_status(BYTE pdrv) {
 }
 
 DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count) {
-  return TM_FATFS_SD_disk_read(buff, sector, count);
+  spi_dma_acquire(&sd_spi_dev);
+  sd_spi_failed = false;
+  DRESULT retval = TM_FATFS_SD_disk_read(buff, sector, count);
+  if (sd_spi_failed) {
+    retval = RES_ERROR;
+  }
+  spi_dma_release(&sd_spi_dev);
+  return retval;
 }
 
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count) {
-  return TM_FATFS_SD_disk_write(buff, sector, count);
+  spi_dma_acquire(&sd_spi_dev);
+  sd_spi_failed = false;
+  DRESULT retval = TM_FATFS_SD_disk_write(buff, sector, count);
+  if (sd_spi_failed) {
+    retval = RES_ERROR;
+  }
+  spi_dma_release(&sd_spi_dev);
+  return retval;
 }
 
 DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
-  return TM_FATFS_SD_disk_ioctl(cmd, buff);
+  spi_dma_acquire(&sd_spi_dev);
+  sd_spi_failed = false;
+  DRESULT retval = TM_FATFS_SD_disk_ioctl(cmd, buff);
+  if (sd_spi_failed) {
+    retval = RES_ERROR;
+  }
+  spi_dma_release(&sd_spi_dev);
+  return retval;
 }
@@ -20,94 +20,37 @@ from PIL import Image
 import glob
 import sys
 
-class Index:
-	def __init__(self, sym, offset_bits):
-		self.sym = sym
-		self.len = 0
-		self.offset_bits = offset_bits
-
-	def __repr__(self):
-		return "{'%s', %d, %d}" % (self.sym, self.len, self.offset_bits)
-
-def get_bitfield(bytes, offset, len):
-	print("GB offset %d len %d" % (offset, len))
-	ov = 0
-	bitsAvaiableThisByte = 8-(offset%8)
-	bitsUsedThisByte = min(bitsAvaiableThisByte, len)
-	v = bytes[int(offset / 8)] >> (bitsAvaiableThisByte - bitsUsedThisByte)
-	v &= ((1<<bitsUsedThisByte)-1)
-	print("GB select value %03x from byte %d, right-shift %d" % (
-		v, offset / 8, (bitsAvaiableThisByte - bitsUsedThisByte)))
-	ov |= (v << (len-bitsUsedThisByte))
-
-	rest_len = len - bitsUsedThisByte
-	rest_offset = offset + bitsUsedThisByte
-	print("GB rest_len %s rest_offset %s" % (rest_len, rest_offset))
-	if (rest_len > 0):
-		assert(rest_offset > offset)
-		assert((rest_offset % 8)==0)
-		ov |= get_bitfield(bytes, rest_offset, rest_len)
-	return ov
-
 class DataBlock:
 	def __init__(self):
-		self.index = {}
-		self.data = []
-		self.offset_bits = 0
+		self.glyphs = {}
+		self.runs = []
 
+	# Glyphs are directly indexed by symbol, so the table covers every
+	# symbol from the first to the last; missing ones have no runs.
 	def emit(self, fp):
-		fp.write("const RasterIndex rasterIndex[] = {\n")
-		idxs = list(self.index.items())
-		idxs.sort()
-		for (k,idx) in idxs:
-			fp.write("  %s,\n" % idx)
-		fp.write("  {'\\0', 0, 0},\n")
+		first = min(self.glyphs)
+		last = max(self.glyphs)
+		fp.write("#define RASTER_FIRST_SYM '%s'\n" % first)
+		fp.write("#define RASTER_NUM_SYMS %d\n" % (ord(last) - ord(first) + 1))
+		fp.write("const RasterGlyph rasterGlyphs[RASTER_NUM_SYMS] PROGMEM = {\n")
+		for c in range(ord(first), ord(last) + 1):
+			(first_run, num_runs) = self.glyphs.get(chr(c), (0, 0))
+			fp.write("  {%d, %d},  // '%s'\n" % (first_run, num_runs, chr(c)))
+		fp.write("};\n")
+		fp.write("const uint16_t rasterRuns[] PROGMEM = {\n")
+		for stripe in self.runs:
+			fp.write("  RASTER_RUN(%d, %d, %d),\n" % (stripe.y, stripe.x0, stripe.x1))
 		fp.write("};\n")
-		fp.write("const uint8_t rasterData[] PROGMEM = {\n")
-		for c in self.data:
-			fp.write("  0x%02x,\n" % c)
-		fp.write("};\n");
 
 	def start_sym(self, sym):
-		print("SS sim %s offset_bits %d\n" % (sym, self.offset_bits))
-		self.index[sym] = Index(sym, self.offset_bits)
+		print("SS sym %s first run %d" % (sym, len(self.runs)))
+		self.glyphs[sym] = (len(self.runs), 0)
 
-	def add_field(self, sym, elevenBitField):
-		self.index[sym].len += 1
-		bitsToGo = 11
-		print("AF ---- start %03x; data offset %d" % (elevenBitField, self.offset_bits))
-		while (bitsToGo > 0):
-			openBits = 8 - self.offset_bits % 8
-			if (openBits == 8):
-				print("AF inserted a 0 byte")
-				self.data.append(0)
-				openBits = 8
-			
-			print("AF bitsToGo %d openBits %d" % (bitsToGo, openBits))
-			# how many bits we'll append on this loop iteration
-			valueWidth = min(openBits, bitsToGo)
-
-			value = elevenBitField
-			if (bitsToGo > openBits):
-				value >>= (bitsToGo-openBits)
-				print("AF unmasked value %03x" % value)
-			value &= ((1<<valueWidth)-1)
-			print("AF inserting val %01x width %d" % (value, valueWidth))
-
-			if (openBits > bitsToGo):
-				value <<= (openBits-bitsToGo)
-				print("AF shifts value left %d" % (openBits-bitsToGo))
-			self.data[-1] |= value
-			print("AF data[%d]  %02x" % ((len(self.data)-1),self.data[-1]))
-			bitsToGo -= valueWidth
-			self.offset_bits += valueWidth
-
-		gotValue = get_bitfield(self.data, self.index[sym].offset_bits
-			+ (self.index[sym].len-1)*11, 11)
-		if (gotValue != elevenBitField):
-			print("put: %03x" % elevenBitField)
-			print("got: %03x" % gotValue)
-			assert(False)
+	def add_stripe(self, sym, stripe):
+		(first_run, num_runs) = self.glyphs[sym]
+		self.glyphs[sym] = (first_run, num_runs + 1)
+		assert(stripe.y < 32 and stripe.x0 < 32 and stripe.x1 < 32)
+		self.runs.append(stripe)
 
 class Stripe:
 	def __init__(self, y, x0, x1):
@@ -115,14 +58,6 @@ class Stripe:
 		self.x0 = x0
 		self.x1 = x1
 
-	def makeElevenBitField(self, lasty):
-		v = 0
-		if (lasty!=self.y):
-			v |= (1<<10)
-		v |= (self.x0<<5)
-		v |= (self.x1<<0)
-		return v
-
 	def __repr__(self):
 		return "{%d,%d,%d}" % (self.y, self.x0, self.x1)
 
@@ -132,7 +67,6 @@ class BitmapFromFile:
 		self.datablock = datablock
 		self.datablock.start_sym(self.symname)
 		self.startBlack = None
-		self.lastStripe = None
 		img = Image.open(filename)
 		for y in range(img.size[1]):
 			#print "y=%s" % y
@@ -155,14 +89,8 @@ class BitmapFromFile:
 			return
 		else:
 			print(m,"accept")
-			lasty = 0
-			if (self.lastStripe!=None):
-				lasty = self.lastStripe.y
 			stripe = Stripe(y, self.startBlack[0], x)
-			self.lastStripe = stripe
-			ebf = stripe.makeElevenBitField(lasty)
-			print("BFF lasty %s y %s stripe %s %s" % (lasty, y, stripe, ebf>>10))
-			self.datablock.add_field(self.symname, ebf)
+			self.datablock.add_stripe(self.symname, stripe)
 			self.startBlack = None
 
 	def emit(self, fp):
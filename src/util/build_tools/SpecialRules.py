@@ -16,6 +16,18 @@ CONVERTERS = [
         action = "$RulosProjectRoot/src/util/sevseg_convert.py $SOURCE > $TARGET",
         script_input = ["src/lib/periph/7seg_panel/sevseg_artwork.txt"]
     ),
+    Converter(
+        dependent_source = "src/lib/chip/avr/periph/7seg_panel_hardware/hardware_rocketpanel.c",
+        intermediate_file = "src/lib/chip/avr/periph/7seg_panel_hardware/rocketpanel_remap.ch",
+        action = "$RulosProjectRoot/src/util/rocketpanel_remap.py > $TARGET",
+        script_input = ["src/util/rocketpanel_remap.py"]
+    ),
+    Converter(
+        dependent_source = "src/lib/periph/7seg_panel/remote_bbuf.c",
+        intermediate_file = "src/lib/periph/7seg_panel/display_tree_routes.ch",
+        action = "$RulosProjectRoot/src/util/display_tree_routes.py $SOURCE > $TARGET",
+        script_input = ["src/lib/periph/7seg_panel/display_tree.ch"]
+    ),
     Converter(
         dependent_source = "src/lib/periph/rasters/rasters.c",
         intermediate_file = "src/lib/periph/rasters/rasters_auto.ch",
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson (jelson@gmail.com).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Generates the remote board routing tables used by remote_bbuf.c from
+# display_tree.ch.
+#
+# For each BOARDCONFIG, display_tree.ch lists the boards in the display tree
+# along with the dongle (remote_addr) that drives each one and the board's
+# index on that dongle. Rather than expanding the tree into an array and
+# searching it at run time, we emit two tables per BOARDCONFIG:
+#
+#   remote_route[board] is the board's {remote_addr, remote_index}.
+#
+#   dongle_boards[dongle_boards_start[d]] up to (but not including)
+#   dongle_boards[dongle_boards_start[d + 1]] are the boards driven by
+#   dongle d, in tree order.
+#
+# usage: display_tree_routes.py display_tree.ch
+
+import os
+import re
+import sys
+
+DBOARD_RE = re.compile(
+    r'DBOARD\(\s*("(?:[^"\\]|\\.)*")\s*,.*,\s*(\d+)\s*,\s*(\d+)\s*,'
+    r'\s*(\d+)\s*,\s*(\d+)\s*\)\s*$')
+CONFIG_RE = re.compile(r'defined\(BOARDCONFIG_(\w+)\)')
+NOT_BOARDS = ('B_END', 'B_NO_BOARD')
+
+def read_lines(filename):
+    # joins continued lines and drops comments
+    with open(filename) as f:
+        text = f.read()
+    text = re.sub(r'/\*.*?\*/', ' ', text, flags=re.S)
+    text = re.sub(r'//.*', '', text)
+    text = text.replace('\\\n', ' ')
+    return [line.strip() for line in text.split('\n')]
+
+def parse(filename):
+    boards = {}
+    trees = {}
+    configs = []
+    selectors = None
+
+    for line in read_lines(filename):
+        if line.startswith('#if') or line.startswith('#elif'):
+            selectors = CONFIG_RE.findall(line)
+            continue
+        if line.startswith('#else') or line.startswith('#endif'):
+            selectors = None
+            continue
+        m = re.match(r'#define\s+(\w+)\s+(.*)$', line)
+        if not m:
+            continue
+        name, body = m.groups()
+
+        if name == 'ROCKET_TREE':
+            configs.append((selectors, body.strip()))
+        elif name.startswith('B_') and name not in NOT_BOARDS:
+            dm = DBOARD_RE.search(body)
+            if not dm:
+                sys.exit(f'{filename}: cannot parse board {name}')
+            label, x, y, remote_addr, remote_idx = dm.groups()
+            boards[name] = (label, int(remote_addr), int(remote_idx))
+        elif name.startswith('T_'):
+            trees[name] = [b for b in re.findall(r'\w+', body)
+                           if b not in NOT_BOARDS]
+
+    for selectors, tree in configs:
+        for b in trees[tree]:
+            if b not in boards:
+                sys.exit(f'{filename}: tree {tree} uses unknown board {b}')
+    return boards, trees, configs
+
+def emit_config(boards, tree_name, tree):
+    routes = [boards[b] for b in tree]
+    num_dongles = max([r[1] for r in routes], default=-1) + 1
+
+    # Dongles drive their boards locally and have an empty tree, so the tree
+    # only has to match the board count when there are remote boards.
+    print(f'#if NUM_REMOTE_BOARDS > 0 && NUM_TOTAL_BOARDS != {len(tree)}')
+    print(f'#error "display tree {tree_name} does not match NUM_TOTAL_BOARDS"')
+    print('#endif')
+    print(f'#define DISPLAY_TREE_NUM_DONGLES {num_dongles}')
+
+    print(f'static const RemoteRoute remote_route[{len(tree)}] PROGMEM = {{')
+    for board, (label, remote_addr, remote_idx) in enumerate(routes):
+        label = label[1:-1]
+        comment = f'board {board}: {label}' if label else f'board {board}'
+        print(f'    {{{remote_addr}, {remote_idx}}},  // {comment}')
+    print('};')
+
+    start = [0]
+    members = []
+    for dongle in range(num_dongles):
+        members += [board for board, r in enumerate(routes) if r[1] == dongle]
+        start.append(len(members))
+    print(f'static const uint8_t dongle_boards_start[{num_dongles + 1}] '
+          'PROGMEM = {')
+    print('    ' + ', '.join(str(s) for s in start) + ',')
+    print('};')
+    print(f'static const uint8_t dongle_boards[{len(members)}] PROGMEM = {{')
+    if members:
+        print('    ' + ', '.join(str(m) for m in members) + ',')
+    print('};')
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f'usage: {sys.argv[0]} display_tree.ch')
+    boards, trees, configs = parse(sys.argv[1])
+
+    print('// automatically generated display tree routing tables, do not edit')
+    print(f'// generated by {os.path.basename(sys.argv[0])} from '
+          f'{os.path.basename(sys.argv[1])}')
+    print()
+
+    directive = '#if'
+    for selectors, tree_name in configs:
+        print(f'{directive} ' + ' || '.join(
+            f'defined(BOARDCONFIG_{s})' for s in selectors))
+        emit_config(boards, tree_name, trees[tree_name])
+        directive = '#elif'
+    print('#else')
+    print('#error "Unknown board-tree config (consider BOARDCONFIG_DEFAULT)"')
+    print('#endif')
+
+main()
@@ -27,10 +27,23 @@ ATMEL_FMT = '''
 }}
 '''
 
+# A pin group is 'count' adjacent pins of one port, starting at pin 'first',
+# that are written together by gpio_group_write().
+ATMEL_GROUP_FMT = '''
+#define GPIO_GROUP_{port}(first, count) (gpio_group_t) {{ \
+    .ddr = &DDR{port}, \
+    .port = &PORT{port}, \
+    .mask = (uint8_t)(((1 << (count)) - 1) << (first)), \
+    .shift = (first), \
+}}
+'''
+
 def atmel():
     for port in ['A', 'B', 'C', 'D']:
         for pin in range(8):
             print(ATMEL_FMT.format(port=port, pin=pin))
+    for port in ['A', 'B', 'C', 'D']:
+        print(ATMEL_GROUP_FMT.format(port=port))
 
 STM32_FMT = '''
 static const gpio_pin_t GPIO_{port}{pin} = {{
@@ -39,23 +52,46 @@ static const gpio_pin_t GPIO_{port}{pin} = {{
 }};
 '''
 
+STM32_GROUP_FMT = '''
+#define GPIO_GROUP_{port}(first, count) ((gpio_group_t) {{ \
+   .port = GPIO{port}, \
+   .mask = ((1UL << (count)) - 1) << (first), \
+   .shift = (first), \
+}})
+'''
 
 def stm32():
     for port in ['A', 'B', 'C', 'D', 'F']:
         print(f'\n\n#if defined(GPIO{port})')
         for pin in range(16):
             print(STM32_FMT.format(port=port, pin=pin))
+        print(STM32_GROUP_FMT.format(port=port))
         print('#endif')
 
+ESP32_GROUP_FMT = '''
+// Groups are limited to GPIOs 0-31, which share one set of registers.
+#define GPIO_GROUP(first, count) ((gpio_group_t) { \
+    .mask = ((1UL << (count)) - 1) << (first), \
+    .shift = (first), \
+})
+'''
+
 def esp32():
     for i in range(32):
         print(f"#define GPIO_{i} {i}")
+    print(ESP32_GROUP_FMT)
+
+GENERATORS = {
+    'avr': atmel,
+    'stm32': stm32,
+    'esp32': esp32,
+}
 
+# usage: makepins.py [avr|stm32|esp32] > autogen-pins-<chip>.h
 def main():
+    chip = sys.argv[1] if len(sys.argv) > 1 else 'stm32'
     print('// automatically generated pin definitions, do not edit')
-    print(f'// generated by {os.path.abspath(sys.argv[0])}')
-    stm32()
-    #atmel()
-    #esp32()
+    print(f'// generated by {os.path.basename(sys.argv[0])} {chip}')
+    GENERATORS[chip]()
 
 main()
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2009 Jon Howell (jonh@jonh.net) and Jeremy Elson (jelson@gmail.com).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Generates the rocket panel remap tables used by hardware_rocketpanel.c.
+#
+# The way each board's LEDs are wired (digits reversed if the board is
+# mounted upside down, segments rotated if an LED is soldered upside down)
+# only depends on the BOARDCONFIG, so rather than working it out each time a
+# segment is programmed, we flatten it into one table per BOARDCONFIG, indexed
+# by [board][digit][segment]. Each entry is the physical digit and segment to
+# select on the bus, packed as (digit << 3) | segment, and printed in octal so
+# the two are easy to read.
+
+import os
+import sys
+
+NUM_DIGITS = 8
+
+SEGMENT_REMAPS = {
+    'SUBU': [0, 1, 2, 3, 4, 5, 6, 7],
+
+    # swap decimal point with segment H, which are the nodes reversed
+    # when an LED is mounted upside-down
+    'SDBU': [0, 1, 2, 3, 4, 5, 7, 6],
+
+    'SUBD': [3, 4, 5, 0, 1, 2, 6, 7],
+    'SDBD': [3, 4, 5, 0, 1, 2, 7, 6],
+}
+
+# (reverse digits, segment remap for each physical digit)
+BOARD_REMAPS = {
+    'SOLDERED_UP_BOARD_UP': (False, ['SUBU'] * 8),
+    'SOLDERED_DN_BOARD_DN': (True, ['SDBD'] * 8),
+    'WALLCLOCK': (False, ['SUBU', 'SUBU', 'SUBU', 'SDBU',
+                          'SUBU', 'SDBU', 'SUBU', 'SUBU']),
+    'CHASECLOCK': (False, ['SUBU', 'SDBU', 'SUBU', 'SUBU',
+                           'SUBU', 'SDBU', 'SUBU', 'SUBU']),
+}
+
+# BOARDCONFIG: (number of local boards, {board: remap other than the default})
+BOARD_CONFIGS = {
+    'ROCKET0': (8, {
+        0: 'WALLCLOCK',
+        3: 'SOLDERED_DN_BOARD_DN',
+        4: 'SOLDERED_DN_BOARD_DN',
+    }),
+    'NETROCKET': (0, {}),
+    'UNIROCKET': (0, {}),
+    'ROCKETDONGLENORTH': (8, {
+        0: 'WALLCLOCK',
+        3: 'SOLDERED_DN_BOARD_DN',
+        4: 'SOLDERED_DN_BOARD_DN',
+    }),
+    'ROCKETDONGLESOUTH': (4, {
+        2: 'SOLDERED_DN_BOARD_DN',
+    }),
+    'ROCKETSOUTHBRIDGE': (0, {}),
+    'UNIROCKET_LOCALSIM': (14, {}),
+    'ROCKET1': (4, {
+        2: 'SOLDERED_DN_BOARD_DN',
+    }),
+    'WALLCLOCK': (1, {
+        0: 'WALLCLOCK',
+    }),
+    'CHASECLOCK': (1, {
+        0: 'CHASECLOCK',
+    }),
+    'DEFAULT': (8, {}),
+}
+
+def board_table(remap_name):
+    reverse_digits, segment_remaps = BOARD_REMAPS[remap_name]
+    rows = []
+    for digit in range(NUM_DIGITS):
+        if reverse_digits:
+            rdigit = digit
+        else:
+            rdigit = NUM_DIGITS - 1 - digit
+        segment_remap = SEGMENT_REMAPS[segment_remaps[rdigit]]
+        rows.append([(rdigit << 3) | segment_remap[segment]
+                     for segment in range(8)])
+    return rows
+
+def emit_config(config_name, num_boards, special_boards):
+    print(f'#if NUM_LOCAL_BOARDS != {num_boards}')
+    print(f'#error "rocketpanel remap table for {config_name} does not match NUM_LOCAL_BOARDS"')
+    print('#endif')
+    print(f'static const uint8_t rocketpanel_remap[{num_boards}][{NUM_DIGITS}][8] PROGMEM = {{')
+    for board in range(num_boards):
+        remap_name = special_boards.get(board, 'SOLDERED_UP_BOARD_UP')
+        print(f'    // board {board}: {remap_name.lower()}')
+        print('    {')
+        for row in board_table(remap_name):
+            print('        {' + ', '.join(f'0{v:02o}' for v in row) + '},')
+        print('    },')
+    print('};')
+
+def main():
+    print('// automatically generated rocket panel remap tables, do not edit')
+    print(f'// generated by {os.path.basename(sys.argv[0])}')
+    print()
+
+    directive = '#if'
+    for config_name, (num_boards, special_boards) in BOARD_CONFIGS.items():
+        print(f'{directive} defined(BOARDCONFIG_{config_name})')
+        emit_config(config_name, num_boards, special_boards)
+        directive = '#elif'
+    print('#endif')
+
+main()